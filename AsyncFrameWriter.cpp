@@ -0,0 +1,141 @@
+/* *********************************************************************
+ * This file contains the background FITS writer used by the multi-frame
+ * acquisition. See AsyncFrameWriter.hpp for a description.
+ * *********************************************************************
+ */
+
+#include <iostream>
+
+#include "fitsio.h"
+#include "AsyncFrameWriter.hpp"
+#include "FitsOps.hpp"
+#include "Scheduler.hpp"
+
+
+
+AsyncFrameWriter::AsyncFrameWriter(size_t MaxQueuedFrames, int nWriterThreads, const std::vector<int> &CPUList)
+{
+
+    this->CPUs = CPUList;
+    this->MaxQueuedFrames = MaxQueuedFrames > 0 ? MaxQueuedFrames : 1;
+    this->bStopRequested = false;
+    this->nBusyWriters = 0;
+    this->nFramesWritten = 0;
+    this->nFramesFailed = 0;
+
+    /*Several files can only be written at the same time by a thread safe cfitsio*/
+    if (nWriterThreads > 1 && !fits_is_reentrant()) {
+        std::cout << "Warning: cfitsio was not built with --enable-reentrant. Using a single writer thread.\n";
+        nWriterThreads = 1;
+    }
+    if (nWriterThreads < 1) nWriterThreads = 1;
+
+    for (int i = 0; i < nWriterThreads; i++)
+        this->WriterThreads.push_back(std::thread(&AsyncFrameWriter::WriterLoop, this));
+
+}
+
+AsyncFrameWriter::~AsyncFrameWriter()
+{
+
+    /*Whatever is still in the queue gets written before the thread exits*/
+    {
+        std::lock_guard<std::mutex> lock(this->QueueMutex);
+        this->bStopRequested = true;
+    }
+    this->QueueChanged.notify_all();
+
+    for (std::thread &t : this->WriterThreads)
+        if (t.joinable()) t.join();
+
+}
+
+
+void AsyncFrameWriter::Submit(std::unique_ptr<FrameRecord> Frame)
+{
+
+    std::unique_lock<std::mutex> lock(this->QueueMutex);
+    this->QueueChanged.wait(lock, [this]{ return this->FrameQueue.size() < this->MaxQueuedFrames; });
+    this->FrameQueue.push_back(std::move(Frame));
+    lock.unlock();
+
+    this->QueueChanged.notify_all();
+
+}
+
+
+void AsyncFrameWriter::WaitUntilDone(void )
+{
+
+    std::unique_lock<std::mutex> lock(this->QueueMutex);
+    this->QueueChanged.wait(lock, [this]{ return this->FrameQueue.empty() && this->nBusyWriters == 0; });
+
+}
+
+
+int AsyncFrameWriter::FramesWritten(void )
+{
+
+    std::lock_guard<std::mutex> lock(this->QueueMutex);
+    return this->nFramesWritten;
+
+}
+
+
+int AsyncFrameWriter::FramesFailed(void )
+{
+
+    std::lock_guard<std::mutex> lock(this->QueueMutex);
+    return this->nFramesFailed;
+
+}
+
+
+void AsyncFrameWriter::WriterLoop(void )
+{
+
+    if (!this->CPUs.empty()) PinCurrentThread(this->CPUs);
+
+    while (true) {
+
+        std::unique_ptr<FrameRecord> Frame;
+
+        {
+            std::unique_lock<std::mutex> lock(this->QueueMutex);
+            this->QueueChanged.wait(lock, [this]{ return !this->FrameQueue.empty() || this->bStopRequested; });
+
+            if (this->FrameQueue.empty()) return;
+
+            Frame = std::move(this->FrameQueue.front());
+            this->FrameQueue.pop_front();
+            this->nBusyWriters++;
+        }
+        /*A slot in the queue just opened up*/
+        this->QueueChanged.notify_all();
+
+        /*A frame whose pixels could not be copied out of the common buffer is lost*/
+        int dStatus = -1;
+        if (!Frame->Pixels.Valid()) {
+            std::cerr << "Frame " << Frame->OutFileName << " has no pixels and was not written.\n";
+        } else {
+            try {
+                dStatus = WriteFrameToFits(*Frame, Frame->Pixels.Data());
+                if (dStatus == 0) std::cout << "\nFrame written to " << Frame->OutFileName << "\n";
+                else std::cerr << "Frame " << Frame->OutFileName << " could not be written.\n";
+            } catch (std::exception &e) {
+                std::cerr << "Frame " << Frame->OutFileName << " could not be written: " << e.what() << "\n";
+            }
+        }
+        Frame.reset();
+
+        {
+            std::lock_guard<std::mutex> lock(this->QueueMutex);
+            this->nBusyWriters--;
+            if (dStatus == 0) this->nFramesWritten++;
+            else this->nFramesFailed++;
+        }
+        this->QueueChanged.notify_all();
+
+    }
+
+}
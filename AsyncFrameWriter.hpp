@@ -0,0 +1,62 @@
+/* *********************************************************************
+ * The asynchronous frame writer. Frames that have been copied out of
+ * the common buffer are queued here and written to disk by a background
+ * thread, so the controller does not sit idle while cfitsio is busy.
+ * The queue is bounded, so that a slow disk throttles the acquisition
+ * instead of filling up the host memory. With several writer threads,
+ * consecutive frames are compressed and written concurrently.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_ASYNCFRAMEWRITER_HPP
+#define CCDDRONE_ASYNCFRAMEWRITER_HPP
+
+#include <memory>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "CCDControlDataTypes.hpp"
+
+
+class AsyncFrameWriter
+{
+
+private:
+
+    std::deque< std::unique_ptr<FrameRecord> > FrameQueue;
+    std::mutex QueueMutex;
+    std::condition_variable QueueChanged;
+    std::vector<std::thread> WriterThreads;
+
+    size_t MaxQueuedFrames;
+    bool bStopRequested;
+    int nBusyWriters;
+    int nFramesWritten;
+    int nFramesFailed;
+    std::vector<int> CPUs;
+
+    void WriterLoop(void );
+
+public:
+
+    /*The writer threads are pinned to CPUs if the list is not empty*/
+    AsyncFrameWriter(size_t MaxQueuedFrames = 2, int nWriterThreads = 1, const std::vector<int> &CPUs = std::vector<int>());
+    ~AsyncFrameWriter();
+
+    /*Hand a frame over to the writer. Blocks if MaxQueuedFrames are already waiting.*/
+    void Submit(std::unique_ptr<FrameRecord> );
+
+    /*Block until every submitted frame has been written*/
+    void WaitUntilDone(void );
+
+    /*Frames that made it to disk, and frames that did not: a failed write, or no pixels to write*/
+    int FramesWritten(void );
+    int FramesFailed(void );
+
+};
+
+
+#endif //CCDDRONE_ASYNCFRAMEWRITER_HPP
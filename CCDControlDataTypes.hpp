@@ -5,7 +5,17 @@
 #ifndef CCDCONTROL_DTYPES
 #define CCDCONTROL_DTYPES
 #include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
 
+#include "CommandStats.hpp"
+#include "FramePool.hpp"
+#include "ReadoutTelemetry.hpp"
+
+
+struct CalibrationMasters;
+struct ClusterTable;
 
 struct CCDVariables{
     /*Variables that will need to be set before exposure*/
@@ -33,6 +43,11 @@ struct CCDVariables{
     double SKRSTWidth;
     double SWWidth;
 
+    /*Parts of the readout that are not set by the widths above, for the readout time model, in us*/
+    double SampleOverhead = 0;
+    double PixelOverhead = 0;
+    double RowOverhead = 0;
+
     int ParallelBin;
     int SerialBin;
 
@@ -83,6 +98,159 @@ struct BiasVariables{
 };
 
 
+struct ProcessingVariables{
+
+    /*Skipper NDCM reduction*/
+    bool ReduceNDCM = false;
+    int NDCMDiscard = 0;
+    bool KeepRawNDCM = true;
+
+    /*De-interlacing of UL images: native (multithreaded) or arc (CArcDeinterlace)*/
+    std::string Deinterlacer = "native";
+    int ProcessingThreads = 0;
+
+    /*Calibration of the MEAN image, see Calibration.hpp*/
+    std::string OverscanSubtraction = "none";  //none, mean or median of the overscan of each row
+    int OverscanCols = -1;                     //Overscan columns per amplifier, -1 = the [roi] overscan strip
+    std::string MasterBias;
+    std::string MasterDark;
+
+};
+
+
+struct AcquisitionVariables{
+
+    /*Read out images larger than the common buffer as row bands*/
+    bool SegmentedReadout = false;
+    int SegmentRows = 0;
+    std::string SegmentBackingFile;
+
+    /*Polling of the controller during an exposure, see ExposeCCD*/
+    double PollInterval = 50.0;     //Longest sleep between polls (ms)
+    double MinPollInterval = 0.5;   //Shortest sleep between polls near the end of the readout (ms)
+    double StallTimeout = 10.0;     //Readout is aborted if the pixel count does not move for this long (s)
+
+    /*Pixel count time series of the readout, see ReadoutTelemetry.hpp*/
+    int TelemetrySamples = 65536;   //Size of the ring, 0 = off
+    double StallEventMs = 100.0;    //A pause of the pixel count longer than this is a stall event
+
+    /*Host frame buffer pool, see FramePool.hpp*/
+    int FramePoolBuffers = 0;       //Buffers kept for reuse, 0 = writer queue depth + writer threads + 2
+    bool FramePoolHugePages = false;
+    bool FramePoolPrefault = true;
+
+    /*Frames the common buffer holds as a ring in a continuous readout*/
+    int ContinuousBufferFrames = 4;
+
+    /*Threads of the pipeline, see Scheduler.hpp. CPU lists are like 2-5,7, empty = any CPU.*/
+    int WorkerThreads = 0;          //Shared pool for the CPU kernels, 0 = a thread per block of rows
+    std::string WorkerCPUs;         //CPUs of the pool and the frame writers
+    bool AcquisitionThread = false; //Poll the controller from a dedicated thread
+    std::string AcquisitionCPUs;
+    int AcquisitionPriority = 0;    //SCHED_FIFO priority of the acquisition thread, 0 = normal
+
+};
+
+
+/*Bringing the controller up, see StartupController*/
+struct StartupVariables{
+
+    bool WarmStart = true;          //Skip the reset and the upload if the controller still runs the firmware
+    int LinkTests = 123;            //TDL round trips to check the fibre link
+    int VerifyWords = 64;           //Program words read back to tell which firmware runs
+    bool ValidateFirmware = true;   //Read back every word while uploading (ArcAPI validation)
+
+    /*Waits of the startup and erase programs, in seconds*/
+    double StartDelay = 10.0;       //Before the controller is first talked to, to switch it on
+    double IdleBeforeErase = 5.0;   //Idle clocking before the erase
+    double EraseVsubOffTime = 5.0;  //Vsub off with the pixel array at (9V,9V)
+    double EraseSettleTime = 5.0;   //Vsub back on, before the clock voltages are restored
+
+};
+
+
+/*Region of interest and binning of the readout. The region is in unbinned pixels of the CCD.*/
+struct RegionVariables{
+
+    bool Enabled = false;
+    int RowStart = 0;
+    int Rows = 0;
+    int ColStart = 0;
+    int Cols = 0;
+    int OverscanStart = 0;
+    int OverscanCols = 0;
+
+    /*Geometry of the CCD from the [ccd] section*/
+    int CCDRows = 0;
+    int CCDCols = 0;
+
+    /*What is read out, in binned pixels. The image is ReadRows x (DataCols + OverscanReadCols).*/
+    int ReadRows = 0;
+    int DataCols = 0;
+    int OverscanReadCols = 0;
+    int ParallelBin = 1;
+    int SerialBin = 1;
+
+};
+
+
+struct OutputVariables{
+
+    /*cfitsio tile compression: none, rice, hcompress, gzip or plio*/
+    std::string Compression = "none";
+    int TileRows = 1;
+    int TileCols = 0;
+    float HCompressScale = 0;
+    float FloatQuantizeLevel = 0;
+
+    /*fits, or raw for the fast spill files of RawFrame.hpp. DirectIO writes them with O_DIRECT.*/
+    std::string Format = "fits";
+    bool DirectIO = true;
+
+    /*Layout of the raw skipper samples: interleaved, cube or planes. See WriteFrameToFits.*/
+    std::string RawLayout = "interleaved";
+    /*Image type of the NDCM reduction products: float or scaled*/
+    std::string ReducedType = "float";
+    double RMSScale = 0.01;
+    /*dense, or sparse for the zero suppressed MEAN_SPARSE table of SparseImage.hpp*/
+    std::string ReducedStorage = "dense";
+    double SparseSigma = 3.0;
+    /*Write the U and L halves of UL images as extensions of their own*/
+    bool SplitAmplifiers = false;
+
+    /*Background writer*/
+    int WriterThreads = 1;
+    int WriterQueueDepth = 2;
+
+    /*Shared memory status for monitors, see SharedStatus.hpp*/
+    bool PublishStatus = false;
+    std::string StatusSegment = "ccddrone";
+    int StatusFrameMB = 64;
+
+    /*Quick look during the readout, see QuickLook.hpp*/
+    bool QuickLook = false;
+    int QuickLookBin = 16;
+    int SaturationLevel = 65535;
+    double AbortSaturatedFraction = 0;  //Stop the readout if more of the samples are saturated, 0 = never
+    int AbortAfterRows = 50;            //Rows to read before the saturated fraction is judged
+    bool SavePartial = false;           //Keep the rows read when a readout is stopped, the frame gets PARTIAL = T
+
+    /*Messages of the acquisition, see Log.hpp: text or json, to LogFile or the terminal*/
+    std::string LogFormat = "text";
+    std::string LogFile = "";
+    int LogQueue = 4096;
+    double ProgressInterval = 0.2;      //Shortest time between two progress messages (s)
+
+    /*Clusters found while the rows arrive, see ClusterFinder.hpp*/
+    bool FindClusters = false;
+    double ClusterSeedSigma = 4.0;      //A cluster needs a pixel above this many sigma of the noise
+    double ClusterPixelSigma = 2.5;     //Pixels above this many sigma are part of a cluster
+    int ClusterMaxPixels = 10000;       //Pixels listed per cluster
+    bool ClusterOnly = false;           //Write the clusters instead of the image
+
+};
+
+
 struct TimeVariables{
 
     std::chrono::system_clock::time_point ProgramStart;
@@ -92,6 +260,7 @@ struct TimeVariables{
 
     double MeasuredReadout;
     double MeasuredExp;
+    double PredictedReadout = 0;
 
     bool isExp = false;
     bool isReadout = false;
@@ -99,4 +268,108 @@ struct TimeVariables{
 
 };
 
+
+/*One axis of a parameter scan. The parameter is named like its key in the config file.*/
+struct ScanAxis{
+
+    std::string Parameter;
+    std::vector<double> Values;
+
+};
+
+struct ScanSpec{
+
+    /*The points are the full grid of all the axes, the last axis changing fastest*/
+    std::vector<ScanAxis> Axes;
+    int FramesPerPoint = 1;
+    int ExposureTime = 0;
+    std::string OutFileName;
+
+};
+
+/*The value of a scanned parameter at the point a frame was taken*/
+struct ScanCoordinate{
+
+    std::string Parameter;
+    double Value;
+
+};
+
+
+/*Result of one synthetic image readout of the link benchmark*/
+struct LinkBenchResult{
+
+    int dRows = 0;
+    int dCols = 0;
+    int nSkipperR = 1;
+
+    /*From the first to the last pixel the controller reported*/
+    double ReadoutSeconds = 0;
+    double PixelRate = 0;
+    /*Fastest rate between two consecutive polls*/
+    double PeakPixelRate = 0;
+
+    /*Cost of a single GetPixelCount on the host*/
+    int nPolls = 0;
+    double MeanPollMicros = 0;
+
+    /*Pixels that do not follow the synthetic ramp*/
+    long RampErrors = 0;
+
+};
+
+
+/*A frame that has been copied out of the common buffer, along with a snapshot
+ *of the settings and clock timers it was taken with. This is what is handed
+ *over to the FITS writer thread so the controller can start the next exposure.*/
+struct FrameRecord{
+
+    std::string OutFileName;
+
+    CCDVariables CCDParams;
+    ClockVariables ClockParams;
+    BiasVariables BiasParams;
+    TimeVariables ClockTimers;
+    ProcessingVariables ProcParams;
+    OutputVariables OutParams;
+    RegionVariables RoiParams;
+
+    /*Commands sent to the controller for this frame*/
+    CommandStats CmdStats;
+
+    /*Pixel count during the readout of this frame*/
+    std::vector<TelemetrySample> Telemetry;
+    long TelemetryDropped = 0;
+    double StallEventMs = 100.0;
+
+    /*Position in a parameter scan, -1 if the frame is not part of one*/
+    int ScanPoint = -1;
+    std::vector<ScanCoordinate> ScanCoords;
+
+    /*True if the UL de-interlace was left for the processing stage to do*/
+    bool bInterlaced = false;
+    FrameBuffer Pixels;
+
+    /*True if the next readout started while the pixels were still being copied out of the
+     *common buffer. The copy may then hold rows of the next frame.*/
+    bool bCopyOverlapped = false;
+
+    /*Products of the NDCM reduction, dCols x dRows each*/
+    std::vector<float> MeanPixels;
+    std::vector<float> RMSPixels;
+
+    /*Masters the MEAN image is calibrated with, and what was done to it*/
+    std::shared_ptr<const CalibrationMasters> Masters;
+    bool bPedestalSubtracted = false;
+    bool bMastersSubtracted = false;
+
+    /*Clusters of the frame, if they were looked for*/
+    std::shared_ptr<const ClusterTable> Clusters;
+
+    /*Rows read if the readout was stopped and the rows were kept, -1 for a complete frame*/
+    int PartialRows = -1;
+    std::string AbortReason;
+
+};
+
 #endif //CCDCONTROL_DTYPES
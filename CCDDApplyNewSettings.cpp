@@ -1,65 +1,73 @@
-#include <iostream>
-#include <iomanip>
-#include <string>
-#include <unistd.h>
-
-#include "LeachController.hpp"
-#include <chrono>
-#include <thread>
-
-
-// ------------------------------------------------------
-//  Main program
-// ------------------------------------------------------
-int main( int argc, char **argv )
-{
-
-
-    std::cout << "This code applies new settings according to the selected config file.\n";
-
-	std::string configFileName;
-
-	/*Now get the args*/
-	if (argc<2) {
-		std::cout << "Default usage: ./CCDDApplyNewSettings <config file>. ";
-		std::cout << "No config file was specified. Using config/Config.ini\n";
-
-		configFileName = "config/Config.ini";
-	} else {
-		configFileName = std::string(argv[1]);
-	}
-
-
-	LeachController _ThisRunControllerInstance(configFileName);
-
-	std::cout<<"Checking for new settings and loading them.\n";
-	//_ThisRunControllerInstance.LoadCCDSettingsFresh();
-	bool config, sequencer;
-	int _CCDSettingsStatus = _ThisRunControllerInstance.LoadAndCheckForSettingsChange(config, sequencer);
-
-    if (sequencer){
-		std::cout<<"Applying new sequencer.\n";
-		_ThisRunControllerInstance.ApplyNewSequencer(_ThisRunControllerInstance.CCDParams.sTimFile);
-	}
-
-	/*Apply biases and clocks*/
-	std::cout<<"Applying biases and clocks.\n";
-	_ThisRunControllerInstance.ApplyAllCCDBasic();
-	_ThisRunControllerInstance.ApplyAllBiasVoltages();
-	_ThisRunControllerInstance.ApplyAllCCDClocks();
-
-
-
-	_ThisRunControllerInstance.CopyOldAndStoreFileHashes();
-
-
-
-	std::cout<<"Set IDLE clocks to ON.\n";
-    _ThisRunControllerInstance.IdleClockToggle();
-
-
-    std::cout<<"New settings have been uploaded to the Leach system.\n";
-
-	return 0;
-}
-
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <unistd.h>
+
+#include "LeachController.hpp"
+#include <chrono>
+#include <thread>
+
+
+// ------------------------------------------------------
+//  Main program
+// ------------------------------------------------------
+int main( int argc, char **argv )
+{
+
+
+    std::cout << "This code applies new settings according to the selected config file.\n";
+
+	std::string configFileName;
+
+	/*Now get the args*/
+	if (argc<2) {
+		std::cout << "Default usage: ./CCDDApplyNewSettings <config file> [full]. ";
+		std::cout << "No config file was specified. Using config/Config.ini\n";
+
+		configFileName = "config/Config.ini";
+	} else {
+		configFileName = std::string(argv[1]);
+	}
+
+	/*Only the settings that changed since the last apply are sent, unless asked for all of them*/
+	bool bFullApply = (argc > 2 && std::string(argv[2]) == "full");
+
+
+	LeachController _ThisRunControllerInstance(configFileName, SelectedDevice());
+
+	std::cout<<"Checking for new settings and loading them.\n";
+	//_ThisRunControllerInstance.LoadCCDSettingsFresh();
+	bool config, sequencer;
+	int _CCDSettingsStatus = _ThisRunControllerInstance.LoadAndCheckForSettingsChange(config, sequencer);
+
+    if (sequencer){
+		std::cout<<"Applying new sequencer.\n";
+		_ThisRunControllerInstance.ApplyNewSequencer(_ThisRunControllerInstance.CCDParams.sTimFile);
+	}
+
+	/*Apply biases and clocks*/
+	std::cout<<"Applying biases and clocks.\n";
+	if (bFullApply) {
+		_ThisRunControllerInstance.ApplyAllCCDBasic();
+		_ThisRunControllerInstance.ApplyAllBiasVoltages();
+		_ThisRunControllerInstance.ApplyAllCCDClocks();
+	} else {
+		_ThisRunControllerInstance.ApplyChangedSettings();
+	}
+
+
+
+	_ThisRunControllerInstance.CopyOldAndStoreFileHashes();
+
+
+
+	std::cout<<"Set IDLE clocks to ON.\n";
+    _ThisRunControllerInstance.IdleClockToggle();
+
+
+    std::cout<<"New settings have been uploaded to the Leach system.\n";
+    _ThisRunControllerInstance.CmdStats.PrintSummary();
+
+	return 0;
+}
+
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <sys/stat.h>
+
+#include "LeachController.hpp"
+#include "SimulatedArcDevice.hpp"
+
+
+#define USAGE( x ) \
+            ( std::cout << std::endl << "Usage: ./" << x << " [config file: Default=config/Config.ini] [cycles: Default=5] [output directory: Default=/tmp] [pixel rate (pix/s): Default=5e6]" << std::endl)
+
+
+/* *********************************************************************
+ * CCDDBenchmark runs the whole host side of an exposure against the
+ * simulated ARC device: PrepareAndExposeCCD, de-interlace, processing
+ * and SaveFits, and then the pipelined multi-frame path. No hardware is
+ * needed, so this can run in CI to catch performance regressions. The
+ * last line of the output is a single BENCH line for scripts to parse.
+ * *********************************************************************
+ */
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double MillisSince(BenchClock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(BenchClock::now() - t0).count();
+}
+
+
+// ------------------------------------------------------
+//  Main program
+// ------------------------------------------------------
+int main( int argc, char **argv )
+{
+
+    std::string configFileName = argc > 1 ? argv[1] : "config/Config.ini";
+    int nCycles = argc > 2 ? atoi(argv[2]) : 5;
+    std::string OutDir = argc > 3 ? argv[3] : "/tmp";
+    double PixelRate = argc > 4 ? atof(argv[4]) : 5e6;
+
+    if (nCycles < 1 || PixelRate <= 0) {
+        USAGE(argv[0]);
+        return -1;
+    }
+
+    SimulatedArcDevice SimDevice(PixelRate, (size_t) 1 << 30);
+    LeachController _ThisRunControllerInstance(configFileName, &SimDevice);
+
+    /*The benchmark should not disturb the state of the real controller*/
+    _ThisRunControllerInstance.HashCache.SetBackingFile("");
+
+    bool config, sequencer;
+    _ThisRunControllerInstance.LoadAndCheckForSettingsChange(config, sequencer);
+    _ThisRunControllerInstance.ApplyAllCCDBasic();
+    _ThisRunControllerInstance.ApplyAllBiasVoltages();
+    _ThisRunControllerInstance.ApplyAllCCDClocks();
+
+    CCDVariables &CCD = _ThisRunControllerInstance.CCDParams;
+    if (CCD.CCDType == "DES") CCD.nSkipperR = 1;
+    CCD.fExpTime = 0;
+    double nPixels = (double) CCD.dRows * CCD.dCols * CCD.nSkipperR;
+
+    std::cout << "Benchmarking " << CCD.dRows << " x " << CCD.dCols << " x " << CCD.nSkipperR
+              << " (" << CCD.AmplifierDirection << ") at a simulated " << PixelRate << " pix/s.\n";
+
+    /*Single frames, one after the other like CCDDExpose does*/
+    double SumExpose = 0, SumSave = 0, SumCycle = 0;
+    for (int k = 0; k < nCycles; k++) {
+
+        std::string OutFile = OutDir + "/CCDDBenchmark_" + std::to_string(k) + ".fits";
+        std::remove(OutFile.c_str());
+
+        _ThisRunControllerInstance.ClockTimers.isReadout = false;
+        _ThisRunControllerInstance.ClockTimers.isExp = false;
+        _ThisRunControllerInstance.ClockTimers.rClockCounter = 0;
+
+        auto t0 = BenchClock::now();
+        if (_ThisRunControllerInstance.PrepareAndExposeCCD(0, NULL) != 0) {
+            std::cout << "Exposure " << k << " failed.\n";
+            return -1;
+        }
+        double tExpose = MillisSince(t0);
+
+        auto t1 = BenchClock::now();
+        _ThisRunControllerInstance.SaveFits(OutFile);
+        double tSave = MillisSince(t1);
+        double tCycle = MillisSince(t0);
+        std::remove(OutFile.c_str());
+
+        SumExpose += tExpose;
+        SumSave += tSave;
+        SumCycle += tCycle;
+        printf("Cycle %d: expose+readout %.1f ms, save %.1f ms, total %.1f ms\n", k, tExpose, tSave, tCycle);
+    }
+
+    /*The pipelined multi-frame path*/
+    std::string MultiOut = OutDir + "/CCDDBenchmark_multi.fits";
+    for (int k = 0; k < nCycles; k++) std::remove(FrameFileName(MultiOut, k).c_str());
+
+    auto t0 = BenchClock::now();
+    int nDone = _ThisRunControllerInstance.ExposeMultipleFrames(0, nCycles, MultiOut);
+    double tMulti = MillisSince(t0);
+    for (int k = 0; k < nCycles; k++) std::remove(FrameFileName(MultiOut, k).c_str());
+
+    if (nDone != nCycles) {
+        std::cout << "The multi-frame run took " << nDone << " of " << nCycles << " frames.\n";
+        return -1;
+    }
+
+    double MeanCycle = SumCycle / nCycles;
+    double MeanMulti = tMulti / nCycles;
+    printf("\nSingle frames:   %.1f ms per frame (expose+readout %.1f ms, save %.1f ms), %.3g pix/s\n",
+           MeanCycle, SumExpose / nCycles, SumSave / nCycles, nPixels * 1000.0 / MeanCycle);
+    printf("Pipelined frames: %.1f ms per frame, %.3g pix/s\n", MeanMulti, nPixels * 1000.0 / MeanMulti);
+
+    printf("BENCH rows=%d cols=%d ndcm=%d frames=%d single_ms=%.2f expose_ms=%.2f save_ms=%.2f pipelined_ms=%.2f single_pix_per_s=%.4g pipelined_pix_per_s=%.4g\n",
+           CCD.dRows, CCD.dCols, CCD.nSkipperR, nCycles, MeanCycle, SumExpose / nCycles, SumSave / nCycles, MeanMulti,
+           nPixels * 1000.0 / MeanCycle, nPixels * 1000.0 / MeanMulti);
+
+    return 0;
+}
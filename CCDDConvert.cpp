@@ -0,0 +1,189 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <chrono>
+
+#include "fitsio.h"
+#include "RawFrame.hpp"
+#include "NativeDeinterlace.hpp"
+#include "SparseImage.hpp"
+
+
+#define USAGE( x ) \
+            ( std::cout << std::endl << "Usage: ./" << x << " <file.raw> [output.fits]  or  ./" << x << " <file.raw|file.fits> <file.raw|file.fits> ..." << std::endl \
+                        << "Raw frames are written as FITS files, FITS files with a MEAN_SPARSE table as <file>_dense.fits" << std::endl)
+
+
+static bool EndsWith(const std::string &s, const std::string &End)
+{
+    return s.size() >= End.size() && s.compare(s.size() - End.size(), End.size(), End) == 0;
+}
+
+
+/*Write the samples of a raw frame with its keys and READOUT table as a FITS file, as
+ *WriteFrameToFits writes a frame that is not reduced*/
+static int ConvertRawFrame(const std::string &InFile, const std::string &OutFile)
+{
+
+    RawFrameFile Raw;
+    if (Raw.Open(InFile) != 0) return -1;
+    const RawFrameHeader &H = Raw.Header();
+
+    /*The primary HDU of the metadata has the keys of the frame, but no image yet*/
+    fitsfile *pMeta, *fptr;
+    int status = 0, nHDUs = 0;
+    void *pMem = (void*) Raw.Metadata();
+    size_t nMemBytes = (size_t) H.MetadataBytes;
+    fits_open_memfile(&pMeta, InFile.c_str(), READONLY, &pMem, &nMemBytes, 0, NULL, &status);
+    if (status != 0) {
+        std::cout << "The metadata of " << InFile << " cannot be read\n";
+        fits_report_error(stderr, status);
+        return -1;
+    }
+
+    fits_create_file(&fptr, OutFile.c_str(), &status);
+    if (status != 0) {
+        std::cout << "Could not create " << OutFile << ". Does it exist already?\n";
+        fits_close_file(pMeta, &status);
+        return -1;
+    }
+
+    fits_copy_hdu(pMeta, fptr, 0, &status);
+    long imageSizeXY[2] = { H.Width, H.Height };
+    fits_resize_img(fptr, USHORT_IMG, 2, &imageSizeXY[0], &status);
+
+    /*The file stays mapped read only, so the samples are de-interlaced in a copy*/
+    long nPixels = imageSizeXY[0] * imageSizeXY[1];
+    if (H.Interlaced) {
+        std::vector<unsigned short> Pixels(nPixels);
+        for (long r = 0; r < H.dRows; r++)
+            DeinterlaceSerialRow(Raw.Pixels() + r * H.Width, Pixels.data() + r * H.Width, H.Width);
+        fits_write_img(fptr, TUSHORT, 1, nPixels, (void *) Pixels.data(), &status);
+    }
+    else fits_write_img(fptr, TUSHORT, 1, nPixels, (void *) Raw.Pixels(), &status);
+
+    fits_get_num_hdus(pMeta, &nHDUs, &status);
+    for (int i = 2; i <= nHDUs; i++) {
+        fits_movabs_hdu(pMeta, i, NULL, &status);
+        fits_copy_hdu(pMeta, fptr, 0, &status);
+    }
+
+    fits_close_file(pMeta, &status);
+    fits_close_file(fptr, &status);
+    fits_report_error(stderr, status);
+
+    return status == 0 ? 0 : -1;
+}
+
+
+/*Write a FITS file with a MEAN_SPARSE table (ReducedStorage = sparse) again with dense MEAN and RMS
+ *images in its place. The other HDUs are copied as they are.*/
+static int ExpandSparseFrame(const std::string &InFile, const std::string &OutFile)
+{
+
+    fitsfile *pIn, *fptr;
+    int status = 0, nHDUs = 0, nSparse = 0;
+    fits_open_file(&pIn, InFile.c_str(), READONLY, &status);
+    if (status != 0) {
+        std::cout << InFile << " cannot be opened\n";
+        fits_report_error(stderr, status);
+        return -1;
+    }
+
+    fits_create_file(&fptr, OutFile.c_str(), &status);
+    if (status != 0) {
+        std::cout << "Could not create " << OutFile << ". Does it exist already?\n";
+        status = 0;
+        fits_close_file(pIn, &status);
+        return -1;
+    }
+
+    fits_get_num_hdus(pIn, &nHDUs, &status);
+    for (int i = 1; i <= nHDUs && status == 0; i++) {
+        fits_movabs_hdu(pIn, i, NULL, &status);
+        char ExtName[FLEN_VALUE] = "";
+        int KeyStatus = 0;
+        fits_read_key(pIn, TSTRING, "EXTNAME", ExtName, NULL, &KeyStatus);
+        if (std::string(ExtName) != "MEAN_SPARSE") {
+            fits_copy_hdu(pIn, fptr, 0, &status);
+            continue;
+        }
+
+        SparseImage Sparse;
+        ReadSparseTable(pIn, Sparse, status);
+        std::vector<float> Images[2];
+        DenseImage(Sparse, Images[0], Images[1]);
+
+        int NDCMKeys[2] = { 0, 0 };
+        int nNDCMKeys = 0;
+        KeyStatus = 0;
+        fits_read_key(pIn, TINT, "NDCMDISC", &NDCMKeys[0], NULL, &KeyStatus);
+        fits_read_key(pIn, TINT, "NDCMUSED", &NDCMKeys[1], NULL, &KeyStatus);
+        if (KeyStatus == 0) nNDCMKeys = 2;
+
+        long imageSizeXY[2] = { Sparse.dCols, Sparse.dRows };
+        const char *Names[2] = { "MEAN", "RMS" };
+        for (int k = 0; k < 2 && status == 0; k++) {
+            if (Images[k].empty()) continue;
+            fits_create_img(fptr, FLOAT_IMG, 2, &imageSizeXY[0], &status);
+            fits_write_key(fptr, TSTRING, "EXTNAME", (char*) Names[k], "NDCM reduction product", &status);
+            fits_write_key(fptr, TDOUBLE, "SPSIGMA", &Sparse.Sigma, "Pixels below pedestal + SPSIGMA * noise: row level", &status);
+            if (nNDCMKeys) {
+                fits_write_key(fptr, TINT, "NDCMDISC", &NDCMKeys[0], "Leading charge measurements discarded", &status);
+                fits_write_key(fptr, TINT, "NDCMUSED", &NDCMKeys[1], "Charge measurements per pixel in the reduction", &status);
+            }
+            fits_write_img(fptr, TFLOAT, 1, (LONGLONG) Images[k].size(), Images[k].data(), &status);
+        }
+        nSparse++;
+    }
+
+    fits_close_file(pIn, &status);
+    fits_close_file(fptr, &status);
+    fits_report_error(stderr, status);
+    if (status == 0 && nSparse == 0) std::cout << InFile << " has no MEAN_SPARSE table, it was copied as it is\n";
+
+    return status == 0 ? 0 : -1;
+}
+
+
+// ------------------------------------------------------
+//  Main program
+// ------------------------------------------------------
+int main( int argc, char **argv )
+{
+
+    if (argc < 2 || std::string(argv[1]) == "--help") {
+        USAGE(argv[0]);
+        return argc < 2 ? -1 : 0;
+    }
+
+    /*Pairs of input and output files*/
+    std::vector<std::pair<std::string, std::string>> Files;
+    /*An output name can only be given for a raw frame, the dense file of a FITS file is always <file>_dense.fits*/
+    if (argc == 3 && !EndsWith(argv[1], ".fits") && !EndsWith(argv[2], ".raw")) Files.push_back(std::make_pair(argv[1], argv[2]));
+    else {
+        for (int i = 1; i < argc; i++) {
+            std::string In = argv[i];
+            std::string Out = In + ".fits";
+            if (EndsWith(In, ".raw")) Out = In.substr(0, In.size() - 4) + ".fits";
+            else if (EndsWith(In, ".fits")) Out = In.substr(0, In.size() - 5) + "_dense.fits";
+            Files.push_back(std::make_pair(In, Out));
+        }
+    }
+
+    int nFailed = 0;
+    for (auto &F : Files) {
+        auto tStart = std::chrono::steady_clock::now();
+        int dRet = EndsWith(F.first, ".fits") ? ExpandSparseFrame(F.first, F.second) : ConvertRawFrame(F.first, F.second);
+        if (dRet != 0) {
+            nFailed++;
+            continue;
+        }
+        std::chrono::duration<double> dt = std::chrono::steady_clock::now() - tStart;
+        printf("%s -> %s (%.2f s)\n", F.first.c_str(), F.second.c_str(), dt.count());
+    }
+
+    if (nFailed > 0) std::cout << nFailed << " of " << Files.size() << " files could not be converted\n";
+    return nFailed > 0 ? -1 : 0;
+}
@@ -1,98 +1,142 @@
-#include <iostream>
-#include <iomanip>
-#include <string>
-#include <unistd.h>
-#include <chrono>
-#include <fstream>
-#include <sys/stat.h>
-
-
-#include "LeachController.hpp"
-
-
-#define USAGE( x ) \
-            ( std::cout << std::endl << "Usage: ./" << x << " [exp time (s) : Default=5] [Output file name: Default Image.fits]" << std::endl)
-
-
-
-// ------------------------------------------------------
-//  Main program
-// ------------------------------------------------------
-int main( int argc, char **argv )
-{
-
-    /*Now get the args*/
-    if (argc<2) {
-        std::cout << "Please specify an exposure value!\n";
-        USAGE(argv[0]);
-        exit( EXIT_FAILURE );
-    }
-
-    int ExposeSeconds;
-    try {
-        ExposeSeconds = atoi(argv[1]);
-    } catch (...)
-    {
-        ExposeSeconds = 5;
-        std::cout << "Exposure was not set correctly. Using a default value of 5 seconds.";
-    }
-
-    std::string OutFileName;
-    try {
-        OutFileName = argv[2];
-    } catch (...)
-    {
-        OutFileName = "Image.fits";
-        std::cout << "Output file name is set to Image.fits since no name was provided.";
-    }
-
-    /*Check if the output filename exists. If so, we end the program immediately.*/
-    struct stat buffer;
-    if (stat (OutFileName.c_str(), &buffer) == 0){
-        std::cout << "The specified output file already exist. Please specify a different name for the output.\n";
-        return -1;
-    }
-
-    /* Read the last config file location - this is needed to compare with the file uploaded
-     * and check that it has not changed since the upload. */
-    std::ifstream LastCfgLoc("do_not_touch/LastConfigLocation.txt", std::fstream::in);
-    std::string LastCfgFile;
-    std::getline(LastCfgLoc, LastCfgFile);
-    LastCfgLoc.close();
-
-    LeachController _ThisRunControllerInstance(LastCfgFile);
-
-    /*At the start of the program, log the time*/
-    _ThisRunControllerInstance.ClockTimers.ProgramStart = std::chrono::system_clock::now();
-
-    /*Check if the settings file has changed in any way*/
-    bool config, sequencer;
-    int _CCDSettingsStatus = _ThisRunControllerInstance.LoadAndCheckForSettingsChange(config, sequencer);
-
-    if (_CCDSettingsStatus == 0){
-
-        _ThisRunControllerInstance.CCDParams.fExpTime = ExposeSeconds;
-        if (_ThisRunControllerInstance.CCDParams.CCDType=="DES")	_ThisRunControllerInstance.CCDParams.nSkipperR=1;
-
-
-        /*Reset clock timers in case this is a multi exposure*/
-        _ThisRunControllerInstance.ClockTimers.isReadout = false;
-        _ThisRunControllerInstance.ClockTimers.isExp = false;
-        _ThisRunControllerInstance.ClockTimers.rClockCounter = 0;
-
-
-        /*Expose*/
-        unsigned short *ImageBufferV;
-        _ThisRunControllerInstance.PrepareAndExposeCCD(ExposeSeconds, ImageBufferV);
-
-        /*Save FITS*/
-        _ThisRunControllerInstance.SaveFits(OutFileName);
-    } else {
-        if (config) std::cout<<"Error: The config file has changed but the new settings were not uploaded.\n";
-        if (sequencer) std::cout<<"Error: The sequencer has changed but it was not uploaded.\n";
-        std::cout<<"CCD was not exposed and an image was not taken. Please resolve the conflicts in the config section first.\n";
-    }
-
-    printf("CCDDrone done. Thank you.\n");
-}
-
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <csignal>
+#include <sys/stat.h>
+
+
+#include "LeachController.hpp"
+
+
+#define USAGE( x ) \
+            ( std::cout << std::endl << "Usage: ./" << x << " [exp time (s) : Default=5] [Output file name: Default Image.fits] [Number of frames: Default=1] [continuous]" << std::endl)
+
+
+/*Ctrl-C stops the exposure or the readout through the controller instead of killing the program
+ *in the middle of it, so the controller does not need to be restarted. Pressing it again does the
+ *same, SIGQUIT (Ctrl-\) still kills the program.*/
+static LeachController *pExposingController = NULL;
+static void HandleInterrupt(int )
+{
+    if (pExposingController != NULL) {
+        pExposingController->AbortExposure();
+        pExposingController->StopContinuous();
+    }
+}
+
+
+
+// ------------------------------------------------------
+//  Main program
+// ------------------------------------------------------
+int main( int argc, char **argv )
+{
+
+    /*Now get the args*/
+    if (argc<2) {
+        std::cout << "Please specify an exposure value!\n";
+        USAGE(argv[0]);
+        exit( EXIT_FAILURE );
+    }
+
+    int ExposeSeconds;
+    try {
+        ExposeSeconds = atoi(argv[1]);
+    } catch (...)
+    {
+        ExposeSeconds = 5;
+        std::cout << "Exposure was not set correctly. Using a default value of 5 seconds.";
+    }
+
+    std::string OutFileName;
+    try {
+        OutFileName = argv[2];
+    } catch (...)
+    {
+        OutFileName = "Image.fits";
+        std::cout << "Output file name is set to Image.fits since no name was provided.";
+    }
+
+    /*Multi-frame runs write <output>_0000.fits, <output>_0001.fits ...*/
+    int nFrames = 1;
+    if (argc > 3) nFrames = atoi(argv[3]);
+    if (nFrames < 1) {
+        std::cout << "Number of frames must be at least 1. Taking a single frame.\n";
+        nFrames = 1;
+    }
+
+    /*A continuous readout runs all the frames without commands in between, and takes fractions of a second*/
+    bool bContinuous = argc > 4 && std::string(argv[4]) == "continuous";
+    float ExposeTime = bContinuous ? (float) atof(argv[1]) : (float) ExposeSeconds;
+
+    /*Check if the output filename exists. If so, we end the program immediately.*/
+    struct stat buffer;
+    for (int k = 0; k < nFrames; k++) {
+        std::string _FrameName = (nFrames == 1 && !bContinuous) ? OutFileName : FrameFileName(OutFileName, k);
+        if (stat (_FrameName.c_str(), &buffer) == 0){
+            std::cout << "The specified output file "<< _FrameName <<" already exist. Please specify a different name for the output.\n";
+            return -1;
+        }
+    }
+
+    /* Read the last config file location - this is needed to compare with the file uploaded
+     * and check that it has not changed since the upload. */
+    std::ifstream LastCfgLoc(DeviceStateFile(SelectedDevice(), "LastConfigLocation.txt"), std::fstream::in);
+    std::string LastCfgFile;
+    std::getline(LastCfgLoc, LastCfgFile);
+    LastCfgLoc.close();
+
+    LeachController _ThisRunControllerInstance(LastCfgFile, SelectedDevice());
+
+    /*At the start of the program, log the time*/
+    _ThisRunControllerInstance.ClockTimers.ProgramStart = std::chrono::system_clock::now();
+
+    /*Check if the settings file has changed in any way*/
+    bool config, sequencer;
+    int _CCDSettingsStatus = _ThisRunControllerInstance.LoadAndCheckForSettingsChange(config, sequencer);
+
+    if (_CCDSettingsStatus == 0){
+
+        pExposingController = &_ThisRunControllerInstance;
+        signal(SIGINT, HandleInterrupt);
+        signal(SIGTERM, HandleInterrupt);
+
+        _ThisRunControllerInstance.CCDParams.fExpTime = ExposeSeconds;
+        if (_ThisRunControllerInstance.CCDParams.CCDType=="DES")	_ThisRunControllerInstance.CCDParams.nSkipperR=1;
+
+
+        /*Reset clock timers in case this is a multi exposure*/
+        _ThisRunControllerInstance.ClockTimers.isReadout = false;
+        _ThisRunControllerInstance.ClockTimers.isExp = false;
+        _ThisRunControllerInstance.ClockTimers.rClockCounter = 0;
+
+
+        if (bContinuous) {
+            /*The frames are written by the background writer as they come out of the common buffer*/
+            int nDone = _ThisRunControllerInstance.ExposeContinuous(ExposeTime, nFrames, OutFileName);
+            std::cout << nDone << " of " << nFrames << " frames were taken.\n";
+        } else if (nFrames > 1) {
+            /*Expose and save all the frames. Writes happen while the next frame is exposing.*/
+            int nDone = _ThisRunControllerInstance.ExposeMultipleFrames(ExposeSeconds, nFrames, OutFileName);
+            std::cout << nDone << " of " << nFrames << " frames were taken.\n";
+        } else {
+            /*Expose*/
+            unsigned short *ImageBufferV;
+            int dResult = _ThisRunControllerInstance.PrepareAndExposeCCD(ExposeSeconds, ImageBufferV);
+
+            /*Save FITS. A stopped readout is only saved if its rows were kept ([output] SavePartial).*/
+            if (dResult != 0) std::cout << "The exposure failed. No image was saved.\n";
+            else if (_ThisRunControllerInstance.SaveFits(OutFileName) != 0) std::cout << "The image could not be written to " << OutFileName << ".\n";
+        }
+    } else {
+        if (config) std::cout<<"Error: The config file has changed but the new settings were not uploaded.\n";
+        if (sequencer) std::cout<<"Error: The sequencer has changed but it was not uploaded.\n";
+        std::cout<<"CCD was not exposed and an image was not taken. Please resolve the conflicts in the config section first.\n";
+    }
+
+    printf("CCDDrone done. Thank you.\n");
+}
+
@@ -0,0 +1,105 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+
+#include "LeachController.hpp"
+
+
+#define USAGE( x ) \
+            ( std::cout << std::endl << "Usage: ./" << x << " [sizes: Default=100x100,500x500,1000x1000] [NDCM values: Default=1,10,100] [commands: Default=1000]" << std::endl \
+                        << "Sizes are <rows>x<cols> and the lists are comma separated." << std::endl)
+
+
+/* *********************************************************************
+ * CCDDLinkBench measures the link between the host and the controller.
+ * First the round trip of single commands, then the pixel rate of 0 s
+ * synthetic images for each size and NDCM value. The controller has to
+ * be started up (CCDDStartupAndErase) before this is run.
+ * *********************************************************************
+ */
+
+static std::vector<std::string> SplitList(const std::string &List)
+{
+    std::vector<std::string> Items;
+    std::istringstream ss(List);
+    std::string Item;
+    while (std::getline(ss, Item, ',')) if (!Item.empty()) Items.push_back(Item);
+    return Items;
+}
+
+
+// ------------------------------------------------------
+//  Main program
+// ------------------------------------------------------
+int main( int argc, char **argv )
+{
+
+    std::string SizeList = argc > 1 ? argv[1] : "100x100,500x500,1000x1000";
+    std::string NDCMList = argc > 2 ? argv[2] : "1,10,100";
+    int nCommands = argc > 3 ? atoi(argv[3]) : 1000;
+
+    if (nCommands < 1) {
+        USAGE(argv[0]);
+        return -1;
+    }
+
+    std::ifstream LastCfgLoc(DeviceStateFile(SelectedDevice(), "LastConfigLocation.txt"), std::fstream::in);
+    std::string LastCfgFile;
+    std::getline(LastCfgLoc, LastCfgFile);
+    LastCfgLoc.close();
+
+    LeachController _ThisRunControllerInstance(LastCfgFile, SelectedDevice());
+    bool config, sequencer;
+    _ThisRunControllerInstance.LoadAndCheckForSettingsChange(config, sequencer);
+
+
+    /*Command round trip*/
+    std::vector<double> Latencies;
+    int nFailed = _ThisRunControllerInstance.MeasureCommandLatency(nCommands, Latencies);
+    std::sort(Latencies.begin(), Latencies.end());
+    double Sum = 0;
+    for (double l : Latencies) Sum += l;
+
+    printf("Command round trip over %d TDL commands (%d failed):\n", nCommands, nFailed);
+    printf("  mean %.1f us | min %.1f us | median %.1f us | p99 %.1f us | max %.1f us\n\n",
+           Sum / Latencies.size(), Latencies.front(), Latencies[Latencies.size()/2],
+           Latencies[(size_t) (0.99 * (Latencies.size()-1))], Latencies.back());
+
+
+    /*Synthetic readouts*/
+    printf("%8s %8s %6s %12s %14s %14s %8s %10s %10s\n", "Rows", "Cols", "NDCM", "Readout(s)", "Rate(pix/s)", "Peak(pix/s)", "Polls", "Poll(us)", "RampErr");
+
+    int rc = 0;
+    for (const std::string &Size : SplitList(SizeList)) {
+        int dRows = 0, dCols = 0;
+        if (sscanf(Size.c_str(), "%dx%d", &dRows, &dCols) != 2 || dRows < 1 || dCols < 1) {
+            std::cout << "Size " << Size << " is not <rows>x<cols>.\n";
+            continue;
+        }
+
+        for (const std::string &NDCM : SplitList(NDCMList)) {
+            int nSkips = atoi(NDCM.c_str());
+            if (nSkips < 1) continue;
+
+            LinkBenchResult Result;
+            if (_ThisRunControllerInstance.MeasureSyntheticReadout(dRows, dCols, nSkips, Result) != 0) {
+                printf("%8d %8d %6d  failed\n", dRows, dCols, nSkips);
+                rc = -1;
+                continue;
+            }
+
+            printf("%8d %8d %6d %12.4f %14.4g %14.4g %8d %10.2f %10ld\n", Result.dRows, Result.dCols, Result.nSkipperR,
+                   Result.ReadoutSeconds, Result.PixelRate, Result.PeakPixelRate, Result.nPolls, Result.MeanPollMicros, Result.RampErrors);
+        }
+    }
+
+    _ThisRunControllerInstance.IdleClockToggle();
+
+    printf("\nCCDDrone done. Thank you.\n");
+    return rc;
+}
@@ -0,0 +1,266 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+
+#include "CArcDeinterlace.h"
+#include "CCDControlDataTypes.hpp"
+#include "UtilityFunctions.hpp"
+#include "NativeDeinterlace.hpp"
+#include "SkipperReduction.hpp"
+#include "Calibration.hpp"
+#include "FitsOps.hpp"
+#include "RawFrame.hpp"
+#include "ClusterFinder.hpp"
+
+
+#define USAGE( x ) \
+            ( std::cout << std::endl << "Usage: ./" << x << " [geometry: Default=6144x1024] [NDCM values: Default=1,10,100,1000,4000]" \
+                        << " [repetitions: Default=5] [threads: Default=0 (all cores)] [buffer limit (MB): Default=512] [output directory: Default=/tmp]" << std::endl)
+
+
+/* *********************************************************************
+ * CCDDMicroBench times the kernels the host runs on every frame, one by
+ * one, over synthetic skipper images: the de-interlace (CArcDeinterlace
+ * and the native one), the NDCM reduction, the overscan subtraction,
+ * the byte swap and sample plane packing, and the FITS encoding and the
+ * raw spill. No controller is needed. The data comes from a fixed seed,
+ * so runs on the same machine can be compared between builds.
+ *
+ * Images with many samples are cut down to as many rows as fit in the
+ * buffer limit; the kernels work row by row, so the rates per pixel do
+ * not depend on the number of rows. Every kernel runs once to fault the
+ * buffers in, then the given number of times; the median is reported.
+ * Each result is also printed as a BENCH line for scripts.
+ * *********************************************************************
+ */
+
+typedef std::chrono::steady_clock BenchClock;
+
+struct KernelResult{
+    std::string Kernel;
+    int nSamples;
+    int nRows;
+    double MedianMs;
+    double BestMs;
+    double GBPerSec;
+    double NsPerPixel;
+    double NsPerSample;
+};
+
+static std::vector<KernelResult> Results;
+
+
+/*Time Func nReps times after one warm-up run. nBytes is what the kernel reads, for the GB/s.*/
+template <typename F>
+static void TimeKernel(const std::string &Name, int nSamples, int nRows, int dCols, double nBytes, int nReps, F Func)
+{
+
+    Func();
+
+    std::vector<double> Times;
+    for (int i = 0; i < nReps; i++) {
+        auto t0 = BenchClock::now();
+        Func();
+        Times.push_back(std::chrono::duration<double, std::milli>(BenchClock::now() - t0).count());
+    }
+    std::sort(Times.begin(), Times.end());
+
+    KernelResult R;
+    R.Kernel = Name;
+    R.nSamples = nSamples;
+    R.nRows = nRows;
+    R.MedianMs = Times[Times.size() / 2];
+    R.BestMs = Times[0];
+    double nPixels = (double) nRows * dCols;
+    R.GBPerSec = R.MedianMs > 0 ? nBytes / (R.MedianMs * 1e6) : 0;
+    R.NsPerPixel = R.MedianMs * 1e6 / nPixels;
+    R.NsPerSample = R.NsPerPixel / nSamples;
+    Results.push_back(R);
+
+    printf("  %-18s %10.2f ms (best %9.2f)  %8.2f GB/s  %10.3f ns/pixel  %8.4f ns/sample\n",
+           Name.c_str(), R.MedianMs, R.BestMs, R.GBPerSec, R.NsPerPixel, R.NsPerSample);
+
+}
+
+
+/*Pedestal, white noise and a few hits, the same every run*/
+static void FillSynthetic(unsigned short *pData, size_t n, uint32_t Seed)
+{
+    uint32_t x = Seed ? Seed : 1;
+    for (size_t i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        unsigned short v = (unsigned short) (8000 + (x & 63));
+        if ((x >> 20) == 0) v += (unsigned short) (x & 4095);
+        pData[i] = v;
+    }
+}
+
+
+static std::vector<int> ParseList(const std::string &s)
+{
+    std::vector<int> v;
+    size_t p = 0;
+    while (p < s.size()) {
+        size_t q = s.find(',', p);
+        if (q == std::string::npos) q = s.size();
+        int n = atoi(s.substr(p, q - p).c_str());
+        if (n > 0) v.push_back(n);
+        p = q + 1;
+    }
+    return v;
+}
+
+
+// ------------------------------------------------------
+//  Main program
+// ------------------------------------------------------
+int main( int argc, char **argv )
+{
+
+    std::string Geometry = argc > 1 ? argv[1] : "6144x1024";
+    std::vector<int> NDCMs = ParseList(argc > 2 ? argv[2] : "1,10,100,1000,4000");
+    int nReps = argc > 3 ? atoi(argv[3]) : 5;
+    int nThreads = argc > 4 ? atoi(argv[4]) : 0;
+    double LimitMB = argc > 5 ? atof(argv[5]) : 512;
+    std::string OutDir = argc > 6 ? argv[6] : "/tmp";
+
+    int dCols = 0, dRows = 0;
+    if (sscanf(Geometry.c_str(), "%dx%d", &dCols, &dRows) != 2 || dCols < 2 || dRows < 1 || dCols % 2 != 0
+        || NDCMs.empty() || nReps < 1 || LimitMB <= 0) {
+        USAGE(argv[0]);
+        return -1;
+    }
+
+    printf("Kernels on %d cols x %d rows, %d repetitions, %d threads (0 = all cores), buffers up to %.0f MB\n",
+           dCols, dRows, nReps, nThreads, LimitMB);
+
+    /*The overscan subtraction works on the reduced image, so it does not depend on NDCM*/
+    {
+        std::vector<unsigned short> Raw((size_t) dCols * dRows);
+        FillSynthetic(Raw.data(), Raw.size(), 12345);
+        std::vector<float> Image(Raw.begin(), Raw.end());
+        std::vector<float> Work(Image.size());
+        int nOver = dCols / 16 > 0 ? dCols / 16 : 1;
+        double nBytes = (double) Image.size() * sizeof(float);
+
+        printf("\nReduced image (%d x %d, %d overscan columns):\n", dCols, dRows, nOver);
+        TimeKernel("overscan_mean", 1, dRows, dCols, nBytes, nReps, [&]() {
+            std::copy(Image.begin(), Image.end(), Work.begin());
+            SubtractRowPedestal(Work.data(), dRows, dCols, 0, dCols - nOver, dCols - nOver, nOver, false);
+        });
+        TimeKernel("overscan_median", 1, dRows, dCols, nBytes, nReps, [&]() {
+            std::copy(Image.begin(), Image.end(), Work.begin());
+            SubtractRowPedestal(Work.data(), dRows, dCols, 0, dCols - nOver, dCols - nOver, nOver, true);
+        });
+    }
+
+    for (int nSamples : NDCMs) {
+
+        /*As many rows as fit in the buffer limit*/
+        size_t RowBytes = (size_t) dCols * nSamples * sizeof(unsigned short);
+        int nRows = (int) std::min<double>(dRows, LimitMB * 1024 * 1024 / RowBytes);
+        if (nRows < 1) nRows = 1;
+        int dWidth = dCols * nSamples;
+        size_t nValues = (size_t) dWidth * nRows;
+        double nBytes = (double) nValues * sizeof(unsigned short);
+
+        std::vector<unsigned short> Raw(nValues), Work(nValues);
+        std::vector<float> Mean((size_t) dCols * nRows), RMS((size_t) dCols * nRows);
+        FillSynthetic(Raw.data(), nValues, 12345 + nSamples);
+
+        printf("\nNDCM %d, %d rows (%.1f MB):\n", nSamples, nRows, nBytes / (1024 * 1024));
+
+        /*De-interlacing of a UL image, in place*/
+        arc::deinterlace::CArcDeinterlace cDlacer;
+        TimeKernel("deint_arc", nSamples, nRows, dCols, nBytes, nReps, [&]() {
+            cDlacer.RunAlg(Work.data(), nRows, dWidth, arc::deinterlace::CArcDeinterlace::DEINTERLACE_SERIAL);
+        });
+        TimeKernel("deint_native_1t", nSamples, nRows, dCols, nBytes, nReps, [&]() {
+            DeinterlaceSerial(Work.data(), nRows, dWidth, 1);
+        });
+        TimeKernel("deint_native", nSamples, nRows, dCols, nBytes, nReps, [&]() {
+            DeinterlaceSerial(Work.data(), nRows, dWidth, nThreads);
+        });
+
+        /*NDCM reduction, alone and fused with the de-interlace*/
+        TimeKernel("reduce_1t", nSamples, nRows, dCols, nBytes, nReps, [&]() {
+            ReduceSkipperRows(Raw.data(), nRows, dCols, nSamples, 0, dCols, Mean.data(), RMS.data());
+        });
+        TimeKernel("reduce", nSamples, nRows, dCols, nBytes, nReps, [&]() {
+            ParallelForRows(nRows, nThreads, [&](int dFirst, int dEnd) {
+                size_t o = (size_t) dFirst * dCols;
+                ReduceSkipperRows(Raw.data() + o * nSamples, dEnd - dFirst, dCols, nSamples, 0, dCols, Mean.data() + o, RMS.data() + o);
+            });
+        });
+        TimeKernel("deint_reduce", nSamples, nRows, dCols, nBytes, nReps, [&]() {
+            DeinterlaceAndReduce(Work.data(), nRows, dCols, nSamples, 0, false, Mean.data(), RMS.data(), nThreads);
+        });
+
+        /*What cfitsio does to every sample before it goes to disk, and the planes layout*/
+        TimeKernel("byteswap", nSamples, nRows, dCols, nBytes, nReps, [&]() {
+            ParallelForRows(nRows, nThreads, [&](int dFirst, int dEnd) {
+                for (size_t i = (size_t) dFirst * dWidth; i < (size_t) dEnd * dWidth; i++) Work[i] = __builtin_bswap16(Raw[i]);
+            });
+        });
+        if (nSamples > 1) {
+            TimeKernel("planes_pack", nSamples, nRows, dCols, nBytes, nReps, [&]() {
+                GatherSamplePlanes(Raw.data(), nRows, dCols, nSamples, dCols, 0, nSamples, Work.data(), nThreads);
+            });
+        }
+
+        /*The cluster finder as the polling thread runs it, a band of rows per callback*/
+        ClusterFinder Finder;
+        Finder.Configure(dCols, nSamples, 0, "UL", 4.0, 2.5, 10000);
+        TimeKernel("clusters", nSamples, nRows, dCols, nBytes, nReps, [&]() {
+            Finder.ReadoutStarted(nRows, dWidth);
+            for (int r = 0; r < nRows; r += 16)
+                Finder.RowsCallback(Raw.data() + (size_t) r * dWidth, r, std::min(16, nRows - r), dWidth);
+            Finder.TakeTable();
+        });
+
+        /*Encoding of the raw samples, into memory so the disk does not count*/
+        FrameRecord Frame;
+        Frame.CCDParams.dCols = dCols;
+        Frame.CCDParams.dRows = nRows;
+        Frame.CCDParams.nSkipperR = nSamples;
+        Frame.CCDParams.AmplifierDirection = "U";
+        Frame.ProcParams.ReduceNDCM = false;
+        const char *Compressions[] = { "none", "rice" };
+        for (const char *Compression : Compressions) {
+            TimeKernel(std::string("fits_") + Compression, nSamples, nRows, dCols, nBytes, nReps, [&]() {
+                Frame.OutFileName = "mem://";
+                Frame.OutParams.Compression = Compression;
+                WriteFrameToFits(Frame, Raw.data());
+            });
+        }
+
+        /*The raw spill goes to the output directory, so this one does measure the disk*/
+        std::string RawFile = OutDir + "/CCDDMicroBench.raw";
+        std::vector<char> Metadata = FrameMetadataFits(Frame);
+        TimeKernel("raw_spill", nSamples, nRows, dCols, nBytes, nReps, [&]() {
+            RawFrameHeader Header = RawFrameHeader();
+            Header.Width = dWidth;
+            Header.Height = nRows;
+            Header.dCols = dCols;
+            Header.dRows = nRows;
+            Header.nSkipperR = nSamples;
+            WriteRawFrame(RawFile, Header, Metadata, Raw.data(), true);
+        });
+        std::remove(RawFile.c_str());
+
+    }
+
+    std::cout << "\n";
+    for (const KernelResult &R : Results)
+        printf("BENCH kernel=%s cols=%d rows=%d ndcm=%d median_ms=%.3f best_ms=%.3f gb_per_s=%.3f ns_per_pixel=%.4f ns_per_sample=%.5f\n",
+               R.Kernel.c_str(), dCols, R.nRows, R.nSamples, R.MedianMs, R.BestMs, R.GBPerSec, R.NsPerPixel, R.NsPerSample);
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "SharedStatus.hpp"
+
+
+#define USAGE( x ) \
+            ( std::cout << std::endl << "Usage: ./" << x << " [segment name: Default=ccddrone]" << std::endl)
+
+
+static const char* StateName(int State)
+{
+    switch (State) {
+        case SHM_IDLE: return "idle";
+        case SHM_EXPOSING: return "exposing";
+        case SHM_READOUT: return "readout";
+        case SHM_FAILED: return "failed";
+    }
+    return "unknown";
+}
+
+
+// ------------------------------------------------------
+//  Main program
+// ------------------------------------------------------
+int main( int argc, char **argv )
+{
+
+    std::string Segment = argc > 1 ? argv[1] : "ccddrone";
+    if (Segment == "--help") { USAGE(argv[0]); return 0; }
+    if (Segment[0] != '/') Segment = "/" + Segment;
+
+    int fd = shm_open(Segment.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        std::cout << "The segment " << Segment << " does not exist. Is PublishStatus = true and has an exposure been started?\n";
+        return -1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    void *pMap = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pMap == MAP_FAILED) {
+        std::cout << "Could not map " << Segment << "\n";
+        return -1;
+    }
+    const SharedStatusHeader *pHeader = (const SharedStatusHeader*) pMap;
+
+    /*Print the state a few times a second, and the mean of every new frame. The mean is computed on the
+     *frame in place, and only shown if the frame was not overwritten while it was being summed.*/
+    int64_t LastFrame = 0;
+    while (true) {
+
+        if (pHeader->Magic != CCDD_SHM_MAGIC) {
+            std::cout << "\nThe segment was closed.\n";
+            break;
+        }
+
+        SharedStatus Status;
+        if (ReadSharedStatus(pHeader, Status)) {
+            printf("\r[%s] state: %-8s remaining: %7.1f s  pixels: %lld / %lld  frames: %lld   ", Segment.c_str(),
+                   StateName(Status.State), Status.RemainingTime, (long long) Status.PixelCount,
+                   (long long) Status.TotalPixels, (long long) Status.FramesCompleted);
+            for (int a = 0; a < Status.nAmps && a < 2; a++)
+                printf("%s: %.1f +- %.1f ADU, %lld sat.  ", Status.nAmps == 2 ? (a == 0 ? "U" : "L") : "amp",
+                       Status.Amps[a].Mean, Status.Amps[a].RMS, (long long) Status.Amps[a].Saturated);
+            fflush(stdout);
+        }
+
+        SharedFrameInfo Info;
+        int Slot;
+        uint64_t Seq;
+        if (ReadLatestFrame(pHeader, Info, Slot, Seq) && Info.FrameNumber != LastFrame
+            && Info.Offset + Info.Bytes <= (uint64_t) st.st_size) {
+            const unsigned short *pPix = (const unsigned short*) ((const char*) pMap + Info.Offset);
+            double Sum = 0;
+            size_t n = (size_t) Info.Rows * Info.Cols;
+            for (size_t i = 0; i < n; i++) Sum += pPix[i];
+            if (SlotStillValid(pHeader, Slot, Seq)) {
+                printf("\nFrame %lld: %d x %d, NDCM %d, mean %.2f ADU\n", (long long) Info.FrameNumber, Info.Rows, Info.Cols,
+                       Info.NDCM, n > 0 ? Sum / n : 0.0);
+                LastFrame = Info.FrameNumber;
+            }
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    munmap(pMap, (size_t) st.st_size);
+    return 0;
+}
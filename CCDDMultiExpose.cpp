@@ -0,0 +1,68 @@
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <sys/stat.h>
+
+#include "LeachController.hpp"
+#include "ControllerGroup.hpp"
+#include "UtilityFunctions.hpp"
+
+
+#define USAGE( x ) \
+            ( std::cout << std::endl << "Usage: ./" << x << " <exp time (s)> <Output file name> <Number of frames> <PCIe boards, e.g. 0,1>" << std::endl)
+
+
+
+// ------------------------------------------------------
+//  Main program
+// ------------------------------------------------------
+int main( int argc, char **argv )
+{
+
+    if (argc < 5) {
+        USAGE(argv[0]);
+        exit( EXIT_FAILURE );
+    }
+
+    int ExposeSeconds = atoi(argv[1]);
+    std::string OutFileName = argv[2];
+    int nFrames = atoi(argv[3]);
+    if (nFrames < 1) {
+        std::cout << "Number of frames must be at least 1. Taking a single frame.\n";
+        nFrames = 1;
+    }
+
+    std::vector<int> Devices;
+    std::stringstream DevList(argv[4]);
+    std::string Dev;
+    while (std::getline(DevList, Dev, ',')) if (!Dev.empty()) Devices.push_back(atoi(Dev.c_str()));
+
+    /*Check if any of the output files exist. If so, we end the program immediately.*/
+    struct stat buffer;
+    for (int d : Devices) {
+        std::string DevFileName = DeviceFileName(OutFileName, d);
+        for (int k = 0; k < nFrames; k++) {
+            std::string _FrameName = (nFrames == 1) ? DevFileName : FrameFileName(DevFileName, k);
+            if (stat (_FrameName.c_str(), &buffer) == 0){
+                std::cout << "The specified output file "<< _FrameName <<" already exist. Please specify a different name for the output.\n";
+                return -1;
+            }
+        }
+    }
+
+    ControllerGroup Group;
+    for (int d : Devices) {
+        if (Group.AddController(d) != 0) {
+            std::cout<<"CCDs were not exposed. Please resolve the problem with PCIe board "<<d<<" first.\n";
+            return -1;
+        }
+    }
+
+    std::vector<int> nFramesTaken = Group.ExposeAll(ExposeSeconds, nFrames, OutFileName);
+
+    for (size_t i = 0; i < Group.Size(); i++)
+        std::cout << "PCIe board " << Group.Controller(i).DeviceIndex << ": " << nFramesTaken[i] << " of " << nFrames << " frames were taken.\n";
+
+    printf("CCDDrone done. Thank you.\n");
+}
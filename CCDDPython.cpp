@@ -0,0 +1,528 @@
+/* *********************************************************************
+ * Python bindings of the controller library, built as the ccddrone
+ * module if the Python headers are found.
+ *
+ *   import ccddrone, numpy as np
+ *   c = ccddrone.Controller("config/Config.ini")
+ *   c.load_settings()
+ *   c.set("vdd", -22.0); c.apply()
+ *   c.expose(10)
+ *   img = np.asarray(c.frame())      #rows x (cols*NDCM) uint16, no copy
+ *
+ * frame() gives a read-only view of the last image where it is, in the
+ * common buffer or in the host buffer of a segmented readout. The view
+ * is only good until the next exposure, so expose() refuses to run while
+ * a view (e.g. a numpy array made from it) is still alive; copy it with
+ * np.array(c.frame()) to keep it. The GIL is released while the CCD is
+ * exposed and read out, and while a FITS file is written.
+ * *********************************************************************
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <string>
+#include <exception>
+
+#include "LeachController.hpp"
+
+
+typedef struct {
+    PyObject_HEAD
+    LeachController *pController;
+    unsigned long Generation;   //Exposures taken, a frame is only valid for the one it was made for
+    int nExports;               //Buffer views of the image that are alive
+    bool bBusy;                 //An exposure or a write runs without the GIL
+} ControllerObject;
+
+typedef struct {
+    PyObject_HEAD
+    ControllerObject *pOwner;
+    unsigned long Generation;
+    unsigned short *pData;
+    int dRows;
+    int dCols;
+    int nSamples;
+    bool bInterlaced;
+    Py_ssize_t Shape[2];
+    Py_ssize_t Strides[2];
+} FrameObject;
+
+static PyTypeObject ControllerType = { PyVarObject_HEAD_INIT(NULL, 0) "ccddrone.Controller" };
+static PyTypeObject FrameType = { PyVarObject_HEAD_INIT(NULL, 0) "ccddrone.Frame" };
+
+
+/*Turn the C++ exceptions (and the ints StartupController throws) into a RuntimeError*/
+#define CATCH_CONTROLLER_ERRORS \
+    catch (const std::exception &e) { PyErr_SetString(PyExc_RuntimeError, e.what()); return NULL; } \
+    catch (...) { PyErr_SetString(PyExc_RuntimeError, "The controller library raised an error."); return NULL; }
+
+
+static bool ControllerOpen(ControllerObject *self)
+{
+    if (self->pController == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "The controller is not open.");
+        return false;
+    }
+    return true;
+}
+
+/*Open, and not used by another Python thread right now*/
+static bool ControllerReady(ControllerObject *self)
+{
+    if (!ControllerOpen(self)) return false;
+    if (self->bBusy) {
+        PyErr_SetString(PyExc_RuntimeError, "The controller is busy with an exposure.");
+        return false;
+    }
+    return true;
+}
+
+
+/* ---------------------------- Frame ---------------------------- */
+
+static void Frame_dealloc(FrameObject *self)
+{
+    Py_XDECREF(self->pOwner);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static int Frame_getbuffer(FrameObject *self, Py_buffer *view, int flags)
+{
+
+    if (self->Generation != self->pOwner->Generation || self->pOwner->pController == NULL) {
+        PyErr_SetString(PyExc_BufferError, "The frame was overwritten by a later exposure.");
+        view->obj = NULL;
+        return -1;
+    }
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "Frames are read-only.");
+        view->obj = NULL;
+        return -1;
+    }
+
+    view->buf = self->pData;
+    view->obj = (PyObject *) self;
+    Py_INCREF(self);
+    view->len = self->Shape[0] * self->Shape[1] * (Py_ssize_t) sizeof(unsigned short);
+    view->itemsize = sizeof(unsigned short);
+    view->readonly = 1;
+    view->ndim = 2;
+    view->format = (flags & PyBUF_FORMAT) ? (char *) "H" : NULL;
+    view->shape = (flags & PyBUF_ND) ? self->Shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->Strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+
+    self->pOwner->nExports++;
+    return 0;
+}
+
+static void Frame_releasebuffer(FrameObject *self, Py_buffer *)
+{
+    self->pOwner->nExports--;
+}
+
+static PyObject *Frame_valid(FrameObject *self, void *)
+{
+    return PyBool_FromLong(self->Generation == self->pOwner->Generation);
+}
+
+static PyObject *Frame_rows(FrameObject *self, void *) { return PyLong_FromLong(self->dRows); }
+static PyObject *Frame_cols(FrameObject *self, void *) { return PyLong_FromLong(self->dCols); }
+static PyObject *Frame_ndcm(FrameObject *self, void *) { return PyLong_FromLong(self->nSamples); }
+static PyObject *Frame_interlaced(FrameObject *self, void *) { return PyBool_FromLong(self->bInterlaced); }
+
+static PyGetSetDef Frame_getset[] = {
+    {(char *) "valid", (getter) Frame_valid, NULL, (char *) "False once a later exposure overwrote the image", NULL},
+    {(char *) "rows", (getter) Frame_rows, NULL, (char *) "Rows of the image", NULL},
+    {(char *) "cols", (getter) Frame_cols, NULL, (char *) "Columns of the image, without the NDCM samples", NULL},
+    {(char *) "ndcm", (getter) Frame_ndcm, NULL, (char *) "Charge measurements per pixel, next to each other in a row", NULL},
+    {(char *) "interlaced", (getter) Frame_interlaced, NULL, (char *) "True if the U and L halves are still interlaced", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyBufferProcs Frame_as_buffer = { (getbufferproc) Frame_getbuffer, (releasebufferproc) Frame_releasebuffer };
+
+
+/* ---------------------------- Controller ---------------------------- */
+
+static int Controller_init(ControllerObject *self, PyObject *args, PyObject *kwds)
+{
+
+    const char *Config = "config/Config.ini";
+    int dDevice = SelectedDevice();
+    static const char *kwlist[] = {"config", "device", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|si", (char **) kwlist, &Config, &dDevice)) return -1;
+
+    delete self->pController;
+    self->pController = NULL;
+    try {
+        self->pController = new LeachController(Config, dDevice);
+    } catch (const std::exception &e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return -1;
+    } catch (...) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not open the controller.");
+        return -1;
+    }
+    self->Generation = 0;
+    self->nExports = 0;
+    self->bBusy = false;
+    return 0;
+}
+
+static void Controller_dealloc(ControllerObject *self)
+{
+    delete self->pController;
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyObject *Controller_load_settings(ControllerObject *self, PyObject *)
+{
+    if (!ControllerReady(self)) return NULL;
+    bool config, sequencer;
+    try {
+        self->pController->LoadAndCheckForSettingsChange(config, sequencer);
+    } CATCH_CONTROLLER_ERRORS
+    return Py_BuildValue("(OO)", config ? Py_True : Py_False, sequencer ? Py_True : Py_False);
+}
+
+static PyObject *Controller_apply(ControllerObject *self, PyObject *args, PyObject *kwds)
+{
+
+    int bFull = 0;
+    static const char *kwlist[] = {"full", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|p", (char **) kwlist, &bFull)) return NULL;
+    if (!ControllerReady(self)) return NULL;
+
+    int nSent = -1;
+    try {
+        LeachController &C = *self->pController;
+        if (bFull) {
+            C.ApplyAllCCDBasic();
+            C.ApplyAllBiasVoltages();
+            C.ApplyAllCCDClocks();
+            C.StoreAppliedSettings();
+        } else {
+            nSent = C.ApplyChangedSettings();
+        }
+        C.CopyOldAndStoreFileHashes();
+    } CATCH_CONTROLLER_ERRORS
+    return PyLong_FromLong(nSent);
+}
+
+static PyObject *Controller_apply_sequencer(ControllerObject *self, PyObject *args)
+{
+    const char *File = NULL;
+    if (!PyArg_ParseTuple(args, "|s", &File)) return NULL;
+    if (!ControllerReady(self)) return NULL;
+    try {
+        LeachController &C = *self->pController;
+        C.ApplyNewSequencer(File != NULL ? std::string(File) : C.CCDParams.sTimFile);
+    } CATCH_CONTROLLER_ERRORS
+    Py_RETURN_NONE;
+}
+
+static PyObject *Controller_startup(ControllerObject *self, PyObject *)
+{
+    if (!ControllerReady(self)) return NULL;
+    try {
+        LeachController &C = *self->pController;
+        C.StartupController();
+        C.ApplyAllCCDBasic();
+        C.ApplyAllBiasVoltages();
+        C.ApplyAllCCDClocks();
+        C.StoreAppliedSettings();
+        C.CopyOldAndStoreFileHashes();
+        C.IdleClockToggle();
+    } CATCH_CONTROLLER_ERRORS
+    Py_RETURN_NONE;
+}
+
+static PyObject *Controller_erase(ControllerObject *self, PyObject *)
+{
+    if (!ControllerReady(self)) return NULL;
+    self->bBusy = true;
+    bool bFailed = false;
+    std::string Error;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        self->pController->PerformEraseProcedure();
+        self->pController->IdleClockToggle();
+    } catch (const std::exception &e) {
+        bFailed = true;
+        Error = e.what();
+    } catch (...) {
+        bFailed = true;
+        Error = "The erase procedure failed.";
+    }
+    Py_END_ALLOW_THREADS
+    self->bBusy = false;
+    if (bFailed) {
+        PyErr_SetString(PyExc_RuntimeError, Error.c_str());
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *Controller_idle(ControllerObject *self, PyObject *)
+{
+    if (!ControllerReady(self)) return NULL;
+    try {
+        self->pController->IdleClockToggle();
+    } CATCH_CONTROLLER_ERRORS
+    Py_RETURN_NONE;
+}
+
+static PyObject *Controller_get(ControllerObject *self, PyObject *args)
+{
+
+    const char *Name;
+    if (!PyArg_ParseTuple(args, "s", &Name)) return NULL;
+    if (!ControllerOpen(self)) return NULL;
+
+    LeachController &C = *self->pController;
+    std::string sName(Name);
+    if (sName == "rows") return PyLong_FromLong(C.CCDParams.dRows);
+    if (sName == "cols") return PyLong_FromLong(C.CCDParams.dCols);
+    if (sName == "ccd_type") return PyUnicode_FromString(C.CCDParams.CCDType.c_str());
+    if (sName == "amplifier") return PyUnicode_FromString(C.CCDParams.AmplifierDirection.c_str());
+    if (sName == "sequencer") return PyUnicode_FromString(C.CCDParams.sTimFile.c_str());
+
+    double *pDouble;
+    int *pInt;
+    if (!C.ScanParameterRef(sName, pDouble, pInt)) {
+        PyErr_Format(PyExc_KeyError, "%s is not a setting that can be read.", Name);
+        return NULL;
+    }
+    if (pDouble != NULL) return PyFloat_FromDouble(*pDouble);
+    return PyLong_FromLong(*pInt);
+}
+
+static PyObject *Controller_set(ControllerObject *self, PyObject *args)
+{
+
+    const char *Name;
+    double dValue;
+    if (!PyArg_ParseTuple(args, "sd", &Name, &dValue)) return NULL;
+    if (!ControllerReady(self)) return NULL;
+
+    double *pDouble;
+    int *pInt;
+    if (!self->pController->ScanParameterRef(Name, pDouble, pInt)) {
+        PyErr_Format(PyExc_KeyError, "%s is not a setting that can be changed.", Name);
+        return NULL;
+    }
+    if (pDouble != NULL) *pDouble = dValue;
+    else *pInt = (int) dValue;
+
+    /*Sent with the next apply()*/
+    Py_RETURN_NONE;
+}
+
+static PyObject *Controller_expose(ControllerObject *self, PyObject *args)
+{
+
+    int dSeconds;
+    if (!PyArg_ParseTuple(args, "i", &dSeconds)) return NULL;
+    if (!ControllerReady(self)) return NULL;
+    if (self->nExports > 0) {
+        PyErr_SetString(PyExc_BufferError, "Views of the last frame are still alive, the exposure would overwrite them.");
+        return NULL;
+    }
+
+    LeachController &C = *self->pController;
+    C.CCDParams.fExpTime = dSeconds;
+    C.ClockTimers.isReadout = false;
+    C.ClockTimers.isExp = false;
+    C.ClockTimers.rClockCounter = 0;
+
+    /*The old frames become invalid as soon as the buffer may change*/
+    self->Generation++;
+    self->bBusy = true;
+    int dResult = -1;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        dResult = C.PrepareAndExposeCCD(dSeconds, NULL);
+    } catch (...) {
+        dResult = -1;
+    }
+    Py_END_ALLOW_THREADS
+    self->bBusy = false;
+
+    if (dResult != 0) {
+        PyErr_SetString(PyExc_RuntimeError, "The exposure failed.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/*Called from another Python thread while expose() runs, it does not wait for the controller*/
+static PyObject *Controller_abort(ControllerObject *self, PyObject *)
+{
+
+    if (!ControllerOpen(self)) return NULL;
+    if (!self->bBusy) Py_RETURN_FALSE;
+    self->pController->AbortExposure();
+    Py_RETURN_TRUE;
+}
+
+static PyObject *Controller_partial_rows(ControllerObject *self, PyObject *)
+{
+    if (!ControllerOpen(self)) return NULL;
+    if (self->pController->PartialRows < 0) Py_RETURN_NONE;
+    return PyLong_FromLong(self->pController->PartialRows);
+}
+
+static PyObject *Controller_frame(ControllerObject *self, PyObject *)
+{
+
+    if (!ControllerReady(self)) return NULL;
+    LeachController &C = *self->pController;
+    unsigned short *pData = C.ImageData();
+    if (self->Generation == 0 || pData == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "There is no image yet.");
+        return NULL;
+    }
+
+    FrameObject *pFrame = PyObject_New(FrameObject, &FrameType);
+    if (pFrame == NULL) return NULL;
+    Py_INCREF(self);
+    pFrame->pOwner = self;
+    pFrame->Generation = self->Generation;
+    pFrame->pData = pData;
+    pFrame->dRows = C.CCDParams.dRows;
+    pFrame->dCols = C.CCDParams.dCols;
+    pFrame->nSamples = C.CCDParams.nSkipperR;
+    pFrame->bInterlaced = C.bImageInterlaced;
+    pFrame->Shape[0] = C.CCDParams.dRows;
+    pFrame->Shape[1] = (Py_ssize_t) C.CCDParams.dCols * C.CCDParams.nSkipperR;
+    pFrame->Strides[0] = pFrame->Shape[1] * (Py_ssize_t) sizeof(unsigned short);
+    pFrame->Strides[1] = sizeof(unsigned short);
+    return (PyObject *) pFrame;
+}
+
+static PyObject *Controller_save(ControllerObject *self, PyObject *args)
+{
+
+    const char *File;
+    if (!PyArg_ParseTuple(args, "s", &File)) return NULL;
+    if (!ControllerReady(self)) return NULL;
+    if (self->Generation == 0) {
+        PyErr_SetString(PyExc_RuntimeError, "There is no image yet.");
+        return NULL;
+    }
+
+    /*Saving an interlaced image de-interlaces the buffer in place*/
+    LeachController &C = *self->pController;
+    bool bWasInterlaced = C.bImageInterlaced;
+    if (bWasInterlaced && self->nExports > 0) {
+        PyErr_SetString(PyExc_BufferError, "Views of the last frame are still alive, saving would de-interlace them in place.");
+        return NULL;
+    }
+
+    std::string sFile(File);
+    self->bBusy = true;
+    bool bFailed = false;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        bFailed = C.SaveFits(sFile) != 0;
+    } catch (...) {
+        bFailed = true;
+    }
+    Py_END_ALLOW_THREADS
+    self->bBusy = false;
+
+    /*Frames made before hold the old layout*/
+    if (C.bImageInterlaced != bWasInterlaced) self->Generation++;
+
+    if (bFailed) {
+        PyErr_SetString(PyExc_RuntimeError, "The FITS file could not be written.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *Controller_readout_time(ControllerObject *self, PyObject *)
+{
+    if (!ControllerReady(self)) return NULL;
+    return PyFloat_FromDouble(self->pController->PredictReadout().FrameTime);
+}
+
+static PyObject *Controller_timers(ControllerObject *self, PyObject *)
+{
+    if (!ControllerOpen(self)) return NULL;
+    const TimeVariables &T = self->pController->ClockTimers;
+    return Py_BuildValue("{s:d,s:d,s:d}", "exposure_ms", T.MeasuredExp, "readout_ms", T.MeasuredReadout,
+                         "predicted_readout_ms", T.PredictedReadout);
+}
+
+static PyMethodDef Controller_methods[] = {
+    {"load_settings", (PyCFunction) Controller_load_settings, METH_NOARGS,
+     "Read the config file. Returns (config changed, sequencer changed) since they were last applied."},
+    {"apply", (PyCFunction) Controller_apply, METH_VARARGS | METH_KEYWORDS,
+     "apply(full=False): send the settings that changed (or all of them). Returns the number sent, -1 for all."},
+    {"apply_sequencer", (PyCFunction) Controller_apply_sequencer, METH_VARARGS,
+     "apply_sequencer([file]): upload the sequencer of the config file, or the one given."},
+    {"startup", (PyCFunction) Controller_startup, METH_NOARGS,
+     "Start the controller up, apply all the settings and start idle clocking."},
+    {"erase", (PyCFunction) Controller_erase, METH_NOARGS, "Run the erase procedure and start idle clocking."},
+    {"idle", (PyCFunction) Controller_idle, METH_NOARGS, "Toggle the idle clocking."},
+    {"get", (PyCFunction) Controller_get, METH_VARARGS,
+     "get(name): a setting by its config file name (vdd, og_lo, IntegralTime, NDCM ...), or rows, cols, ccd_type, amplifier, sequencer."},
+    {"set", (PyCFunction) Controller_set, METH_VARARGS, "set(name, value): change a setting in memory, it is sent by apply()."},
+    {"expose", (PyCFunction) Controller_expose, METH_VARARGS, "expose(seconds): expose and read out the CCD."},
+    {"abort", (PyCFunction) Controller_abort, METH_NOARGS,
+     "Stop the expose() running in another thread. Returns False if there is none."},
+    {"partial_rows", (PyCFunction) Controller_partial_rows, METH_NOARGS,
+     "Rows of the last image if its readout was stopped and the rows were kept, None if it is complete."},
+    {"frame", (PyCFunction) Controller_frame, METH_NOARGS, "The last image as a read-only buffer, valid until the next exposure."},
+    {"save", (PyCFunction) Controller_save, METH_VARARGS, "save(file): process the last image and write it to a FITS file."},
+    {"readout_time", (PyCFunction) Controller_readout_time, METH_NOARGS, "Expected readout time (s) of the next image."},
+    {"timers", (PyCFunction) Controller_timers, METH_NOARGS, "Measured and predicted times of the last exposure."},
+    {NULL, NULL, 0, NULL}
+};
+
+
+/* ---------------------------- Module ---------------------------- */
+
+static PyModuleDef ccddroneModule = {
+    PyModuleDef_HEAD_INIT, "ccddrone", "Python bindings of the CCDDrone controller library.", -1, NULL
+};
+
+PyMODINIT_FUNC PyInit_ccddrone(void)
+{
+
+    ControllerType.tp_basicsize = sizeof(ControllerObject);
+    ControllerType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ControllerType.tp_doc = "Controller(config='config/Config.ini', device=$CCDD_DEVICE): one Leach controller.";
+    ControllerType.tp_new = PyType_GenericNew;
+    ControllerType.tp_init = (initproc) Controller_init;
+    ControllerType.tp_dealloc = (destructor) Controller_dealloc;
+    ControllerType.tp_methods = Controller_methods;
+
+    FrameType.tp_basicsize = sizeof(FrameObject);
+    FrameType.tp_flags = Py_TPFLAGS_DEFAULT;
+    FrameType.tp_doc = "Read-only view of an image in the controller buffers, use numpy.asarray(frame).";
+    FrameType.tp_dealloc = (destructor) Frame_dealloc;
+    FrameType.tp_getset = Frame_getset;
+    FrameType.tp_as_buffer = &Frame_as_buffer;
+
+    if (PyType_Ready(&ControllerType) < 0 || PyType_Ready(&FrameType) < 0) return NULL;
+
+    PyObject *m = PyModule_Create(&ccddroneModule);
+    if (m == NULL) return NULL;
+
+    Py_INCREF(&ControllerType);
+    Py_INCREF(&FrameType);
+    if (PyModule_AddObject(m, "Controller", (PyObject *) &ControllerType) < 0
+        || PyModule_AddObject(m, "Frame", (PyObject *) &FrameType) < 0) {
+        Py_DECREF(&ControllerType);
+        Py_DECREF(&FrameType);
+        Py_DECREF(m);
+        return NULL;
+    }
+
+    return m;
+}
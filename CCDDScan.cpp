@@ -0,0 +1,93 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <sys/stat.h>
+
+
+#include "LeachController.hpp"
+
+
+#define USAGE( x ) \
+            ( std::cout << std::endl << "Usage: ./" << x << " <exp time (s)> <Output file name> <Frames per point> <parameter>=<start>:<stop>:<step> [<parameter>=<v1>,<v2>,... ...]" << std::endl \
+                        << "Example: ./" << x << " 0 /data/Scan.fits 5 vdd=-23:-19:0.5 og_lo=-3,-2.5,-2" << std::endl)
+
+
+
+// ------------------------------------------------------
+//  Main program
+// ------------------------------------------------------
+int main( int argc, char **argv )
+{
+
+    /*Now get the args*/
+    if (argc<5) {
+        std::cout << "Please specify the exposure, output, frames per point and at least one parameter to scan!\n";
+        USAGE(argv[0]);
+        exit( EXIT_FAILURE );
+    }
+
+    ScanSpec Scan;
+    Scan.ExposureTime = atoi(argv[1]);
+    Scan.OutFileName = argv[2];
+    Scan.FramesPerPoint = atoi(argv[3]);
+    if (Scan.FramesPerPoint < 1) {
+        std::cout << "Number of frames per point must be at least 1. Taking a single frame per point.\n";
+        Scan.FramesPerPoint = 1;
+    }
+
+    /* Read the last config file location - this is needed to compare with the file uploaded
+     * and check that it has not changed since the upload. */
+    std::ifstream LastCfgLoc(DeviceStateFile(SelectedDevice(), "LastConfigLocation.txt"), std::fstream::in);
+    std::string LastCfgFile;
+    std::getline(LastCfgLoc, LastCfgFile);
+    LastCfgLoc.close();
+
+    LeachController _ThisRunControllerInstance(LastCfgFile, SelectedDevice());
+
+    /*At the start of the program, log the time*/
+    _ThisRunControllerInstance.ClockTimers.ProgramStart = std::chrono::system_clock::now();
+
+    int nPoints = 1;
+    for (int i = 4; i < argc; i++) {
+        ScanAxis Axis;
+        if (_ThisRunControllerInstance.ParseScanAxis(argv[i], Axis) != 0) {
+            USAGE(argv[0]);
+            return -1;
+        }
+        Scan.Axes.push_back(Axis);
+        nPoints *= (int) Axis.Values.size();
+    }
+
+    /*Check if any of the output files exist. If so, we end the program immediately.*/
+    struct stat buffer;
+    for (int p = 0; p < nPoints; p++) {
+        for (int k = 0; k < Scan.FramesPerPoint; k++) {
+            std::string _FrameName = FrameFileName(FrameFileName(Scan.OutFileName, p), k);
+            if (stat (_FrameName.c_str(), &buffer) == 0){
+                std::cout << "The output file "<< _FrameName <<" already exist. Please specify a different name for the output.\n";
+                return -1;
+            }
+        }
+    }
+
+    /*Check if the settings file has changed in any way*/
+    bool config, sequencer;
+    int _CCDSettingsStatus = _ThisRunControllerInstance.LoadAndCheckForSettingsChange(config, sequencer);
+
+    if (_CCDSettingsStatus == 0){
+
+        std::cout << "Scanning " << nPoints << " points with " << Scan.FramesPerPoint << " frames each.\n";
+        int nDone = _ThisRunControllerInstance.RunParameterScan(Scan);
+        std::cout << nDone << " of " << nPoints << " scan points were taken.\n";
+
+    } else {
+        if (config) std::cout<<"Error: The config file has changed but the new settings were not uploaded.\n";
+        if (sequencer) std::cout<<"Error: The sequencer has changed but it was not uploaded.\n";
+        std::cout<<"The scan was not started. Please resolve the conflicts in the config section first.\n";
+    }
+
+    printf("CCDDrone done. Thank you.\n");
+}
@@ -0,0 +1,506 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "LeachController.hpp"
+
+
+#define USAGE( x ) \
+            ( std::cout << std::endl << "Usage: ./" << x << " [config file: Default=config/Config.ini] [--socket <path> | --tcp <port>] [--device <PCIe board>]" \
+                        << " [--preset <name>=<config file> ...]" << std::endl \
+                        << "Default socket: do_not_touch/ccddrone.sock (do_not_touch/devN/ccddrone.sock for board N)" << std::endl)
+
+
+/* *********************************************************************
+ * CCDDServer keeps a single LeachController open and takes requests
+ * over a Unix (or TCP) socket, so automation does not pay for opening
+ * the device, parsing and hashing the config on every frame.
+ *
+ * The protocol is one command per line, and every command gets a one
+ * line reply starting with OK or ERR:
+ *   EXPOSE <exp time (s)> <output file> [frames]
+ *   ABORT                   - stop the exposure that is running, sent on the
+ *                             same connection while EXPOSE has not replied
+ *   APPLY [config file] [full] - same as CCDDApplyNewSettings
+ *   PRESET LOAD <name> <config file> - parse a config file once and keep it
+ *   PRESET USE <name>       - switch to a preset, sending only what differs
+ *   PRESET LIST | DROP <name>
+ *   ERASE                   - same as CCDDPerformEraseProcedure
+ *   STARTUP                 - same as CCDDStartupAndErase
+ *   IDLE                    - switch idle clocking on
+ *   STATUS                  - settings and the last exposure
+ *   STATS [file] [reset]    - command statistics as JSON, or to a file
+ *   QUIT                    - close this connection
+ *   SHUTDOWN                - stop the server
+ *
+ * SIGUSR1 also stops the exposure that is running, SIGINT and SIGTERM
+ * stop it and then the server. The rows read are saved if [output]
+ * SavePartial is on, and EXPOSE replies ERR either way.
+ * *********************************************************************
+ */
+
+static volatile sig_atomic_t bShutdown = 0;
+static LeachController *pServerController = NULL;
+static void HandleSignal(int )
+{
+    bShutdown = 1;
+    if (pServerController != NULL) pServerController->AbortExposure();
+}
+static void HandleAbortSignal(int )
+{
+    if (pServerController != NULL) pServerController->AbortExposure();
+}
+
+/*Without SA_RESTART, so that a signal gets the server out of a blocking accept() or read()*/
+static void InstallHandler(int Signal, void (*Handler)(int ), bool bRestart)
+{
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = Handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = bRestart ? SA_RESTART : 0;
+    sigaction(Signal, &sa, NULL);
+}
+
+
+/*State of the server between requests*/
+struct ServerState{
+    std::string LastOutput;
+    int nExposures = 0;
+    bool bSettingsApplied = false;
+};
+
+
+static std::string HandleExpose(LeachController &Controller, ServerState &State, std::istringstream &Args)
+{
+
+    int ExposeSeconds = -1, nFrames = 1;
+    std::string OutFileName;
+    Args >> ExposeSeconds >> OutFileName;
+    if (ExposeSeconds < 0 || OutFileName.empty()) return "ERR usage: EXPOSE <exp time (s)> <output file> [frames]";
+    if (!(Args >> nFrames) || nFrames < 1) nFrames = 1;
+
+    if (!State.bSettingsApplied) return "ERR the config file has changed but the new settings were not applied. Send APPLY first.";
+
+    struct stat buffer;
+    for (int k = 0; k < nFrames; k++) {
+        std::string _FrameName = (nFrames == 1) ? OutFileName : FrameFileName(OutFileName, k);
+        if (stat (_FrameName.c_str(), &buffer) == 0) return "ERR output file " + _FrameName + " already exists";
+    }
+
+    Controller.ClockTimers.ProgramStart = std::chrono::system_clock::now();
+    Controller.CCDParams.fExpTime = ExposeSeconds;
+    if (Controller.CCDParams.CCDType=="DES") Controller.CCDParams.nSkipperR=1;
+
+    int nDone;
+    if (nFrames > 1) {
+        nDone = Controller.ExposeMultipleFrames(ExposeSeconds, nFrames, OutFileName);
+    } else {
+        Controller.ClockTimers.isReadout = false;
+        Controller.ClockTimers.isExp = false;
+        Controller.ClockTimers.rClockCounter = 0;
+
+        nDone = 0;
+        if (Controller.PrepareAndExposeCCD(ExposeSeconds, NULL) == 0 && Controller.SaveFits(OutFileName) == 0) nDone = 1;
+    }
+
+    State.LastOutput = OutFileName;
+    State.nExposures += nDone;
+
+    if (Controller.PartialRows >= 0)
+        return "ERR " + std::to_string(nDone) + " of " + std::to_string(nFrames) + " frames taken, the last one has "
+               + std::to_string(Controller.PartialRows) + " of " + std::to_string(Controller.CCDParams.dRows) + " rows: " + Controller.AbortReason;
+    if (!Controller.AbortReason.empty())
+        return "ERR " + std::to_string(nDone) + " of " + std::to_string(nFrames) + " frames taken: " + Controller.AbortReason;
+    if (nDone != nFrames) return "ERR " + std::to_string(nDone) + " of " + std::to_string(nFrames) + " frames taken";
+    return "OK " + std::to_string(nDone) + " frames taken";
+}
+
+
+static std::string HandleApply(LeachController &Controller, ServerState &State, std::istringstream &Args)
+{
+
+    std::string Arg;
+    bool bFullApply = false;
+    while (Args >> Arg) {
+        if (Arg == "full" || Arg == "FULL") bFullApply = true;
+        else Controller.INIFileLoc = Arg;
+    }
+
+    bool config, sequencer;
+    Controller.LoadAndCheckForSettingsChange(config, sequencer);
+
+    if (sequencer){
+        std::cout<<"Applying new sequencer.\n";
+        Controller.ApplyNewSequencer(Controller.CCDParams.sTimFile);
+    }
+
+    std::cout<<"Applying biases and clocks.\n";
+    int nSent = -1;
+    if (bFullApply) {
+        Controller.ApplyAllCCDBasic();
+        Controller.ApplyAllBiasVoltages();
+        Controller.ApplyAllCCDClocks();
+    } else {
+        nSent = Controller.ApplyChangedSettings();
+    }
+    Controller.CopyOldAndStoreFileHashes();
+    Controller.IdleClockToggle();
+    Controller.CurrentPreset.clear();
+
+    State.bSettingsApplied = true;
+    std::string Sent = (nSent < 0) ? "all settings" : std::to_string(nSent) + " changed settings";
+    return std::string("OK ") + Sent + " from " + Controller.INIFileLoc + " applied" + (sequencer ? " with a new sequencer" : "");
+}
+
+
+static std::string HandlePreset(LeachController &Controller, ServerState &State, std::istringstream &Args)
+{
+
+    std::string Sub, Name, FileName;
+    Args >> Sub >> Name >> FileName;
+    for (char &c : Sub) c = (char) toupper(c);
+
+    if (Sub == "LOAD") {
+        if (Name.empty() || FileName.empty()) return "ERR usage: PRESET LOAD <name> <config file>";
+        if (Controller.LoadPreset(Name, FileName) != 0) return "ERR preset " + Name + " could not be loaded from " + FileName;
+        return "OK preset " + Name + " loaded from " + FileName;
+    }
+
+    if (Sub == "USE") {
+        if (Name.empty()) return "ERR usage: PRESET USE <name>";
+        int nSent;
+        bool sequencer;
+        if (Controller.SwitchPreset(Name, nSent, sequencer) != 0) return "ERR there is no preset " + Name;
+        Controller.IdleClockToggle();
+        State.bSettingsApplied = true;
+        std::string Sent = (nSent < 0) ? "all settings" : std::to_string(nSent) + " changed settings";
+        return "OK preset " + Name + ": " + Sent + " applied" + (sequencer ? " with a new sequencer" : "");
+    }
+
+    if (Sub == "LIST") {
+        std::string Reply = "OK";
+        for (const std::string &n : Controller.PresetNames())
+            Reply += " " + n + (n == Controller.CurrentPreset ? "*" : "");
+        return Reply;
+    }
+
+    if (Sub == "DROP") {
+        if (!Controller.DropPreset(Name)) return "ERR there is no preset " + Name;
+        return "OK preset " + Name + " dropped";
+    }
+
+    return "ERR usage: PRESET LOAD <name> <config file> | USE <name> | LIST | DROP <name>";
+}
+
+
+static std::string HandleStartup(LeachController &Controller, ServerState &State)
+{
+
+    bool config, sequencer;
+    Controller.LoadAndCheckForSettingsChange(config, sequencer);
+
+    std::cout<<"Starting up the controller.\n";
+    Controller.StartupController();
+
+    std::cout<<"Applying biases and clocks.\n";
+    Controller.ApplyAllCCDBasic();
+    Controller.ApplyAllBiasVoltages();
+    Controller.ApplyAllCCDClocks();
+
+    Controller.IdleClockToggle();
+    Controller.PerformEraseProcedure([&Controller]() { Controller.CopyOldAndStoreFileHashes(); });
+
+    State.bSettingsApplied = true;
+    return "OK controller started and erased";
+}
+
+
+static std::string HandleStatus(LeachController &Controller, ServerState &State)
+{
+
+    std::ostringstream Reply;
+    Reply << "OK config=" << Controller.INIFileLoc
+          << " applied=" << (State.bSettingsApplied ? 1 : 0)
+          << " preset=" << (Controller.CurrentPreset.empty() ? "-" : Controller.CurrentPreset)
+          << " type=" << Controller.CCDParams.CCDType
+          << " rows=" << Controller.CCDParams.dRows
+          << " cols=" << Controller.CCDParams.dCols
+          << " ndcm=" << Controller.CCDParams.nSkipperR
+          << " exposures=" << State.nExposures
+          << " last=" << (State.LastOutput.empty() ? "-" : State.LastOutput)
+          << " mexp=" << Controller.ClockTimers.MeasuredExp
+          << " mread=" << Controller.ClockTimers.MeasuredReadout;
+    return Reply.str();
+}
+
+
+/*STATS [file] [reset]: the command counters as one line of JSON, or written to a file*/
+static std::string HandleStats(LeachController &Controller, std::istringstream &Args)
+{
+
+    std::string Arg, FileName;
+    bool bReset = false;
+    while (Args >> Arg) {
+        if (Arg == "reset") bReset = true;
+        else FileName = Arg;
+    }
+
+    std::string Reply;
+    if (FileName.empty()) Reply = "OK " + Controller.CmdStats.ToJSON();
+    else if (Controller.CmdStats.DumpJSON(FileName) == 0) Reply = "OK command statistics written to " + FileName;
+    else return "ERR could not write " + FileName;
+
+    if (bReset) Controller.CmdStats.Clear();
+    return Reply;
+}
+
+
+/*Run one command line. Sets bCloseConnection / bShutdown for QUIT / SHUTDOWN.*/
+static std::string HandleCommand(LeachController &Controller, ServerState &State, const std::string &Line, bool &bCloseConnection)
+{
+
+    std::istringstream Args(Line);
+    std::string Cmd;
+    Args >> Cmd;
+    for (char &c : Cmd) c = (char) toupper(c);
+
+    try {
+        if (Cmd == "EXPOSE") return HandleExpose(Controller, State, Args);
+        if (Cmd == "APPLY") return HandleApply(Controller, State, Args);
+        if (Cmd == "PRESET") return HandlePreset(Controller, State, Args);
+        if (Cmd == "STARTUP") return HandleStartup(Controller, State);
+        if (Cmd == "ERASE") {
+            Controller.PerformEraseProcedure();
+            Controller.IdleClockToggle();
+            return "OK erase procedure performed";
+        }
+        if (Cmd == "IDLE") {
+            Controller.IdleClockToggle();
+            return "OK idle clocking toggled";
+        }
+        if (Cmd == "ABORT") return "ERR there is no exposure to abort";
+        if (Cmd == "STATUS") return HandleStatus(Controller, State);
+        if (Cmd == "STATS") return HandleStats(Controller, Args);
+        if (Cmd == "QUIT") {
+            bCloseConnection = true;
+            return "OK bye";
+        }
+        if (Cmd == "SHUTDOWN") {
+            bCloseConnection = true;
+            bShutdown = 1;
+            return "OK shutting down";
+        }
+    } catch (std::exception &e) {
+        return std::string("ERR ") + e.what();
+    } catch (...) {
+        return "ERR unknown exception while running " + Cmd;
+    }
+
+    if (Cmd.empty()) return "ERR empty command";
+    return "ERR unknown command " + Cmd;
+}
+
+
+/*While an exposure runs, the connection is still read so that ABORT can stop it. The other
+ *commands that arrive are left in Pending for after the exposure.*/
+static void WatchForAbort(LeachController &Controller, int ClientFd, std::string &Pending, const std::atomic<bool> &bDone)
+{
+
+    char Buf[1024];
+    while (!bDone) {
+        struct pollfd p;
+        p.fd = ClientFd;
+        p.events = POLLIN;
+        p.revents = 0;
+        if (poll(&p, 1, 50) <= 0) continue;
+
+        ssize_t n = read(ClientFd, Buf, sizeof(Buf));
+        if (n <= 0) return;
+        Pending.append(Buf, n);
+
+        std::string Kept;
+        std::string::size_type Start = 0, nl;
+        while ((nl = Pending.find('\n', Start)) != std::string::npos) {
+            std::string Line = Pending.substr(Start, nl - Start);
+            if (!Line.empty() && Line.back() == '\r') Line.pop_back();
+            for (char &c : Line) c = (char) toupper(c);
+            if (Line == "ABORT") {
+                std::cout << "\n> ABORT\n";
+                Controller.AbortExposure();
+                std::string Reply = "OK abort requested\n";
+                std::cout << "< " << Reply;
+                if (write(ClientFd, Reply.c_str(), Reply.size()) < 0) return;
+            }
+            else Kept += Pending.substr(Start, nl - Start + 1);
+            Start = nl + 1;
+        }
+        Pending = Kept + Pending.substr(Start);
+    }
+
+}
+
+
+static int OpenListeningSocket(const std::string &SocketPath, int TcpPort)
+{
+
+    int fd;
+    if (TcpPort > 0) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons((unsigned short) TcpPort);
+        if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+            std::cout << "Could not bind to TCP port " << TcpPort << ": " << strerror(errno) << "\n";
+            return -1;
+        }
+    } else {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        struct sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, SocketPath.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(SocketPath.c_str());
+        if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+            std::cout << "Could not bind to " << SocketPath << ": " << strerror(errno) << "\n";
+            return -1;
+        }
+    }
+
+    if (listen(fd, 4) != 0) {
+        std::cout << "Could not listen on the socket: " << strerror(errno) << "\n";
+        return -1;
+    }
+    return fd;
+}
+
+
+// ------------------------------------------------------
+//  Main program
+// ------------------------------------------------------
+int main( int argc, char **argv )
+{
+
+    std::string configFileName = "config/Config.ini";
+    std::string SocketPath = "";
+    int TcpPort = 0;
+    int DeviceIndex = SelectedDevice();
+    std::vector<std::string> PresetArgs;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i+1 < argc) SocketPath = argv[++i];
+        else if (arg == "--device" && i+1 < argc) DeviceIndex = atoi(argv[++i]);
+        else if (arg == "--tcp" && i+1 < argc) TcpPort = atoi(argv[++i]);
+        else if (arg == "--preset" && i+1 < argc) PresetArgs.push_back(argv[++i]);
+        else if (arg == "--help") { USAGE(argv[0]); return 0; }
+        else configFileName = arg;
+    }
+
+    if (SocketPath.empty()) SocketPath = DeviceStateFile(DeviceIndex, "ccddrone.sock");
+
+    LeachController _ThisRunControllerInstance(configFileName, DeviceIndex);
+    pServerController = &_ThisRunControllerInstance;
+
+    InstallHandler(SIGINT, HandleSignal, false);
+    InstallHandler(SIGTERM, HandleSignal, false);
+    InstallHandler(SIGUSR1, HandleAbortSignal, true);
+    signal(SIGPIPE, SIG_IGN);
+    ServerState State;
+
+    /*Nobody else should be applying settings while the server runs, so the digests can stay in memory*/
+    _ThisRunControllerInstance.HashCache.SetBackingFile("");
+
+    /*The server only exposes with settings it knows are on the controller*/
+    bool config, sequencer;
+    int _CCDSettingsStatus = _ThisRunControllerInstance.LoadAndCheckForSettingsChange(config, sequencer);
+    State.bSettingsApplied = (_CCDSettingsStatus == 0);
+    if (config) std::cout<<"Warning: The config file has changed but the new settings were not uploaded. Send APPLY.\n";
+    if (sequencer) std::cout<<"Warning: The sequencer has changed but it was not uploaded. Send APPLY.\n";
+
+    /*Presets given on the command line are parsed now, so the first switch is as fast as the others*/
+    for (const std::string &p : PresetArgs) {
+        std::string::size_type eq = p.find('=');
+        if (eq == std::string::npos || eq == 0) {
+            std::cout << "Warning: --preset must be <name>=<config file>, " << p << " is ignored.\n";
+            continue;
+        }
+        _ThisRunControllerInstance.LoadPreset(p.substr(0, eq), p.substr(eq + 1));
+    }
+
+    int ListenFd = OpenListeningSocket(SocketPath, TcpPort);
+    if (ListenFd < 0) return -1;
+
+    if (TcpPort > 0) std::cout << "CCDDServer listening on 127.0.0.1:" << TcpPort << "\n";
+    else std::cout << "CCDDServer listening on " << SocketPath << "\n";
+
+    while (!bShutdown) {
+
+        int ClientFd = accept(ListenFd, NULL, NULL);
+        if (ClientFd < 0) {
+            if (errno == EINTR) continue;
+            std::cout << "accept failed: " << strerror(errno) << "\n";
+            break;
+        }
+
+        /*One client at a time: the controller can only do one thing at once anyway*/
+        std::string Pending;
+        bool bCloseConnection = false;
+        char Buf[1024];
+
+        while (!bCloseConnection && !bShutdown) {
+            ssize_t n = read(ClientFd, Buf, sizeof(Buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            Pending.append(Buf, n);
+
+            std::string::size_type nl;
+            while (!bCloseConnection && (nl = Pending.find('\n')) != std::string::npos) {
+                std::string Line = Pending.substr(0, nl);
+                Pending.erase(0, nl + 1);
+                if (!Line.empty() && Line.back() == '\r') Line.pop_back();
+
+                std::cout << "\n> " << Line << "\n";
+                std::string Cmd = Line.substr(0, Line.find(' '));
+                for (char &c : Cmd) c = (char) toupper(c);
+                std::atomic<bool> bCommandDone(false);
+                std::thread Watcher;
+                if (Cmd == "EXPOSE")
+                    Watcher = std::thread(WatchForAbort, std::ref(_ThisRunControllerInstance), ClientFd, std::ref(Pending), std::cref(bCommandDone));
+                std::string Reply = HandleCommand(_ThisRunControllerInstance, State, Line, bCloseConnection) + "\n";
+                bCommandDone = true;
+                if (Watcher.joinable()) Watcher.join();
+                std::cout << "< " << Reply;
+                if (write(ClientFd, Reply.c_str(), Reply.size()) < 0) bCloseConnection = true;
+            }
+        }
+
+        close(ClientFd);
+    }
+
+    close(ListenFd);
+    if (TcpPort <= 0) unlink(SocketPath.c_str());
+
+    printf("CCDDrone server done. Thank you.\n");
+    return 0;
+}
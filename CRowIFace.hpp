@@ -0,0 +1,35 @@
+/* *********************************************************************
+ * Row listener interface for streaming processing during readout.
+ * ExposeCCD calls RowsCallback every time the pixel count moves past
+ * one or more complete rows of the common buffer, so that consumers
+ * (deinterlace, NDCM reduction, file output ...) can work on the image
+ * while the rest of it is still being clocked out.
+ *
+ * The rows are handed over as they sit in the common buffer, i.e. before
+ * any de-interlacing. A row is dCols * nSkipperR pixels wide.
+ * The callbacks run on the thread that polls the controller, so anything
+ * expensive should be handed off to another thread.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_CROWIFACE_HPP
+#define CCDDRONE_CROWIFACE_HPP
+
+
+class CRowIFace
+{
+public:
+    virtual ~CRowIFace() {}
+
+    /*Called once readout begins, before the first row arrives*/
+    virtual void ReadoutStarted( int /*dRows*/, int /*dRowWidth*/ ) {}
+
+    /*nRows complete rows starting at dFirstRow. pRows points to the first of them.*/
+    virtual void RowsCallback( const unsigned short *pRows, int dFirstRow, int nRows, int dRowWidth ) = 0;
+
+    /*Called after the last row has been delivered*/
+    virtual void ReadoutFinished( void ) {}
+};
+
+
+#endif //CCDDRONE_CROWIFACE_HPP
@@ -0,0 +1,191 @@
+/* *********************************************************************
+ * This file contains the calibration of the reduced images. See
+ * Calibration.hpp for a description.
+ * *********************************************************************
+ */
+
+#include <iostream>
+#include <algorithm>
+
+#include "fitsio.h"
+#include "Calibration.hpp"
+#include "UtilityFunctions.hpp"
+
+
+/*Read the image of a master file into Pixels. Returns 0 on success, -1 otherwise.*/
+static int ReadMasterImage(const std::string &FileName, std::vector<float> &Pixels, long &dCols, long &dRows)
+{
+
+    fitsfile *fptr;
+    int status = 0;
+    fits_open_file(&fptr, FileName.c_str(), READONLY, &status);
+    if (status) {
+        fits_report_error(stderr, status);
+        return -1;
+    }
+
+    /*CCDDrone files have the reduced image in the MEAN HDU, which may not be the primary one*/
+    fits_movnam_hdu(fptr, IMAGE_HDU, (char*) "MEAN", 0, &status);
+    if (status) {
+        status = 0;
+        int hdutype;
+        fits_movabs_hdu(fptr, 1, &hdutype, &status);
+    }
+
+    long Size[2] = { 0, 0 };
+    fits_get_img_size(fptr, 2, Size, &status);
+    if (status == 0 && Size[0] > 0 && Size[1] > 0) {
+        Pixels.resize((size_t) Size[0] * Size[1]);
+        int anynul = 0;
+        float nulval = 0;
+        fits_read_img(fptr, TFLOAT, 1, (LONGLONG) Pixels.size(), &nulval, Pixels.data(), &anynul, &status);
+    }
+    else if (status == 0) {
+        std::cout << FileName << " has no image.\n";
+        status = -1;
+    }
+
+    int closeStatus = 0;
+    fits_close_file(fptr, &closeStatus);
+    if (status) {
+        if (status > 0) fits_report_error(stderr, status);
+        return -1;
+    }
+
+    dCols = Size[0];
+    dRows = Size[1];
+    return 0;
+
+}
+
+
+std::shared_ptr<const CalibrationMasters> LoadCalibrationMasters(const std::string &BiasFile, const std::string &DarkFile)
+{
+
+    if (BiasFile.empty() && DarkFile.empty()) return NULL;
+
+    std::shared_ptr<CalibrationMasters> Masters(new CalibrationMasters);
+    Masters->BiasFile = BiasFile;
+    Masters->DarkFile = DarkFile;
+
+    long dCols = 0, dRows = 0;
+    if (!BiasFile.empty()) {
+        if (ReadMasterImage(BiasFile, Masters->Bias, dCols, dRows) != 0) {
+            std::cout << "Could not read the master bias " << BiasFile << ".\n";
+            return NULL;
+        }
+        Masters->dCols = dCols;
+        Masters->dRows = dRows;
+    }
+    if (!DarkFile.empty()) {
+        if (ReadMasterImage(DarkFile, Masters->Dark, dCols, dRows) != 0) {
+            std::cout << "Could not read the master dark " << DarkFile << ".\n";
+            return NULL;
+        }
+        if (!Masters->Bias.empty() && (dCols != Masters->dCols || dRows != Masters->dRows)) {
+            std::cout << "The master bias and dark are not the same size.\n";
+            return NULL;
+        }
+        Masters->dCols = dCols;
+        Masters->dRows = dRows;
+    }
+
+    std::cout << "Loaded calibration masters of " << Masters->dCols << " x " << Masters->dRows << ".\n";
+    return Masters;
+
+}
+
+
+void SubtractRowPedestal(float *pImage, int nRows, int dCols, int dFirstCol, int dEndCol,
+                         int dFirstOver, int nOver, bool bMedian)
+{
+
+    if (nOver <= 0) return;
+    std::vector<float> Overscan(nOver);
+
+    for (int r = 0; r < nRows; r++) {
+
+        float *pRow = pImage + (size_t) r * dCols;
+        float fPedestal;
+
+        if (bMedian) {
+            std::copy(pRow + dFirstOver, pRow + dFirstOver + nOver, Overscan.begin());
+            std::nth_element(Overscan.begin(), Overscan.begin() + nOver/2, Overscan.end());
+            fPedestal = Overscan[nOver/2];
+            if (nOver % 2 == 0) {
+                float fLower = *std::max_element(Overscan.begin(), Overscan.begin() + nOver/2);
+                fPedestal = 0.5f * (fPedestal + fLower);
+            }
+        } else {
+            float fSum = 0;
+            for (int c = dFirstOver; c < dFirstOver + nOver; c++) fSum += pRow[c];
+            fPedestal = fSum / nOver;
+        }
+
+        /*Plain loop so that the compiler can vectorize it*/
+        for (int c = dFirstCol; c < dEndCol; c++) pRow[c] -= fPedestal;
+    }
+
+}
+
+
+bool CalibrateFrame(FrameRecord &Frame)
+{
+
+    const ProcessingVariables &P = Frame.ProcParams;
+    bool bPedestal = P.OverscanSubtraction != "none";
+    const CalibrationMasters *pMasters = Frame.Masters.get();
+
+    Frame.bPedestalSubtracted = false;
+    Frame.bMastersSubtracted = false;
+    if (Frame.MeanPixels.empty() || (!bPedestal && pMasters == NULL)) return false;
+
+    int dCols = Frame.CCDParams.dCols;
+    int dRows = Frame.CCDParams.dRows;
+    float *pImage = Frame.MeanPixels.data();
+
+    /*The overscan is what each amplifier reads last: the end of the row, or the middle of the
+     *row for UL since the L half is mirrored*/
+    int nOver = P.OverscanCols >= 0 ? P.OverscanCols : Frame.RoiParams.OverscanReadCols;
+    bool bUL = Frame.CCDParams.AmplifierDirection == "UL";
+    int dHalf = dCols / 2;
+    if (bPedestal && (nOver <= 0 || nOver > (bUL ? dHalf : dCols))) {
+        std::cout << "No usable overscan columns (" << nOver << "). The pedestal is not subtracted.\n";
+        bPedestal = false;
+    }
+
+    if (pMasters != NULL && (pMasters->dCols != dCols || pMasters->dRows != dRows)) {
+        std::cout << "The calibration masters are " << pMasters->dCols << " x " << pMasters->dRows << " but the image is "
+                  << dCols << " x " << dRows << ". They are not subtracted.\n";
+        pMasters = NULL;
+    }
+    if (!bPedestal && pMasters == NULL) return false;
+
+    bool bMedian = P.OverscanSubtraction == "median";
+    float fDarkScale = (float) (Frame.ClockTimers.MeasuredExp / 1000.0);
+    const float *pBias = (pMasters != NULL && !pMasters->Bias.empty()) ? pMasters->Bias.data() : NULL;
+    const float *pDark = (pMasters != NULL && !pMasters->Dark.empty()) ? pMasters->Dark.data() : NULL;
+
+    ParallelForRows(dRows, P.ProcessingThreads, [=](int dFirstRow, int dEndRow) {
+        float *pRows = pImage + (size_t) dFirstRow * dCols;
+        int nRows = dEndRow - dFirstRow;
+
+        if (bPedestal) {
+            if (bUL) {
+                SubtractRowPedestal(pRows, nRows, dCols, 0, dHalf, dHalf - nOver, nOver, bMedian);
+                SubtractRowPedestal(pRows, nRows, dCols, dHalf, dCols, dHalf, nOver, bMedian);
+            }
+            else SubtractRowPedestal(pRows, nRows, dCols, 0, dCols, dCols - nOver, nOver, bMedian);
+        }
+
+        size_t dFirst = (size_t) dFirstRow * dCols;
+        size_t nPix = (size_t) nRows * dCols;
+        if (pBias != NULL) for (size_t i = 0; i < nPix; i++) pRows[i] -= pBias[dFirst + i];
+        if (pDark != NULL) for (size_t i = 0; i < nPix; i++) pRows[i] -= fDarkScale * pDark[dFirst + i];
+    });
+
+    Frame.bPedestalSubtracted = bPedestal;
+    Frame.bMastersSubtracted = pMasters != NULL;
+    return true;
+
+}
@@ -0,0 +1,47 @@
+/* *********************************************************************
+ * Calibration of the reduced (MEAN) image before it is written: the
+ * pedestal of every row is taken from the overscan columns of each
+ * amplifier and subtracted, then the master bias and the master dark
+ * (scaled to the exposure time) are subtracted if they are loaded.
+ * The raw samples and the RMS image are left as they are.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_CALIBRATION_HPP
+#define CCDDRONE_CALIBRATION_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "CCDControlDataTypes.hpp"
+
+
+/*Master frames held in memory and shared by all the frames taken with them*/
+struct CalibrationMasters{
+
+    std::string BiasFile;
+    std::string DarkFile;
+    long dCols = 0;
+    long dRows = 0;
+    std::vector<float> Bias;    //ADU, empty if there is no master bias
+    std::vector<float> Dark;    //ADU per second of exposure, empty if there is no master dark
+
+};
+
+
+/*Read the master bias and dark. Each can be empty. A file written by CCDDrone is read from its MEAN
+ *HDU, any other from its first image HDU. Returns NULL if neither is given or a file cannot be read.*/
+std::shared_ptr<const CalibrationMasters> LoadCalibrationMasters(const std::string &BiasFile, const std::string &DarkFile);
+
+/*Subtract the mean or median of the columns [dFirstOver, dFirstOver+nOver) from the columns [dFirstCol, dEndCol)
+ *of each of the nRows rows of a dCols wide image*/
+void SubtractRowPedestal(float *pImage, int nRows, int dCols, int dFirstCol, int dEndCol,
+                         int dFirstOver, int nOver, bool bMedian);
+
+/*Calibrate the MeanPixels of a reduced frame as its ProcParams ask for, with the masters of the frame.
+ *Returns true if anything was done.*/
+bool CalibrateFrame(FrameRecord & );
+
+
+#endif //CCDDRONE_CALIBRATION_HPP
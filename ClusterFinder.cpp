@@ -0,0 +1,315 @@
+/* *********************************************************************
+ * This file contains the streaming cluster finder. See ClusterFinder.hpp
+ * for a description.
+ * *********************************************************************
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "ClusterFinder.hpp"
+
+/*Median absolute deviation of a gaussian to its sigma*/
+#define MAD_TO_SIGMA 1.4826
+
+
+void ClusterFinder::Configure(int dCols, int nSamples, int nDiscard, const std::string &AmplifierDirection,
+                              double SeedSigma, double PixelSigma, int MaxPixels)
+{
+    this->dCols = dCols > 0 ? dCols : 1;
+    this->nSamples = nSamples > 0 ? nSamples : 1;
+    this->nDiscard = nDiscard > 0 && nDiscard < this->nSamples ? nDiscard : 0;
+    this->nAmps = AmplifierDirection == "UL" ? 2 : 1;
+    this->SeedSigma = SeedSigma;
+    this->PixelSigma = PixelSigma;
+    this->MaxPixels = MaxPixels > 0 ? MaxPixels : 1;
+}
+
+
+void ClusterFinder::ReadoutStarted(int dRows, int dRowWidth)
+{
+
+    /*The samples of a UL row alternate U, L. The L half ends up mirrored on the right.*/
+    this->ColumnPixel.resize(dRowWidth);
+    this->ColumnUsed.resize(dRowWidth);
+    for (int i = 0; i < dRowWidth; i++) {
+        int dPixel, dSample;
+        if (this->nAmps == 2) {
+            int dInAmp = i / 2;
+            dSample = dInAmp % this->nSamples;
+            dPixel = i % 2 == 0 ? dInAmp / this->nSamples : this->dCols - 1 - dInAmp / this->nSamples;
+        } else {
+            dSample = i % this->nSamples;
+            dPixel = i / this->nSamples;
+        }
+        if (dPixel >= this->dCols) dPixel = this->dCols - 1;
+        if (dPixel < 0) dPixel = 0;
+        this->ColumnPixel[i] = dPixel;
+        this->ColumnUsed[i] = dSample >= this->nDiscard;
+    }
+    this->nUsedSamples = this->nSamples - this->nDiscard;
+
+    this->Sums.assign(this->dCols, 0);
+    this->Row.assign(this->dCols, 0);
+    this->Scratch.reserve(this->dCols);
+    for (int a = 0; a < 2; a++) {
+        this->NoiseSum[a] = 0;
+        this->nNoiseRows[a] = 0;
+    }
+
+    this->Open.clear();
+    this->Parent.clear();
+    this->LastRow.clear();
+    this->Seeded.clear();
+    this->FreeIds.clear();
+    this->Merged.clear();
+    this->PrevLabel.assign(this->dCols, -1);
+    this->CurLabel.assign(this->dCols, -1);
+
+    this->Table = std::make_shared<ClusterTable>();
+    this->Table->dCols = this->dCols;
+    this->Table->dRows = dRows;
+    this->Table->nAmps = this->nAmps;
+    this->Table->nSamples = this->nUsedSamples;
+    this->Table->SeedSigma = this->SeedSigma;
+    this->Table->PixelSigma = this->PixelSigma;
+    this->Table->Rows.reserve(dRows > 0 ? dRows : 0);
+    this->RowsSeen = 0;
+    this->LastRowSeen = -1;
+
+}
+
+
+void ClusterFinder::RowsCallback(const unsigned short *pRows, int dFirstRow, int nRows, int dRowWidth)
+{
+
+    if (!this->Table || (int) this->ColumnPixel.size() != dRowWidth) return;
+
+    for (int r = 0; r < nRows; r++)
+        this->ProcessRow(pRows + (size_t) r * dRowWidth, dFirstRow + r);
+
+    this->RowsSeen += nRows;
+
+}
+
+
+void ClusterFinder::ReadoutFinished(void )
+{
+    if (this->Table) this->CloseFinished(this->LastRowSeen + 1, true);
+}
+
+
+std::shared_ptr<const ClusterTable> ClusterFinder::TakeTable(void )
+{
+    this->ReadoutFinished();
+    std::shared_ptr<const ClusterTable> Done = this->Table;
+    this->Table.reset();
+    return Done;
+}
+
+
+int ClusterFinder::Find(int Id)
+{
+    while (this->Parent[Id] != Id) {
+        this->Parent[Id] = this->Parent[this->Parent[Id]];
+        Id = this->Parent[Id];
+    }
+    return Id;
+}
+
+
+int ClusterFinder::NewCluster(void )
+{
+
+    int Id;
+    if (!this->FreeIds.empty()) {
+        Id = this->FreeIds.back();
+        this->FreeIds.pop_back();
+    } else {
+        Id = (int) this->Open.size();
+        this->Open.emplace_back();
+        this->Parent.push_back(Id);
+        this->LastRow.push_back(-1);
+        this->Seeded.push_back(0);
+    }
+    this->Open[Id] = ClusterEvent();
+    this->Parent[Id] = Id;
+    this->Seeded[Id] = 0;
+    return Id;
+
+}
+
+
+/*Merge two clusters that met in the current row. The smaller one goes into the larger one, which is
+ *returned; the smaller id stays reserved until the row is done, since labels of it may be left.*/
+int ClusterFinder::Join(int a, int b)
+{
+
+    if (this->Open[a].nPixels < this->Open[b].nPixels) std::swap(a, b);
+    ClusterEvent &A = this->Open[a];
+    ClusterEvent &B = this->Open[b];
+
+    A.XMin = std::min(A.XMin, B.XMin);
+    A.XMax = std::max(A.XMax, B.XMax);
+    A.YMin = std::min(A.YMin, B.YMin);
+    A.YMax = std::max(A.YMax, B.YMax);
+    A.nPixels += B.nPixels;
+    A.Charge += B.Charge;
+    A.XMean += B.XMean;
+    A.YMean += B.YMean;
+    A.MaxValue = std::max(A.MaxValue, B.MaxValue);
+    A.bTruncated = A.bTruncated || B.bTruncated;
+
+    size_t nKeep = std::min(B.X.size(), (size_t) this->MaxPixels - std::min(A.X.size(), (size_t) this->MaxPixels));
+    if (nKeep < B.X.size()) A.bTruncated = true;
+    A.X.insert(A.X.end(), B.X.begin(), B.X.begin() + nKeep);
+    A.Y.insert(A.Y.end(), B.Y.begin(), B.Y.begin() + nKeep);
+    A.Value.insert(A.Value.end(), B.Value.begin(), B.Value.begin() + nKeep);
+
+    this->LastRow[a] = std::max(this->LastRow[a], this->LastRow[b]);
+    this->LastRow[b] = -1;
+    this->Seeded[a] |= this->Seeded[b];
+    this->Parent[b] = a;
+    this->Open[b] = ClusterEvent();
+    this->Merged.push_back(b);
+    return a;
+
+}
+
+
+void ClusterFinder::AddPixel(int Id, int x, int y, float v, bool bSeed)
+{
+
+    ClusterEvent &E = this->Open[Id];
+    if (E.nPixels == 0) {
+        E.XMin = E.XMax = x;
+        E.YMin = E.YMax = y;
+        E.MaxValue = v;
+    }
+    E.XMin = std::min(E.XMin, x);
+    E.XMax = std::max(E.XMax, x);
+    E.YMax = std::max(E.YMax, y);
+    E.MaxValue = std::max(E.MaxValue, v);
+    E.nPixels++;
+    E.Charge += v;
+    /*Charge weighted sums until the cluster is closed*/
+    E.XMean += (double) v * x;
+    E.YMean += (double) v * y;
+
+    if ((int) E.X.size() < this->MaxPixels) {
+        E.X.push_back(x);
+        E.Y.push_back(y);
+        E.Value.push_back(v);
+    }
+    else E.bTruncated = true;
+
+    this->LastRow[Id] = y;
+    if (bSeed) this->Seeded[Id] = 1;
+
+}
+
+
+/*Close the clusters that did not grow in row dRow, or all of them. Clusters reaching the seed
+ *threshold go to the table, the others are noise and are dropped.*/
+void ClusterFinder::CloseFinished(int dRow, bool bAll)
+{
+
+    for (int Id = 0; Id < (int) this->Open.size(); Id++) {
+        if (this->LastRow[Id] < 0 || this->Parent[Id] != Id) continue;
+        if (!bAll && this->LastRow[Id] >= dRow) continue;
+
+        ClusterEvent &E = this->Open[Id];
+        if (this->Seeded[Id]) {
+            if (E.Charge > 0) {
+                E.XMean /= E.Charge;
+                E.YMean /= E.Charge;
+            }
+            this->Table->Events.push_back(std::move(E));
+        }
+
+        this->Open[Id] = ClusterEvent();
+        this->LastRow[Id] = -1;
+        this->FreeIds.push_back(Id);
+    }
+
+    if (bAll) std::fill(this->PrevLabel.begin(), this->PrevLabel.end(), -1);
+
+}
+
+
+void ClusterFinder::ProcessRow(const unsigned short *pRow, int dRow)
+{
+
+    /*A gap in the rows breaks the clusters*/
+    if (this->LastRowSeen >= 0 && dRow != this->LastRowSeen + 1) this->CloseFinished(dRow, true);
+    this->LastRowSeen = dRow;
+
+    /*Average the samples of every pixel*/
+    std::fill(this->Sums.begin(), this->Sums.end(), 0);
+    int dRowWidth = (int) this->ColumnPixel.size();
+    for (int i = 0; i < dRowWidth; i++)
+        if (this->ColumnUsed[i]) this->Sums[this->ColumnPixel[i]] += pRow[i];
+    double dScale = 1.0 / this->nUsedSamples;
+    for (int x = 0; x < this->dCols; x++) this->Row[x] = (float) (this->Sums[x] * dScale);
+
+    /*Pedestal and noise of the row, per amplifier*/
+    RowPedestal P;
+    float PixelThreshold[2] = { 0, 0 }, SeedThreshold[2] = { 0, 0 };
+    int dHalf = this->nAmps == 2 ? this->dCols / 2 : this->dCols;
+    for (int a = 0; a < this->nAmps; a++) {
+        int dBegin = a == 0 ? 0 : dHalf;
+        int dEnd = a == 0 ? dHalf : this->dCols;
+        if (dEnd <= dBegin) continue;
+
+        this->Scratch.assign(this->Row.begin() + dBegin, this->Row.begin() + dEnd);
+        auto Mid = this->Scratch.begin() + this->Scratch.size() / 2;
+        std::nth_element(this->Scratch.begin(), Mid, this->Scratch.end());
+        float Pedestal = *Mid;
+        for (float &v : this->Scratch) v = std::fabs(v - Pedestal);
+        std::nth_element(this->Scratch.begin(), Mid, this->Scratch.end());
+        double dRowNoise = MAD_TO_SIGMA * *Mid;
+
+        this->NoiseSum[a] += dRowNoise;
+        this->nNoiseRows[a]++;
+        double Noise = this->NoiseSum[a] / this->nNoiseRows[a];
+
+        for (int x = dBegin; x < dEnd; x++) this->Row[x] -= Pedestal;
+        P.Pedestal[a] = Pedestal;
+        P.Noise[a] = (float) Noise;
+        PixelThreshold[a] = (float) (this->PixelSigma * Noise);
+        SeedThreshold[a] = (float) (this->SeedSigma * Noise);
+    }
+    this->Table->Rows.push_back(P);
+
+    /*Label the pixels above threshold, joining them with their neighbours to the left and in the row before*/
+    std::fill(this->CurLabel.begin(), this->CurLabel.end(), -1);
+    for (int x = 0; x < this->dCols; x++) {
+        float v = this->Row[x];
+        int a = x < dHalf ? 0 : 1;
+        if (v <= PixelThreshold[a]) continue;
+        this->Table->nPixelsAbove++;
+
+        int Neighbours[4] = { x > 0 ? this->CurLabel[x-1] : -1, x > 0 ? this->PrevLabel[x-1] : -1,
+                              this->PrevLabel[x], x + 1 < this->dCols ? this->PrevLabel[x+1] : -1 };
+        int Id = -1;
+        for (int n : Neighbours) {
+            if (n < 0) continue;
+            int r = this->Find(n);
+            if (Id < 0) Id = r;
+            else if (r != Id) Id = this->Join(Id, r);
+        }
+        if (Id < 0) Id = this->NewCluster();
+        this->AddPixel(Id, x, dRow, v, v > SeedThreshold[a]);
+        this->CurLabel[x] = Id;
+    }
+
+    /*Once the labels point to the clusters that are left, the merged ones can be reused*/
+    for (int &l : this->CurLabel)
+        if (l >= 0) l = this->Find(l);
+    std::swap(this->PrevLabel, this->CurLabel);
+    this->CloseFinished(dRow, false);
+    this->FreeIds.insert(this->FreeIds.end(), this->Merged.begin(), this->Merged.end());
+    this->Merged.clear();
+
+}
@@ -0,0 +1,139 @@
+/* *********************************************************************
+ * Streaming cluster finder. While the rows arrive from the controller
+ * (see CRowIFace.hpp), the samples of every pixel are averaged and the
+ * pedestal of the row is subtracted, per amplifier. The pedestal is the
+ * median of the row and the noise is taken from its median absolute
+ * deviation, followed over the rows. Pixels above PixelSigma times the
+ * noise are joined with their eight neighbours into clusters, across
+ * the row boundaries, and a cluster is kept once a row goes by without
+ * adding to it, if one of its pixels is above SeedSigma.
+ *
+ * The clusters of a frame (pixel lists, charge, bounding box) and the
+ * pedestal and noise of every row form a ClusterTable, which is written
+ * as the CLUSTERS and PEDESTALS tables of the frame, see FitsOps.cpp.
+ * Coordinates are those of the de-interlaced image: the L half of a UL
+ * readout is mirrored on the right.
+ *
+ * Only the rows of the last readout and the open clusters are held, and
+ * the work is a few operations per sample, so this runs on the polling
+ * thread like the quick look.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_CLUSTERFINDER_HPP
+#define CCDDRONE_CLUSTERFINDER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "CRowIFace.hpp"
+
+
+struct ClusterEvent{
+
+    int nPixels = 0;
+    double Charge = 0;          //Sum of the pedestal subtracted pixels (ADU)
+    float MaxValue = 0;
+    int XMin = 0, XMax = 0, YMin = 0, YMax = 0;
+    double XMean = 0, YMean = 0;  //Charge weighted
+    bool bTruncated = false;    //More pixels than MaxPixels, the list holds the first of them
+
+    std::vector<int> X;
+    std::vector<int> Y;
+    std::vector<float> Value;
+
+};
+
+
+/*Pedestal and noise of one row, per amplifier (ADU)*/
+struct RowPedestal{
+    float Pedestal[2] = { 0, 0 };
+    float Noise[2] = { 0, 0 };
+};
+
+
+struct ClusterTable{
+
+    int dCols = 0;
+    int dRows = 0;
+    int nAmps = 1;
+    int nSamples = 1;
+    double SeedSigma = 0;
+    double PixelSigma = 0;
+    long nPixelsAbove = 0;      //Pixels above the pixel threshold, in kept clusters or not
+
+    std::vector<ClusterEvent> Events;
+    std::vector<RowPedestal> Rows;
+
+};
+
+
+class ClusterFinder : public CRowIFace
+{
+
+private:
+    int dCols = 0;
+    int nSamples = 1;
+    int nDiscard = 0;
+    int nAmps = 1;
+    double SeedSigma = 4.0;
+    double PixelSigma = 2.5;
+    int MaxPixels = 10000;
+
+    /*Per raw column of a row: the image column it goes to, and whether the sample is used*/
+    std::vector<int> ColumnPixel;
+    std::vector<uint8_t> ColumnUsed;
+    int nUsedSamples = 1;
+
+    /*The averaged row, pedestal subtracted, and its scratch space for the medians*/
+    std::vector<uint64_t> Sums;
+    std::vector<float> Row;
+    std::vector<float> Scratch;
+
+    /*Noise followed over the rows, per amplifier*/
+    double NoiseSum[2];
+    int nNoiseRows[2];
+
+    /*Clusters that can still grow. Labels of the previous and current row point into Open, -1 for
+     *no cluster. Clusters that were merged point to the one they went into through Parent.*/
+    std::vector<ClusterEvent> Open;
+    std::vector<int> Parent;
+    std::vector<int> LastRow;
+    std::vector<uint8_t> Seeded;
+    std::vector<int> FreeIds;
+    std::vector<int> Merged;
+    std::vector<int> PrevLabel;
+    std::vector<int> CurLabel;
+
+    std::shared_ptr<ClusterTable> Table;
+    int RowsSeen = 0;
+    int LastRowSeen = -1;
+
+    int Find(int );
+    int Join(int, int );
+    int NewCluster(void );
+    void AddPixel(int Id, int x, int y, float v, bool bSeed);
+    void CloseFinished(int dRow, bool bAll);
+    void ProcessRow(const unsigned short *pRow, int dRow);
+
+public:
+    /*The geometry of the next readout. AmplifierDirection is that of the [ccd] section.*/
+    void Configure(int dCols, int nSamples, int nDiscard, const std::string &AmplifierDirection,
+                   double SeedSigma, double PixelSigma, int MaxPixels);
+
+    void ReadoutStarted(int dRows, int dRowWidth) override;
+    void RowsCallback(const unsigned short *pRows, int dFirstRow, int nRows, int dRowWidth) override;
+    void ReadoutFinished(void ) override;
+
+    int Rows(void ) const { return RowsSeen; }
+
+    /*The clusters of the last readout. The clusters still open are closed first, so that a frame that
+     *ended early is complete too. The finder starts over with the next readout.*/
+    std::shared_ptr<const ClusterTable> TakeTable(void );
+
+};
+
+
+#endif //CCDDRONE_CLUSTERFINDER_HPP
@@ -0,0 +1,141 @@
+/* *********************************************************************
+ * This file contains the command counters and latency histograms. See
+ * CommandStats.hpp.
+ * *********************************************************************
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+
+#include "CommandStats.hpp"
+
+
+double CommandStat::Quantile(double q) const
+{
+
+    if (this->Count == 0) return 0;
+
+    long long Target = (long long) (q * this->Count + 0.5);
+    if (Target < 1) Target = 1;
+
+    long long Seen = 0;
+    for (int i = 0; i < CMDSTATS_NBINS; i++) {
+        Seen += this->Histogram[i];
+        if (Seen >= Target) {
+            double Edge = (double) (1LL << (i+1));
+            return Edge < this->MaxMicros ? Edge : this->MaxMicros;
+        }
+    }
+    return this->MaxMicros;
+
+}
+
+
+std::string CommandStats::OpcodeName(int Opcode)
+{
+
+    char c[3] = { (char) ((Opcode >> 16) & 0xFF), (char) ((Opcode >> 8) & 0xFF), (char) (Opcode & 0xFF) };
+    bool bPrintable = (Opcode & 0xFF000000) == 0;
+    for (int i = 0; i < 3; i++)
+        if (!((c[i] >= 'A' && c[i] <= 'Z') || (c[i] >= '0' && c[i] <= '9') || c[i] == '_')) bPrintable = false;
+
+    if (bPrintable) return std::string(c, 3);
+
+    char Hex[16];
+    snprintf(Hex, sizeof(Hex), "0x%06X", Opcode);
+    return std::string(Hex);
+
+}
+
+
+void CommandStats::Record(const std::string &Opcode, double Micros, bool bError)
+{
+
+    CommandStat &S = this->Stats[Opcode];
+
+    if (S.Count == 0 || Micros < S.MinMicros) S.MinMicros = Micros;
+    if (S.Count == 0 || Micros > S.MaxMicros) S.MaxMicros = Micros;
+    S.Count++;
+    S.TotalMicros += Micros;
+    if (bError) S.Errors++;
+
+    int Bin = 0;
+    while (Bin < CMDSTATS_NBINS-1 && Micros >= (double) (1LL << (Bin+1))) Bin++;
+    S.Histogram[Bin]++;
+
+}
+
+
+long long CommandStats::TotalCount(void ) const
+{
+    long long n = 0;
+    for (auto &s : this->Stats) n += s.second.Count;
+    return n;
+}
+
+
+double CommandStats::TotalMicros(void ) const
+{
+    double t = 0;
+    for (auto &s : this->Stats) t += s.second.TotalMicros;
+    return t;
+}
+
+
+std::string CommandStats::ToJSON(void ) const
+{
+
+    std::ostringstream js;
+    js << std::setprecision(6);
+    js << "{\"total_count\":" << this->TotalCount() << ",\"total_us\":" << this->TotalMicros() << ",\"commands\":{";
+
+    bool bFirst = true;
+    for (auto &s : this->Stats) {
+        const CommandStat &S = s.second;
+        if (!bFirst) js << ",";
+        bFirst = false;
+        js << "\"" << s.first << "\":{\"count\":" << S.Count << ",\"errors\":" << S.Errors
+           << ",\"total_us\":" << S.TotalMicros << ",\"mean_us\":" << S.TotalMicros / S.Count
+           << ",\"min_us\":" << S.MinMicros << ",\"max_us\":" << S.MaxMicros
+           << ",\"p50_us\":" << S.Quantile(0.5) << ",\"p99_us\":" << S.Quantile(0.99) << ",\"histogram_log2_us\":[";
+        for (int i = 0; i < CMDSTATS_NBINS; i++) js << (i ? "," : "") << S.Histogram[i];
+        js << "]}";
+    }
+
+    js << "}}";
+    return js.str();
+
+}
+
+
+int CommandStats::DumpJSON(const std::string &FileName) const
+{
+
+    std::ofstream f(FileName, std::fstream::trunc | std::fstream::out);
+    if (!f.is_open()) {
+        std::cout << "Could not write the command statistics to " << FileName << "\n";
+        return -1;
+    }
+    f << this->ToJSON() << "\n";
+    return 0;
+
+}
+
+
+void CommandStats::PrintSummary(void ) const
+{
+
+    if (this->Stats.empty()) return;
+
+    printf("\nCommand   Count   Errors   Total (ms)   Mean (us)   p99 (us)   Max (us)\n");
+    for (auto &s : this->Stats) {
+        const CommandStat &S = s.second;
+        printf("%-8s %6lld %8lld %12.2f %11.1f %10.0f %10.0f\n", s.first.c_str(), S.Count, S.Errors,
+               S.TotalMicros / 1000.0, S.TotalMicros / S.Count, S.Quantile(0.99), S.MaxMicros);
+    }
+    printf("All      %6lld %8s %12.2f\n", this->TotalCount(), "", this->TotalMicros() / 1000.0);
+
+}
@@ -0,0 +1,65 @@
+/* *********************************************************************
+ * Counters and latency histograms of the commands sent to the Leach
+ * controller, one entry per opcode (SBN, SSR, STC, RET, CIT ...). Every
+ * round trip through LeachController::TimedCommand is recorded here, so
+ * it can be seen which steps of a startup or an apply take the time and
+ * what the polling costs during an exposure.
+ * A CommandStats is used by a single controller thread and is not
+ * locked.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_COMMANDSTATS_HPP
+#define CCDDRONE_COMMANDSTATS_HPP
+
+#include <string>
+#include <map>
+
+
+/*Latencies are histogrammed in powers of two of microseconds: bin i holds [2^i, 2^(i+1)) us,
+ *bin 0 everything below 2 us and the last bin everything above*/
+#define CMDSTATS_NBINS 24
+
+struct CommandStat{
+
+    long long Count = 0;
+    long long Errors = 0;
+    double TotalMicros = 0;
+    double MinMicros = 0;
+    double MaxMicros = 0;
+    long long Histogram[CMDSTATS_NBINS] = {0};
+
+    /*Latency below which a fraction q of the commands were, from the histogram (upper bin edge)*/
+    double Quantile(double q) const;
+
+};
+
+
+class CommandStats
+{
+
+private:
+
+    std::map<std::string, CommandStat> Stats;
+
+public:
+
+    /*Name of an opcode. The ARC words are three ASCII characters, e.g. 0x00534554 is SET.*/
+    static std::string OpcodeName(int );
+
+    void Record(const std::string &Opcode, double Micros, bool bError = false);
+    void Record(int Opcode, double Micros, bool bError = false) { Record(OpcodeName(Opcode), Micros, bError); }
+    void Clear(void ) { Stats.clear(); }
+
+    const std::map<std::string, CommandStat>& Entries(void ) const { return Stats; }
+    long long TotalCount(void ) const;
+    double TotalMicros(void ) const;
+
+    std::string ToJSON(void ) const;
+    int DumpJSON(const std::string &FileName) const;
+    void PrintSummary(void ) const;
+
+};
+
+
+#endif //CCDDRONE_COMMANDSTATS_HPP
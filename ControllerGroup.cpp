@@ -0,0 +1,108 @@
+/* *********************************************************************
+ * This file contains the routines that expose several controllers at
+ * the same time. The images of the controller on board N are written
+ * to <output>_devN.fits (and <output>_devN_0000.fits ... for a series
+ * of frames). Several files are only written at once by a cfitsio that
+ * was built with --enable-reentrant, otherwise the writes of the
+ * boards take turns (see FitsWriteLock).
+ * *********************************************************************
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <chrono>
+
+#include "ControllerGroup.hpp"
+#include "UtilityFunctions.hpp"
+
+
+/*
+ * Every board keeps its own state files, so the config of a controller is the one
+ * that was last applied to that board (CCDD_DEVICE=N ./CCDDApplyNewSettings <config>).
+ * Returns 0 if the controller is ready to expose and -1 otherwise.
+ */
+int ControllerGroup::AddController(int DeviceIndex)
+{
+
+    for (auto &c : this->Controllers) {
+        if (c->DeviceIndex == DeviceIndex) {
+            std::cout << "PCIe board " << DeviceIndex << " is already part of the group.\n";
+            return -1;
+        }
+    }
+
+    std::ifstream LastCfgLoc(DeviceStateFile(DeviceIndex, "LastConfigLocation.txt"), std::fstream::in);
+    std::string LastCfgFile;
+    std::getline(LastCfgLoc, LastCfgFile);
+    LastCfgLoc.close();
+
+    if (LastCfgFile.empty()) {
+        std::cout << "No settings were ever applied to PCIe board " << DeviceIndex << ". Run CCDDApplyNewSettings for it first.\n";
+        return -1;
+    }
+
+    std::unique_ptr<LeachController> Controller(new LeachController(LastCfgFile, DeviceIndex));
+    Controller->ClockTimers.ProgramStart = std::chrono::system_clock::now();
+
+    bool config, sequencer;
+    if (Controller->LoadAndCheckForSettingsChange(config, sequencer) != 0) {
+        if (config) std::cout<<"Error: The config file of board "<<DeviceIndex<<" has changed but the new settings were not uploaded.\n";
+        if (sequencer) std::cout<<"Error: The sequencer of board "<<DeviceIndex<<" has changed but it was not uploaded.\n";
+        return -1;
+    }
+
+    this->Controllers.push_back(std::move(Controller));
+    return 0;
+
+}
+
+
+std::vector<int> ControllerGroup::ExposeAll(int ExposureTime, int nFrames, std::string OutFileName)
+{
+
+    size_t nControllers = this->Controllers.size();
+    std::vector<int> nFramesTaken(nControllers, 0);
+    if (nControllers == 0) return nFramesTaken;
+
+    /*A controller that fails leaves the barrier, so the others carry on without it*/
+    StartBarrier ExposureStart((int) nControllers);
+    std::vector<std::thread> Acquisitions;
+
+    for (size_t i = 0; i < nControllers; i++) {
+
+        LeachController &Controller = *this->Controllers[i];
+        Controller.pStartBarrier = &ExposureStart;
+        Controller.CCDParams.fExpTime = ExposureTime;
+
+        Acquisitions.push_back(std::thread([&Controller, &ExposureStart, &nFramesTaken, i, ExposureTime, nFrames, OutFileName]() {
+
+            std::string DevFileName = DeviceFileName(OutFileName, Controller.DeviceIndex);
+
+            Controller.ClockTimers.isReadout = false;
+            Controller.ClockTimers.isExp = false;
+            Controller.ClockTimers.rClockCounter = 0;
+
+            if (nFrames > 1) {
+                nFramesTaken[i] = Controller.ExposeMultipleFrames(ExposureTime, nFrames, DevFileName);
+            } else if (Controller.PrepareAndExposeCCD(ExposureTime, NULL) == 0) {
+                try {
+                    if (Controller.SaveFits(DevFileName) == 0) nFramesTaken[i] = 1;
+                } catch (std::exception &e) {
+                    std::cerr << "The image of board " << Controller.DeviceIndex << " could not be written: " << e.what() << "\n";
+                }
+            }
+
+            ExposureStart.Leave();
+
+        }));
+
+    }
+
+    for (std::thread &t : Acquisitions) t.join();
+    for (auto &c : this->Controllers) c->pStartBarrier = NULL;
+
+    return nFramesTaken;
+
+}
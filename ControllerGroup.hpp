@@ -0,0 +1,42 @@
+/* *********************************************************************
+ * A group of Leach controllers, one per PCIe board, that are exposed
+ * together. Every controller runs its acquisition on its own thread,
+ * with its own common buffer and frame writer, and the exposures of
+ * all the controllers start together at a barrier.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_CONTROLLERGROUP_HPP
+#define CCDDRONE_CONTROLLERGROUP_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "LeachController.hpp"
+
+
+class ControllerGroup
+{
+
+private:
+
+    std::vector< std::unique_ptr<LeachController> > Controllers;
+
+public:
+
+    ControllerGroup() {};
+
+    /*Open the controller on the PCIe board DeviceIndex with the config it was last applied with*/
+    int AddController(int DeviceIndex);
+
+    size_t Size(void ) const { return Controllers.size(); }
+    LeachController& Controller(size_t i) { return *Controllers[i]; }
+
+    /*Expose every controller nFrames times. Returns the number of frames taken by each controller.*/
+    std::vector<int> ExposeAll(int ExposureTime, int nFrames, std::string OutFileName);
+
+};
+
+
+#endif //CCDDRONE_CONTROLLERGROUP_HPP
@@ -0,0 +1,144 @@
+/* *********************************************************************
+ * This file contains the stat keyed digest cache used for checking if
+ * the settings or sequencer have changed. See FileHashCache.hpp.
+ * *********************************************************************
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstdio>
+#include <chrono>
+
+#include <sys/stat.h>
+
+#include "FileHashCache.hpp"
+#include "picosha2.h"
+
+/*A file is only cached if its mtime and ctime are this much older than the hash. This covers
+ *filesystems with 1 s and 2 s timestamps, and the coarse clock the kernel stamps files with.*/
+#define RACY_MARGIN_NS 2000000000LL
+
+
+int StatFile(const std::string &Path, FileStamp &Stamp)
+{
+
+    struct stat st;
+    if (stat(Path.c_str(), &st) != 0) {
+        Stamp = FileStamp();
+        return -1;
+    }
+
+    Stamp.Size = (long long) st.st_size;
+    Stamp.MTimeNs = (long long) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    Stamp.CTimeNs = (long long) st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+    Stamp.Inode = (unsigned long long) st.st_ino;
+    Stamp.Device = (unsigned long long) st.st_dev;
+    return 0;
+
+}
+
+
+FileHashCache::FileHashCache(std::string BackingFile)
+{
+    this->bDirty = false;
+    this->SetBackingFile(BackingFile);
+}
+
+
+void FileHashCache::SetBackingFile(std::string BackingFile)
+{
+    this->BackingFile = BackingFile;
+    this->Entries.clear();
+    if (!this->BackingFile.empty()) this->Load();
+}
+
+
+void FileHashCache::Clear(void )
+{
+    this->Entries.clear();
+    this->bDirty = true;
+    this->Save();
+}
+
+
+std::string FileHashCache::Digest(const std::string &Path)
+{
+
+    FileStamp Stamp;
+    bool bStatOK = (StatFile(Path, Stamp) == 0);
+
+    /*Someone may be sharing the backing file, so look at it again before trusting our copy*/
+    if (!this->BackingFile.empty()) this->Load();
+
+    auto it = this->Entries.find(Path);
+    if (bStatOK && it != this->Entries.end() && it->second.Stamp == Stamp) return it->second.Digest;
+
+    long long NowNs = (long long) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::system_clock::now().time_since_epoch()).count();
+    std::ifstream f1(Path, std::fstream::binary);
+    std::vector<unsigned char> s1(picosha2::k_digest_size);
+    picosha2::hash256(f1, s1.begin(), s1.end());
+    f1.close();
+    std::string Digest = picosha2::bytes_to_hex_string(s1.begin(), s1.end());
+
+    /*A file that can't be stat'ed is hashed every time, same as before. So is one that was changed
+     *too recently: an edit right after this one could keep the same stat data.*/
+    bool bRacy = NowNs - Stamp.MTimeNs < RACY_MARGIN_NS || NowNs - Stamp.CTimeNs < RACY_MARGIN_NS;
+    if (bStatOK && !bRacy) {
+        this->Entries[Path] = Entry{Stamp, Digest};
+        this->bDirty = true;
+        this->Save();
+    }
+
+    return Digest;
+
+}
+
+
+/*Format: one file per line - digest size mtime ctime inode device path*/
+void FileHashCache::Load(void )
+{
+
+    std::ifstream fCache(this->BackingFile);
+    if (!fCache.is_open()) return;
+
+    std::map<std::string, Entry> _Entries;
+    std::string Line;
+    while (std::getline(fCache, Line)) {
+        std::istringstream ss(Line);
+        Entry e;
+        std::string Path;
+        if (!(ss >> e.Digest >> e.Stamp.Size >> e.Stamp.MTimeNs >> e.Stamp.CTimeNs >> e.Stamp.Inode >> e.Stamp.Device)) continue;
+        ss >> std::ws;
+        std::getline(ss, Path);
+        if (!Path.empty()) _Entries[Path] = e;
+    }
+
+    this->Entries.swap(_Entries);
+    this->bDirty = false;
+
+}
+
+
+void FileHashCache::Save(void )
+{
+
+    if (this->BackingFile.empty() || !this->bDirty) return;
+
+    /*Write to a temporary file and rename so a reader never sees half a cache*/
+    std::string TmpFile = this->BackingFile + ".tmp";
+    std::ofstream fCache(TmpFile, std::fstream::trunc | std::fstream::out);
+    if (!fCache.is_open()) return;
+
+    for (auto &it : this->Entries) {
+        fCache << it.second.Digest << " " << it.second.Stamp.Size << " " << it.second.Stamp.MTimeNs << " "
+               << it.second.Stamp.CTimeNs << " " << it.second.Stamp.Inode << " " << it.second.Stamp.Device << " "
+               << it.first << "\n";
+    }
+    fCache.close();
+
+    if (std::rename(TmpFile.c_str(), this->BackingFile.c_str()) == 0) this->bDirty = false;
+
+}
@@ -0,0 +1,72 @@
+/* *********************************************************************
+ * Cache of the SHA256 digests of the settings and sequencer files. A
+ * digest is reused as long as the stat data of the file (size, mtime,
+ * ctime, inode and device) is unchanged, so the files only need to be
+ * read and hashed again after they were actually modified. A file that
+ * was modified shortly before it was hashed is not cached (the racy
+ * clean rule of git): another change within the timestamp resolution
+ * of the filesystem would leave its stat data as it was.
+ * The cache can be kept in memory only, or be backed by a small text
+ * file so that the stand-alone programs share it between runs.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_FILEHASHCACHE_HPP
+#define CCDDRONE_FILEHASHCACHE_HPP
+
+#include <string>
+#include <map>
+
+
+/*What we know about a file without reading it*/
+struct FileStamp{
+
+    long long Size = -1;
+    long long MTimeNs = 0;
+    long long CTimeNs = 0;
+    unsigned long long Inode = 0;
+    unsigned long long Device = 0;
+
+    bool operator==(const FileStamp &o) const {
+        return Size == o.Size && MTimeNs == o.MTimeNs && CTimeNs == o.CTimeNs && Inode == o.Inode && Device == o.Device;
+    }
+    bool operator!=(const FileStamp &o) const { return !(*this == o); }
+
+};
+
+/*Returns 0 and fills the stamp if the file could be stat'ed, -1 otherwise*/
+int StatFile(const std::string &Path, FileStamp &Stamp);
+
+
+class FileHashCache
+{
+
+private:
+    struct Entry{
+        FileStamp Stamp;
+        std::string Digest;
+    };
+
+    std::map<std::string, Entry> Entries;
+    std::string BackingFile;
+    bool bDirty;
+
+    void Load(void );
+    void Save(void );
+
+public:
+    /*An empty BackingFile keeps the cache in memory only*/
+    FileHashCache(std::string BackingFile = "");
+
+    void SetBackingFile(std::string );
+
+    /*Hex SHA256 of the file, hashed again only if its stat data changed*/
+    std::string Digest(const std::string &Path);
+
+    /*Forget everything*/
+    void Clear(void );
+
+};
+
+
+#endif //CCDDRONE_FILEHASHCACHE_HPP
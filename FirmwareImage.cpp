@@ -0,0 +1,159 @@
+/* *********************************************************************
+ * This file contains the parser and the cache of the firmware images.
+ * See FirmwareImage.hpp for a description.
+ * *********************************************************************
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+
+#include <sys/stat.h>
+
+#include "ArcDefs.h"
+#include "FirmwareImage.hpp"
+
+#define FIRMWARE_CACHE_MAGIC "CCDDFW1"
+
+
+int FirmwareImage::ParseLod(const std::string &LodFile)
+{
+
+    std::ifstream fLod(LodFile);
+    if (!fLod.is_open()) {
+        std::cout << "Could not open the firmware file " << LodFile << "\n";
+        return -1;
+    }
+
+    this->Words.clear();
+
+    /*Data lines follow a "_DATA <type> <address>" line until the next _ directive
+     *(_SYMBOL, _START, _END ...), whose lines are not data*/
+    bool bInData = false;
+    int dMemType = 0;
+    int dAddr = 0;
+    std::string Line;
+    while (std::getline(fLod, Line)) {
+
+        std::istringstream ss(Line);
+        std::string Token;
+        if (!(ss >> Token)) continue;
+
+        if (Token[0] == '_') {
+            bInData = false;
+            if (Token != "_DATA") continue;
+
+            std::string sType, sAddr;
+            if (!(ss >> sType >> sAddr)) continue;
+            if (sType == "P") dMemType = P_MEM;
+            else if (sType == "X") dMemType = X_MEM;
+            else if (sType == "Y") dMemType = Y_MEM;
+            else if (sType == "R") dMemType = R_MEM;
+            else continue;
+            dAddr = (int) std::stoul(sAddr, NULL, 16);
+            bInData = true;
+            continue;
+        }
+
+        if (!bInData) continue;
+
+        do {
+            try {
+                int dValue = (int) std::stoul(Token, NULL, 16);
+                this->Words.push_back({ dMemType | dAddr, dValue });
+                dAddr++;
+            } catch (const std::exception &) {
+                std::cout << "Not a data word in " << LodFile << ": " << Token << "\n";
+                return -1;
+            }
+        } while (ss >> Token);
+    }
+
+    return this->Words.empty() ? -1 : 0;
+
+}
+
+
+/*Format: magic line, digest line, word count line, then the words as (MemAddr, Value) int32 pairs*/
+int FirmwareImage::Load(const std::string &CacheFile, const std::string &Digest)
+{
+
+    std::ifstream fCache(CacheFile, std::fstream::binary);
+    if (!fCache.is_open()) return -1;
+
+    std::string Magic, FileDigest;
+    size_t nWords = 0;
+    std::getline(fCache, Magic);
+    std::getline(fCache, FileDigest);
+    fCache >> nWords;
+    fCache.ignore(1);
+    if (Magic != FIRMWARE_CACHE_MAGIC || FileDigest != Digest || nWords == 0) return -1;
+
+    std::vector<int32_t> Raw(2 * nWords);
+    if (!fCache.read((char *) Raw.data(), Raw.size() * sizeof(int32_t))) return -1;
+
+    this->Words.resize(nWords);
+    for (size_t i = 0; i < nWords; i++) this->Words[i] = { Raw[2*i], Raw[2*i+1] };
+    this->Digest = Digest;
+    return 0;
+
+}
+
+
+int FirmwareImage::Save(const std::string &CacheFile) const
+{
+
+    std::vector<int32_t> Raw(2 * this->Words.size());
+    for (size_t i = 0; i < this->Words.size(); i++) {
+        Raw[2*i] = this->Words[i].MemAddr;
+        Raw[2*i+1] = this->Words[i].Value;
+    }
+
+    /*Write to a temporary file and rename, so that a reader never sees half an image*/
+    std::string TmpFile = CacheFile + ".tmp";
+    std::ofstream fCache(TmpFile, std::fstream::binary | std::fstream::trunc);
+    if (!fCache.is_open()) return -1;
+    fCache << FIRMWARE_CACHE_MAGIC << "\n" << this->Digest << "\n" << this->Words.size() << "\n";
+    fCache.write((const char *) Raw.data(), Raw.size() * sizeof(int32_t));
+    fCache.close();
+    if (!fCache) return -1;
+
+    return std::rename(TmpFile.c_str(), CacheFile.c_str()) == 0 ? 0 : -1;
+
+}
+
+
+std::vector<FirmwareWord> FirmwareImage::VerificationWords(int n) const
+{
+
+    std::vector<FirmwareWord> Program;
+    for (const FirmwareWord &W : this->Words)
+        if ((W.MemAddr & ~0xFFFF) == P_MEM && (W.MemAddr & 0xFFFF) < MAX_DSP_START_LOAD_ADDR) Program.push_back(W);
+
+    if (n <= 0 || Program.empty()) return std::vector<FirmwareWord>();
+    if ((size_t) n >= Program.size()) return Program;
+
+    std::vector<FirmwareWord> Sample;
+    for (int i = 0; i < n; i++) Sample.push_back(Program[(size_t) i * Program.size() / n]);
+    return Sample;
+
+}
+
+
+int LoadFirmwareImage(const std::string &LodFile, const std::string &Digest, const std::string &CacheDir, FirmwareImage &Image)
+{
+
+    if (Digest.empty()) return -1;
+
+    mkdir(CacheDir.c_str(), 0755);
+    std::string CacheFile = CacheDir + "/" + Digest + ".img";
+    if (Image.Load(CacheFile, Digest) == 0) return 0;
+
+    if (Image.ParseLod(LodFile) != 0) return -1;
+    Image.Digest = Digest;
+    if (Image.Save(CacheFile) != 0) std::cout << "Could not store the parsed firmware in " << CacheFile << "\n";
+    return 0;
+
+}
@@ -0,0 +1,54 @@
+/* *********************************************************************
+ * Parsed image of a controller firmware (.lod) file. The text file is
+ * parsed once into the memory words it loads, and the result is kept
+ * in a small binary cache file named after the SHA256 of the .lod, so
+ * later runs do not parse it again.
+ *
+ * The image is used to tell if the controller still runs a firmware,
+ * by reading back a sample of its program memory words, so that the
+ * reset and the upload can be skipped on a warm start.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_FIRMWAREIMAGE_HPP
+#define CCDDRONE_FIRMWAREIMAGE_HPP
+
+#include <string>
+#include <vector>
+
+
+/*One word of DSP memory. MemAddr is the memory type bit (P_MEM, X_MEM, Y_MEM, R_MEM) | address,
+ *as it is given to the RDM and WRM commands.*/
+struct FirmwareWord{
+    int MemAddr;
+    int Value;
+};
+
+
+class FirmwareImage
+{
+
+public:
+    std::string Digest;
+    std::vector<FirmwareWord> Words;
+
+    /*Parse the _DATA sections of a .lod file. Returns 0 on success, -1 otherwise.*/
+    int ParseLod(const std::string &LodFile);
+
+    /*Binary cache file. Load returns -1 if the file is missing or not for Digest.*/
+    int Load(const std::string &CacheFile, const std::string &Digest);
+    int Save(const std::string &CacheFile) const;
+
+    /*Up to n program memory words spread evenly over the program, for checking what the controller runs.
+     *Only the part of P memory that is loaded from the file (below MAX_DSP_START_LOAD_ADDR) is used.*/
+    std::vector<FirmwareWord> VerificationWords(int n) const;
+
+};
+
+
+/*The image of LodFile with the given digest: from CacheDir if it was parsed before, otherwise parsed
+ *and stored in CacheDir. Returns 0 on success, -1 otherwise.*/
+int LoadFirmwareImage(const std::string &LodFile, const std::string &Digest, const std::string &CacheDir, FirmwareImage &Image);
+
+
+#endif //CCDDRONE_FIRMWAREIMAGE_HPP
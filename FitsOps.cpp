@@ -1,9 +1,17 @@
-#ifndef FITSOPS_HPP
-#define FITSOPS_HPP
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <vector>
 
 #include "fitsio.h"
 #include "LeachController.hpp"
 #include "CCDControlDataTypes.hpp"
+#include "FitsOps.hpp"
+#include "SkipperReduction.hpp"
+#include "Calibration.hpp"
+#include "RawFrame.hpp"
+#include "ClusterFinder.hpp"
+#include "SparseImage.hpp"
 
 /*Function needed to convert time points to string*/
 static std::string timePointAsString(const std::chrono::system_clock::time_point& tp)
@@ -15,30 +23,128 @@ static std::string timePointAsString(const std::chrono::system_clock::time_point
 }
 
 
-/*Function to write an SK Merged image as a FITS file.*/
-void LeachController::SaveFits(std::string outFileName)
+/*Function to write an SK Merged image as a FITS file. The image is written
+ *straight from the common buffer (or the segmented readout buffer), so this
+ *is only valid until the next exposure. Returns 0 if the file was written.*/
+int LeachController::SaveFits(std::string outFileName)
 {
 
-    /*These are the temporary FITS variables we need to open the file
-     * fptr -> fits file pointer
-     * status, imgtype and nAxis are self explanatory
-     * imageSizeXY stores the size of the image
-     * fpixelallread is something weird about FITS that I didnt care to read too much except
-     *        it needs to be {1,1} to read the entire file
-     */
-    fitsfile *fptr;       /* pointer to the FITS file; defined in fitsio.h */
-    int status, nAxis=2;
-    long fpixel[2] = {1,1};
-    int dfpixel = 1;
-    long nPixelsToWrite;
-    long imageSizeXY[2] = { this->CCDParams.dCols*this->CCDParams.nSkipperR, this->CCDParams.dRows};
-    nPixelsToWrite = imageSizeXY[0] * imageSizeXY[1];
+    FrameRecord Frame;
+    Frame.OutFileName = outFileName;
+    Frame.CCDParams = this->CCDParams;
+    Frame.ClockParams = this->ClockParams;
+    Frame.BiasParams = this->BiasParams;
+    Frame.ClockTimers = this->ClockTimers;
+    Frame.ProcParams = this->ProcParams;
+    Frame.OutParams = this->OutParams;
+    Frame.RoiParams = this->RoiParams;
+    Frame.CmdStats = this->ExposureCmdStats;
+    Frame.Masters = this->Masters;
+    this->Telemetry.CopySamples(Frame.Telemetry);
+    Frame.TelemetryDropped = this->Telemetry.Dropped();
+    Frame.StallEventMs = this->AcqParams.StallEventMs;
+    Frame.bInterlaced = this->bImageInterlaced;
+    Frame.ScanPoint = this->ScanPoint;
+    Frame.ScanCoords = this->ScanCoords;
+    Frame.PartialRows = this->PartialRows;
+    Frame.AbortReason = this->AbortReason;
 
+    if (this->OutParams.QuickLook) WriteQuickLookFits(this->QuickLookStats, QuickLookFileName(outFileName));
+    if (this->OutParams.FindClusters) Frame.Clusters = this->EventFinder.TakeTable();
 
-    status = 0;         /* initialize status before calling fitsio routines */
-    fits_create_file(&fptr, outFileName.c_str(), &status);
-    fits_create_img(fptr, USHORT_IMG, nAxis, &imageSizeXY[0], &status);
-    int nullValue=0;
+    unsigned short *pData = this->ImageData();
+    int dStatus = WriteFrameToFits(Frame, pData);
+
+    /*The image may have been de-interlaced in place, it must not be de-interlaced again*/
+    this->bImageInterlaced = Frame.bInterlaced;
+    return dStatus;
+
+}
+
+
+/*Copy the last image out of the common buffer into a host side frame, so that it can
+ *be written to disk while the next exposure is already running.*/
+std::unique_ptr<FrameRecord> LeachController::CopyFrameFromCommonBuffer(std::string outFileName)
+{
+
+    const unsigned short *pData = this->ImageData();
+    std::unique_ptr<FrameRecord> Frame = this->RecordLastExposure(outFileName);
+    this->CopyFramePixels(*Frame, pData);
+
+    return Frame;
+}
+
+
+/*Settings and state of the last exposure, with its pixels only if they are already in a
+ *host side buffer. The common buffer can be copied later with CopyFramePixels, as long as
+ *the next readout did not start.*/
+std::unique_ptr<FrameRecord> LeachController::RecordLastExposure(std::string outFileName)
+{
+
+    std::unique_ptr<FrameRecord> Frame(new FrameRecord);
+    Frame->OutFileName = outFileName;
+    Frame->CCDParams = this->CCDParams;
+    Frame->ClockParams = this->ClockParams;
+    Frame->BiasParams = this->BiasParams;
+    Frame->ClockTimers = this->ClockTimers;
+    Frame->ProcParams = this->ProcParams;
+    Frame->OutParams = this->OutParams;
+    Frame->RoiParams = this->RoiParams;
+    Frame->CmdStats = this->ExposureCmdStats;
+    Frame->Masters = this->Masters;
+    this->Telemetry.CopySamples(Frame->Telemetry);
+    Frame->TelemetryDropped = this->Telemetry.Dropped();
+    Frame->StallEventMs = this->AcqParams.StallEventMs;
+    Frame->bInterlaced = this->bImageInterlaced;
+    Frame->ScanPoint = this->ScanPoint;
+    Frame->ScanCoords = this->ScanCoords;
+    Frame->PartialRows = this->PartialRows;
+    Frame->AbortReason = this->AbortReason;
+
+    /*The quick look is small, so it goes out right away rather than after the frame*/
+    if (this->OutParams.QuickLook) WriteQuickLookFits(this->QuickLookStats, QuickLookFileName(outFileName));
+    if (this->OutParams.FindClusters) Frame->Clusters = this->EventFinder.TakeTable();
+
+    /*An image assembled in a pool buffer is handed over as it is*/
+    if (this->bImageInHostBuffer && this->SegmentedFrame.Valid()) {
+        Frame->Pixels = std::move(this->SegmentedFrame);
+        this->bImageInHostBuffer = false;
+    }
+    else this->SetupFramePool();
+
+    return Frame;
+}
+
+
+/*Copy the pixels of the frame from pData into a pool buffer, if the frame has none yet.
+ *This only uses the frame and the pool, so it can run while the next exposure integrates.
+ *Returns -1 if the pixels could not be copied, the frame is then left without any.*/
+int LeachController::CopyFramePixels(FrameRecord &Frame, const unsigned short *pData)
+{
+
+    if (Frame.Pixels.Valid()) return 0;
+
+    size_t nPixels = (size_t)Frame.CCDParams.dCols * Frame.CCDParams.dRows * Frame.CCDParams.nSkipperR;
+    Frame.Pixels = this->FrameBuffers.Acquire();
+
+    if (!Frame.Pixels.Valid() || Frame.Pixels.Pixels() < nPixels)
+        printf ("Could not get a frame buffer for %zu pixels.\n", nPixels);
+    else if (pData != NULL) {
+        std::memcpy(Frame.Pixels.Data(), pData, nPixels*sizeof(unsigned short));
+        return 0;
+    }
+    else
+        printf ("Why is the data a null pointer?\n");
+
+    Frame.Pixels.Release();
+    return -1;
+
+}
+
+
+/*Write the settings and clock timers a frame was taken with as keys of the current HDU*/
+static void WriteFrameKeys(fitsfile *fptr, FrameRecord &Frame, int &status)
+{
 
     /*Write processed comment*/
     std::string sKFixedCmt = "This image was taken by a DAMIC UW CCD. "
@@ -47,63 +153,63 @@ void LeachController::SaveFits(std::string outFileName)
     fits_write_comment(fptr, sKFixedCmt.c_str(), &status);
 
     /* Write the Meta keywords - CCD*/
-    std::string SequencerUsed = "ASMFILE: Sequencer file used "+this->CCDParams.sTimFile;
+    std::string SequencerUsed = "ASMFILE: Sequencer file used "+Frame.CCDParams.sTimFile;
 
-    fits_write_key(fptr, TSTRING, "CCDType", (char*) this->CCDParams.CCDType.c_str(), "CCD Type (DES or SK)", &status);
-    fits_write_key(fptr, TFLOAT, "Exp", &this->CCDParams.fExpTime, "Exposure time (s)", &status);
-    fits_write_key(fptr, TSHORT, "NDCMs", &this->CCDParams.nSkipperR, "Number of charge measurements", &status);
-    fits_write_key(fptr, TSTRING, "AMPL", (char*) this->CCDParams.AmplifierDirection.c_str(), "Amplifier(s) used", &status);
+    fits_write_key(fptr, TSTRING, "CCDType", (char*) Frame.CCDParams.CCDType.c_str(), "CCD Type (DES or SK)", &status);
+    fits_write_key(fptr, TFLOAT, "Exp", &Frame.CCDParams.fExpTime, "Exposure time (s)", &status);
+    fits_write_key(fptr, TSHORT, "NDCMs", &Frame.CCDParams.nSkipperR, "Number of charge measurements", &status);
+    fits_write_key(fptr, TSTRING, "AMPL", (char*) Frame.CCDParams.AmplifierDirection.c_str(), "Amplifier(s) used", &status);
     fits_write_comment(fptr, SequencerUsed.c_str(), &status);
-    fits_write_key(fptr, TBYTE, "SUPERSE", &this->CCDParams.super_sequencer, "Super sequencer (SSeq) used?", &status);
-    fits_write_key(fptr, TBYTE, "InvRG", &this->CCDParams.InvRG, "Is RG inverted", &status);
-    fits_write_key(fptr, TSTRING, "HCKDirn", (char*) this->CCDParams.HClkDirection.c_str(), "Serial register h-clock direction (SSEq only)", &status);
-    fits_write_key(fptr, TSTRING, "VCKDirn", (char*) this->CCDParams.VClkDirection.c_str(), "Vertical clock direction (SSeq only)", &status);
-    fits_write_key(fptr, TDOUBLE, "ITGTIME", &this->CCDParams.IntegralTime, "Integration time (SSeq only)", &status);
-    fits_write_key(fptr, TINT, "VidGain", &this->CCDParams.Gain, "Video gain", &status);
-    fits_write_key(fptr, TINT, "ITGSpd", &this->CCDParams.ItgSpeed, "Integrator speed (0=slow, 1=fast)", &status);
-    fits_write_key(fptr, TDOUBLE, "PRETIME", &this->CCDParams.PedestalIntgWait, "Pedestal settling + video ADC refresh time", &status);
-    fits_write_key(fptr, TDOUBLE, "POSTIME", &this->CCDParams.SignalIntgWait, "Signal settling time", &status);
-    fits_write_key(fptr, TDOUBLE, "DGWIDTH", &this->CCDParams.DGWidth, "DG Width (SK only)", &status);
-    fits_write_key(fptr, TDOUBLE, "RGWIDTH", &this->CCDParams.SKRSTWidth, "Skipping reset width (SK only)", &status);
-    fits_write_key(fptr, TDOUBLE, "OGWIDTH", &this->CCDParams.OGWidth, "OG Width (SK only)", &status);
-    fits_write_key(fptr, TDOUBLE, "SWWIDTH", &this->CCDParams.SWWidth, "SW Pulse Width (SK only)", &status);
-
-
-    fits_write_key(fptr, TINT, "NPBIN", &this->CCDParams.ParallelBin, "Binning in the V-direction (parallel clocks)", &status);
-    fits_write_key(fptr, TINT, "NSBIN", &this->CCDParams.SerialBin, "Binning in the H-direction (serial clocks)", &status);
-    fits_write_key(fptr, TSTRING, "SecStg", (char*) this->CCDParams.SecondStageVersion.c_str(), "Second stage board revision (SSeq only)", &status);
+    fits_write_key(fptr, TBYTE, "SUPERSE", &Frame.CCDParams.super_sequencer, "Super sequencer (SSeq) used?", &status);
+    fits_write_key(fptr, TBYTE, "InvRG", &Frame.CCDParams.InvRG, "Is RG inverted", &status);
+    fits_write_key(fptr, TSTRING, "HCKDirn", (char*) Frame.CCDParams.HClkDirection.c_str(), "Serial register h-clock direction (SSEq only)", &status);
+    fits_write_key(fptr, TSTRING, "VCKDirn", (char*) Frame.CCDParams.VClkDirection.c_str(), "Vertical clock direction (SSeq only)", &status);
+    fits_write_key(fptr, TDOUBLE, "ITGTIME", &Frame.CCDParams.IntegralTime, "Integration time (SSeq only)", &status);
+    fits_write_key(fptr, TINT, "VidGain", &Frame.CCDParams.Gain, "Video gain", &status);
+    fits_write_key(fptr, TINT, "ITGSpd", &Frame.CCDParams.ItgSpeed, "Integrator speed (0=slow, 1=fast)", &status);
+    fits_write_key(fptr, TDOUBLE, "PRETIME", &Frame.CCDParams.PedestalIntgWait, "Pedestal settling + video ADC refresh time", &status);
+    fits_write_key(fptr, TDOUBLE, "POSTIME", &Frame.CCDParams.SignalIntgWait, "Signal settling time", &status);
+    fits_write_key(fptr, TDOUBLE, "DGWIDTH", &Frame.CCDParams.DGWidth, "DG Width (SK only)", &status);
+    fits_write_key(fptr, TDOUBLE, "RGWIDTH", &Frame.CCDParams.SKRSTWidth, "Skipping reset width (SK only)", &status);
+    fits_write_key(fptr, TDOUBLE, "OGWIDTH", &Frame.CCDParams.OGWidth, "OG Width (SK only)", &status);
+    fits_write_key(fptr, TDOUBLE, "SWWIDTH", &Frame.CCDParams.SWWidth, "SW Pulse Width (SK only)", &status);
+
+
+    fits_write_key(fptr, TINT, "NPBIN", &Frame.CCDParams.ParallelBin, "Binning in the V-direction (parallel clocks)", &status);
+    fits_write_key(fptr, TINT, "NSBIN", &Frame.CCDParams.SerialBin, "Binning in the H-direction (serial clocks)", &status);
+    fits_write_key(fptr, TSTRING, "SecStg", (char*) Frame.CCDParams.SecondStageVersion.c_str(), "Second stage board revision (SSeq only)", &status);
 
 
     /*Write the Meta keywords - Clocks*/
-    fits_write_key(fptr, TDOUBLE, "OneVCKHi", &this->ClockParams.one_vclock_hi, "V1 clock Hi", &status);
-    fits_write_key(fptr, TDOUBLE, "OneVCKLo", &this->ClockParams.one_vclock_lo, "V1 clock Lo", &status);
+    fits_write_key(fptr, TDOUBLE, "OneVCKHi", &Frame.ClockParams.one_vclock_hi, "V1 clock Hi", &status);
+    fits_write_key(fptr, TDOUBLE, "OneVCKLo", &Frame.ClockParams.one_vclock_lo, "V1 clock Lo", &status);
 
-    if (this->CCDParams.SecondStageVersion == "UW2") {
-        fits_write_key(fptr, TDOUBLE, "TwoVCKHi", &this->ClockParams.two_vclock_hi, "V2 clock Hi", &status);
-        fits_write_key(fptr, TDOUBLE, "TwoVCKLo", &this->ClockParams.two_vclock_lo, "V2 clock Lo", &status);
+    if (Frame.CCDParams.SecondStageVersion == "UW2") {
+        fits_write_key(fptr, TDOUBLE, "TwoVCKHi", &Frame.ClockParams.two_vclock_hi, "V2 clock Hi", &status);
+        fits_write_key(fptr, TDOUBLE, "TwoVCKLo", &Frame.ClockParams.two_vclock_lo, "V2 clock Lo", &status);
     } else {
         double _TwoVCKPlaceholder = -996.0;
         fits_write_key(fptr, TDOUBLE, "TwoVCKHi", &_TwoVCKPlaceholder, "V2 clock Hi", &status);
         fits_write_key(fptr, TDOUBLE, "TwoVCKLo", &_TwoVCKPlaceholder, "V2 clock Lo", &status);
     }
-    fits_write_key(fptr, TDOUBLE, "TGHi", &this->ClockParams.tg_hi, "Transfer Gate Hi", &status);
-    fits_write_key(fptr, TDOUBLE, "TGLo", &this->ClockParams.tg_lo, "Transfer Gate Lo", &status);
+    fits_write_key(fptr, TDOUBLE, "TGHi", &Frame.ClockParams.tg_hi, "Transfer Gate Hi", &status);
+    fits_write_key(fptr, TDOUBLE, "TGLo", &Frame.ClockParams.tg_lo, "Transfer Gate Lo", &status);
 
-    fits_write_key(fptr, TDOUBLE, "HUHi", &this->ClockParams.u_hclock_hi, "U Serial Register H-Clocks Hi", &status);
-    fits_write_key(fptr, TDOUBLE, "HULo", &this->ClockParams.u_hclock_lo, "U Serial Register H-Clocks Lo", &status);
-    fits_write_key(fptr, TDOUBLE, "HLHi", &this->ClockParams.l_hclock_hi, "L Serial Register H-Clocks Hi", &status);
-    fits_write_key(fptr, TDOUBLE, "HLLo", &this->ClockParams.l_hclock_lo, "L Serial Register H-Clocks Lo", &status);
+    fits_write_key(fptr, TDOUBLE, "HUHi", &Frame.ClockParams.u_hclock_hi, "U Serial Register H-Clocks Hi", &status);
+    fits_write_key(fptr, TDOUBLE, "HULo", &Frame.ClockParams.u_hclock_lo, "U Serial Register H-Clocks Lo", &status);
+    fits_write_key(fptr, TDOUBLE, "HLHi", &Frame.ClockParams.l_hclock_hi, "L Serial Register H-Clocks Hi", &status);
+    fits_write_key(fptr, TDOUBLE, "HLLo", &Frame.ClockParams.l_hclock_lo, "L Serial Register H-Clocks Lo", &status);
 
-    fits_write_key(fptr, TDOUBLE, "RGHi", &this->ClockParams.rg_hi, "Reset Gate Hi", &status);
-    fits_write_key(fptr, TDOUBLE, "RGLo", &this->ClockParams.rg_lo, "Reset Gate Lo", &status);
-    fits_write_key(fptr, TDOUBLE, "SWHi", &this->ClockParams.sw_hi, "Summing Well Hi", &status);
-    fits_write_key(fptr, TDOUBLE, "SWLo", &this->ClockParams.sw_lo, "Summing Well Lo", &status);
+    fits_write_key(fptr, TDOUBLE, "RGHi", &Frame.ClockParams.rg_hi, "Reset Gate Hi", &status);
+    fits_write_key(fptr, TDOUBLE, "RGLo", &Frame.ClockParams.rg_lo, "Reset Gate Lo", &status);
+    fits_write_key(fptr, TDOUBLE, "SWHi", &Frame.ClockParams.sw_hi, "Summing Well Hi", &status);
+    fits_write_key(fptr, TDOUBLE, "SWLo", &Frame.ClockParams.sw_lo, "Summing Well Lo", &status);
 
-    if(this->CCDParams.CCDType == "SK") {
-        fits_write_key(fptr, TDOUBLE, "DGHi", &this->ClockParams.dg_hi, "DG Hi (SK only)", &status);
-        fits_write_key(fptr, TDOUBLE, "DGLo", &this->ClockParams.dg_lo, "DG Lo (SK only)", &status);
-        fits_write_key(fptr, TDOUBLE, "OGHi", &this->ClockParams.og_hi, "OG Hi (SK only)", &status);
-        fits_write_key(fptr, TDOUBLE, "OGLo", &this->ClockParams.og_lo, "OG Lo (SK only)", &status);
+    if(Frame.CCDParams.CCDType == "SK") {
+        fits_write_key(fptr, TDOUBLE, "DGHi", &Frame.ClockParams.dg_hi, "DG Hi (SK only)", &status);
+        fits_write_key(fptr, TDOUBLE, "DGLo", &Frame.ClockParams.dg_lo, "DG Lo (SK only)", &status);
+        fits_write_key(fptr, TDOUBLE, "OGHi", &Frame.ClockParams.og_hi, "OG Hi (SK only)", &status);
+        fits_write_key(fptr, TDOUBLE, "OGLo", &Frame.ClockParams.og_lo, "OG Lo (SK only)", &status);
     } else {
         double _DESPlaceHolder = -999.0;
         fits_write_key(fptr, TDOUBLE, "DGHi", &_DESPlaceHolder, "DG Hi (SK only)", &status);
@@ -113,46 +219,678 @@ void LeachController::SaveFits(std::string outFileName)
     }
 
     /*Write the Meta keywords - Biases*/
-    fits_write_key(fptr, TDOUBLE, "BATTR", &this->BiasParams.battrelay, "Battery box relay TTL Line", &status);
-    fits_write_key(fptr, TDOUBLE, "VDD", &this->BiasParams.vdd, "Vdd", &status);
-    fits_write_key(fptr, TSHORT, "VidOffL", &this->BiasParams.video_offsets_L, "Video pedestal offset L", &status);
-    fits_write_key(fptr, TSHORT, "VidOffU", &this->BiasParams.video_offsets_U, "Video pedestal offset U", &status);
+    fits_write_key(fptr, TDOUBLE, "BATTR", &Frame.BiasParams.battrelay, "Battery box relay TTL Line", &status);
+    fits_write_key(fptr, TDOUBLE, "VDD", &Frame.BiasParams.vdd, "Vdd", &status);
+    fits_write_key(fptr, TSHORT, "VidOffL", &Frame.BiasParams.video_offsets_L, "Video pedestal offset L", &status);
+    fits_write_key(fptr, TSHORT, "VidOffU", &Frame.BiasParams.video_offsets_U, "Video pedestal offset U", &status);
 
 
-    if(this->CCDParams.CCDType == "SK") {
+    if(Frame.CCDParams.CCDType == "SK") {
         double _SKPlaceHolder = -998.0;
-        fits_write_key(fptr, TDOUBLE, "Drain", &this->BiasParams.drain, "Drain (SK Only)", &status);
-        fits_write_key(fptr, TDOUBLE, "VRef", &this->BiasParams.vrefsk, "VRef", &status);
+        fits_write_key(fptr, TDOUBLE, "Drain", &Frame.BiasParams.drain, "Drain (SK Only)", &status);
+        fits_write_key(fptr, TDOUBLE, "VRef", &Frame.BiasParams.vrefsk, "VRef", &status);
         fits_write_key(fptr, TDOUBLE, "OpG", &_SKPlaceHolder, "OpG (DES Only)", &status);
     } else {
         double _DPlaceHolder = -997.0;
         fits_write_key(fptr, TDOUBLE, "Drain", &_DPlaceHolder, "Drain (SK Only)", &status);
-        fits_write_key(fptr, TDOUBLE, "VRef", &this->BiasParams.vref, "VRef", &status);
-        fits_write_key(fptr, TDOUBLE, "OpG", &this->BiasParams.opg, "OpG (DES only)", &status);
+        fits_write_key(fptr, TDOUBLE, "VRef", &Frame.BiasParams.vref, "VRef", &status);
+        fits_write_key(fptr, TDOUBLE, "OpG", &Frame.BiasParams.opg, "OpG (DES only)", &status);
     }
 
     /*Write the Meta keywords for time*/
-    std::string ProgStart = timePointAsString(this->ClockTimers.ProgramStart);
-    std::string ExpStart = timePointAsString(this->ClockTimers.ExpStart);
-    std::string ReadOutStart = timePointAsString(this->ClockTimers.Readoutstart);
-    std::string ReadOutEnd = timePointAsString(this->ClockTimers.ReadoutEnd);
+    std::string ProgStart = timePointAsString(Frame.ClockTimers.ProgramStart);
+    std::string ExpStart = timePointAsString(Frame.ClockTimers.ExpStart);
+    std::string ReadOutStart = timePointAsString(Frame.ClockTimers.Readoutstart);
+    std::string ReadOutEnd = timePointAsString(Frame.ClockTimers.ReadoutEnd);
 
     fits_write_key(fptr, TSTRING, "ProgStrt", (char*) ProgStart.c_str(), "Program start time", &status);
     fits_write_key(fptr, TSTRING, "ExpStart", (char*) ExpStart.c_str(), "Exposure start time", &status);
     fits_write_key(fptr, TSTRING, "RdStrt", (char*) ReadOutStart.c_str(), "Readout start time", &status);
     fits_write_key(fptr, TSTRING, "RdEnd", (char*) ReadOutEnd.c_str(), "Readout end time", &status);
 
-    fits_write_key(fptr, TDOUBLE, "MExp", &this->ClockTimers.MeasuredExp, "Measured exposure time (ms)", &status);
-    fits_write_key(fptr, TDOUBLE, "MRead", &this->ClockTimers.MeasuredReadout, "Measured readout time (ms)", &status);
+    fits_write_key(fptr, TDOUBLE, "MExp", &Frame.ClockTimers.MeasuredExp, "Measured exposure time (ms)", &status);
+    fits_write_key(fptr, TDOUBLE, "MRead", &Frame.ClockTimers.MeasuredReadout, "Measured readout time (ms)", &status);
+    fits_write_key(fptr, TDOUBLE, "PRead", &Frame.ClockTimers.PredictedReadout, "Predicted readout time (ms)", &status);
+
+    /*A readout that was stopped only has its first NROWSRD rows, the rest is 0*/
+    int bPartial = Frame.PartialRows >= 0;
+    fits_write_key(fptr, TLOGICAL, "PARTIAL", &bPartial, "The readout was stopped before the end", &status);
+    if (bPartial) {
+        fits_write_key(fptr, TINT, "NROWSRD", &Frame.PartialRows, "Rows read before the readout was stopped", &status);
+        if (!Frame.AbortReason.empty())
+            fits_write_key(fptr, TSTRING, "ABORTRSN", (char*) Frame.AbortReason.substr(0, 68).c_str(), "Why the readout was stopped", &status);
+    }
+
+    /*The copy out of the common buffer overlapped the next readout, the pixels can not be trusted*/
+    int bCopyLate = Frame.bCopyOverlapped;
+    fits_write_key(fptr, TLOGICAL, "CPYLATE", &bCopyLate, "Next readout started during the copy of this frame", &status);
+
+    /*Commands sent to the controller for this frame. Per opcode: C<op>N is the count, C<op>MS the total time.*/
+    long long nCmd = Frame.CmdStats.TotalCount();
+    double CmdMs = Frame.CmdStats.TotalMicros() / 1000.0;
+    fits_write_key(fptr, TLONGLONG, "NCMD", &nCmd, "Controller commands and polls for this frame", &status);
+    fits_write_key(fptr, TDOUBLE, "CMDMS", &CmdMs, "Time spent in controller commands (ms)", &status);
+    for (auto &c : Frame.CmdStats.Entries()) {
+        if (c.first.size() != 3) continue;
+        std::string KeyN = "C" + c.first + "N";
+        std::string KeyMs = "C" + c.first + "MS";
+        long long nOp = c.second.Count;
+        double OpMs = c.second.TotalMicros / 1000.0;
+        std::string CmtN = c.first + " commands";
+        std::string CmtMs = "Total time of the " + c.first + " commands (ms)";
+        fits_write_key(fptr, TLONGLONG, KeyN.c_str(), &nOp, CmtN.c_str(), &status);
+        fits_write_key(fptr, TDOUBLE, KeyMs.c_str(), &OpMs, CmtMs.c_str(), &status);
+    }
+
+    /*Scan coordinates*/
+    if (Frame.ScanPoint >= 0) {
+        int nScanPar = (int) Frame.ScanCoords.size();
+        fits_write_key(fptr, TINT, "SCANPT", &Frame.ScanPoint, "Index of the scan point", &status);
+        fits_write_key(fptr, TINT, "SCANNPAR", &nScanPar, "Number of scanned parameters", &status);
+        for (int i = 0; i < nScanPar; i++) {
+            std::string KeyPar = "SCANP" + std::to_string(i+1);
+            std::string KeyVal = "SCANV" + std::to_string(i+1);
+            fits_write_key(fptr, TSTRING, KeyPar.c_str(), (char*) Frame.ScanCoords[i].Parameter.c_str(), "Scanned parameter", &status);
+            fits_write_key(fptr, TDOUBLE, KeyVal.c_str(), &Frame.ScanCoords[i].Value, "Value of the scanned parameter", &status);
+        }
+    }
+
+}
+
+
+/*Where the image is on the CCD. nSamples is the number of image columns per pixel, the NDCMs for
+ *the raw image and 1 for the reduced ones. The LTM / LTV keys map the physical (unbinned) CCD
+ *pixel to the image pixel: image = LTM * physical + LTV, with the skipper samples of a pixel
+ *centred on it.*/
+static void WriteGeometryKeys(fitsfile *fptr, FrameRecord &Frame, int nSamples, int &status)
+{
+
+    const RegionVariables &R = Frame.RoiParams;
+    if (R.CCDCols <= 0 || R.CCDRows <= 0) return;
+
+    std::string sCCDSum = std::to_string(R.SerialBin) + " " + std::to_string(R.ParallelBin);
+    std::string sDetSize = "[1:" + std::to_string(R.CCDCols) + ",1:" + std::to_string(R.CCDRows) + "]";
+    std::string sDetSec = "[" + std::to_string(R.ColStart+1) + ":" + std::to_string(R.ColStart+R.Cols) + ","
+                          + std::to_string(R.RowStart+1) + ":" + std::to_string(R.RowStart+R.Rows) + "]";
+    std::string sDataSec = "[1:" + std::to_string(R.DataCols*nSamples) + ",1:" + std::to_string(R.ReadRows) + "]";
+
+    double LTM1 = (double) nSamples / R.SerialBin;
+    double LTM2 = 1.0 / R.ParallelBin;
+    double LTV1 = 0.5 - nSamples * (R.ColStart + 0.5) / R.SerialBin;
+    double LTV2 = 0.5 - (R.RowStart + 0.5) / R.ParallelBin;
+
+    fits_write_key(fptr, TSTRING, "CCDSUM", (char*) sCCDSum.c_str(), "Binning: serial parallel", &status);
+    fits_write_key(fptr, TSTRING, "DETSIZE", (char*) sDetSize.c_str(), "Size of the CCD (unbinned)", &status);
+    fits_write_key(fptr, TSTRING, "DETSEC", (char*) sDetSec.c_str(), "Region of the CCD read out (unbinned)", &status);
+    fits_write_key(fptr, TSTRING, "DATASEC", (char*) sDataSec.c_str(), "Image section with the data", &status);
+    if (R.OverscanReadCols > 0) {
+        std::string sBiasSec = "[" + std::to_string(R.DataCols*nSamples+1) + ":" + std::to_string((R.DataCols+R.OverscanReadCols)*nSamples)
+                               + ",1:" + std::to_string(R.ReadRows) + "]";
+        fits_write_key(fptr, TSTRING, "BIASSEC", (char*) sBiasSec.c_str(), "Image section with the overscan", &status);
+    }
+    fits_write_key(fptr, TDOUBLE, "LTM1_1", &LTM1, "Image to physical transformation matrix", &status);
+    fits_write_key(fptr, TDOUBLE, "LTM2_2", &LTM2, "Image to physical transformation matrix", &status);
+    fits_write_key(fptr, TDOUBLE, "LTV1", &LTV1, "Image to physical transformation vector", &status);
+    fits_write_key(fptr, TDOUBLE, "LTV2", &LTV2, "Image to physical transformation vector", &status);
+
+}
+
+
+/*Set up the tile compression for the next image HDU of dWidth x dHeight pixels.
+ *This has to happen before every fits_create_img.*/
+static void SetTileCompression(fitsfile *fptr, FrameRecord &Frame, long dWidth, long dHeight, int &status)
+{
+
+    std::string &Compression = Frame.OutParams.Compression;
+    if (Compression == "none") return;
+
+    int dCompType = RICE_1;
+    if (Compression == "hcompress") dCompType = HCOMPRESS_1;
+    else if (Compression == "gzip") dCompType = GZIP_2;
+    else if (Compression == "plio") dCompType = PLIO_1;
+
+    /*TileCols = 0 means the full width. HCOMPRESS needs 2D tiles of at least 4 rows.*/
+    long tileDim[2] = { Frame.OutParams.TileCols > 0 ? Frame.OutParams.TileCols : dWidth,
+                        Frame.OutParams.TileRows > 0 ? Frame.OutParams.TileRows : 1 };
+    if (dCompType == HCOMPRESS_1 && tileDim[1] < 4) tileDim[1] = dHeight < 16 ? dHeight : 16;
+    if (tileDim[0] > dWidth) tileDim[0] = dWidth;
+    if (tileDim[1] > dHeight) tileDim[1] = dHeight;
+
+    fits_set_compression_type(fptr, dCompType, &status);
+    fits_set_tile_dim(fptr, 2, tileDim, &status);
+    if (dCompType == HCOMPRESS_1) fits_set_hcomp_scale(fptr, Frame.OutParams.HCompressScale, &status);
+    /*A quantize level of 0 keeps float images lossless*/
+    fits_set_quantize_level(fptr, Frame.OutParams.FloatQuantizeLevel, &status);
+
+}
+
+
+/*Write how a reduced image was made: the samples used and the calibration of the MEAN image*/
+static void WriteReductionKeys(fitsfile *fptr, FrameRecord &Frame, bool bMean, int &status)
+{
+
+    int nUsed = Frame.CCDParams.nSkipperR - Frame.ProcParams.NDCMDiscard;
+    fits_write_key(fptr, TINT, "NDCMDISC", &Frame.ProcParams.NDCMDiscard, "Leading charge measurements discarded", &status);
+    fits_write_key(fptr, TINT, "NDCMUSED", &nUsed, "Charge measurements per pixel in the reduction", &status);
+    if (bMean && Frame.bPedestalSubtracted)
+        fits_write_key(fptr, TSTRING, "PEDSUB", (char*) Frame.ProcParams.OverscanSubtraction.c_str(), "Row pedestal from the overscan subtracted", &status);
+    if (bMean && Frame.bMastersSubtracted && !Frame.Masters->BiasFile.empty())
+        fits_write_key(fptr, TSTRING, "BIASFILE", (char*) Frame.Masters->BiasFile.c_str(), "Master bias subtracted", &status);
+    if (bMean && Frame.bMastersSubtracted && !Frame.Masters->DarkFile.empty())
+        fits_write_key(fptr, TSTRING, "DARKFILE", (char*) Frame.Masters->DarkFile.c_str(), "Master dark subtracted, scaled by MExp", &status);
+
+}
+
+
+/*Write one of the NDCM reduction products (mean or RMS) as an image HDU of dWidth columns.
+ *If this is the first HDU in the file, it also gets all the frame keys.
+ *With ReducedType = scaled, the mean is stored as 32 bit integers with BSCALE = 1/NDCMUSED, which
+ *is the resolution the mean has anyway, and the RMS as 16 bit integers in steps of RMSScale.
+ *Otherwise both are 32 bit floats.*/
+static void WriteReducedImage(fitsfile *fptr, FrameRecord &Frame, std::vector<float> &Pixels, long dWidth,
+                              const char *ExtName, bool bPrimary, int &status)
+{
+
+    long imageSizeXY[2] = { dWidth, Frame.CCDParams.dRows};
+    int nUsed = Frame.CCDParams.nSkipperR - Frame.ProcParams.NDCMDiscard;
+    bool bMean = std::string(ExtName).compare(0, 4, "MEAN") == 0;
+
+    int dBitpix = FLOAT_IMG;
+    double dScale = 1.0, dZero = 0.0;
+    if (Frame.OutParams.ReducedType == "scaled") {
+        /*The sums of the samples have to fit in 32 bits*/
+        if (bMean && (double) nUsed * 65535.0 < 2147483647.0) {
+            dBitpix = LONG_IMG;
+            dScale = 1.0 / nUsed;
+        }
+        else if (!bMean && Frame.OutParams.RMSScale > 0) {
+            dBitpix = SHORT_IMG;
+            dScale = Frame.OutParams.RMSScale;
+            dZero = 32768.0 * dScale;
+        }
+    }
+
+    SetTileCompression(fptr, Frame, imageSizeXY[0], imageSizeXY[1], status);
+    fits_create_img(fptr, dBitpix, 2, &imageSizeXY[0], &status);
+    fits_write_key(fptr, TSTRING, "EXTNAME", (char*) ExtName, "NDCM reduction product", &status);
+    if (bPrimary) WriteFrameKeys(fptr, Frame, status);
+    if (dWidth == Frame.CCDParams.dCols) WriteGeometryKeys(fptr, Frame, 1, status);
+    WriteReductionKeys(fptr, Frame, bMean, status);
+
+    if (dBitpix == FLOAT_IMG) {
+        fits_write_img(fptr, TFLOAT, 1, (long) Pixels.size(), Pixels.data(), &status);
+        return;
+    }
+
+    fits_write_key(fptr, TDOUBLE, "BSCALE", &dScale, "Physical value = BZERO + BSCALE * stored value", &status);
+    fits_write_key(fptr, TDOUBLE, "BZERO", &dZero, "Physical value = BZERO + BSCALE * stored value", &status);
+    fits_set_bscale(fptr, dScale, dZero, &status);
+
+    /*An RMS beyond the 16 bit range is stored as the largest value instead of failing the write*/
+    if (dBitpix == SHORT_IMG) {
+        float fMax = (float) (dZero + 32767.0 * dScale);
+        std::vector<float> Clipped(Pixels);
+        for (auto &v : Clipped) if (v > fMax) v = fMax;
+        fits_write_img(fptr, TFLOAT, 1, (long) Clipped.size(), Clipped.data(), &status);
+    }
+    else
+        fits_write_img(fptr, TFLOAT, 1, (long) Pixels.size(), Pixels.data(), &status);
+
+}
+
+
+/*Write the MEAN and RMS images as the zero suppressed MEAN_SPARSE table of SparseImage.hpp*/
+static void WriteSparseReduced(fitsfile *fptr, FrameRecord &Frame, int &status)
+{
+
+    SparseImage Sparse;
+    int nAmps = Frame.CCDParams.AmplifierDirection == "UL" ? 2 : 1;
+    SparsifyImage(Frame.MeanPixels.data(), Frame.RMSPixels.empty() ? NULL : Frame.RMSPixels.data(), Frame.CCDParams.dRows,
+                  Frame.CCDParams.dCols, nAmps, Frame.OutParams.SparseSigma, Sparse, Frame.ProcParams.ProcessingThreads);
+
+    WriteSparseTable(fptr, Sparse, "MEAN_SPARSE", status);
+    WriteReductionKeys(fptr, Frame, true, status);
+
+}
+
+
+/*Write the raw samples of a skipper frame (dCols pixels wide) as sample planes of dCols x dRows, plane s
+ *holding the s-th charge measurement of every pixel. RawLayout = cube makes a 3D image with NAXIS3 = NDCM,
+ *RawLayout = planes stacks the planes in a 2D image of dCols x (dRows*NDCM). The interleaved
+ *samples are transposed a block of planes at a time, so only a fraction of the frame is copied.
+ *Pixels from dReversedFromCol on have their samples in reverse order. The frame keys are only
+ *written if bPrimary.*/
+static void WriteSamplePlanes(fitsfile *fptr, FrameRecord &Frame, unsigned short *pData, int dCols, int dReversedFromCol,
+                              bool bPrimary, int &status)
+{
+
+    int nSamples = Frame.CCDParams.nSkipperR;
+    int dRows = Frame.CCDParams.dRows;
+    bool bCube = Frame.OutParams.RawLayout == "cube";
+
+    long imageSize[3] = { dCols, bCube ? dRows : (long) dRows * nSamples, nSamples };
+    SetTileCompression(fptr, Frame, imageSize[0], dRows, status);
+    fits_create_img(fptr, USHORT_IMG, bCube ? 3 : 2, &imageSize[0], &status);
+    if (bPrimary) {
+        WriteFrameKeys(fptr, Frame, status);
+        WriteGeometryKeys(fptr, Frame, 1, status);
+    }
+    fits_write_key(fptr, TSTRING, "SAMPLAYO", (char*) Frame.OutParams.RawLayout.c_str(), "Layout of the charge measurements", &status);
+
+    if (pData == NULL) {
+        printf ("Why is the data a null pointer?\n");
+        return;
+    }
+
+    size_t dPlaneSize = (size_t) dCols * dRows;
+    int nBlockPlanes = nSamples < 16 ? nSamples : 16;
+    std::vector<unsigned short> Planes((size_t) nBlockPlanes * dPlaneSize);
+
+    for (int s = 0; s < nSamples && status == 0; s += nBlockPlanes) {
+        int nPlanes = nSamples - s < nBlockPlanes ? nSamples - s : nBlockPlanes;
+        GatherSamplePlanes(pData, dRows, dCols, nSamples, dReversedFromCol, s, nPlanes, Planes.data(),
+                           Frame.ProcParams.ProcessingThreads);
+        fits_write_img(fptr, TUSHORT, 1 + (LONGLONG) s * dPlaneSize, (LONGLONG) nPlanes * dPlaneSize, Planes.data(), &status);
+    }
+
+}
+
+
+/*Copy columns [dFirstCol, dFirstCol+dHalfWidth) of every row of a dWidth wide image*/
+template <typename T>
+static std::vector<T> ExtractColumns(const T *pSrc, int dRows, int dWidth, int dFirstCol, int dHalfWidth)
+{
+    std::vector<T> Half((size_t) dRows * dHalfWidth);
+    for (int r = 0; r < dRows; r++)
+        std::memcpy(Half.data() + (size_t) r * dHalfWidth, pSrc + (size_t) r * dWidth + dFirstCol, dHalfWidth * sizeof(T));
+    return Half;
+}
+
+
+/*Keys that describe which amplifier an extension comes from*/
+static void WriteAmplifierKeys(fitsfile *fptr, FrameRecord &Frame, int Amp, int dFirstCol, int &status)
+{
+    int dVideoOffset = Amp == 0 ? Frame.BiasParams.video_offsets_U : Frame.BiasParams.video_offsets_L;
+    int dFirstCol1 = dFirstCol + 1;
+    int bMirrored = Amp == 1;
+    fits_write_key(fptr, TSTRING, "AMPNAME", (char*) (Amp == 0 ? "U" : "L"), "Amplifier of this extension", &status);
+    fits_write_key(fptr, TINT, "VIDOFF", &dVideoOffset, "Video pedestal offset of this amplifier", &status);
+    fits_write_key(fptr, TINT, "VIDGAIN", &Frame.CCDParams.Gain, "Video gain", &status);
+    fits_write_key(fptr, TINT, "AMPCOL1", &dFirstCol1, "First pixel column of this half in the full image", &status);
+    fits_write_key(fptr, TLOGICAL, "AMPFLIP", &bMirrored, "Columns are mirrored with respect to the readout", &status);
+}
+
+
+/*Write the half image of one amplifier (0 = U, 1 = L) into its own FITS file, as RAW_x, MEAN_x and RMS_x
+ *extensions behind an empty primary HDU*/
+static void WriteAmplifierFile(fitsfile *fptr, FrameRecord &Frame, unsigned short *pData, int Amp,
+                               bool bWriteRaw, bool bReduced, int &status)
+{
+
+    const char *sAmp = Amp == 0 ? "U" : "L";
+    int nSamples = Frame.CCDParams.nSkipperR;
+    int dRows = Frame.CCDParams.dRows;
+    int dHalfCols = Frame.CCDParams.dCols / 2;
+    int dFirstCol = Amp * dHalfCols;
+
+    fits_create_img(fptr, BYTE_IMG, 0, NULL, &status);
+
+    if (bWriteRaw && pData != NULL) {
+        std::vector<unsigned short> Raw = ExtractColumns(pData, dRows, Frame.CCDParams.dCols * nSamples,
+                                                         dFirstCol * nSamples, dHalfCols * nSamples);
+        if (Frame.OutParams.RawLayout != "interleaved" && nSamples > 1) {
+            /*Every pixel of the L half has its samples in reverse order*/
+            WriteSamplePlanes(fptr, Frame, Raw.data(), dHalfCols, Amp == 0 ? dHalfCols : 0, false, status);
+        } else {
+            long imageSizeXY[2] = { (long) dHalfCols * nSamples, dRows };
+            SetTileCompression(fptr, Frame, imageSizeXY[0], imageSizeXY[1], status);
+            fits_create_img(fptr, USHORT_IMG, 2, &imageSizeXY[0], &status);
+            fits_write_img(fptr, TUSHORT, 1, (LONGLONG) Raw.size(), Raw.data(), &status);
+        }
+        std::string ExtName = std::string("RAW_") + sAmp;
+        fits_write_key(fptr, TSTRING, "EXTNAME", (char*) ExtName.c_str(), "Raw samples of one amplifier", &status);
+        WriteAmplifierKeys(fptr, Frame, Amp, dFirstCol, status);
+    }
 
-    /*Write image*/
-    unsigned short *pData = (unsigned short *)pArcDev->CommonBufferVA();
-    if (pData==NULL)
+    if (bReduced) {
+        std::vector<float> Mean = ExtractColumns(Frame.MeanPixels.data(), dRows, Frame.CCDParams.dCols, dFirstCol, dHalfCols);
+        std::string ExtName = std::string("MEAN_") + sAmp;
+        WriteReducedImage(fptr, Frame, Mean, dHalfCols, ExtName.c_str(), false, status);
+        WriteAmplifierKeys(fptr, Frame, Amp, dFirstCol, status);
+
+        std::vector<float> RMS = ExtractColumns(Frame.RMSPixels.data(), dRows, Frame.CCDParams.dCols, dFirstCol, dHalfCols);
+        ExtName = std::string("RMS_") + sAmp;
+        WriteReducedImage(fptr, Frame, RMS, dHalfCols, ExtName.c_str(), false, status);
+        WriteAmplifierKeys(fptr, Frame, Amp, dFirstCol, status);
+    }
+
+}
+
+
+/*Write a UL frame with the U and L halves in their own extensions (SplitAmplifiers). The primary HDU
+ *only has the frame keys. Each half is extracted, encoded and compressed into an in-memory FITS file
+ *on its own thread, and the finished HDUs are then copied into the output file one after the other.
+ *Without a thread safe (reentrant) build of cfitsio, the two halves are encoded one after the other.*/
+static void WriteAmplifierHDUs(fitsfile *fptr, FrameRecord &Frame, unsigned short *pData,
+                               bool bWriteRaw, bool bReduced, int &status)
+{
+
+    fits_create_img(fptr, BYTE_IMG, 0, NULL, &status);
+    WriteFrameKeys(fptr, Frame, status);
+    WriteGeometryKeys(fptr, Frame, bWriteRaw ? Frame.CCDParams.nSkipperR : 1, status);
+    if (status) return;
+
+    if (pData == NULL && bWriteRaw)
         printf ("Why is the data a null pointer?\n");
-    fits_write_img(fptr, TUSHORT, dfpixel, nPixelsToWrite, pData, &status);
+
+    fitsfile *pAmpFile[2] = { NULL, NULL };
+    int AmpStatus[2] = { 0, 0 };
+    auto EncodeHalf = [&](int a) {
+        fits_create_file(&pAmpFile[a], "mem://", &AmpStatus[a]);
+        WriteAmplifierFile(pAmpFile[a], Frame, pData, a, bWriteRaw, bReduced, AmpStatus[a]);
+    };
+    if (fits_is_reentrant()) {
+        std::vector<std::thread> Workers;
+        for (int a = 0; a < 2; a++) Workers.emplace_back(EncodeHalf, a);
+        for (auto &W : Workers) W.join();
+    }
+    else for (int a = 0; a < 2; a++) EncodeHalf(a);
+
+    for (int a = 0; a < 2; a++) {
+        if (AmpStatus[a]) {
+            fits_report_error(stderr, AmpStatus[a]);
+            if (status == 0) status = AmpStatus[a];
+        }
+        int nHDUs = 0;
+        if (pAmpFile[a] != NULL && fits_get_num_hdus(pAmpFile[a], &nHDUs, &AmpStatus[a]) == 0) {
+            for (int h = 2; h <= nHDUs && status == 0; h++) {
+                int hdutype;
+                fits_movabs_hdu(pAmpFile[a], h, &hdutype, &status);
+                fits_copy_hdu(pAmpFile[a], fptr, 0, &status);
+            }
+        }
+        int closeStatus = 0;
+        if (pAmpFile[a] != NULL) fits_close_file(pAmpFile[a], &closeStatus);
+    }
+
+}
+
+
+/*Write the pixel count time series of the readout as the READOUT binary table, with the
+ *rate statistics and stall events in its header. The rates are taken over 10 ms windows.*/
+static void WriteTelemetryTable(fitsfile *fptr, FrameRecord &Frame, int &status)
+{
+
+    if (Frame.Telemetry.empty()) return;
+
+    long nRows = (long) Frame.Telemetry.size();
+    std::vector<double> Times(nRows);
+    std::vector<int> Counts(nRows);
+    for (long i = 0; i < nRows; i++) {
+        Times[i] = Frame.Telemetry[i].Time;
+        Counts[i] = Frame.Telemetry[i].PixelCount;
+    }
+
+    TelemetrySummary S = ReadoutTelemetry::Summarize(Frame.Telemetry, Frame.TelemetryDropped, 0.01, Frame.StallEventMs);
+
+    char *ttype[] = { (char*) "TIME", (char*) "PIXELS" };
+    char *tform[] = { (char*) "1D", (char*) "1J" };
+    char *tunit[] = { (char*) "s", (char*) "pixel" };
+    fits_create_tbl(fptr, BINARY_TBL, nRows, 2, ttype, tform, tunit, "READOUT", &status);
+    fits_write_col(fptr, TDOUBLE, 1, 1, 1, nRows, Times.data(), &status);
+    fits_write_col(fptr, TINT, 2, 1, 1, nRows, Counts.data(), &status);
+
+    fits_write_key(fptr, TLONG, "NSAMPLE", &S.nSamples, "Pixel count samples in the table", &status);
+    fits_write_key(fptr, TLONG, "NDROPPED", &S.nDropped, "Earliest samples overwritten in the ring", &status);
+    fits_write_key(fptr, TDOUBLE, "RATEMEAN", &S.MeanRate, "Mean pixel rate (pix/s)", &status);
+    fits_write_key(fptr, TDOUBLE, "RATEMIN", &S.MinRate, "Lowest pixel rate over 10 ms (pix/s)", &status);
+    fits_write_key(fptr, TDOUBLE, "RATEMAX", &S.MaxRate, "Highest pixel rate over 10 ms (pix/s)", &status);
+    fits_write_key(fptr, TDOUBLE, "STALLMS", &Frame.StallEventMs, "Pause of the pixel count counted as a stall (ms)", &status);
+    fits_write_key(fptr, TINT, "NSTALL", &S.nStalls, "Stall events during the readout", &status);
+    fits_write_key(fptr, TDOUBLE, "STALLMAX", &S.LongestStall, "Longest stall (ms)", &status);
+    fits_write_key(fptr, TDOUBLE, "STALLSUM", &S.StallTime, "Total time in stalls (ms)", &status);
+
+}
+
+
+/*Write the clusters of the frame as the CLUSTERS binary table, one row per cluster with its pixels as
+ *variable length arrays, and the pedestal and noise of every row as the PEDESTALS table*/
+static void WriteClusterTables(fitsfile *fptr, FrameRecord &Frame, int &status)
+{
+
+    if (!Frame.Clusters) return;
+    const ClusterTable &T = *Frame.Clusters;
+
+    long nEvents = (long) T.Events.size();
+    char *ttype[] = { (char*) "NPIX", (char*) "CHARGE", (char*) "MAXVAL", (char*) "XMIN", (char*) "XMAX", (char*) "YMIN",
+                      (char*) "YMAX", (char*) "XBAR", (char*) "YBAR", (char*) "TRUNC", (char*) "PIX_X", (char*) "PIX_Y",
+                      (char*) "PIX_VAL" };
+    char *tform[] = { (char*) "1J", (char*) "1D", (char*) "1E", (char*) "1J", (char*) "1J", (char*) "1J", (char*) "1J",
+                      (char*) "1D", (char*) "1D", (char*) "1L", (char*) "1PJ", (char*) "1PJ", (char*) "1PE" };
+    char *tunit[] = { (char*) "pixel", (char*) "ADU", (char*) "ADU", (char*) "pixel", (char*) "pixel", (char*) "pixel",
+                      (char*) "pixel", (char*) "pixel", (char*) "pixel", (char*) "", (char*) "pixel", (char*) "pixel",
+                      (char*) "ADU" };
+    fits_create_tbl(fptr, BINARY_TBL, nEvents, 13, ttype, tform, tunit, "CLUSTERS", &status);
+
+    for (long i = 0; i < nEvents && status == 0; i++) {
+        const ClusterEvent &E = T.Events[i];
+        char bTruncated = E.bTruncated;
+        long r = i + 1;
+        fits_write_col(fptr, TINT, 1, r, 1, 1, (void*) &E.nPixels, &status);
+        fits_write_col(fptr, TDOUBLE, 2, r, 1, 1, (void*) &E.Charge, &status);
+        fits_write_col(fptr, TFLOAT, 3, r, 1, 1, (void*) &E.MaxValue, &status);
+        fits_write_col(fptr, TINT, 4, r, 1, 1, (void*) &E.XMin, &status);
+        fits_write_col(fptr, TINT, 5, r, 1, 1, (void*) &E.XMax, &status);
+        fits_write_col(fptr, TINT, 6, r, 1, 1, (void*) &E.YMin, &status);
+        fits_write_col(fptr, TINT, 7, r, 1, 1, (void*) &E.YMax, &status);
+        fits_write_col(fptr, TDOUBLE, 8, r, 1, 1, (void*) &E.XMean, &status);
+        fits_write_col(fptr, TDOUBLE, 9, r, 1, 1, (void*) &E.YMean, &status);
+        fits_write_col(fptr, TLOGICAL, 10, r, 1, 1, &bTruncated, &status);
+        fits_write_col(fptr, TINT, 11, r, 1, (LONGLONG) E.X.size(), (void*) E.X.data(), &status);
+        fits_write_col(fptr, TINT, 12, r, 1, (LONGLONG) E.Y.size(), (void*) E.Y.data(), &status);
+        fits_write_col(fptr, TFLOAT, 13, r, 1, (LONGLONG) E.Value.size(), (void*) E.Value.data(), &status);
+    }
+
+    int dSamples = T.nSamples;
+    fits_write_key(fptr, TLONG, "NCLUSTER", &nEvents, "Clusters found in the frame", &status);
+    fits_write_key(fptr, TLONG, "NPIXABOV", (void*) &T.nPixelsAbove, "Pixels above the pixel threshold", &status);
+    fits_write_key(fptr, TDOUBLE, "SEEDSIG", (void*) &T.SeedSigma, "Seed threshold (sigma of the noise)", &status);
+    fits_write_key(fptr, TDOUBLE, "PIXSIG", (void*) &T.PixelSigma, "Pixel threshold (sigma of the noise)", &status);
+    fits_write_key(fptr, TINT, "NSAMPAVG", &dSamples, "Samples averaged per pixel", &status);
+
+    long nRows = (long) T.Rows.size();
+    if (nRows == 0) return;
+    std::vector<float> Pedestal[2], Noise[2];
+    for (int a = 0; a < T.nAmps; a++) {
+        Pedestal[a].resize(nRows);
+        Noise[a].resize(nRows);
+        for (long r = 0; r < nRows; r++) {
+            Pedestal[a][r] = T.Rows[r].Pedestal[a];
+            Noise[a][r] = T.Rows[r].Noise[a];
+        }
+    }
+
+    char *ptype[] = { (char*) "PEDESTAL_U", (char*) "NOISE_U", (char*) "PEDESTAL_L", (char*) "NOISE_L" };
+    char *pform[] = { (char*) "1E", (char*) "1E", (char*) "1E", (char*) "1E" };
+    char *punit[] = { (char*) "ADU", (char*) "ADU", (char*) "ADU", (char*) "ADU" };
+    if (T.nAmps == 1) {
+        ptype[0] = (char*) "PEDESTAL";
+        ptype[1] = (char*) "NOISE";
+    }
+    fits_create_tbl(fptr, BINARY_TBL, nRows, 2 * T.nAmps, ptype, pform, punit, "PEDESTALS", &status);
+    for (int a = 0; a < T.nAmps; a++) {
+        fits_write_col(fptr, TFLOAT, 1 + 2*a, 1, 1, nRows, Pedestal[a].data(), &status);
+        fits_write_col(fptr, TFLOAT, 2 + 2*a, 1, 1, nRows, Noise[a].data(), &status);
+    }
+
+}
+
+
+/*Write a frame and all the settings it was taken with as a FITS file.
+ *If the frame is to be NDCM reduced, the mean and RMS images are written as extra HDUs,
+ *or instead of the raw samples if KeepRawNDCM is false. With compression turned on,
+ *every image is stored as a tile compressed HDU. The clusters found during the readout are
+ *added as tables, or written instead of the images with ClusterOnly.
+ *This does not touch the controller, so it is safe to call from the writer thread.*/
+int WriteFrameToFits(FrameRecord &Frame, unsigned short *pData)
+{
+
+    /*These are the temporary FITS variables we need to open the file
+     * fptr -> fits file pointer
+     * status, imgtype and nAxis are self explanatory
+     * imageSizeXY stores the size of the image
+     * fpixelallread is something weird about FITS that I didnt care to read too much except
+     *        it needs to be {1,1} to read the entire file
+     */
+    fitsfile *fptr;       /* pointer to the FITS file; defined in fitsio.h */
+    int status, nAxis=2;
+    int dfpixel = 1;
+    long nPixelsToWrite;
+    long imageSizeXY[2] = { Frame.CCDParams.dCols*Frame.CCDParams.nSkipperR, Frame.CCDParams.dRows};
+    nPixelsToWrite = imageSizeXY[0] * imageSizeXY[1];
+
+    /*Only the clusters: the settings in the primary header, no image*/
+    if (Frame.OutParams.ClusterOnly && Frame.Clusters) {
+        std::unique_lock<std::mutex> FitsLock = FitsWriteLock();
+        status = 0;
+        fits_create_file(&fptr, Frame.OutFileName.c_str(), &status);
+        fits_create_img(fptr, USHORT_IMG, 0, NULL, &status);
+        WriteFrameKeys(fptr, Frame, status);
+        WriteGeometryKeys(fptr, Frame, Frame.CCDParams.nSkipperR, status);
+        WriteClusterTables(fptr, Frame, status);
+        WriteTelemetryTable(fptr, Frame, status);
+        fits_close_file(fptr, &status);
+        fits_report_error(stderr, status);
+        return status;
+    }
+
+    /*Fast spill: no reduction, no FITS encoding*/
+    if (Frame.OutParams.Format == "raw") {
+        std::unique_lock<std::mutex> FitsLock = FitsWriteLock();
+        return WriteFrameToRaw(Frame, pData);
+    }
+
+    /*Collapse the skipper samples first, if asked to*/
+    bool bReduced = ReduceFrameNDCM(Frame, pData);
+    bool bWriteRaw = !bReduced || Frame.ProcParams.KeepRawNDCM;
+    if (bReduced) CalibrateFrame(Frame);
+
+    /*The reduction runs alongside other writers, the file is written alone*/
+    std::unique_lock<std::mutex> FitsLock = FitsWriteLock();
+
+    status = 0;         /* initialize status before calling fitsio routines */
+    fits_create_file(&fptr, Frame.OutFileName.c_str(), &status);
+
+    /*The sparse table holds both halves of a UL image with their own levels*/
+    bool bSparse = bReduced && Frame.OutParams.ReducedStorage == "sparse";
+    bool bSplit = Frame.OutParams.SplitAmplifiers && Frame.CCDParams.AmplifierDirection == "UL" && !bSparse;
+
+    if (bSplit) {
+        WriteAmplifierHDUs(fptr, Frame, pData, bWriteRaw, bReduced, status);
+    }
+    else if (bWriteRaw && Frame.OutParams.RawLayout != "interleaved" && Frame.CCDParams.nSkipperR > 1) {
+        /*Once the two amplifiers are de-interlaced, the L half is mirrored*/
+        int dCols = Frame.CCDParams.dCols;
+        WriteSamplePlanes(fptr, Frame, pData, dCols, Frame.CCDParams.AmplifierDirection == "UL" ? dCols / 2 : dCols, true, status);
+    }
+    else if (bWriteRaw) {
+        SetTileCompression(fptr, Frame, imageSizeXY[0], imageSizeXY[1], status);
+        fits_create_img(fptr, USHORT_IMG, nAxis, &imageSizeXY[0], &status);
+        WriteFrameKeys(fptr, Frame, status);
+        WriteGeometryKeys(fptr, Frame, Frame.CCDParams.nSkipperR, status);
+
+        /*Write image*/
+        if (pData==NULL)
+            printf ("Why is the data a null pointer?\n");
+        fits_write_img(fptr, TUSHORT, dfpixel, nPixelsToWrite, (void *) pData, &status);
+    }
+
+    if (bSparse) {
+        /*A table can not be the primary HDU*/
+        if (!bWriteRaw) {
+            fits_create_img(fptr, FLOAT_IMG, 0, NULL, &status);
+            WriteFrameKeys(fptr, Frame, status);
+            WriteGeometryKeys(fptr, Frame, 1, status);
+        }
+        WriteSparseReduced(fptr, Frame, status);
+    }
+    else if (bReduced && !bSplit) {
+        WriteReducedImage(fptr, Frame, Frame.MeanPixels, Frame.CCDParams.dCols, "MEAN", !bWriteRaw, status);
+        WriteReducedImage(fptr, Frame, Frame.RMSPixels, Frame.CCDParams.dCols, "RMS", false, status);
+    }
+
+    WriteClusterTables(fptr, Frame, status);
+    WriteTelemetryTable(fptr, Frame, status);
+
     /*Done*/
     fits_close_file(fptr, &status);
     fits_report_error(stderr, status);
+    return status;
 }
 
-#endif
+
+std::unique_lock<std::mutex> FitsWriteLock(void )
+{
+
+    static std::mutex FitsWriteMutex;
+    if (fits_is_reentrant()) return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(FitsWriteMutex);
+
+}
+
+
+std::vector<char> FrameMetadataFits(FrameRecord &Frame)
+{
+
+    fitsfile *fptr;
+    int status = 0;
+    size_t nMemBytes = 2880;
+    void *pMem = malloc(nMemBytes);
+    std::vector<char> Metadata;
+
+    fits_create_memfile(&fptr, &pMem, &nMemBytes, 2880, realloc, &status);
+    fits_create_img(fptr, USHORT_IMG, 0, NULL, &status);
+    WriteFrameKeys(fptr, Frame, status);
+    WriteGeometryKeys(fptr, Frame, Frame.CCDParams.nSkipperR, status);
+    WriteClusterTables(fptr, Frame, status);
+    WriteTelemetryTable(fptr, Frame, status);
+    fits_flush_file(fptr, &status);
+
+    /*The memory file can be larger than the FITS file in it*/
+    LONGLONG HeadStart, DataStart, DataEnd;
+    fits_get_hduaddrll(fptr, &HeadStart, &DataStart, &DataEnd, &status);
+    fits_close_file(fptr, &status);
+
+    if (status == 0) {
+        size_t nBytes = (size_t) (DataEnd + 2879) / 2880 * 2880;
+        if (nBytes > nMemBytes) nBytes = nMemBytes;
+        Metadata.assign((const char*) pMem, (const char*) pMem + nBytes);
+    }
+    else fits_report_error(stderr, status);
+
+    free(pMem);
+    return Metadata;
+}
+
+
+int WriteFrameToRaw(FrameRecord &Frame, unsigned short *pData)
+{
+
+    if (pData == NULL) {
+        printf ("Why is the data a null pointer?\n");
+        return -1;
+    }
+
+    RawFrameHeader Header;
+    memset(&Header, 0, sizeof(Header));
+    Header.dCols = Frame.CCDParams.dCols;
+    Header.dRows = Frame.CCDParams.dRows;
+    Header.nSkipperR = Frame.CCDParams.nSkipperR;
+    Header.Width = Frame.CCDParams.dCols * Frame.CCDParams.nSkipperR;
+    Header.Height = Frame.CCDParams.dRows;
+    Header.Interlaced = Frame.bInterlaced ? 1 : 0;
+    strncpy(Header.AmplifierDirection, Frame.CCDParams.AmplifierDirection.c_str(), sizeof(Header.AmplifierDirection) - 1);
+
+    Frame.OutFileName = RawFrameFileName(Frame.OutFileName);
+    return WriteRawFrame(Frame.OutFileName, Header, FrameMetadataFits(Frame), pData, Frame.OutParams.DirectIO);
+}
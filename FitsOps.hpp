@@ -0,0 +1,30 @@
+/* *********************************************************************
+ * Declarations of the FITS output routines that do not need a live
+ * controller. These work on FrameRecords that have already been copied
+ * out of the common buffer, so they can be run from a writer thread.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_FITSOPS_HPP
+#define CCDDRONE_FITSOPS_HPP
+
+#include <vector>
+#include <mutex>
+
+#include "CCDControlDataTypes.hpp"
+
+/*Returns the cfitsio status, 0 if the file was written*/
+int WriteFrameToFits(FrameRecord &, unsigned short * );
+
+/*Held while a file is written, so that a cfitsio that is not thread safe is only used by one
+ *thread at a time, whichever controller or writer it belongs to. Empty if cfitsio is reentrant.*/
+std::unique_lock<std::mutex> FitsWriteLock(void );
+
+/*Keys and READOUT table of a frame as a FITS file without an image, the metadata of a raw frame file*/
+std::vector<char> FrameMetadataFits(FrameRecord &);
+
+/*Dump the samples of a frame as they are to <name>.raw, see RawFrame.hpp. OutFileName is changed to the raw file.*/
+int WriteFrameToRaw(FrameRecord &, unsigned short * );
+
+
+#endif //CCDDRONE_FITSOPS_HPP
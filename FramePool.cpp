@@ -0,0 +1,207 @@
+/* *********************************************************************
+ * This file contains the host frame buffer pool. See FramePool.hpp.
+ * *********************************************************************
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "FramePool.hpp"
+
+/*Huge pages are 2 MB on x86-64. The mapping is rounded up to whole pages.*/
+#define FRAMEPOOL_HUGEPAGE_BYTES (2UL*1024*1024)
+
+
+struct FramePoolBlock{
+    void *pMap;
+    size_t nMappedBytes;
+};
+
+
+struct FramePoolShared{
+
+    std::mutex mtx;
+    std::vector<FramePoolBlock> Free;
+    size_t BufferPixels = 0;
+    size_t nKeep = 0;
+    bool bHugePages = false;
+    bool bPrefault = false;
+    bool bHugePagesFailed = false;
+    bool bConfigured = false;
+
+    FramePoolBlock Map(void );
+    static void Unmap(const FramePoolBlock &B) { if (B.pMap != NULL) munmap(B.pMap, B.nMappedBytes); }
+
+    ~FramePoolShared() { for (auto &B : Free) Unmap(B); }
+
+};
+
+
+/*Map one buffer. With huge pages, explicit hugetlbfs pages are tried first. If none are reserved
+ *(vm.nr_hugepages), normal pages with transparent huge pages are used.*/
+FramePoolBlock FramePoolShared::Map(void )
+{
+
+    FramePoolBlock B = { NULL, 0 };
+    size_t nBytes = this->BufferPixels * sizeof(unsigned short);
+    if (nBytes == 0) return B;
+
+    int dFlags = MAP_PRIVATE | MAP_ANONYMOUS | (this->bPrefault ? MAP_POPULATE : 0);
+
+    if (this->bHugePages && !this->bHugePagesFailed) {
+        size_t nHugeBytes = (nBytes + FRAMEPOOL_HUGEPAGE_BYTES - 1) / FRAMEPOOL_HUGEPAGE_BYTES * FRAMEPOOL_HUGEPAGE_BYTES;
+        void *pMap = mmap(NULL, nHugeBytes, PROT_READ | PROT_WRITE, dFlags | MAP_HUGETLB, -1, 0);
+        if (pMap != MAP_FAILED) {
+            B.pMap = pMap;
+            B.nMappedBytes = nHugeBytes;
+            return B;
+        }
+        std::cout << "No huge pages for the frame buffers (" << strerror(errno) << "). Using transparent huge pages.\n";
+        this->bHugePagesFailed = true;
+    }
+
+    void *pMap = mmap(NULL, nBytes, PROT_READ | PROT_WRITE, dFlags, -1, 0);
+    if (pMap == MAP_FAILED) {
+        std::cout << "Could not map " << nBytes << " bytes for a frame buffer: " << strerror(errno) << "\n";
+        return B;
+    }
+#ifdef MADV_HUGEPAGE
+    if (this->bHugePages) madvise(pMap, nBytes, MADV_HUGEPAGE);
+#endif
+
+    B.pMap = pMap;
+    B.nMappedBytes = nBytes;
+    return B;
+
+}
+
+
+FrameBuffer& FrameBuffer::operator=(FrameBuffer &&Other) noexcept
+{
+
+    if (this != &Other) {
+        this->Release();
+        this->pPool = std::move(Other.pPool);
+        this->pData = Other.pData;
+        this->nPixels = Other.nPixels;
+        this->nMappedBytes = Other.nMappedBytes;
+        Other.pData = NULL;
+        Other.nPixels = 0;
+        Other.nMappedBytes = 0;
+    }
+    return *this;
+
+}
+
+
+void FrameBuffer::Release(void )
+{
+
+    if (this->pData == NULL) return;
+
+    FramePoolBlock B = { (void*) this->pData, this->nMappedBytes };
+    bool bKept = false;
+    if (this->pPool) {
+        std::lock_guard<std::mutex> lock(this->pPool->mtx);
+        if (this->nPixels == this->pPool->BufferPixels && this->pPool->Free.size() < this->pPool->nKeep) {
+            this->pPool->Free.push_back(B);
+            bKept = true;
+        }
+    }
+    if (!bKept) FramePoolShared::Unmap(B);
+
+    this->pPool.reset();
+    this->pData = NULL;
+    this->nPixels = 0;
+    this->nMappedBytes = 0;
+
+}
+
+
+FramePool::FramePool() : pShared(new FramePoolShared)
+{
+}
+
+
+int FramePool::Configure(size_t nPixels, int nBuffers, bool bHugePages, bool bPrefault)
+{
+
+    std::lock_guard<std::mutex> lock(this->pShared->mtx);
+    FramePoolShared &S = *this->pShared;
+
+    if (nBuffers < 0) nBuffers = 0;
+    if (S.bConfigured && S.BufferPixels == nPixels && S.bHugePages == bHugePages && S.nKeep == (size_t) nBuffers) return 0;
+
+    if (S.BufferPixels != nPixels || S.bHugePages != bHugePages) {
+        for (auto &B : S.Free) FramePoolShared::Unmap(B);
+        S.Free.clear();
+        S.BufferPixels = nPixels;
+        S.bHugePages = bHugePages;
+        S.bHugePagesFailed = false;
+    }
+    S.bPrefault = bPrefault;
+    S.nKeep = (size_t) nBuffers;
+
+    while (S.Free.size() > S.nKeep) {
+        FramePoolShared::Unmap(S.Free.back());
+        S.Free.pop_back();
+    }
+    while (S.Free.size() < S.nKeep) {
+        FramePoolBlock B = S.Map();
+        if (B.pMap == NULL) return -1;
+        S.Free.push_back(B);
+    }
+    S.bConfigured = true;
+
+    return 0;
+
+}
+
+
+FrameBuffer FramePool::Acquire(void )
+{
+
+    FrameBuffer Buffer;
+    FramePoolBlock B = { NULL, 0 };
+
+    {
+        std::lock_guard<std::mutex> lock(this->pShared->mtx);
+        if (!this->pShared->Free.empty()) {
+            B = this->pShared->Free.back();
+            this->pShared->Free.pop_back();
+        } else {
+            B = this->pShared->Map();
+        }
+        if (B.pMap == NULL) return Buffer;
+        Buffer.nPixels = this->pShared->BufferPixels;
+    }
+
+    Buffer.pPool = this->pShared;
+    Buffer.pData = (unsigned short*) B.pMap;
+    Buffer.nMappedBytes = B.nMappedBytes;
+    return Buffer;
+
+}
+
+
+size_t FramePool::BufferPixels(void ) const
+{
+    std::lock_guard<std::mutex> lock(this->pShared->mtx);
+    return this->pShared->BufferPixels;
+}
+
+bool FramePool::HugePages(void ) const
+{
+    std::lock_guard<std::mutex> lock(this->pShared->mtx);
+    return this->pShared->bHugePages && !this->pShared->bHugePagesFailed;
+}
+
+int FramePool::FreeBuffers(void ) const
+{
+    std::lock_guard<std::mutex> lock(this->pShared->mtx);
+    return (int) this->pShared->Free.size();
+}
@@ -0,0 +1,84 @@
+/* *********************************************************************
+ * Pool of host side frame buffers. Frames that are copied out of the
+ * common buffer (multi-frame mode) or assembled on the host (segmented
+ * readout) are put in buffers from this pool instead of freshly
+ * allocated memory, so the page faults and the zeroing of a multi-GB
+ * allocation are only paid once. The buffers can be backed by huge
+ * pages and faulted in when the pool is set up.
+ *
+ * A buffer is handed from the acquisition to the reduction and the
+ * writer as a FrameBuffer handle, which is moved and never copied. It
+ * goes back to the pool when the last stage lets go of the handle. The
+ * pool state is shared with the handles, so a handle may outlive the
+ * pool it came from.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_FRAMEPOOL_HPP
+#define CCDDRONE_FRAMEPOOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+struct FramePoolShared;
+
+
+class FrameBuffer
+{
+
+private:
+    std::shared_ptr<FramePoolShared> pPool;
+    unsigned short *pData = NULL;
+    size_t nPixels = 0;
+    size_t nMappedBytes = 0;
+
+    friend class FramePool;
+
+public:
+    FrameBuffer() {};
+    ~FrameBuffer() { Release(); }
+    FrameBuffer(FrameBuffer &&Other) noexcept { *this = std::move(Other); }
+    FrameBuffer& operator=(FrameBuffer &&Other) noexcept;
+    FrameBuffer(const FrameBuffer& ) = delete;
+    FrameBuffer& operator=(const FrameBuffer& ) = delete;
+
+    unsigned short* Data(void ) { return pData; }
+    const unsigned short* Data(void ) const { return pData; }
+    size_t Pixels(void ) const { return nPixels; }
+    bool Valid(void ) const { return pData != NULL; }
+
+    /*Give the buffer back to the pool*/
+    void Release(void );
+
+};
+
+
+class FramePool
+{
+
+private:
+    std::shared_ptr<FramePoolShared> pShared;
+
+public:
+    FramePool();
+
+    /*Set the pool up for frames of nPixels. nBuffers are mapped (and faulted in if bPrefault) right
+     *away and kept for reuse. Nothing happens if the pool is already set up like this. Buffers of another size that are still out are freed when they come back.
+     *Returns 0 on success and -1 if the buffers could not be mapped.*/
+    int Configure(size_t nPixels, int nBuffers, bool bHugePages, bool bPrefault);
+
+    /*A buffer of the configured size. If none is free another one is mapped, so this never waits.
+     *The buffer is invalid if that fails.*/
+    FrameBuffer Acquire(void );
+
+    size_t BufferPixels(void ) const;
+    bool HugePages(void ) const;
+    int FreeBuffers(void ) const;
+
+};
+
+
+#endif //CCDDRONE_FRAMEPOOL_HPP
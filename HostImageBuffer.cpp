@@ -0,0 +1,103 @@
+/* *********************************************************************
+ * This file contains the host side image buffer used by the segmented
+ * readout. See HostImageBuffer.hpp for a description.
+ * *********************************************************************
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "HostImageBuffer.hpp"
+
+
+
+HostImageBuffer::HostImageBuffer()
+{
+    this->pMap = NULL;
+    this->MapBytes = 0;
+    this->fd = -1;
+}
+
+HostImageBuffer::~HostImageBuffer()
+{
+    this->Release();
+}
+
+
+int HostImageBuffer::Allocate(size_t nPixels, std::string BackingFile)
+{
+
+    size_t nBytes = nPixels * sizeof(unsigned short);
+
+    /*Re-use the existing mapping if it is the same size and kind*/
+    if (this->pMap != NULL && this->MapBytes == nBytes && (this->fd >= 0) == !BackingFile.empty()) return 0;
+    this->Release();
+    if (nBytes == 0) return 0;
+
+    void *pNewMap;
+    if (BackingFile.empty()) {
+        pNewMap = mmap(NULL, nBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        this->fd = open(BackingFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (this->fd < 0) {
+            std::cout << "Could not open the image backing file " << BackingFile << ": " << strerror(errno) << "\n";
+            return -1;
+        }
+        if (ftruncate(this->fd, (off_t) nBytes) != 0) {
+            std::cout << "Could not size the image backing file " << BackingFile << ": " << strerror(errno) << "\n";
+            close(this->fd);
+            this->fd = -1;
+            return -1;
+        }
+        pNewMap = mmap(NULL, nBytes, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+    }
+
+    if (pNewMap == MAP_FAILED) {
+        std::cout << "Could not map " << nBytes << " bytes for the host image buffer: " << strerror(errno) << "\n";
+        if (this->fd >= 0) close(this->fd);
+        this->fd = -1;
+        return -1;
+    }
+
+    madvise(pNewMap, nBytes, MADV_SEQUENTIAL);
+    this->pMap = pNewMap;
+    this->MapBytes = nBytes;
+    return 0;
+}
+
+
+void HostImageBuffer::Release(void )
+{
+
+    if (this->pMap != NULL) munmap(this->pMap, this->MapBytes);
+    if (this->fd >= 0) close(this->fd);
+
+    this->pMap = NULL;
+    this->MapBytes = 0;
+    this->fd = -1;
+}
+
+
+void HostImageBuffer::Retire(size_t nFirstPixel, size_t nPixels)
+{
+
+    /*Only file backed pages can be written back and dropped without losing them*/
+    if (this->fd < 0 || this->pMap == NULL) return;
+
+    long dPage = sysconf(_SC_PAGESIZE);
+    size_t dStart = nFirstPixel * sizeof(unsigned short);
+    size_t dEnd = dStart + nPixels * sizeof(unsigned short);
+    dStart -= dStart % dPage;
+    if (dEnd > this->MapBytes) dEnd = this->MapBytes;
+    if (dEnd <= dStart) return;
+
+    char *pStart = (char *) this->pMap + dStart;
+    msync(pStart, dEnd - dStart, MS_ASYNC);
+    madvise(pStart, dEnd - dStart, MADV_DONTNEED);
+}
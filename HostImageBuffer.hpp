@@ -0,0 +1,41 @@
+/* *********************************************************************
+ * Host side image buffer. Used to assemble images that are larger than
+ * the kernel common buffer. The memory is mapped either anonymously or
+ * from a file, in which case the kernel can page finished parts of the
+ * image out to disk and the host memory use stays bounded.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_HOSTIMAGEBUFFER_HPP
+#define CCDDRONE_HOSTIMAGEBUFFER_HPP
+
+#include <string>
+#include <cstddef>
+
+
+class HostImageBuffer
+{
+
+private:
+    void *pMap;
+    size_t MapBytes;
+    int fd;
+
+public:
+    HostImageBuffer();
+    ~HostImageBuffer();
+
+    /*Map room for nPixels. An empty BackingFile gives anonymous memory. Returns 0 on success, -1 otherwise.*/
+    int Allocate(size_t nPixels, std::string BackingFile = "");
+    void Release(void );
+
+    unsigned short* Data(void ) { return (unsigned short *) pMap; }
+    size_t Pixels(void ) const { return MapBytes / sizeof(unsigned short); }
+
+    /*Let the kernel know that [nFirstPixel, nFirstPixel + nPixels) is done with for now*/
+    void Retire(size_t nFirstPixel, size_t nPixels);
+
+};
+
+
+#endif //CCDDRONE_HOSTIMAGEBUFFER_HPP
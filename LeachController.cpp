@@ -10,6 +10,9 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <chrono>
+#include <algorithm>
 
 #include "CArcDevice.h"
 #include "CArcPCIe.h"
@@ -21,20 +24,28 @@
 
 #include "LeachController.hpp"
 #include "CCDControlDataTypes.hpp"
+#include "UtilityFunctions.hpp"
 
 
 
-LeachController::LeachController(std::string INIFileLoc)
+LeachController::LeachController(std::string INIFileLoc, int DeviceIndex)
 {
 
+    this->DeviceIndex = DeviceIndex;
+    this->HashCache.SetBackingFile(this->StateFile("HashCache.txt"));
+
     /*New ArcDevice*/
     pArcDev = new arc::device::CArcPCIe;
+    bOwnsDevice = true;
 
     /*Open the Arc controller by loading a timing file*/
     arc::device::CArcPCIe::FindDevices();
-    pArcDev->Open(0);
+    if (DeviceIndex >= arc::device::CArcPCIe::DeviceCount())
+        std::cout<<"Warning: There is no PCIe board "<<DeviceIndex<<". Found "<<arc::device::CArcPCIe::DeviceCount()<<" board(s).\n";
+    pArcDev->Open(DeviceIndex);
 
     this->INIFileLoc = INIFileLoc;
+    this->RowsDelivered = 0;
 
     /*Check if a controller is connected*/
     if ( !pArcDev->IsControllerConnected() )
@@ -42,19 +53,91 @@ LeachController::LeachController(std::string INIFileLoc)
 
 
 
+}
+
+
+/*Use a device that was set up by the caller, e.g. a SimulatedArcDevice. It is opened here
+ *if it is not open yet, and the caller keeps ownership of it.*/
+LeachController::LeachController(std::string INIFileLoc, arc::device::CArcDevice *pDevice, int DeviceIndex)
+{
+
+    this->DeviceIndex = DeviceIndex;
+    this->HashCache.SetBackingFile(this->StateFile("HashCache.txt"));
+
+    pArcDev = pDevice;
+    bOwnsDevice = false;
+
+    if ( !pArcDev->IsOpen() ) pArcDev->Open(0);
+
+    this->INIFileLoc = INIFileLoc;
+    this->RowsDelivered = 0;
+
+    if ( !pArcDev->IsControllerConnected() )
+        std::cout<<"Warning: A controller is not connected. Check if the unit is connected and powered on.\n";
+
 }
 
 LeachController::~LeachController()
 {
 
-    pArcDev->Close();
+    if (bOwnsDevice) {
+        pArcDev->Close();
+        delete pArcDev;
+    }
+
+}
+
+/*Send a command to the controller and record how long the round trip took. Errors in the
+ *reply are counted, exceptions from the ARC API are counted and passed on.*/
+int LeachController::TimedCommand(int dBoardId, int dCommand, int dArg1, int dArg2, int dArg3, int dArg4)
+{
+
+    auto t0 = std::chrono::steady_clock::now();
+    int dReply;
+    try {
+        dReply = pArcDev->Command(dBoardId, dCommand, dArg1, dArg2, dArg3, dArg4);
+    } catch (...) {
+        double dMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+        this->CmdStats.Record(dCommand, dMicros, true);
+        this->ExposureCmdStats.Record(dCommand, dMicros, true);
+        throw;
+    }
+    double dMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+
+    bool bError = pArcDev->ContainsError(dReply);
+    this->CmdStats.Record(dCommand, dMicros, bError);
+    this->ExposureCmdStats.Record(dCommand, dMicros, bError);
+    return dReply;
 
 }
 
+/*The pixel count polls during a readout are recorded as PIX*/
+int LeachController::TimedPixelCount(void )
+{
+
+    auto t0 = std::chrono::steady_clock::now();
+    int dPixelCount = pArcDev->GetPixelCount();
+    double dMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+
+    this->CmdStats.Record("PIX", dMicros);
+    this->ExposureCmdStats.Record("PIX", dMicros);
+    return dPixelCount;
+
+}
+
+/*Path of a state file of this controller, e.g. LastHashes.txt*/
+std::string LeachController::StateFile(const std::string &File) const
+{
+    return DeviceStateFile(this->DeviceIndex, File);
+}
+
 /* Function to apply all the basic CCD params.*/
 
 void LeachController::ApplyAllCCDBasic(void ){
 
+    /*Everything is sent from here, whatever a differential apply before left out*/
+    this->bAppliedIncomplete = false;
+
     if (this->CCDParams.super_sequencer){
         /*Set CCD type for the sequencer - DES or SK sequence*/
         this->SetCCDType();
@@ -99,151 +182,204 @@ void LeachController::ApplyAllCCDBasic(void ){
 void LeachController::ApplyAllCCDClocks(void )
 {
     /*Set Clocks*/
+    std::vector<ClockDAC> Clocks;
+    std::vector<DACWrite> Writes;
+    this->ClockChannelMap(this->CCDParams, this->ClockParams, Clocks, true);
+    this->ClockDACWrites(Clocks, Writes);
+    this->IssueDACWrites(Writes, "clock voltages");
 
-    /*These sets of clocks are common and did not change between Second stage generations.*/
-
-    this->SetDACValueClock(0, this->ClockParams.one_vclock_lo, this->ClockParams.one_vclock_hi); //Channel 0: V1
-    this->SetDACValueClock(1, this->ClockParams.one_vclock_lo, this->ClockParams.one_vclock_hi); //Channel 1: V2
-    this->SetDACValueClock(2, this->ClockParams.one_vclock_lo, this->ClockParams.one_vclock_hi); //Channel 2: V3
-
-    this->SetDACValueClock(12, this->ClockParams.l_hclock_lo, this->ClockParams.l_hclock_hi); //Channel 12: H1L
-    this->SetDACValueClock(13, this->ClockParams.l_hclock_lo, this->ClockParams.l_hclock_hi); //Channel 13: H2L
-    this->SetDACValueClock(14, this->ClockParams.l_hclock_lo, this->ClockParams.l_hclock_hi); //Channel 14: H3L
-    this->SetDACValueClock(15, this->ClockParams.u_hclock_lo, this->ClockParams.u_hclock_hi); //Channel 15: H1U
-    this->SetDACValueClock(16, this->ClockParams.u_hclock_lo, this->ClockParams.u_hclock_hi); //Channel 16: H2U
-    this->SetDACValueClock(17, this->ClockParams.u_hclock_lo, this->ClockParams.u_hclock_hi); //Channel 17: H3U
-
-    /*These parameters do change between boards */
-    if (this->CCDParams.SecondStageVersion == "UW1") {
-
-
-        this->SetDACValueClock(6, this->ClockParams.tg_lo, this->ClockParams.tg_hi); //Channel 6: TG
-
-        this->SetDACValueClock(18, this->ClockParams.sw_lo, this->ClockParams.sw_hi); //Channel 18: SWL
-        this->SetDACValueClock(23, this->ClockParams.sw_lo, this->ClockParams.sw_hi); //Channel 23: SWU
-
-        //Reset gate needs to be checked against the current timing file and be flipped if necessary
-        if (this->CCDParams.InvRG) {
-            this->SetDACValueClock(20, this->ClockParams.rg_hi, this->ClockParams.rg_lo); //Channel 20: RGL
-            this->SetDACValueClock(21, this->ClockParams.rg_hi, this->ClockParams.rg_lo); //Channel 21: RGU
-        } else {
-            this->SetDACValueClock(20, this->ClockParams.rg_lo, this->ClockParams.rg_hi); //Channel 20: RGL
-            this->SetDACValueClock(21, this->ClockParams.rg_lo, this->ClockParams.rg_hi); //Channel 21: RGU
-        }
-
-        this->SetDACValueClock(7, this->ClockParams.og_lo, this->ClockParams.og_hi); //Channel 7: OG
-        this->SetDACValueClock(9, this->ClockParams.og_lo, this->ClockParams.og_hi); //Channel 9: OG
-
-        this->SetDACValueClock(8, this->ClockParams.dg_lo, this->ClockParams.dg_hi); //Channel 8: DG
-        this->SetDACValueClock(10, this->ClockParams.dg_lo, this->ClockParams.dg_hi); //Channel 10: DG
+}
 
 
+/*
+ * The clock lines of the second stage boards. Each line is a DAC channel of the
+ * clock board and the (min, max) voltages it gets. RG lines are flipped when the
+ * timing file inverts RG (InvRG). A TG line of the UW2 is held high when charge is
+ * moved the other way (VClkDirection), so only the TG that is used opens.
+ * To add a second stage board, add a table and a line in SecondStageBoards.
+ */
+enum ClockLineRule { LINE_PLAIN, LINE_RG, LINE_TG1, LINE_TG2 };
+
+struct ClockLine{
+    int chan;
+    double ClockVariables::*lo;
+    double ClockVariables::*hi;
+    ClockLineRule rule;
+    const char *name;
+};
+
+/*These sets of clocks are common and did not change between Second stage generations.*/
+static const ClockLine CommonClockLines[] = {
+    {0, &ClockVariables::one_vclock_lo, &ClockVariables::one_vclock_hi, LINE_PLAIN, "V1"},
+    {1, &ClockVariables::one_vclock_lo, &ClockVariables::one_vclock_hi, LINE_PLAIN, "V2"},
+    {2, &ClockVariables::one_vclock_lo, &ClockVariables::one_vclock_hi, LINE_PLAIN, "V3"},
+    {12, &ClockVariables::l_hclock_lo, &ClockVariables::l_hclock_hi, LINE_PLAIN, "H1L"},
+    {13, &ClockVariables::l_hclock_lo, &ClockVariables::l_hclock_hi, LINE_PLAIN, "H2L"},
+    {14, &ClockVariables::l_hclock_lo, &ClockVariables::l_hclock_hi, LINE_PLAIN, "H3L"},
+    {15, &ClockVariables::u_hclock_lo, &ClockVariables::u_hclock_hi, LINE_PLAIN, "H1U"},
+    {16, &ClockVariables::u_hclock_lo, &ClockVariables::u_hclock_hi, LINE_PLAIN, "H2U"},
+    {17, &ClockVariables::u_hclock_lo, &ClockVariables::u_hclock_hi, LINE_PLAIN, "H3U"},
+};
+
+static const ClockLine UW1ClockLines[] = {
+    {6, &ClockVariables::tg_lo, &ClockVariables::tg_hi, LINE_PLAIN, "TG"},
+    {18, &ClockVariables::sw_lo, &ClockVariables::sw_hi, LINE_PLAIN, "SWL"},
+    {23, &ClockVariables::sw_lo, &ClockVariables::sw_hi, LINE_PLAIN, "SWU"},
+    {20, &ClockVariables::rg_lo, &ClockVariables::rg_hi, LINE_RG, "RGL"},
+    {21, &ClockVariables::rg_lo, &ClockVariables::rg_hi, LINE_RG, "RGU"},
+    {7, &ClockVariables::og_lo, &ClockVariables::og_hi, LINE_PLAIN, "OG"},
+    {9, &ClockVariables::og_lo, &ClockVariables::og_hi, LINE_PLAIN, "OG"},
+    {8, &ClockVariables::dg_lo, &ClockVariables::dg_hi, LINE_PLAIN, "DG"},
+    {10, &ClockVariables::dg_lo, &ClockVariables::dg_hi, LINE_PLAIN, "DG"},
+};
+
+static const ClockLine UW2ClockLines[] = {
+    {3, &ClockVariables::two_vclock_lo, &ClockVariables::two_vclock_hi, LINE_PLAIN, "2V1"},
+    {4, &ClockVariables::two_vclock_lo, &ClockVariables::two_vclock_hi, LINE_PLAIN, "2V2"},
+    {5, &ClockVariables::two_vclock_lo, &ClockVariables::two_vclock_hi, LINE_PLAIN, "2V3"},
+    {6, &ClockVariables::tg_lo, &ClockVariables::tg_hi, LINE_TG1, "TG1"},
+    {8, &ClockVariables::tg_lo, &ClockVariables::tg_hi, LINE_TG2, "TG2"},
+    {7, &ClockVariables::og_lo, &ClockVariables::og_hi, LINE_PLAIN, "OG1"},
+    {9, &ClockVariables::og_lo, &ClockVariables::og_hi, LINE_PLAIN, "OG2"},
+    {18, &ClockVariables::sw_lo, &ClockVariables::sw_hi, LINE_PLAIN, "SWL"},
+    {23, &ClockVariables::sw_lo, &ClockVariables::sw_hi, LINE_PLAIN, "SWU"},
+    {20, &ClockVariables::rg_lo, &ClockVariables::rg_hi, LINE_RG, "RG1"},
+    {22, &ClockVariables::rg_lo, &ClockVariables::rg_hi, LINE_RG, "RG2"},
+    {19, &ClockVariables::dg_lo, &ClockVariables::dg_hi, LINE_PLAIN, "DG1"},
+    {21, &ClockVariables::dg_lo, &ClockVariables::dg_hi, LINE_PLAIN, "DG2"},
+};
+
+struct SecondStageBoard{
+    const char *Version;
+    const ClockLine *Lines;
+    size_t nLines;
+};
+
+static const SecondStageBoard SecondStageBoards[] = {
+    {"UW1", UW1ClockLines, sizeof(UW1ClockLines) / sizeof(UW1ClockLines[0])},
+    {"UW2", UW2ClockLines, sizeof(UW2ClockLines) / sizeof(UW2ClockLines[0])},
+};
+
+
+static void ClockLineVolts(const ClockLine &Line, const CCDVariables &_CCDSettings, const ClockVariables &_clockSettings,
+                           double &lo, double &hi)
+{
+    lo = _clockSettings.*Line.lo;
+    hi = _clockSettings.*Line.hi;
 
-    } else if (this->CCDParams.SecondStageVersion=="UW2") {
+    if (Line.rule == LINE_RG && _CCDSettings.InvRG) std::swap(lo, hi);
+    if (Line.rule == LINE_TG1 && _CCDSettings.VClkDirection == "2") lo = hi;
+    if (Line.rule == LINE_TG2 && _CCDSettings.VClkDirection == "1") lo = hi;
+}
 
 
-        this->SetDACValueClock(3, this->ClockParams.two_vclock_lo, this->ClockParams.two_vclock_hi); //Channel 3: 2V1
-        this->SetDACValueClock(4, this->ClockParams.two_vclock_lo, this->ClockParams.two_vclock_hi); //Channel 4: 2V2
-        this->SetDACValueClock(5, this->ClockParams.two_vclock_lo, this->ClockParams.two_vclock_hi); //Channel 5: 2V3
+/*
+ * The clock DAC channels and the (min, max) voltage for each of them, from the
+ * tables above. ApplyAllCCDClocks and ApplyChangedSettings both use this list.
+ */
+void LeachController::ClockChannelMap(const CCDVariables &_CCDSettings, const ClockVariables &_clockSettings,
+                                      std::vector<ClockDAC> &Clocks, bool bWarn)
+{
+    Clocks.clear();
 
-        /*You should only be able open the TG corresponding to the direction of charge movement*/
-        if (this->CCDParams.VClkDirection == "1") {
-            this->SetDACValueClock(6, this->ClockParams.tg_lo, this->ClockParams.tg_hi); //Channel 6: TG1
-            this->SetDACValueClock(8, this->ClockParams.tg_hi, this->ClockParams.tg_hi); //Channel 8: TG2
-        } else if (this->CCDParams.VClkDirection == "2"){
-            this->SetDACValueClock(6, this->ClockParams.tg_hi, this->ClockParams.tg_hi); //Channel 6: TG1
-            this->SetDACValueClock(8, this->ClockParams.tg_lo, this->ClockParams.tg_hi); //Channel 8: TG2
-        } else {
-            this->SetDACValueClock(6, this->ClockParams.tg_lo, this->ClockParams.tg_hi); //Channel 6: TG1
-            this->SetDACValueClock(8, this->ClockParams.tg_lo, this->ClockParams.tg_hi); //Channel 8: TG2
+    double lo, hi;
+    for (const ClockLine &Line : CommonClockLines) {
+        ClockLineVolts(Line, _CCDSettings, _clockSettings, lo, hi);
+        Clocks.push_back({Line.chan, lo, hi, Line.name});
+    }
 
-            if (this->CCDParams.VClkDirection != "12")
-                std::cout<<"V-Clock direction is ambiguous, so both TG are set to enabled. "
-                           "However, you should still stop and verify the V-clock directions.";
+    /*These parameters do change between boards */
+    for (const SecondStageBoard &Board : SecondStageBoards) {
+        if (_CCDSettings.SecondStageVersion != Board.Version) continue;
+        for (size_t i = 0; i < Board.nLines; i++) {
+            ClockLineVolts(Board.Lines[i], _CCDSettings, _clockSettings, lo, hi);
+            Clocks.push_back({Board.Lines[i].chan, lo, hi, Board.Lines[i].name});
         }
 
-        
-        this->SetDACValueClock(7, this->ClockParams.og_lo, this->ClockParams.og_hi); //Channel 7: OG1
-        this->SetDACValueClock(9, this->ClockParams.og_lo, this->ClockParams.og_hi); //Channel 9: OG2
+        if (bWarn && _CCDSettings.SecondStageVersion == "UW2" && _CCDSettings.VClkDirection != "1"
+            && _CCDSettings.VClkDirection != "2" && _CCDSettings.VClkDirection != "12")
+            std::cout<<"V-Clock direction is ambiguous, so both TG are set to enabled. "
+                       "However, you should still stop and verify the V-clock directions.";
+        return;
+    }
 
-        this->SetDACValueClock(18, this->ClockParams.sw_lo, this->ClockParams.sw_hi); //Channel 18: SWL
-        this->SetDACValueClock(23, this->ClockParams.sw_lo, this->ClockParams.sw_hi); //Channel 23: SWU
+    if (bWarn) std::cout<<"The second stage is neither UW1 or UW2, which means pre-set clock voltages could not be applied. "
+                        <<"Stop and check.\n";
 
+}
 
-        //Reset gate needs to be checked against the current timing file and be flipped if necessary
-        if (this->CCDParams.InvRG) {
-            this->SetDACValueClock(20, this->ClockParams.rg_hi, this->ClockParams.rg_lo); //Channel 20: RG1
-            this->SetDACValueClock(22, this->ClockParams.rg_hi, this->ClockParams.rg_lo); //Channel 21: RG2
-        } else {
-            this->SetDACValueClock(20, this->ClockParams.rg_lo, this->ClockParams.rg_hi); //Channel 20: RG1
-            this->SetDACValueClock(22, this->ClockParams.rg_lo, this->ClockParams.rg_hi); //Channel 21: RG2
-        }
 
 
-        this->SetDACValueClock(19, this->ClockParams.dg_lo, this->ClockParams.dg_hi); //Channel 18: DG1
-        this->SetDACValueClock(21, this->ClockParams.dg_lo, this->ClockParams.dg_hi); //Channel 23: DG2
+/*
+ * Function to apply the bias voltages.
+ * Again, this is specific to the UW second stage board.
+ */
+void LeachController::ApplyAllBiasVoltages(void )
+{
 
-    } else {
+    std::vector<BiasDAC> Biases, VideoOffsets;
+    this->BiasChannelMap(this->CCDParams, this->BiasParams, Biases, VideoOffsets);
 
-        std::cout<<"The second stage is neither UW1 or UW2, which means pre-set clock voltages could not be applied. "
-                 <<"Stop and check.\n";
-    }
+    std::vector<DACWrite> Writes;
+    this->BiasDACWrites(Biases, VideoOffsets, Writes);
+    this->IssueDACWrites(Writes, "bias voltages");
 
 }
 
 
-
 /*
- * Function to apply the bias voltages.
- * Again, this is specific to the UW second stage board.
+ * The bias DAC channels and their values, followed by the video offsets.
  */
-void LeachController::ApplyAllBiasVoltages(void )
+void LeachController::BiasChannelMap(const CCDVariables &_CCDSettings, const BiasVariables &_biasSettings,
+                                     std::vector<BiasDAC> &Biases, std::vector<BiasDAC> &VideoOffsets)
 {
+    Biases.clear();
+    VideoOffsets.clear();
 
     /*Set Biases*/
     //Vdd
-    this->SetDACValueBias(0,BiasVoltToADC(this->BiasParams.vdd,0));
-    this->SetDACValueBias(1,BiasVoltToADC(this->BiasParams.vdd,1));
-    this->SetDACValueBias(2,0);
-    this->SetDACValueBias(3,0);
+    Biases.push_back({0, BiasVoltToADC(_biasSettings.vdd,0)});
+    Biases.push_back({1, BiasVoltToADC(_biasSettings.vdd,1)});
+    Biases.push_back({2, 0});
+    Biases.push_back({3, 0});
 
 
     //VR(1-4)
-    if (this->CCDParams.CCDType=="DES")
+    if (_CCDSettings.CCDType=="DES")
     {
-        this->SetDACValueBias(4,BiasVoltToADC(this->BiasParams.vref,4));
-        this->SetDACValueBias(5,BiasVoltToADC(this->BiasParams.vref,5));
+        Biases.push_back({4, BiasVoltToADC(_biasSettings.vref,4)});
+        Biases.push_back({5, BiasVoltToADC(_biasSettings.vref,5)});
     }
     else
     {
-        this->SetDACValueBias(4,BiasVoltToADC(this->BiasParams.vrefsk,4));
-        this->SetDACValueBias(5,BiasVoltToADC(this->BiasParams.vrefsk,5));
+        Biases.push_back({4, BiasVoltToADC(_biasSettings.vrefsk,4)});
+        Biases.push_back({5, BiasVoltToADC(_biasSettings.vrefsk,5)});
     }
     //DrainL and DrainU
-    if(this->CCDParams.CCDType=="SK")
+    if(_CCDSettings.CCDType=="SK")
     {
-        this->SetDACValueBias(6,BiasVoltToADC(this->BiasParams.drain,6));
-        this->SetDACValueBias(7,BiasVoltToADC(this->BiasParams.drain,7));
+        Biases.push_back({6, BiasVoltToADC(_biasSettings.drain,6)});
+        Biases.push_back({7, BiasVoltToADC(_biasSettings.drain,7)});
     }
 
     //OG(1-4)
-    if (this->CCDParams.CCDType=="DES")
+    if (_CCDSettings.CCDType=="DES")
     {
-        this->SetDACValueBias(8,BiasVoltToADC(this->BiasParams.opg,8));
-        this->SetDACValueBias(9,BiasVoltToADC(this->BiasParams.opg,9));
+        Biases.push_back({8, BiasVoltToADC(_biasSettings.opg,8)});
+        Biases.push_back({9, BiasVoltToADC(_biasSettings.opg,9)});
     }
 
-    this->SetDACValueBias(10,0);
+    Biases.push_back({10, 0});
     //Controls Relay for battery box
-    this->SetDACValueBias(11,BiasVoltToADC(this->BiasParams.battrelay,11));
+    Biases.push_back({11, BiasVoltToADC(_biasSettings.battrelay,11)});
 
     //VSUB
-    //this->SetDACValueBias(pArcDev, 12,0);
-    //this->SetDACValueBias(pArcDev, 13,0);
+    //Biases.push_back({12, 0});
+    //Biases.push_back({13, 0});
 
     //Video Offsets, channels 2 and 3 on the video board. 3 is R and 2 is L
-    this->SetDACValueVideoOffset(2, this->BiasParams.video_offsets_U);
-    this->SetDACValueVideoOffset(3, this->BiasParams.video_offsets_L);
+    VideoOffsets.push_back({2, _biasSettings.video_offsets_U});
+    VideoOffsets.push_back({3, _biasSettings.video_offsets_L});
 
 }
 
@@ -13,6 +13,12 @@
 #define CCDDRONE_LEACHCONTROLLER_HPP
 
 #include <string>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <map>
+#include <atomic>
 
 #include "CArcDevice.h"
 #include "CArcDevice.h"
@@ -20,10 +26,24 @@
 #include "CArcPCI.h"
 #include "CArcDeinterlace.h"
 #include "CExpIFace.h"
+#include "CConIFace.h"
 #include "ArcDefs.h"
 
 #include "CCDControlDataTypes.hpp"
 #include "UtilityFunctions.hpp"
+#include "CRowIFace.hpp"
+#include "HostImageBuffer.hpp"
+#include "FileHashCache.hpp"
+#include "CommandStats.hpp"
+#include "StatusPublisher.hpp"
+#include "QuickLook.hpp"
+#include "ClusterFinder.hpp"
+#include "FirmwareImage.hpp"
+#include "ReadoutModel.hpp"
+#include "Scheduler.hpp"
+
+
+class AsyncFrameWriter;
 
 
 
@@ -56,7 +76,9 @@ class LeachController
 
 private:
 
-    arc::device::CArcPCIe *pArcDev;
+    /*The device is a CArcPCIe unless another one was given to the constructor*/
+    arc::device::CArcDevice *pArcDev;
+    bool bOwnsDevice;
     ProgressBar ReadoutProgress;
 
     // ------------------------------------------------------
@@ -69,12 +91,15 @@ private:
         LeachController &L;
         CExposeListener(LeachController &LO): L(LO) {};
 
+        LogRate ExposureRate;
+
         void ExposeCallback( float fElapsedTime )
         {
-            printf("\rExposure time remaining: %.3f",fElapsedTime);
+            LogProgress(ExposureRate, false, "exposure", fElapsedTime, 0, "Exposure time remaining: %.3f", fElapsedTime);
+            L.Publisher.ExposureProgress(fElapsedTime);
             /*If the exposure is about to end, and VDD is off, then turn VDD back on*/
             if (L._expose_isVDDOn == false && fElapsedTime < 3.0 ) {
-                printf("\nTurning VDD ON\n");
+                LogMessage(LOG_INFO, "vdd", "Turning VDD ON");
                 L.ToggleVDD(1);
             }
         }
@@ -105,6 +130,30 @@ private:
     void SetDACValueBias(int, int );
     void SetDACValueVideoOffset(int, int );
 
+    /*The DAC channels that make up a set of clock and bias settings*/
+    struct ClockDAC{ int chan; double lo; double hi; const char *name; };
+    struct BiasDAC{ int chan; int val; };
+    void ClockChannelMap(const CCDVariables&, const ClockVariables&, std::vector<ClockDAC>&, bool bWarn = false);
+    void BiasChannelMap(const CCDVariables&, const BiasVariables&, std::vector<BiasDAC>&, std::vector<BiasDAC>& );
+
+    /*One SBN write: board (jumper setting), DAC number on the board, CLK or VID and the 12 bit word.
+     *The settings are compiled into a list of these, which is sent in one go and checked once.*/
+    struct DACWrite{ int board; int dac; int type; int val; const char *name; };
+    void ClockDACWrites(const std::vector<ClockDAC>&, std::vector<DACWrite>& );
+    void BiasDACWrites(const std::vector<BiasDAC>&, const std::vector<BiasDAC>&, std::vector<DACWrite>& );
+    int IssueDACWrites(const std::vector<DACWrite>&, const char* );
+
+    /*LeachControllerDifferentialApply - private part*/
+    /*Shadow copy of the settings that are on the controller right now*/
+    CCDVariables AppliedCCDParams;
+    ClockVariables AppliedClockParams;
+    BiasVariables AppliedBiasParams;
+    bool bAppliedValid = false;
+    bool bAppliedUnknown = false;
+    /*Some writes of the last differential apply failed, so LastSettings.ini is not written until a full apply*/
+    bool bAppliedIncomplete = false;
+    bool LoadAppliedSettings(void );
+
     /*LeachControllerMiscHardwareProcedures - private part*/
     int SetSSR(void );
     int SetCCDType(void );
@@ -112,25 +161,166 @@ private:
     int SetHDR(void);
     int SelectAmplifierAndHClocks(void);
     int CalculateTiming(double );
+    int LoadFirmware(const std::string&, FirmwareImage& );
+    bool ControllerRunsFirmware(const FirmwareImage& );
+    bool WarmStartPossible(const std::string& );
 
     /*LeachControllerExpose - private part*/
-    void ExposeCCD( float fExpTime, const bool& bAbort = false,
+    void ExposeCCD( float fExpTime, const std::atomic<bool>& bAbort,
                     CExposeListener::CExpIFace* pExpIFace = NULL, bool bOpenShutter = true );
+    void DeliverCompletedRows(int );
+    /*Set by AbortExposure. The pixels read when the readout was stopped, -1 if it was not.
+     *The flags are set from signal handlers, so they have to be lock-free.*/
+    static_assert(ATOMIC_BOOL_LOCK_FREE == 2, "The abort flags are set from signal handlers");
+    std::atomic<bool> bAbortExposure{false};
+    int AbortedPixelCount = -1;
+    void StopReadout(int, const std::string& );
+    int SalvageReadout(void );
+    void DeinterlaceImage(unsigned short* );
+    void SetReadoutGeometry(void );
+    bool bSubArraySet = false;
+    bool bBinningSet = false;
+
+    /*In a series of frames (ExposeMultipleFrames) the controller is still set up for the previous
+     *frame, so the setup commands are only sent again if something changed*/
+    bool bFrameSeries = false;
+    struct {
+        bool bValid = false;
+        int nSkipperR = 0;
+        int dRows = 0;
+        int dCols = 0;
+        int ExpTimeMs = -1;
+    } PreparedReadout;
+    bool bCommonBufferMapped = false;
+    size_t MappedBufferBytes = 0;
+    void MapCommonBuffer(size_t );
+    /*Runs in a thread while the next exposure integrates, and should be done before its readout
+     *starts. The flag is set if the readout started while it was still running.*/
+    std::function<void(void )> DuringNextExposure;
+    bool bDuringExposureLate = false;
+
+    /*The thread that polls the controller, if AcquisitionThread is set. Work started from it is
+     *moved back to the worker CPUs at normal priority.*/
+    std::unique_ptr<DedicatedThread> AcquisitionWorker;
+    void SetupScheduling(void );
+    void RunAcquisition(const std::function<void(void )>& );
+    void LeaveAcquisitionScheduling(void );
+
+    /*Pixel count samples of the current readout*/
+    ReadoutTelemetry Telemetry;
+    void PublishExposureResult(bool );
+
+    /*Streaming consumers of the rows during readout*/
+    std::vector<CRowIFace*> RowListeners;
+    int RowsDelivered;
+    void SetupQuickLook(void );
+    void PublishQuickLook(void );
+    void SetupClusterFinder(void );
+
+    /*LeachControllerSegmentedReadout - private part*/
+    int PrepareAndExposeCCDSegmented(int );
+    HostImageBuffer SegmentedImage;
+    FrameBuffer SegmentedFrame;
+    bool bImageInHostBuffer = false;
+    int SegmentRowOffset = 0;
+    int SegmentTotalRows = 0;
+
+    /*LeachControllerContinuous - private part*/
+    /*Gets the frames of a continuous readout from the ARC API and queues them on the frame writer*/
+    class CContinuousListener : public arc::device::CConIFace
+    {
+    public:
+        LeachController &L;
+        AsyncFrameWriter *pWriter;
+        std::string OutFileName;
+        int nFrames = 0;
+        float ExposureTime = 0;
+        int nFramesReceived = 0;
+        int nFramesLost = 0;
+        int dLastFrameCount = 0;
+        /*What the ARC API polls, set by the stop watcher of ExposeContinuous*/
+        bool bStop = false;
+        std::chrono::steady_clock::time_point tLastFrame;
+        LogRate FrameRate;
+        CContinuousListener(LeachController &LO, AsyncFrameWriter *pW, const std::string &Out): L(LO), pWriter(pW), OutFileName(Out) {};
+
+        void FrameCallback( int dFramesPerBuffer, int dFrameCount, int dRows, int dCols, void* pBuffer );
+    };
+    std::atomic<bool> bAbortContinuous{false};
+
+    /*LeachControllerConfigHandler - private part*/
+    void ParseAllSettings(void );
+    void ComputeReadoutGeometry(void );
+    void SetupParsedSettings(void );
+    void WriteAppliedStateFiles(const std::string &INIText, const std::string &SettingsDigest, const std::string &SequencerDigest);
+    void MarkAppliedStateStale(void );
+    /*The settings parsed from the config file the last time, with the stat data of the file*/
+    struct ParsedSettings{
+        std::string INIFileLoc;
+        FileStamp Stamp;
+        CCDVariables CCDParams;
+        ClockVariables ClockParams;
+        BiasVariables BiasParams;
+        ProcessingVariables ProcParams;
+        AcquisitionVariables AcqParams;
+        OutputVariables OutParams;
+        RegionVariables RoiParams;
+        StartupVariables StartupParams;
+        bool bValid = false;
+    } LastParsed;
+    void CaptureSettings(ParsedSettings& ) const;
+    void RestoreSettings(const ParsedSettings& );
+
+    /*LeachControllerPresets - private part*/
+    struct SettingsPreset{
+        ParsedSettings Settings;
+        std::string INIText;        //The config file as it was loaded, for LastSettings.ini
+        std::string SettingsDigest;
+    };
+    std::map<std::string, SettingsPreset> Presets;
 
 
 
 public:
 
-    LeachController(std::string );
+    LeachController(std::string, int DeviceIndex = 0 );
+    LeachController(std::string, arc::device::CArcDevice*, int DeviceIndex = 0 );
     ~LeachController();
 
+    /*Which PCIe board this instance drives, and where its state files are kept*/
+    int DeviceIndex;
+    std::string StateFile(const std::string& ) const;
+
+    /*If set, every exposure waits here right before it starts, so that several controllers start together*/
+    StartBarrier *pStartBarrier = NULL;
+
     /*Variables that will need to be set before exposure*/
     std::string INIFileLoc;
     CCDVariables CCDParams;
     ClockVariables ClockParams;
     BiasVariables BiasParams;
+    ProcessingVariables ProcParams;
+    AcquisitionVariables AcqParams;
+    OutputVariables OutParams;
+    RegionVariables RoiParams;
+    StartupVariables StartupParams;
     TimeVariables ClockTimers;
 
+    /*Digests of the config and sequencer files. Backed by HashCache.txt in the state directory by default,
+     *long running programs can keep it in memory only with HashCache.SetBackingFile("")*/
+    FileHashCache HashCache;
+
+    /*Every command sent to the controller is timed. CmdStats counts since the controller was
+     *opened and ExposureCmdStats since the start of the last exposure (written to its FITS file).*/
+    CommandStats CmdStats;
+    CommandStats ExposureCmdStats;
+    int TimedCommand(int dBoardId, int dCommand, int dArg1 = arc::device::CArcDevice::NOPARAM, int dArg2 = arc::device::CArcDevice::NOPARAM,
+                     int dArg3 = arc::device::CArcDevice::NOPARAM, int dArg4 = arc::device::CArcDevice::NOPARAM);
+    int TimedPixelCount(void );
+
+    /*Exposure state and the last frame in shared memory, if PublishStatus is set in [output]*/
+    StatusPublisher Publisher;
+
     /*Routines - Universal and defined in LeachController.cpp*/
     void ApplyAllCCDBasic(void );
     /*Routines - UW specific and defined in LeachController.cpp*/
@@ -142,22 +332,78 @@ public:
     /*Routines - Generic and organized by filename*/
 
     /*LeachControllerConfigHandler*/
-    void ParseCCDSettings(CCDVariables&, ClockVariables&, BiasVariables& );
+    void ParseCCDSettings(CCDVariables&, ClockVariables&, BiasVariables&, std::string FileLoc = "" );
+    void ParseProcessingSettings(ProcessingVariables& );
+    void ParseAcquisitionSettings(AcquisitionVariables& );
+    void ParseOutputSettings(OutputVariables& );
+    void ParseRegionSettings(RegionVariables& );
+    void ParseStartupSettings(StartupVariables& );
     int LoadAndCheckForSettingsChange(bool&, bool& );
     void CopyOldAndStoreFileHashes(void );
     void LoadCCDSettingsFresh(void );
 
+    /*LeachControllerPresets - public part*/
+    int LoadPreset(const std::string &Name, const std::string &INIFile);
+    int SwitchPreset(const std::string &Name, int &nSent, bool &bSequencer);
+    bool DropPreset(const std::string &Name);
+    std::vector<std::string> PresetNames(void ) const;
+    std::string CurrentPreset;
+
 
     /*LeachControllerExpose - public part*/
-    void PrepareAndExposeCCD(int, unsigned short*);
+    int PrepareAndExposeCCD(int, unsigned short*);
     int _expose_isVDDOn = true;
     int TotalPixelsToRead;
+    bool bImageInterlaced = false;
+    void AddRowListener(CRowIFace* );
+    void RemoveRowListener(CRowIFace* );
+    unsigned short* ImageData(void );
+    /*Stops the exposure or the readout in progress at the next poll of the controller. Can be called
+     *from another thread or a signal handler.*/
+    void AbortExposure(void ) { this->bAbortExposure = true; }
+    /*Why the last exposure was stopped, and how many rows its image has if they were kept
+     *([output] SavePartial). PartialRows is -1 if the image was read out completely.*/
+    std::string AbortReason;
+    int PartialRows = -1;
+    /*Statistics and preview of the last readout, kept while the rows arrive if [output] QuickLook is on*/
+    QuickLook QuickLookStats;
+    /*Clusters of the last readout, found while the rows arrive if [output] FindClusters is on*/
+    ClusterFinder EventFinder;
+
+
+    /*LeachControllerDifferentialApply - public part*/
+    int ApplyChangedSettings(void );
+    void StoreAppliedSettings(void );
+    void InvalidateAppliedSettings(void );
+
+
+    /*LeachControllerMultiFrame*/
+    int ExposeMultipleFrames(int, int, std::string, AsyncFrameWriter* pFrameWriter = NULL );
+    /*Host buffers the frames are copied or assembled into, sized for the current readout*/
+    FramePool FrameBuffers;
+    void SetupFramePool(void );
+
+
+    /*LeachControllerContinuous*/
+    int ExposeContinuous(float, int, std::string, AsyncFrameWriter* pFrameWriter = NULL );
+    /*Ends a continuous readout after the frame that is being read out, can be called from another thread*/
+    void StopContinuous(void ) { this->bAbortContinuous = true; }
+
+
+    /*LeachControllerScan*/
+    /*The setting with a config file name, for the scans and the Python bindings*/
+    bool ScanParameterRef(const std::string&, double*&, int*& );
+    int ParseScanAxis(std::string, ScanAxis& );
+    int RunParameterScan(const ScanSpec& );
+    /*Scan point of the frames being taken now, these are written to the FITS headers*/
+    int ScanPoint = -1;
+    std::vector<ScanCoordinate> ScanCoords;
 
 
     /*LeachControllerMiscHardwareProcedures - public part*/
     void CCDBiasToggle(bool );
     void StartupController(void );
-    void PerformEraseProcedure(void);
+    void PerformEraseProcedure(std::function<void(void )> DuringDwell = nullptr);
     void ApplyAllPositiveVPixelArray(void );
     void RestoreVClockVoltages (void);
     void IdleClockToggle(void );
@@ -174,9 +420,25 @@ public:
     int ApplySummingWellWidth(double);
 
 
+    /*LeachControllerTimingProcedures*/
+    /*Expected readout time of the image as it is set up now. The model is corrected with every readout.*/
+    ReadoutPrediction PredictReadout(void );
+    ReadoutTimeModel ReadoutModel;
+
+
+
+    /*LeachControllerLinkBench*/
+    int MeasureCommandLatency(int, std::vector<double>& );
+    int MeasureSyntheticReadout(int, int, int, LinkBenchResult& );
+
 
     /*FitsOps*/
-    void SaveFits(std::string );
+    int SaveFits(std::string );
+    std::unique_ptr<FrameRecord> CopyFrameFromCommonBuffer(std::string );
+    std::unique_ptr<FrameRecord> RecordLastExposure(std::string );
+    int CopyFramePixels(FrameRecord&, const unsigned short* );
+    /*Master bias and dark of the [processing] section, shared with the frames that use them*/
+    std::shared_ptr<const CalibrationMasters> Masters;
 
 
 
@@ -11,6 +11,8 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <chrono>
+#include <vector>
 
 #include "CArcDevice.h"
 #include "CArcPCIe.h"
@@ -64,7 +66,7 @@ int LeachController::BiasVoltToADC(double PD, int line)
 
     biasVoltADC = (int)ADCVal;
     if (biasVoltADC > 4095)
-        printf ("Warning: Bias on line %d is %d which is more than the limit 4095.\n ",line,biasVoltADC);
+        LogMessage(LOG_WARN, "dac", "Warning: Bias on line %d is %d which is more than the limit 4095.", line, biasVoltADC);
 
     return 0x00000FFF & biasVoltADC;
 
@@ -81,11 +83,11 @@ void LeachController::SetDACValueClock(int dac_chan, double dmin, double dmax)
 
     int resp1, resp2;
 
-    resp1 = this->pArcDev->Command( TIM_ID, SBN, CLOCK_JUMPER,  2*dac_chan, CLK, ClockVoltToADC(dmax) ); //MAX
-    resp2 = this->pArcDev->Command( TIM_ID, SBN, CLOCK_JUMPER,  2*dac_chan+1, CLK, ClockVoltToADC(dmin) ); //MIN
+    resp1 = this->TimedCommand( TIM_ID, SBN, CLOCK_JUMPER,  2*dac_chan, CLK, ClockVoltToADC(dmax) ); //MAX
+    resp2 = this->TimedCommand( TIM_ID, SBN, CLOCK_JUMPER,  2*dac_chan+1, CLK, ClockVoltToADC(dmin) ); //MIN
 
     if (resp1 != 0x00444F4E || resp2 != 0x00444F4E )
-        printf ("Error setting CVIon channel: %d | code (max, min): (%X, %X)\n", dac_chan, resp1, resp2);
+        LogMessage(LOG_ERROR, "dac", "Error setting CVIon channel: %d | code (max, min): (%X, %X)", dac_chan, resp1, resp2);
 
 }
 
@@ -98,10 +100,10 @@ void LeachController::SetDACValueBias(int dac_chan, int val)
 
     int resp;
 
-    resp = this->pArcDev->Command( TIM_ID, SBN, CLOCK_JUMPER, dac_chan, VID, val ); //MAX
+    resp = this->TimedCommand( TIM_ID, SBN, CLOCK_JUMPER, dac_chan, VID, val ); //MAX
 
     if (resp != 0x00444F4E )
-        printf ("Error setting CVIon channel: %d | code: %X\n", dac_chan, resp);
+        LogMessage(LOG_ERROR, "dac", "Error setting CVIon channel: %d | code: %X", dac_chan, resp);
 
 
 }
@@ -116,26 +118,99 @@ void LeachController::SetDACValueVideoOffset(int dac_chan, int OffsetVal)
 
     /*Validate inputs*/
     if (dac_chan != 2 && dac_chan != 3){
-        printf ("Incorrect video channel. Please check the video output channel.\n");
+        LogMessage(LOG_ERROR, "dac", "Incorrect video channel. Please check the video output channel.");
         return;
     }
 
     if (OffsetVal < 0 || OffsetVal > 4095 ){
-        printf("Video offset value must be between 0 - 16383.\n");
+        LogMessage(LOG_WARN, "dac", "Video offset value must be between 0 - 16383.");
         //return;
     }
 
     int resp;
 
-    resp = this->pArcDev->Command( TIM_ID, SBN, VIDEO_JUMPER, dac_chan, VID, OffsetVal );
+    resp = this->TimedCommand( TIM_ID, SBN, VIDEO_JUMPER, dac_chan, VID, OffsetVal );
 
     if (resp != 0x00444F4E )
-        printf ("Error setting video offset on channel: %d | code: %X\n", dac_chan, resp);
+        LogMessage(LOG_ERROR, "dac", "Error setting video offset on channel: %d | code: %X", dac_chan, resp);
 
 
 }
 
 
+/*
+ * The DAC writes of a set of clocks: the max and the min DAC of each channel.
+ */
+void LeachController::ClockDACWrites(const std::vector<ClockDAC> &Clocks, std::vector<DACWrite> &Writes)
+{
+
+    for (const ClockDAC &c : Clocks) {
+        Writes.push_back({CLOCK_JUMPER, 2*c.chan, CLK, ClockVoltToADC(c.hi), c.name}); //MAX
+        Writes.push_back({CLOCK_JUMPER, 2*c.chan+1, CLK, ClockVoltToADC(c.lo), c.name}); //MIN
+    }
+
+}
+
+
+/*
+ * The DAC writes of the biases and of the video offsets.
+ */
+void LeachController::BiasDACWrites(const std::vector<BiasDAC> &Biases, const std::vector<BiasDAC> &VideoOffsets,
+                                    std::vector<DACWrite> &Writes)
+{
+
+    for (const BiasDAC &b : Biases) Writes.push_back({CLOCK_JUMPER, b.chan, VID, b.val, "bias"});
+
+    for (const BiasDAC &v : VideoOffsets) {
+        if (v.chan != 2 && v.chan != 3){
+            LogMessage(LOG_ERROR, "dac", "Incorrect video channel. Please check the video output channel.");
+            continue;
+        }
+        if (v.val < 0 || v.val > 4095 )
+            LogMessage(LOG_WARN, "dac", "Video offset value must be between 0 - 16383.");
+        Writes.push_back({VIDEO_JUMPER, v.chan, VID, v.val, "video offset"});
+    }
+
+}
+
+
+/*
+ * Send a list of DAC writes. All of them are sent first, and the replies are
+ * checked afterwards, with one report of the writes that failed.
+ * Returns the number of writes that failed.
+ */
+int LeachController::IssueDACWrites(const std::vector<DACWrite> &Writes, const char *What)
+{
+
+    if (Writes.empty()) return 0;
+
+    std::vector<int> Replies(Writes.size());
+    auto tStart = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < Writes.size(); i++) {
+        const DACWrite &w = Writes[i];
+        Replies[i] = this->TimedCommand( TIM_ID, SBN, w.board, w.dac, w.type, w.val );
+    }
+    double dTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+
+    int nFailed = 0;
+    for (size_t i = 0; i < Writes.size(); i++) {
+        if (Replies[i] == 0x00444F4E) continue;
+        const DACWrite &w = Writes[i];
+        if (nFailed == 0) LogMessage(LOG_ERROR, "dac", "Error setting the %s:", What);
+        LogMessage(LOG_ERROR, "dac", "  %s | board %d DAC %d value %d | code: %X", w.name, w.board, w.dac, w.val, Replies[i]);
+        nFailed++;
+    }
+
+    LogMessage(nFailed ? LOG_WARN : LOG_INFO, "dac", "%s: %zu DAC writes in %.1f ms (%.2f ms each)%s", What, Writes.size(), dTime,
+               dTime / Writes.size(), nFailed ? ", some failed" : "");
+
+    /*What follows the setup is printed directly*/
+    LogFlush();
+    return nFailed;
+
+}
+
+
 /*Toggle the CCD Substrate bias line*/
 void LeachController::CCDBiasToggle (bool state)
 {
@@ -152,7 +227,7 @@ void LeachController::CCDBiasToggle (bool state)
 void LeachController::IdleClockToggle (void )
 {
 
-    this->pArcDev->Command(TIM_ID, IDL);
+    this->TimedCommand( TIM_ID, IDL);
 
 }
 
@@ -5,20 +5,24 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
 
 
 #include "LeachController.hpp"
 #include "CCDControlDataTypes.hpp"
-#include "picosha2.h"
 #include "INIReader.h"
+#include "Calibration.hpp"
 #include "CCDControlDataTypes.hpp"
 
 
 
-void LeachController::ParseCCDSettings(CCDVariables &_CCDSettings, ClockVariables &_clockSettings, BiasVariables &_biasSettings)
+/*Parse the CCD, clock and bias settings from FileLoc, or from INIFileLoc if it is empty*/
+void LeachController::ParseCCDSettings(CCDVariables &_CCDSettings, ClockVariables &_clockSettings, BiasVariables &_biasSettings, std::string FileLoc)
 {
 
-    INIReader _LeachConfig(INIFileLoc.c_str());
+    if (FileLoc.empty()) FileLoc = this->INIFileLoc;
+    INIReader _LeachConfig(FileLoc.c_str());
 
     if (_LeachConfig.ParseError() != 0)
     {
@@ -91,6 +95,9 @@ void LeachController::ParseCCDSettings(CCDVariables &_CCDSettings, ClockVariable
     _CCDSettings.OGWidth =  _LeachConfig.GetReal("timing","OGWidth",0.6);
     _CCDSettings.SKRSTWidth =  _LeachConfig.GetReal("timing","SkippingRGWidth",0.6);
     _CCDSettings.SWWidth =  _LeachConfig.GetReal("timing","SWPulseWidth",0.6);
+    _CCDSettings.SampleOverhead =  _LeachConfig.GetReal("timing","SampleOverhead",0.0);
+    _CCDSettings.PixelOverhead =  _LeachConfig.GetReal("timing","PixelOverhead",0.0);
+    _CCDSettings.RowOverhead =  _LeachConfig.GetReal("timing","RowOverhead",0.0);
 
 
 
@@ -107,11 +114,341 @@ void LeachController::ParseCCDSettings(CCDVariables &_CCDSettings, ClockVariable
 }
 
 
+/*Settings of the host side processing of the image. These do not need to be applied to the controller.*/
+void LeachController::ParseProcessingSettings(ProcessingVariables &_procSettings)
+{
+
+    INIReader _LeachConfig(INIFileLoc.c_str());
+
+    _procSettings.ReduceNDCM = _LeachConfig.GetBoolean("processing", "ReduceNDCM", false);
+    _procSettings.NDCMDiscard = _LeachConfig.GetInteger("processing", "NDCMDiscard", 0);
+    _procSettings.KeepRawNDCM = _LeachConfig.GetBoolean("processing", "KeepRawNDCM", true);
+
+    _procSettings.Deinterlacer = _LeachConfig.Get("processing", "Deinterlacer", "native");
+    if (_procSettings.Deinterlacer != "native" && _procSettings.Deinterlacer != "arc") {
+        std::cout<<"Warning: Deinterlacer must be native or arc. Using the native de-interlacer.\n";
+        _procSettings.Deinterlacer = "native";
+    }
+    _procSettings.ProcessingThreads = _LeachConfig.GetInteger("processing", "ProcessingThreads", 0);
+
+    _procSettings.OverscanSubtraction = _LeachConfig.Get("processing", "OverscanSubtraction", "none");
+    if (_procSettings.OverscanSubtraction != "none" && _procSettings.OverscanSubtraction != "mean"
+        && _procSettings.OverscanSubtraction != "median") {
+        std::cout<<"Warning: OverscanSubtraction must be none, mean or median. The pedestal will not be subtracted.\n";
+        _procSettings.OverscanSubtraction = "none";
+    }
+    _procSettings.OverscanCols = _LeachConfig.GetInteger("processing", "OverscanCols", -1);
+    _procSettings.MasterBias = _LeachConfig.Get("processing", "MasterBias", "");
+    _procSettings.MasterDark = _LeachConfig.Get("processing", "MasterDark", "");
+    if (!_procSettings.ReduceNDCM && (_procSettings.OverscanSubtraction != "none" || !_procSettings.MasterBias.empty()
+        || !_procSettings.MasterDark.empty()))
+        std::cout<<"Warning: The calibration works on the reduced image. Set ReduceNDCM = true to use it.\n";
+
+    if (_procSettings.NDCMDiscard < 0) {
+        std::cout<<"Warning: NDCMDiscard cannot be negative. No charge measurements will be discarded.\n";
+        _procSettings.NDCMDiscard = 0;
+    }
+
+}
+
+
+/*Settings of how the image is brought from the controller into host memory*/
+void LeachController::ParseAcquisitionSettings(AcquisitionVariables &_acqSettings)
+{
+
+    INIReader _LeachConfig(INIFileLoc.c_str());
+
+    _acqSettings.SegmentedReadout = _LeachConfig.GetBoolean("acquisition", "SegmentedReadout", false);
+    _acqSettings.SegmentRows = _LeachConfig.GetInteger("acquisition", "SegmentRows", 0);
+    _acqSettings.SegmentBackingFile = _LeachConfig.Get("acquisition", "SegmentBackingFile", "");
+
+    _acqSettings.PollInterval = _LeachConfig.GetReal("acquisition", "PollInterval", 50.0);
+    _acqSettings.MinPollInterval = _LeachConfig.GetReal("acquisition", "MinPollInterval", 0.5);
+    _acqSettings.StallTimeout = _LeachConfig.GetReal("acquisition", "StallTimeout", 10.0);
+    if (_acqSettings.PollInterval <= 0) _acqSettings.PollInterval = 50.0;
+    if (_acqSettings.MinPollInterval <= 0 || _acqSettings.MinPollInterval > _acqSettings.PollInterval)
+        _acqSettings.MinPollInterval = _acqSettings.PollInterval;
+
+    _acqSettings.TelemetrySamples = _LeachConfig.GetInteger("acquisition", "TelemetrySamples", 65536);
+    _acqSettings.StallEventMs = _LeachConfig.GetReal("acquisition", "StallEventMs", 100.0);
+    if (_acqSettings.TelemetrySamples < 0) _acqSettings.TelemetrySamples = 0;
+    _acqSettings.FramePoolBuffers = _LeachConfig.GetInteger("acquisition", "FramePoolBuffers", 0);
+    _acqSettings.FramePoolHugePages = _LeachConfig.GetBoolean("acquisition", "FramePoolHugePages", false);
+    _acqSettings.FramePoolPrefault = _LeachConfig.GetBoolean("acquisition", "FramePoolPrefault", true);
+    _acqSettings.ContinuousBufferFrames = _LeachConfig.GetInteger("acquisition", "ContinuousBufferFrames", 4);
+    if (_acqSettings.ContinuousBufferFrames < 2) _acqSettings.ContinuousBufferFrames = 2;
+
+    _acqSettings.WorkerThreads = _LeachConfig.GetInteger("acquisition", "WorkerThreads", 0);
+    _acqSettings.WorkerCPUs = _LeachConfig.Get("acquisition", "WorkerCPUs", "");
+    _acqSettings.AcquisitionThread = _LeachConfig.GetBoolean("acquisition", "AcquisitionThread", false);
+    _acqSettings.AcquisitionCPUs = _LeachConfig.Get("acquisition", "AcquisitionCPUs", "");
+    _acqSettings.AcquisitionPriority = _LeachConfig.GetInteger("acquisition", "AcquisitionPriority", 0);
+    if (_acqSettings.WorkerThreads < 0) _acqSettings.WorkerThreads = 0;
+    if (_acqSettings.AcquisitionPriority < 0 || _acqSettings.AcquisitionPriority > 99) {
+        std::cout<<"Warning: AcquisitionPriority must be between 0 and 99. The acquisition thread will be scheduled normally.\n";
+        _acqSettings.AcquisitionPriority = 0;
+    }
+
+}
+
+
+/*Settings of the FITS output*/
+void LeachController::ParseOutputSettings(OutputVariables &_outSettings)
+{
+
+    INIReader _LeachConfig(INIFileLoc.c_str());
+
+    _outSettings.Compression = _LeachConfig.Get("output", "Compression", "none");
+    if (_outSettings.Compression != "none" && _outSettings.Compression != "rice" && _outSettings.Compression != "hcompress"
+        && _outSettings.Compression != "gzip" && _outSettings.Compression != "plio") {
+        std::cout<<"Warning: Compression must be none, rice, hcompress, gzip or plio. The images will not be compressed.\n";
+        _outSettings.Compression = "none";
+    }
+    _outSettings.TileRows = _LeachConfig.GetInteger("output", "TileRows", 1);
+    _outSettings.TileCols = _LeachConfig.GetInteger("output", "TileCols", 0);
+    _outSettings.HCompressScale = _LeachConfig.GetReal("output", "HCompressScale", 0);
+    _outSettings.FloatQuantizeLevel = _LeachConfig.GetReal("output", "FloatQuantizeLevel", 0);
+
+    _outSettings.Format = _LeachConfig.Get("output", "Format", "fits");
+    if (_outSettings.Format != "fits" && _outSettings.Format != "raw") {
+        std::cout<<"Warning: Format must be fits or raw. The images will be written as FITS files.\n";
+        _outSettings.Format = "fits";
+    }
+    _outSettings.DirectIO = _LeachConfig.GetBoolean("output", "DirectIO", true);
+
+    _outSettings.RawLayout = _LeachConfig.Get("output", "RawLayout", "interleaved");
+    if (_outSettings.RawLayout != "interleaved" && _outSettings.RawLayout != "cube" && _outSettings.RawLayout != "planes") {
+        std::cout<<"Warning: RawLayout must be interleaved, cube or planes. The samples will be written interleaved.\n";
+        _outSettings.RawLayout = "interleaved";
+    }
+    _outSettings.ReducedType = _LeachConfig.Get("output", "ReducedType", "float");
+    if (_outSettings.ReducedType != "float" && _outSettings.ReducedType != "scaled") {
+        std::cout<<"Warning: ReducedType must be float or scaled. The reduced images will be written as floats.\n";
+        _outSettings.ReducedType = "float";
+    }
+    _outSettings.RMSScale = _LeachConfig.GetReal("output", "RMSScale", 0.01);
+    _outSettings.ReducedStorage = _LeachConfig.Get("output", "ReducedStorage", "dense");
+    if (_outSettings.ReducedStorage != "dense" && _outSettings.ReducedStorage != "sparse") {
+        std::cout<<"Warning: ReducedStorage must be dense or sparse. The reduced images will be written dense.\n";
+        _outSettings.ReducedStorage = "dense";
+    }
+    _outSettings.SparseSigma = _LeachConfig.GetReal("output", "SparseSigma", 3.0);
+    _outSettings.SplitAmplifiers = _LeachConfig.GetBoolean("output", "SplitAmplifiers", false);
+
+    _outSettings.WriterThreads = _LeachConfig.GetInteger("output", "WriterThreads", 1);
+    _outSettings.WriterQueueDepth = _LeachConfig.GetInteger("output", "WriterQueueDepth", 2);
+    if (_outSettings.WriterThreads < 1) _outSettings.WriterThreads = 1;
+    if (_outSettings.WriterQueueDepth < 1) _outSettings.WriterQueueDepth = 1;
+
+    _outSettings.PublishStatus = _LeachConfig.GetBoolean("output", "PublishStatus", false);
+    _outSettings.StatusSegment = _LeachConfig.Get("output", "StatusSegment", "ccddrone");
+    _outSettings.StatusFrameMB = _LeachConfig.GetInteger("output", "StatusFrameMB", 64);
+    if (_outSettings.StatusFrameMB < 0) _outSettings.StatusFrameMB = 0;
+
+    _outSettings.QuickLook = _LeachConfig.GetBoolean("output", "QuickLook", false);
+    _outSettings.QuickLookBin = _LeachConfig.GetInteger("output", "QuickLookBin", 16);
+    _outSettings.SaturationLevel = _LeachConfig.GetInteger("output", "SaturationLevel", 65535);
+    _outSettings.AbortSaturatedFraction = _LeachConfig.GetReal("output", "AbortSaturatedFraction", 0);
+    _outSettings.AbortAfterRows = _LeachConfig.GetInteger("output", "AbortAfterRows", 50);
+    _outSettings.SavePartial = _LeachConfig.GetBoolean("output", "SavePartial", false);
+    if (_outSettings.QuickLookBin < 1) _outSettings.QuickLookBin = 1;
+
+    _outSettings.LogFormat = _LeachConfig.Get("output", "LogFormat", "text");
+    if (_outSettings.LogFormat != "text" && _outSettings.LogFormat != "json") {
+        std::cout<<"Warning: LogFormat must be text or json. Logging as text.\n";
+        _outSettings.LogFormat = "text";
+    }
+    _outSettings.LogFile = _LeachConfig.Get("output", "LogFile", "");
+    _outSettings.LogQueue = _LeachConfig.GetInteger("output", "LogQueue", 4096);
+    _outSettings.ProgressInterval = _LeachConfig.GetReal("output", "ProgressInterval", 0.2);
+    if (_outSettings.LogQueue < 64) _outSettings.LogQueue = 64;
+    if (_outSettings.ProgressInterval < 0) _outSettings.ProgressInterval = 0;
+
+    _outSettings.FindClusters = _LeachConfig.GetBoolean("output", "FindClusters", false);
+    _outSettings.ClusterSeedSigma = _LeachConfig.GetReal("output", "ClusterSeedSigma", 4.0);
+    _outSettings.ClusterPixelSigma = _LeachConfig.GetReal("output", "ClusterPixelSigma", 2.5);
+    _outSettings.ClusterMaxPixels = _LeachConfig.GetInteger("output", "ClusterMaxPixels", 10000);
+    _outSettings.ClusterOnly = _LeachConfig.GetBoolean("output", "ClusterOnly", false);
+    if (_outSettings.ClusterPixelSigma > _outSettings.ClusterSeedSigma) {
+        std::cout<<"Warning: ClusterPixelSigma is above ClusterSeedSigma. Using the seed threshold for both.\n";
+        _outSettings.ClusterPixelSigma = _outSettings.ClusterSeedSigma;
+    }
+    if (_outSettings.ClusterMaxPixels < 1) _outSettings.ClusterMaxPixels = 1;
+    if (_outSettings.ClusterOnly && !_outSettings.FindClusters) {
+        std::cout<<"Warning: ClusterOnly needs FindClusters. The images will be written.\n";
+        _outSettings.ClusterOnly = false;
+    }
+
+}
+
+
+/*Region of interest of the readout. The geometry of the CCD is read from the [ccd] section,
+ *since CCDParams.dRows and dCols become the size of what is read out.*/
+void LeachController::ParseRegionSettings(RegionVariables &_roiSettings)
+{
+
+    INIReader _LeachConfig(INIFileLoc.c_str());
+
+    _roiSettings.CCDCols = _LeachConfig.GetInteger("ccd", "columns", 4000);
+    _roiSettings.CCDRows = _LeachConfig.GetInteger("ccd", "rows", 4000);
+
+    _roiSettings.Enabled = _LeachConfig.GetBoolean("roi", "Enabled", false);
+    _roiSettings.RowStart = _LeachConfig.GetInteger("roi", "RowStart", 0);
+    _roiSettings.Rows = _LeachConfig.GetInteger("roi", "Rows", 0);
+    _roiSettings.ColStart = _LeachConfig.GetInteger("roi", "ColStart", 0);
+    _roiSettings.Cols = _LeachConfig.GetInteger("roi", "Cols", 0);
+    _roiSettings.OverscanStart = _LeachConfig.GetInteger("roi", "OverscanStart", 0);
+    _roiSettings.OverscanCols = _LeachConfig.GetInteger("roi", "OverscanCols", 0);
+
+}
+
+
+/*Work out the size of the readout from the region of interest and the binning, and set
+ *CCDParams.dRows and dCols to it. Everything that sizes the image (the buffer, STC, the
+ *processing and the FITS file) goes by these two.*/
+void LeachController::ComputeReadoutGeometry(void )
+{
+
+    RegionVariables &R = this->RoiParams;
+
+    int PBin = this->CCDParams.ParallelBin > 1 ? this->CCDParams.ParallelBin : 1;
+    int SBin = this->CCDParams.SerialBin > 1 ? this->CCDParams.SerialBin : 1;
+    R.ParallelBin = PBin;
+    R.SerialBin = SBin;
+
+    int Overscan = 0;
+    if (R.Enabled) {
+        if (R.RowStart < 0 || R.RowStart >= R.CCDRows) R.RowStart = 0;
+        if (R.ColStart < 0 || R.ColStart >= R.CCDCols) R.ColStart = 0;
+        if (R.Rows <= 0 || R.RowStart + R.Rows > R.CCDRows) R.Rows = R.CCDRows - R.RowStart;
+        if (R.Cols <= 0 || R.ColStart + R.Cols > R.CCDCols) R.Cols = R.CCDCols - R.ColStart;
+        if (R.OverscanCols > 0) Overscan = R.OverscanCols;
+
+        if (R.RowStart % PBin || R.Rows % PBin || R.ColStart % SBin || R.Cols % SBin || Overscan % SBin)
+            std::cout<<"Warning: The region of interest is not a multiple of the binning. The edges are rounded.\n";
+    } else {
+        R.RowStart = 0;
+        R.ColStart = 0;
+        R.Rows = R.CCDRows;
+        R.Cols = R.CCDCols;
+    }
+
+    R.ReadRows = (R.Rows + PBin - 1) / PBin;
+    R.DataCols = (R.Cols + SBin - 1) / SBin;
+    R.OverscanReadCols = (Overscan + SBin - 1) / SBin;
+
+    this->CCDParams.dRows = R.ReadRows;
+    this->CCDParams.dCols = R.DataCols + R.OverscanReadCols;
+
+}
+
+
+/*How the controller is brought up*/
+void LeachController::ParseStartupSettings(StartupVariables &_startSettings)
+{
+
+    INIReader _LeachConfig(INIFileLoc.c_str());
+
+    _startSettings.WarmStart = _LeachConfig.GetBoolean("startup", "WarmStart", true);
+    _startSettings.LinkTests = _LeachConfig.GetInteger("startup", "LinkTests", 123);
+    _startSettings.VerifyWords = _LeachConfig.GetInteger("startup", "VerifyWords", 64);
+    _startSettings.ValidateFirmware = _LeachConfig.GetBoolean("startup", "ValidateFirmware", true);
+    _startSettings.StartDelay = _LeachConfig.GetReal("startup", "StartDelay", 10.0);
+    _startSettings.IdleBeforeErase = _LeachConfig.GetReal("startup", "IdleBeforeErase", 5.0);
+    _startSettings.EraseVsubOffTime = _LeachConfig.GetReal("startup", "EraseVsubOffTime", 5.0);
+    _startSettings.EraseSettleTime = _LeachConfig.GetReal("startup", "EraseSettleTime", 5.0);
+    if (_startSettings.StartDelay < 0) _startSettings.StartDelay = 0;
+    if (_startSettings.IdleBeforeErase < 0) _startSettings.IdleBeforeErase = 0;
+    if (_startSettings.EraseVsubOffTime < 0) _startSettings.EraseVsubOffTime = 0;
+    if (_startSettings.EraseSettleTime < 0) _startSettings.EraseSettleTime = 0;
+    if (_startSettings.LinkTests < 1) _startSettings.LinkTests = 1;
+    if (_startSettings.VerifyWords < 1) {
+        std::cout<<"Warning: VerifyWords must be at least 1. Warm starts are turned off.\n";
+        _startSettings.WarmStart = false;
+    }
+
+}
+
+
+/*Parse all the sections of the config file. If the file has the same stat data as the last time
+ *it was parsed by this instance, the settings parsed then are used again.*/
+void LeachController::ParseAllSettings(void )
+{
+
+    FileStamp Stamp;
+    bool bStatOK = (StatFile(this->INIFileLoc, Stamp) == 0);
+
+    if (bStatOK && this->LastParsed.bValid && this->LastParsed.INIFileLoc == this->INIFileLoc && this->LastParsed.Stamp == Stamp) {
+        this->RestoreSettings(this->LastParsed);
+        return;
+    }
+
+    this->ParseCCDSettings(this->CCDParams,this->ClockParams,this->BiasParams);
+    this->ParseProcessingSettings(this->ProcParams);
+    this->ParseAcquisitionSettings(this->AcqParams);
+    this->ParseOutputSettings(this->OutParams);
+    this->ParseRegionSettings(this->RoiParams);
+    this->ParseStartupSettings(this->StartupParams);
+    this->ComputeReadoutGeometry();
+    this->SetupParsedSettings();
+
+    this->CaptureSettings(this->LastParsed);
+    this->LastParsed.INIFileLoc = this->INIFileLoc;
+    this->LastParsed.Stamp = Stamp;
+    this->LastParsed.bValid = bStatOK;
+
+}
+
+
+/*What the settings need besides the values: the masters, the frame pool and the threads*/
+void LeachController::SetupParsedSettings(void )
+{
+
+    /*The masters are only read again when other files are named*/
+    const std::string &BiasFile = this->ProcParams.MasterBias;
+    const std::string &DarkFile = this->ProcParams.MasterDark;
+    if (this->Masters ? (this->Masters->BiasFile != BiasFile || this->Masters->DarkFile != DarkFile)
+                      : (!BiasFile.empty() || !DarkFile.empty()))
+        this->Masters = LoadCalibrationMasters(BiasFile, DarkFile);
+
+    /*A pool size that is set explicitly is mapped and faulted in now rather than at the first frame*/
+    if (this->AcqParams.FramePoolBuffers > 0) this->SetupFramePool();
+    this->SetupScheduling();
+
+}
+
+
+void LeachController::CaptureSettings(ParsedSettings &Out) const
+{
+    Out.CCDParams = this->CCDParams;
+    Out.ClockParams = this->ClockParams;
+    Out.BiasParams = this->BiasParams;
+    Out.ProcParams = this->ProcParams;
+    Out.AcqParams = this->AcqParams;
+    Out.OutParams = this->OutParams;
+    Out.RoiParams = this->RoiParams;
+    Out.StartupParams = this->StartupParams;
+}
+
+
+void LeachController::RestoreSettings(const ParsedSettings &In)
+{
+    this->CCDParams = In.CCDParams;
+    this->ClockParams = In.ClockParams;
+    this->BiasParams = In.BiasParams;
+    this->ProcParams = In.ProcParams;
+    this->AcqParams = In.AcqParams;
+    this->OutParams = In.OutParams;
+    this->RoiParams = In.RoiParams;
+    this->StartupParams = In.StartupParams;
+}
+
+
 int LeachController::LoadAndCheckForSettingsChange(bool &config, bool &sequencer )
 {
 
     /*Load the old SHA256 keys*/
-    std::ifstream f3("do_not_touch/LastHashes.txt", std::fstream::in);
+    std::ifstream f3(this->StateFile("LastHashes.txt"), std::fstream::in);
     std::string OldSettingsHash;
     std::string OldFirmwareHash;
 
@@ -119,22 +456,13 @@ int LeachController::LoadAndCheckForSettingsChange(bool &config, bool &sequencer
     std::getline(f3, OldFirmwareHash);
 
     /*Load the new settings*/
-    this->ParseCCDSettings(this->CCDParams,this->ClockParams,this->BiasParams);
+    this->ParseAllSettings();
 
-    /*Calculate new SHA256 keys*/
-    std::ifstream f1(this->INIFileLoc, std::fstream::binary);
-    std::vector<unsigned char> s1(picosha2::k_digest_size);
-    picosha2::hash256(f1, s1.begin(), s1.end());
-    f1.close();
-
-    std::ifstream fSeq(this->CCDParams.sTimFile, std::fstream::binary);
-    std::vector<unsigned char> s2(picosha2::k_digest_size);
-    picosha2::hash256(fSeq, s2.begin(), s2.end());
-    fSeq.close();
+    /*Calculate new SHA256 keys. Files that were not touched since the last time are not read again.*/
+    std::string f1s = this->HashCache.Digest(this->INIFileLoc);
+    std::string f2s = this->HashCache.Digest(this->CCDParams.sTimFile);
 
     /*Compare keys and return based on the match conditions*/
-    std::string f1s = picosha2::bytes_to_hex_string(s1.begin(), s1.end());
-    std::string f2s = picosha2::bytes_to_hex_string(s2.begin(), s2.end());
     config = 0;
     sequencer = 0;
 
@@ -161,38 +489,68 @@ void LeachController::CopyOldAndStoreFileHashes(void)
 
     //Copy the settings file first for later comparisons.
     std::ifstream f1(this->INIFileLoc, std::fstream::binary);
-    std::ofstream f2("do_not_touch/LastSettings.ini", std::fstream::trunc);
-    f2 << f1.rdbuf();
+    std::stringstream INIText;
+    INIText << f1.rdbuf();
+    f1.close();
 
-    f1.clear();
-    f1.seekg(0);
+    this->WriteAppliedStateFiles(INIText.str(), this->HashCache.Digest(this->INIFileLoc), this->HashCache.Digest(this->CCDParams.sTimFile));
 
+}
 
-    std::ifstream fSeq(this->CCDParams.sTimFile, std::ios::binary);
-    std::vector<unsigned char> s1(picosha2::k_digest_size);
-    picosha2::hash256(f1, s1.begin(), s1.end());
-    std::vector<unsigned char> s2(picosha2::k_digest_size);
-    picosha2::hash256(fSeq, s2.begin(), s2.end());
 
+/*Record what is on the controller for the next program: the settings in LastSettings.ini, their digest and
+ *that of the sequencer in LastHashes.txt, and where they came from in LastConfigLocation.txt*/
+void LeachController::WriteAppliedStateFiles(const std::string &INIText, const std::string &SettingsDigest, const std::string &SequencerDigest)
+{
 
-    std::string f1s = picosha2::bytes_to_hex_string(s1.begin(), s1.end());
-    std::string f2s = picosha2::bytes_to_hex_string(s2.begin(), s2.end());
+    /*After a differential apply that failed in part, the next program has to apply everything*/
+    if (this->bAppliedIncomplete) std::remove(this->StateFile("LastSettings.ini").c_str());
+    else {
+        std::ofstream f2(this->StateFile("LastSettings.ini"), std::fstream::trunc);
+        f2 << INIText;
+        f2.close();
+    }
 
-    std::ofstream f3("do_not_touch/LastHashes.txt", std::fstream::trunc | std::fstream::out);
-    f3 << f1s << "\n" << f2s;
+    std::ofstream f3(this->StateFile("LastHashes.txt"), std::fstream::trunc | std::fstream::out);
+    f3 << SettingsDigest << "\n" << SequencerDigest;
     f3.close();
 
-    std::ofstream f4("do_not_touch/LastConfigLocation.txt", std::fstream::trunc | std::fstream::out);
+    std::ofstream f4(this->StateFile("LastConfigLocation.txt"), std::fstream::trunc | std::fstream::out);
     f4 << this->INIFileLoc << "\n";
     f4.close();
 
+    /*LastSettings.ini now describes what is on the controller*/
+    if (!this->bAppliedIncomplete) this->StoreAppliedSettings();
+
+}
+
+
+/*The controller is about to get settings that are not in any config file (a scan). Until the state files
+ *are written again, the next program must not trust them: without LastSettings.ini everything is applied,
+ *and a settings digest that matches no file makes CCDDExpose ask for an apply. The sequencer digest is kept.*/
+void LeachController::MarkAppliedStateStale(void )
+{
+
+    std::ifstream fIn(this->StateFile("LastHashes.txt"), std::fstream::in);
+    std::string OldSettingsHash, OldFirmwareHash;
+    std::getline(fIn, OldSettingsHash);
+    std::getline(fIn, OldFirmwareHash);
+    fIn.close();
+
+    std::remove(this->StateFile("LastSettings.ini").c_str());
+
+    std::ofstream f3(this->StateFile("LastHashes.txt"), std::fstream::trunc | std::fstream::out);
+    f3 << "stale" << "\n" << OldFirmwareHash;
+    f3.close();
+
 }
 
 
 void LeachController::LoadCCDSettingsFresh(void)
 {
 
-    this->ParseCCDSettings(this->CCDParams,this->ClockParams,this->BiasParams);
+    this->LastParsed.bValid = false;
+    this->ParseAllSettings();
     this->CopyOldAndStoreFileHashes( );
 }
 
@@ -0,0 +1,226 @@
+/* *********************************************************************
+ * This file contains the continuous readout. The controller exposes
+ * and reads out nFrames frames back to back on its own (SNF / FPB of
+ * the ARC timing firmware), into a common buffer that holds a few of
+ * them as a ring. The ARC API polls the frame count and hands every
+ * completed frame to CContinuousListener, which copies it out of the
+ * ring and queues it on the frame writer. No command is sent between
+ * the frames.
+ * *********************************************************************
+ */
+
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "LeachController.hpp"
+#include "AsyncFrameWriter.hpp"
+#include "UtilityFunctions.hpp"
+
+/*Frames in the ring start on a page boundary, which covers the PCI and the PCIe boundaries*/
+#define CONTINUOUS_FRAME_ALIGN 4096
+
+/*How often the stop watcher looks at bAbortContinuous*/
+#define CONTINUOUS_STOP_POLL_MS 50
+
+
+/* *********************************************************************
+ * Called by CArcDevice::Continuous on the thread that runs it, every
+ * time a frame is complete. The frame has to be copied out before the
+ * controller comes round to its slot of the ring again, so this only
+ * records and copies it; the de-interlacing, the NDCM reduction and the
+ * file output happen on the writer threads.
+ * *********************************************************************
+ */
+
+void LeachController::CContinuousListener::FrameCallback(int dFramesPerBuffer, int dFrameCount, int dRows, int dCols, void *pBuffer)
+{
+
+    auto tNow = std::chrono::steady_clock::now();
+
+    /*The frame count of the board moves by one per frame, a larger step means frames were overwritten*/
+    if (this->nFramesReceived > 0 && dFrameCount > this->dLastFrameCount + 1)
+        this->nFramesLost += dFrameCount - this->dLastFrameCount - 1;
+
+    /*There are no exposure and readout start events, the clock times follow from the frame period*/
+    double dPeriodMs = std::chrono::duration<double, std::milli>(tNow - this->tLastFrame).count();
+    double dExposureMs = this->ExposureTime * 1000.0;
+    TimeVariables &T = L.ClockTimers;
+    T.ReadoutEnd = std::chrono::system_clock::now();
+    T.ExpStart = T.ReadoutEnd - std::chrono::microseconds((long) (dPeriodMs * 1000.0));
+    T.Readoutstart = T.ExpStart + std::chrono::microseconds((long) (dExposureMs * 1000.0));
+    T.MeasuredExp = dExposureMs;
+    T.MeasuredReadout = dPeriodMs > dExposureMs ? dPeriodMs - dExposureMs : 0;
+
+    std::unique_ptr<FrameRecord> Frame = L.RecordLastExposure(FrameFileName(this->OutFileName, this->nFramesReceived));
+    L.CopyFramePixels(*Frame, (const unsigned short *) pBuffer);
+    this->pWriter->Submit(std::move(Frame));
+
+    this->nFramesReceived++;
+    this->dLastFrameCount = dFrameCount;
+    this->tLastFrame = tNow;
+
+    LogProgress(this->FrameRate, this->nFramesReceived == this->nFrames, "continuous", this->nFramesReceived, this->nFrames,
+                "Frame %d / %d read out (%d per buffer, %.2f s per frame)", this->nFramesReceived, this->nFrames, dFramesPerBuffer, dPeriodMs / 1000.0);
+    L.Publisher.ReadoutProgress((int64_t) this->nFramesReceived * dRows * dCols);
+
+}
+
+
+/* *********************************************************************
+ * Take nFrames exposures of ExposureTime seconds each as one continuous
+ * readout. Frame k is written to FrameFileName(OutFileName, k). The
+ * super-sequencer is set up once (SSR, geometry, STC with the total
+ * columns of all NDCM samples), and VDD stays on for the whole run,
+ * since nothing can be sent to the controller between the frames.
+ * Returns the number of frames that were read out and, with the own
+ * writer, also written.
+ * *********************************************************************
+ */
+
+int LeachController::ExposeContinuous(float ExposureTime, int nFrames, std::string OutFileName, AsyncFrameWriter* pFrameWriter)
+{
+
+    /*A stop that comes in from here on, during the setup as well, ends the run*/
+    this->bAbortContinuous = false;
+
+    std::unique_ptr<AsyncFrameWriter> OwnFrameWriter;
+    if (pFrameWriter == NULL) {
+        OwnFrameWriter.reset(new AsyncFrameWriter(this->OutParams.WriterQueueDepth, this->OutParams.WriterThreads,
+                                                  ParseCPUList(this->AcqParams.WorkerCPUs)));
+        pFrameWriter = OwnFrameWriter.get();
+    }
+
+    this->ComputeReadoutGeometry();
+    this->ExposureCmdStats.Clear();
+    this->Telemetry.Reset(0);
+
+    if (this->AcqParams.SegmentedReadout) {
+        std::cout << "A continuous readout can not be segmented. Every frame must fit in the common buffer.\n";
+        return 0;
+    }
+
+    /*The rows are never looked at while they come in*/
+    bool bQuickLook = this->OutParams.QuickLook;
+    if (bQuickLook) std::cout << "Warning: the quick look is not kept in a continuous readout.\n";
+    this->OutParams.QuickLook = false;
+    bool bFindClusters = this->OutParams.FindClusters, bClusterOnly = this->OutParams.ClusterOnly;
+    if (bFindClusters) std::cout << "Warning: clusters are not looked for in a continuous readout. The images are written.\n";
+    this->OutParams.FindClusters = false;
+    this->OutParams.ClusterOnly = false;
+
+    CContinuousListener Listener(*this, pFrameWriter, OutFileName);
+    Listener.nFrames = nFrames;
+    Listener.ExposureTime = ExposureTime;
+    bool bSuccess = false;
+
+    try {
+
+        this->bImageInHostBuffer = false;
+        this->SegmentRowOffset = 0;
+        this->SegmentTotalRows = 0;
+        if (this->CCDParams.CCDType != "SK") this->CCDParams.nSkipperR = 1;
+
+        /*The readouts of a continuous run do not leave the controller set up for the next single frame*/
+        this->PreparedReadout.bValid = false;
+        this->PreparedReadout.ExpTimeMs = -1;
+
+        if (this->CCDParams.CCDType == "SK") this->SetSSR();
+        this->SetReadoutGeometry();
+        int TotalCol = this->CCDParams.dCols * this->CCDParams.nSkipperR;
+        this->TimedCommand( TIM_ID, STC, TotalCol);
+
+        /*The ring holds ContinuousBufferFrames frames, the ARC API works out how many really fit*/
+        size_t FrameBytes = (size_t) TotalCol * this->CCDParams.dRows * sizeof(unsigned short);
+        size_t SlotBytes = (FrameBytes + CONTINUOUS_FRAME_ALIGN - 1) / CONTINUOUS_FRAME_ALIGN * CONTINUOUS_FRAME_ALIGN;
+        int nSlots = this->AcqParams.ContinuousBufferFrames < nFrames ? this->AcqParams.ContinuousBufferFrames : nFrames;
+        this->MapCommonBuffer(SlotBytes * nSlots);
+        if ( (size_t) pArcDev->CommonBufferSize() < FrameBytes ) {
+            std::cout<<"Common buffer size: "<<pArcDev->CommonBufferSize()<<"  | Image memory requirement: "<<FrameBytes<<"\n";
+            throw std::runtime_error("Failed to map image buffer!");
+        }
+        printf("Rows %d, Cols %d | NDCMS: %d , Total number of columns: %d\n",pArcDev->GetImageRows(), pArcDev->GetImageCols(), this->CCDParams.nSkipperR, TotalCol);
+
+        /*UL frames are de-interlaced by the frame writer*/
+        this->bImageInterlaced = this->CCDParams.AmplifierDirection == "UL" || this->CCDParams.AmplifierDirection == "LU";
+
+        ReadoutPrediction Prediction = this->PredictReadout();
+        this->ClockTimers.PredictedReadout = Prediction.FrameTime * 1000.0;
+        printf("Continuous readout of %d frames. Expected time: %.1f s (%.3f s exposure + %.2f s readout per frame)\n",
+               nFrames, nFrames * (ExposureTime + Prediction.FrameTime), ExposureTime, Prediction.FrameTime);
+
+        if (!this->_expose_isVDDOn) this->ToggleVDD(1);
+        std::cout << "VDD stays on during a continuous readout.\n";
+
+        if (this->pStartBarrier != NULL) this->pStartBarrier->Wait();
+        Listener.tLastFrame = std::chrono::steady_clock::now();
+        this->Publisher.ExposureStarted(ExposureTime, (int64_t) nFrames * this->CCDParams.dRows * TotalCol);
+
+        /*The ARC API only looks at its stop flag between polls of the frame count. The watcher
+         *sets it and tells the controller to stop as soon as a stop is asked for, rather than
+         *leaving it for the end of the frame in progress.*/
+        std::atomic<bool> bRunDone( false );
+        std::thread StopWatcher( [this, &Listener, &bRunDone]() {
+            while ( !bRunDone ) {
+                if ( this->bAbortContinuous ) {
+                    Listener.bStop = true;
+                    try { pArcDev->StopContinuous(); } catch (...) {}
+                    return;
+                }
+                std::this_thread::sleep_for( std::chrono::milliseconds( CONTINUOUS_STOP_POLL_MS ) );
+            }
+        } );
+        struct StopOnExit {
+            std::atomic<bool> &bDone;
+            std::thread &t;
+            ~StopOnExit() { bDone = true; if ( t.joinable() ) t.join(); }
+        } StopStopWatcher{ bRunDone, StopWatcher };
+
+        if (!this->bAbortContinuous)
+            this->RunAcquisition([&]() {
+                pArcDev->Continuous(this->CCDParams.dRows, TotalCol, nFrames, ExposureTime, Listener.bStop, &Listener, true);
+            });
+        LogFlush();
+        std::cout << "\n";
+
+        bSuccess = Listener.nFramesReceived == nFrames;
+        if (this->bAbortContinuous) std::cout << "The continuous readout was stopped.\n";
+
+    } catch (std::runtime_error &e) {
+        /*The ARC API throws when it sees its stop flag*/
+        if (this->bAbortContinuous) std::cout << "\nThe continuous readout was stopped.\n";
+        else {
+            std::cout << "\nfailed!" << std::endl;
+            std::cerr << std::endl << e.what() << std::endl;
+            std::cout << "Does the timing firmware support continuous readouts (SNF and FPB)?\n";
+        }
+        try { pArcDev->StopContinuous(); } catch (...) {}
+    } catch (...) {
+        std::cerr << std::endl << "Error: unknown exception occurred!!!" << std::endl;
+        try { pArcDev->StopContinuous(); } catch (...) {}
+    }
+
+    if (Listener.nFramesLost > 0)
+        std::cout << "Warning: " << Listener.nFramesLost << " frames were overwritten in the common buffer before they were copied."
+                  << " Increase ContinuousBufferFrames or WriterQueueDepth.\n";
+    std::cout << Listener.nFramesReceived << " of " << nFrames << " frames were read out.\n";
+
+    this->OutParams.QuickLook = bQuickLook;
+    this->OutParams.FindClusters = bFindClusters;
+    this->OutParams.ClusterOnly = bClusterOnly;
+    this->bImageInterlaced = false;
+    this->Publisher.ExposureFinished(bSuccess);
+
+    int nFramesTaken = Listener.nFramesReceived;
+    if (OwnFrameWriter) {
+        std::cout << "\nWaiting for the remaining frames to be written.\n";
+        OwnFrameWriter->WaitUntilDone();
+        int nFailed = OwnFrameWriter->FramesFailed();
+        if (nFailed > 0) std::cout << nFailed << " of " << nFramesTaken << " frames could not be written.\n";
+        nFramesTaken -= nFailed;
+    }
+
+    return nFramesTaken;
+}
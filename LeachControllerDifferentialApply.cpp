@@ -0,0 +1,147 @@
+/* *********************************************************************
+ * This file contains the differential apply of the settings. The
+ * controller keeps a shadow copy of the settings that were last applied
+ * (do_not_touch/LastSettings.ini has the same settings for the stand
+ * alone programs), and only the DAC channels and super-sequencer timing
+ * that differ from it are sent to the Leach system.
+ * *********************************************************************
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "LeachController.hpp"
+#include "CCDControlDataTypes.hpp"
+
+
+
+void LeachController::StoreAppliedSettings(void )
+{
+    this->AppliedCCDParams = this->CCDParams;
+    this->AppliedClockParams = this->ClockParams;
+    this->AppliedBiasParams = this->BiasParams;
+    this->bAppliedValid = true;
+    this->bAppliedUnknown = false;
+}
+
+
+/*The controller was reset or reloaded, so nothing is known about what is on it*/
+void LeachController::InvalidateAppliedSettings(void )
+{
+    this->bAppliedValid = false;
+    this->bAppliedUnknown = true;
+}
+
+
+/*Returns true if the shadow settings are known, either from this process
+ *or from the LastSettings.ini written by the last program that applied them*/
+bool LeachController::LoadAppliedSettings(void )
+{
+
+    if (this->bAppliedValid) return true;
+    if (this->bAppliedUnknown) return false;
+
+    struct stat buffer;
+    std::string LastSettings = this->StateFile("LastSettings.ini");
+    if (stat(LastSettings.c_str(), &buffer) != 0) return false;
+
+    this->ParseCCDSettings(this->AppliedCCDParams, this->AppliedClockParams, this->AppliedBiasParams, LastSettings);
+    this->bAppliedValid = true;
+    return true;
+
+}
+
+
+/*
+ * Apply the settings in CCDParams, ClockParams and BiasParams, but only send
+ * what differs from the shadow copy. If the shadow is not known, or something
+ * changed that affects how the channels are mapped or the order the super-sequencer
+ * needs its commands in, everything is applied like before.
+ * Returns the number of settings that were sent, or -1 if everything was applied.
+ */
+int LeachController::ApplyChangedSettings(void )
+{
+
+    const CCDVariables &New = this->CCDParams;
+    const CCDVariables &Old = this->AppliedCCDParams;
+
+    bool bFullApply = !this->LoadAppliedSettings();
+    if (!bFullApply) {
+        bFullApply = New.CCDType != Old.CCDType || New.SecondStageVersion != Old.SecondStageVersion
+                     || New.InvRG != Old.InvRG || New.super_sequencer != Old.super_sequencer
+                     || New.AmplifierDirection != Old.AmplifierDirection || New.HClkDirection != Old.HClkDirection
+                     || New.VClkDirection != Old.VClkDirection;
+    }
+
+    if (bFullApply) {
+        std::cout<<"Applying all the settings.\n";
+        this->ApplyAllCCDBasic();
+        this->ApplyAllBiasVoltages();
+        this->ApplyAllCCDClocks();
+        this->StoreAppliedSettings();
+        return -1;
+    }
+
+    int nSent = 0, nFailed = 0;
+    auto Sent = [&](int dResult) { nSent++; if (dResult != 0) nFailed++; };
+
+    /*Super-sequencer timing*/
+    if (New.super_sequencer) {
+        if (New.IntegralTime != Old.IntegralTime || New.Gain != Old.Gain) {
+            Sent(this->ApplyNewIntegralTimeAndGain(New.IntegralTime, New.Gain));
+        } else {
+            /*Same integrator as ApplyNewIntegralTimeAndGain would have picked*/
+            this->CCDParams.ItgSpeed = (New.IntegralTime < 4.5) ? 1 : 0;
+        }
+        if (New.PedestalIntgWait != Old.PedestalIntgWait) Sent(this->ApplyNewPedestalIntegralWait(New.PedestalIntgWait));
+        if (New.SignalIntgWait != Old.SignalIntgWait) Sent(this->ApplyNewSignalIntegralWait(New.SignalIntgWait));
+        if (New.ParallelBin != Old.ParallelBin) Sent(this->ApplyPBIN(New.ParallelBin));
+        if (New.SerialBin != Old.SerialBin) Sent(this->ApplySBIN(New.SerialBin));
+        if (New.DGWidth != Old.DGWidth) Sent(this->ApplyDGWidth(New.DGWidth));
+        if (New.OGWidth != Old.OGWidth) Sent(this->ApplyOGWidth(New.OGWidth));
+        if (New.SKRSTWidth != Old.SKRSTWidth) Sent(this->ApplySkippingRGWidth(New.SKRSTWidth));
+        if (New.SWWidth != Old.SWWidth) Sent(this->ApplySummingWellWidth(New.SWWidth));
+    }
+
+    if (New.CCDType == "SK" && New.nSkipperR != Old.nSkipperR) Sent(this->SetSSR());
+
+    /*Clocks, biases and video offsets. The DAC words are compared, so a change below the DAC
+     *resolution is not sent, and only the half of a clock that changed is*/
+    std::vector<ClockDAC> NewClocks, OldClocks;
+    std::vector<BiasDAC> NewBiases, OldBiases, NewOffsets, OldOffsets;
+    std::vector<DACWrite> NewWrites, OldWrites, ChangedWrites;
+    this->ClockChannelMap(this->CCDParams, this->ClockParams, NewClocks, true);
+    this->ClockChannelMap(this->AppliedCCDParams, this->AppliedClockParams, OldClocks);
+    this->BiasChannelMap(this->CCDParams, this->BiasParams, NewBiases, NewOffsets);
+    this->BiasChannelMap(this->AppliedCCDParams, this->AppliedBiasParams, OldBiases, OldOffsets);
+    this->ClockDACWrites(NewClocks, NewWrites);
+    this->BiasDACWrites(NewBiases, NewOffsets, NewWrites);
+    this->ClockDACWrites(OldClocks, OldWrites);
+    this->BiasDACWrites(OldBiases, OldOffsets, OldWrites);
+
+    for (size_t i = 0; i < NewWrites.size(); i++) {
+        const DACWrite &w = NewWrites[i];
+        if (i < OldWrites.size() && OldWrites[i].board == w.board && OldWrites[i].dac == w.dac
+            && OldWrites[i].type == w.type && OldWrites[i].val == w.val) continue;
+        ChangedWrites.push_back(w);
+    }
+    nFailed += this->IssueDACWrites(ChangedWrites, "changed voltages");
+    nSent += (int) ChangedWrites.size();
+
+    /*What failed is not on the controller, so the shadow can not be trusted until everything is sent again*/
+    if (nFailed > 0) {
+        std::cout<<nFailed<<" of "<<nSent<<" changed settings could not be applied. The next apply sends all the settings.\n";
+        this->InvalidateAppliedSettings();
+        this->bAppliedIncomplete = true;
+        return nSent;
+    }
+
+    std::cout<<nSent<<" changed settings were applied.\n";
+    this->StoreAppliedSettings();
+    return nSent;
+
+}
@@ -6,10 +6,15 @@
 
 #include "LeachController.hpp"
 #include "UtilityFunctions.hpp"
+#include "NativeDeinterlace.hpp"
 
 #include <string>
 #include <iostream>
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cstring>
 
 #include "CArcDevice.h"
 #include "CArcPCIe.h"
@@ -24,8 +29,7 @@
  */
 
 #define ChkAbortExposure if(bAbort){ \
-                            pArcDev->StopExposure(); \
-                            throw std::runtime_error( "Expose Aborted!" ); \
+                            this->StopReadout( dPixelCount, "Expose Aborted!" ); \
                             }
 
 /* *********************************************************************
@@ -34,17 +38,63 @@
 * appropreate parameters (nSkipperR for SK CCDs) etc are set properly
 * before an exposure is taken.
 * This routine will also set SSR values before a skipper exposure.
+* Returns 0 if the image was acquired and -1 otherwise. If the readout
+* was stopped (AbortExposure, or the quick look criteria) and [output]
+* SavePartial is on, the rows read so far are kept: 0 is returned and
+* PartialRows says how many rows the image has.
 * *********************************************************************
 */
 
-void LeachController::PrepareAndExposeCCD(int ExposureTime, unsigned short *ImageBuffer)
+int LeachController::PrepareAndExposeCCD(int ExposureTime, unsigned short *ImageBuffer)
 {
 
+    /*An abort asked for between the frames of a series still stops the series*/
+    if (!this->bFrameSeries) this->bAbortExposure = false;
+    this->AbortedPixelCount = -1;
+    this->AbortReason.clear();
+    this->PartialRows = -1;
+
+    /*The size of the readout follows the region of interest and the binning*/
+    this->ComputeReadoutGeometry();
+    this->ExposureCmdStats.Clear();
+    this->Telemetry.Reset((size_t) this->AcqParams.TelemetrySamples);
+
+    if (this->OutParams.PublishStatus) {
+        std::string Segment = this->OutParams.StatusSegment;
+        if (this->DeviceIndex > 0) Segment += "_dev" + std::to_string(this->DeviceIndex);
+        if (!this->Publisher.IsOpen() || this->Publisher.SegmentName() != "/" + Segment)
+            this->Publisher.Open(Segment, (size_t) this->OutParams.StatusFrameMB * 1024 * 1024, this->DeviceIndex);
+    } else if (this->Publisher.IsOpen()) {
+        this->Publisher.Close();
+    }
+
+    /*Images that do not fit in the common buffer are read out in bands. The bands are made with
+     *the image size, so they can not be combined with a sub-array readout.*/
+    if (this->AcqParams.SegmentedReadout && this->RoiParams.Enabled)
+        std::cout<<"Warning: Segmented readout is not possible with a region of interest. Reading out in one go.\n";
+    else if (this->AcqParams.SegmentedReadout) {
+        int dResult = this->PrepareAndExposeCCDSegmented(ExposureTime);
+        this->PublishExposureResult(dResult == 0);
+        return dResult;
+    }
 
     try {
 
-        if (this->CCDParams.CCDType == "SK") this->SetSSR();
-        else this->CCDParams.nSkipperR = 1;
+        this->bImageInterlaced = false;
+        this->bImageInHostBuffer = false;
+        this->SegmentRowOffset = 0;
+        this->SegmentTotalRows = 0;
+
+        if (this->CCDParams.CCDType != "SK") this->CCDParams.nSkipperR = 1;
+
+        /*The next frame of a series needs no setup if it is read out like the previous one*/
+        bool bSameSetup = this->bFrameSeries && this->PreparedReadout.bValid && this->PreparedReadout.nSkipperR == this->CCDParams.nSkipperR
+                          && this->PreparedReadout.dRows == this->CCDParams.dRows && this->PreparedReadout.dCols == this->CCDParams.dCols;
+        this->PreparedReadout.bValid = false;
+
+        if (this->CCDParams.CCDType == "SK" && !bSameSetup) this->SetSSR();
+        this->SetupQuickLook();
+        this->SetupClusterFinder();
 
         /*Needed for callbacks during exposure*/
         CExposeListener cExposeListener(*this);
@@ -54,30 +104,33 @@ void LeachController::PrepareAndExposeCCD(int ExposureTime, unsigned short *Imag
 
         //pArcDev->UnMapCommonBuffer();
 
-        /*This sets the NSR and NPR in the leach assembly. Somehow this doesnt work?*/
-        pArcDev->SetImageSize( this->CCDParams.dRows, this->CCDParams.dCols );
-        pArcDev->Command( TIM_ID, STC, TotalCol);
+        /*This sets the NSR and NPR in the leach assembly, and the sub-array and binning if any*/
+        if (!bSameSetup) {
+            this->SetReadoutGeometry();
+            this->TimedCommand( TIM_ID, STC, TotalCol);
+        }
 
-        pArcDev->ReMapCommonBuffer(ImageMemorySize);
+        this->MapCommonBuffer(ImageMemorySize);
         printf("Rows %d, Cols %d | NDCMS: %d , Total number of columns: %d\n",pArcDev->GetImageRows(), pArcDev->GetImageCols(), this->CCDParams.nSkipperR, TotalCol);
 
+        ReadoutPrediction Prediction = this->PredictReadout();
+        printf("Expected readout time: %.2f s%s\n", Prediction.FrameTime, this->ReadoutModel.Calibrations() > 0 ? "" : " (model not calibrated yet)");
+
         /*This will happen if the memory required is > kernel buffer size*/
         if ( pArcDev->CommonBufferSize() < ImageMemorySize ) {
             std::cout<<"Common buffer size: "<<pArcDev->CommonBufferSize()<<"  | Image memory requirement: "<<ImageMemorySize<<"\n";
             throw std::runtime_error("Failed to map image buffer!");
         }
 
-        /*De-Interlacing part*/
-        int dDeintAlg;
-        if (this->CCDParams.AmplifierDirection == "UL") {
-            dDeintAlg = arc::deinterlace::CArcDeinterlace::DEINTERLACE_SERIAL;
-        } else if (this->CCDParams.AmplifierDirection == "U" || this->CCDParams.AmplifierDirection == "L") {
-            dDeintAlg = arc::deinterlace::CArcDeinterlace::DEINTERLACE_NONE;
-        } else {
-            std::cout << "The amplifier selected does not exist. Interlacing is not set. Stop and verify!\n";
-        }
-
+        this->PreparedReadout.bValid = true;
+        this->PreparedReadout.nSkipperR = this->CCDParams.nSkipperR;
+        this->PreparedReadout.dRows = this->CCDParams.dRows;
+        this->PreparedReadout.dCols = this->CCDParams.dCols;
 
+        /*De-Interlacing part: DeinterlaceImage takes care of UL / LU after the readout*/
+        const std::string &Amp = this->CCDParams.AmplifierDirection;
+        if (Amp != "UL" && Amp != "LU" && Amp != "U" && Amp != "L")
+            std::cout << "The amplifier selected does not exist. Interlacing is not set. Stop and verify!\n";
 
 
         /*To eliminate the possibility of the amplifiers behaving as a source of light,
@@ -87,20 +140,27 @@ void LeachController::PrepareAndExposeCCD(int ExposureTime, unsigned short *Imag
 
         std::cout<<"Turning VDD OFF before exposure.\n";
         this->ToggleVDD(0);
+        if (this->pStartBarrier != NULL) this->pStartBarrier->Wait();
         std::cout << "Starting exposure\n";
-        this->ExposeCCD(ExposureTime, false, &cExposeListener);
+        try {
+            this->RunAcquisition([&]() { this->ExposeCCD(ExposureTime, this->bAbortExposure, &cExposeListener); });
+        } catch (std::runtime_error &) {
+            /*A stopped readout still has the rows read so far*/
+            int dRowsRead = this->SalvageReadout();
+            if (dRowsRead < 1) throw;
+            this->PartialRows = dRowsRead;
+            if (!this->_expose_isVDDOn) this->ToggleVDD(1);
+        }
         this->ClockTimers.ReadoutEnd = std::chrono::system_clock::now();
         this->ReadoutProgress.done();
-        std::cout << "\nExposure complete.\n";
+        if (this->PartialRows >= 0)
+            printf("\n%s The first %d of %d rows are kept.\n", this->AbortReason.c_str(), this->PartialRows, this->CCDParams.dRows);
+        else
+            std::cout << "\nExposure complete.\n";
 
 
         /*If two amplifiers were used, we need to de-interlace*/
-        if (this->CCDParams.AmplifierDirection == "UL" || this->CCDParams.AmplifierDirection == "LU") {
-            std::cout << "Since amplifier selected was UL / LU, the image will now be de-interlaced.\n";
-            unsigned short *pU16Buf = (unsigned short *) pArcDev->CommonBufferVA();
-            arc::deinterlace::CArcDeinterlace cDlacer;
-            cDlacer.RunAlg(pU16Buf, this->CCDParams.dRows, this->CCDParams.dCols * this->CCDParams.nSkipperR, dDeintAlg);
-        }
+        this->DeinterlaceImage((unsigned short *) pArcDev->CommonBufferVA());
 
 
         /*Set the imageBuffer before finishing*/
@@ -112,6 +172,13 @@ void LeachController::PrepareAndExposeCCD(int ExposureTime, unsigned short *Imag
         this->ClockTimers.MeasuredExp = ExpDuration.count();
         this->ClockTimers.MeasuredReadout = RdoutDuration.count();
 
+        /*Correct the readout time model with what it really took*/
+        this->ClockTimers.PredictedReadout = Prediction.FrameTime * 1000.0;
+        if (this->PartialRows < 0) {
+            double dError = this->ReadoutModel.Calibrate(Prediction, this->ClockTimers.MeasuredReadout / 1000.0);
+            printf("Readout took %.2f s, %.2f s expected (%+.1f%%)\n", this->ClockTimers.MeasuredReadout / 1000.0, Prediction.FrameTime, dError * 100.0);
+        }
+
     /* In case we run into a runtime error */
     } catch (std::runtime_error &e) {
         std::cout << "failed!" << std::endl;
@@ -121,6 +188,13 @@ void LeachController::PrepareAndExposeCCD(int ExposureTime, unsigned short *Imag
             pArcDev->StopExposure();
         }
 
+        /*Stopped before the end of the integration, the amplifiers are still off*/
+        if (!this->_expose_isVDDOn) this->ToggleVDD(1);
+
+        this->PreparedReadout.bValid = false;
+        this->PublishExposureResult(false);
+        return -1;
+
     /* Or any other kind of error */
     } catch (...) {
         std::cerr << std::endl << "Error: unknown exception occurred!!!" << std::endl;
@@ -128,7 +202,163 @@ void LeachController::PrepareAndExposeCCD(int ExposureTime, unsigned short *Imag
         if (pArcDev->IsReadout()) {
             pArcDev->StopExposure();
         }
+
+        /*Stopped before the end of the integration, the amplifiers are still off*/
+        if (!this->_expose_isVDDOn) this->ToggleVDD(1);
+
+        this->PreparedReadout.bValid = false;
+        this->PublishExposureResult(false);
+        return -1;
     }
+
+    this->PublishExposureResult(true);
+    return 0;
+}
+
+/* *********************************************************************
+ * Tell the monitors how the exposure ended and publish the frame. The
+ * segment is created with the first exposure after PublishStatus was
+ * turned on.
+ * *********************************************************************
+ */
+
+void LeachController::PublishExposureResult(bool bSuccess)
+{
+
+    if (!this->Publisher.IsOpen()) return;
+
+    this->Publisher.ExposureFinished(bSuccess);
+    if (bSuccess && this->OutParams.StatusFrameMB > 0)
+        this->Publisher.PublishFrame(this->ImageData(), this->CCDParams.dRows, this->CCDParams.dCols * this->CCDParams.nSkipperR,
+                                     this->CCDParams.nSkipperR, this->bImageInterlaced);
+
+}
+
+
+/* *********************************************************************
+ * De-interlace the image in pU16Buf if it was read out with both
+ * amplifiers. When the image is going to be NDCM reduced anyway, the
+ * native de-interlace is left to the processing stage, which does both
+ * in a single pass over the buffer. In a series of frames it is left to
+ * the frame writer as well, so that the next exposure can start.
+ * *********************************************************************
+ */
+
+void LeachController::DeinterlaceImage(unsigned short *pU16Buf)
+{
+
+    if (this->CCDParams.AmplifierDirection != "UL" && this->CCDParams.AmplifierDirection != "LU") return;
+
+    if (this->ProcParams.Deinterlacer == "arc") {
+        std::cout << "Since amplifier selected was UL / LU, the image will now be de-interlaced.\n";
+        arc::deinterlace::CArcDeinterlace cDlacer;
+        cDlacer.RunAlg(pU16Buf, this->CCDParams.dRows, this->CCDParams.dCols * this->CCDParams.nSkipperR,
+                       arc::deinterlace::CArcDeinterlace::DEINTERLACE_SERIAL);
+    } else if (this->ProcParams.ReduceNDCM) {
+        std::cout << "Since amplifier selected was UL / LU, the image will be de-interlaced during the NDCM reduction.\n";
+        this->bImageInterlaced = true;
+    } else if (this->bFrameSeries) {
+        std::cout << "Since amplifier selected was UL / LU, the image will be de-interlaced by the frame writer.\n";
+        this->bImageInterlaced = true;
+    } else {
+        std::cout << "Since amplifier selected was UL / LU, the image will now be de-interlaced.\n";
+        DeinterlaceSerial(pU16Buf, this->CCDParams.dRows, this->CCDParams.dCols * this->CCDParams.nSkipperR,
+                          this->ProcParams.ProcessingThreads);
+    }
+
+}
+
+
+/* *********************************************************************
+ * Tell the controller what part of the CCD is read out. Binning is
+ * done by the super-sequencer itself (PBIN / SBIN), otherwise it is
+ * set with the ARC binning registers. A region of interest is set as
+ * an ARC sub-array, with the overscan strip as its bias region. The
+ * ARC calls take the centre of the box in binned pixels.
+ * *********************************************************************
+ */
+
+void LeachController::SetReadoutGeometry(void )
+{
+
+    const RegionVariables &R = this->RoiParams;
+
+    if (!this->CCDParams.super_sequencer && (R.ParallelBin > 1 || R.SerialBin > 1)) {
+        int dBinRows = 0, dBinCols = 0;
+        pArcDev->SetBinning(R.CCDRows, R.CCDCols, R.ParallelBin, R.SerialBin, &dBinRows, &dBinCols);
+        this->bBinningSet = true;
+    } else if (this->bBinningSet) {
+        pArcDev->UnSetBinning(R.CCDRows, R.CCDCols);
+        this->bBinningSet = false;
+    }
+
+    if (R.Enabled) {
+        int dOldRows = 0, dOldCols = 0;
+        pArcDev->SetSubArray(dOldRows, dOldCols,
+                             R.RowStart / R.ParallelBin + R.ReadRows / 2, R.ColStart / R.SerialBin + R.DataCols / 2,
+                             R.ReadRows, R.DataCols, R.OverscanStart / R.SerialBin, R.OverscanReadCols);
+        this->bSubArraySet = true;
+    } else if (this->bSubArraySet) {
+        pArcDev->UnSetSubArray(this->CCDParams.dRows, this->CCDParams.dCols);
+        this->bSubArraySet = false;
+    }
+
+    pArcDev->SetImageSize( this->CCDParams.dRows, this->CCDParams.dCols );
+
+}
+
+
+/* *********************************************************************
+ * Map the common buffer for dBytes of image. Unmapping and mapping a
+ * large buffer again takes a while and gives the same buffer, so it is
+ * skipped if the size did not change.
+ * *********************************************************************
+ */
+
+void LeachController::MapCommonBuffer(size_t dBytes)
+{
+
+    if (this->bCommonBufferMapped && dBytes == this->MappedBufferBytes && pArcDev->CommonBufferVA() != NULL) return;
+
+    pArcDev->ReMapCommonBuffer(dBytes);
+    this->bCommonBufferMapped = true;
+    this->MappedBufferBytes = dBytes;
+
+}
+
+
+/* *********************************************************************
+ * Where the last image lives: the common buffer, or the host side
+ * image buffer if it was read out in segments.
+ * *********************************************************************
+ */
+
+unsigned short* LeachController::ImageData(void )
+{
+
+    if (this->bImageInHostBuffer) return this->SegmentedFrame.Valid() ? this->SegmentedFrame.Data() : this->SegmentedImage.Data();
+    return (unsigned short *) pArcDev->CommonBufferVA();
+
+}
+
+
+/* *********************************************************************
+ * How long ExposeCCD sleeps before the next poll of the controller.
+ * RemainingSeconds is the predicted time until the exposure or the
+ * readout ends; the wait is half of it, so the polls get closer the
+ * nearer the end is, between the configured shortest and longest wait.
+ * *********************************************************************
+ */
+
+static std::chrono::microseconds NextPollDelay(double RemainingSeconds, double MinPollMs, double MaxPollMs)
+{
+
+    double dDelayMs = RemainingSeconds * 1000.0 / 2.0;
+    if (dDelayMs > MaxPollMs) dDelayMs = MaxPollMs;
+    if (dDelayMs < MinPollMs) dDelayMs = MinPollMs;
+
+    return std::chrono::microseconds( (long) (dDelayMs * 1000.0) );
+
 }
 
 
@@ -145,21 +375,38 @@ void LeachController::PrepareAndExposeCCD(int ExposureTime, unsigned short *Imag
  *                   method to abort/stop either exposing or image readout.
  *                   NULL by default.
  * pExpIFace - Function pointer to CExpIFace class. NULL by default.
+ *
+ * The controller is polled with waits that adapt to where the exposure
+ * is: long ones while the CCD integrates, and shorter ones as the end of
+ * the readout predicted from the measured pixel rate comes closer (the
+ * readout time model, until the first row is in). The
+ * ARC driver has no interrupt that signals the end of a readout, so
+ * polling the status and the pixel count is all there is. The readout
+ * is aborted if the pixel count does not move for StallTimeout seconds,
+ * or for four expected row times if that is longer.
  * *********************************************************************
  */
 
 
-void LeachController::ExposeCCD( float fExpTime, const bool& bAbort, CExposeListener::CExpIFace* pExpIFace, bool bOpenShutter )
+void LeachController::ExposeCCD( float fExpTime, const std::atomic<bool>& bAbort, CExposeListener::CExpIFace* pExpIFace, bool bOpenShutter )
 {
     float fRemainingTime    = fExpTime;
     bool  bInReadout		= false;
-    int   dTimeoutCounter	= 0;
     int   dLastPixelCount	= 0;
     int   dPixelCount		= 0;
-    int   dExposeCounter	= 0;
+
+    std::chrono::steady_clock::time_point tExpStart, tLastRET, tReadStart, tLastProgress;
 
     /*Number of pixels to read*/
     this->TotalPixelsToRead = this->CCDParams.dCols * this->CCDParams.dRows * this->CCDParams.nSkipperR;
+    int dSegmentPixelOffset = this->SegmentRowOffset * this->CCDParams.dCols * this->CCDParams.nSkipperR;
+    this->RowsDelivered = 0;
+
+    /*Until the pixel rate is measured, the readout is expected to go as the model says. A row can take
+     *long with many samples, so a stall is only declared after a few of them passed without a pixel.*/
+    ReadoutPrediction Prediction = this->PredictReadout();
+    double dStallTimeout = this->AcqParams.StallTimeout;
+    if ( dStallTimeout < 4.0 * Prediction.CorrectedRowTime() ) dStallTimeout = 4.0 * Prediction.CorrectedRowTime();
 
 
     /* Check for adequate buffer size */
@@ -179,28 +426,68 @@ void LeachController::ExposeCCD( float fExpTime, const bool& bAbort, CExposeList
     pArcDev->SetOpenShutter( bOpenShutter );
 
 
-    /* Set the exposure time */
-    int dRetVal  = pArcDev->Command( TIM_ID, SET, int( fExpTime * 1000.0 ) );
+    /* Set the exposure time, unless the previous frame of the series had the same */
+    int dRetVal;
+    int dExpTimeMs = int( fExpTime * 1000.0 );
+    if ( !this->bFrameSeries || this->PreparedReadout.ExpTimeMs != dExpTimeMs ) {
+        this->PreparedReadout.ExpTimeMs = -1;
+        dRetVal  = this->TimedCommand( TIM_ID, SET, dExpTimeMs );
 
-    if ( dRetVal != DON ) {
-        printf("Set exposure time failed. Reply: 0x%X\n",dRetVal );
-        throw std::runtime_error( "Exception thrown because SET command failed." );
+        if ( dRetVal != DON ) {
+            printf("Set exposure time failed. Reply: 0x%X\n",dRetVal );
+            throw std::runtime_error( "Exception thrown because SET command failed." );
+        }
+        this->PreparedReadout.ExpTimeMs = dExpTimeMs;
     }
 
 
     /* Start the exposure */
     this->ClockTimers.ExpStart = std::chrono::system_clock::now();
     this->ClockTimers.isExp = true;
-    dRetVal = pArcDev->Command( TIM_ID, SEX );
+    tExpStart = std::chrono::steady_clock::now();
+    tLastRET = tExpStart;
+    if (this->SegmentRowOffset == 0) {
+        int dAllRows = this->SegmentTotalRows > 0 ? this->SegmentTotalRows : this->CCDParams.dRows;
+        this->Publisher.ExposureStarted(fExpTime, (int64_t) dAllRows * this->CCDParams.dCols * this->CCDParams.nSkipperR);
+    }
+    dRetVal = this->TimedCommand( TIM_ID, SEX );
     if ( dRetVal != DON ) {
         printf("Start exposure command failed. Reply: 0x%X\n",dRetVal );
         throw std::runtime_error( "Exception thrown because SEX command failed." );
     }
 
+    /*Work left over from the previous frame of a series runs while this one integrates. It has
+     *to be done before the pixels of this frame arrive, and before leaving here in any case.*/
+    std::atomic<bool> bExposureWorkDone( true );
+    std::thread DuringExposure;
+    struct JoinOnExit {
+        std::thread &t;
+        ~JoinOnExit() { if ( t.joinable() ) t.join(); }
+    } JoinDuringExposure{ DuringExposure };
+    if ( this->DuringNextExposure ) {
+        std::function<void(void )> Work = std::move(this->DuringNextExposure);
+        this->DuringNextExposure = nullptr;
+        bExposureWorkDone = false;
+        DuringExposure = std::thread( [this, Work, &bExposureWorkDone]() {
+            this->LeaveAcquisitionScheduling();
+            Work();
+            bExposureWorkDone = true;
+        } );
+    }
+
 
     while ( dPixelCount < ( this->CCDParams.dRows * this->CCDParams.dCols * this->CCDParams.nSkipperR ) ) {
-        if ( pArcDev->IsReadout() ) {
+        if ( !bInReadout && pArcDev->IsReadout() ) {
             bInReadout = true;
+            if ( DuringExposure.joinable() ) {
+                if ( !bExposureWorkDone ) {
+                    LogMessage(LOG_WARN, "readout", "Warning: the readout started before the work on the previous frame was done.");
+                    this->bDuringExposureLate = true;
+                }
+                DuringExposure.join();
+            }
+            tReadStart = std::chrono::steady_clock::now();
+            tLastProgress = tReadStart;
 
             /*Set the clock timers to readout mode*/
             if (this->ClockTimers.rClockCounter == 0){
@@ -209,7 +496,12 @@ void LeachController::ExposeCCD( float fExpTime, const bool& bAbort, CExposeList
                 this->ClockTimers.isExp = false;
                 this->ClockTimers.rClockCounter = 1;
                 this->ReadoutProgress.SetEssentials(this->TotalPixelsToRead,this->ClockTimers.Readoutstart);
-                std::cout<<std::endl<<"Total pixels to read: "<<this->TotalPixelsToRead<<std::endl;
+                LogMessage(LOG_INFO, "readout", "\nTotal pixels to read: %d", this->TotalPixelsToRead);
+
+                /*In a segmented readout, this only happens for the first band*/
+                int dAllRows = this->SegmentTotalRows > 0 ? this->SegmentTotalRows : this->CCDParams.dRows;
+                for (CRowIFace *pListener : this->RowListeners)
+                    pListener->ReadoutStarted(dAllRows, this->CCDParams.dCols * this->CCDParams.nSkipperR);
             }
             //printf("Is in readout: %d\n",pArcDev->IsReadout());
         }
@@ -219,12 +511,16 @@ void LeachController::ExposeCCD( float fExpTime, const bool& bAbort, CExposeList
         // ----------------------------
         // Checking the elapsed time > 1 sec. is to prevent race conditions with
         // sending RET while the PCI board is going into readout. Added check
-        // for exposure_time > 1 sec. to prevent RET error.
-        if ( !bInReadout && fRemainingTime > 1.1f && dExposeCounter >= 5 && fExpTime > 1.0f ) {
+        // for exposure_time > 1 sec. to prevent RET error. RET is sent at most every
+        // 250 ms, however short the waits between the polls become.
+        auto tNow = std::chrono::steady_clock::now();
+        if ( !bInReadout && fRemainingTime > 1.1f && fExpTime > 1.0f &&
+             std::chrono::duration<double, std::milli>(tNow - tLastRET).count() >= 250.0 ) {
+            tLastRET = tNow;
             // Ignore all RET timeouts
             try {
                                 // Read the elapsed exposure time.
-                dRetVal = pArcDev->Command( TIM_ID, RET );
+                dRetVal = this->TimedCommand( TIM_ID, RET );
 
                 if ( dRetVal != ROUT ) {
                     if ( pArcDev->ContainsError( dRetVal ) || pArcDev->ContainsError( dRetVal, 0, int( fExpTime * 1000 ) ) ) {
@@ -234,7 +530,6 @@ void LeachController::ExposeCCD( float fExpTime, const bool& bAbort, CExposeList
 
                     ChkAbortExposure;
 
-                    dExposeCounter  = 0;
                     fRemainingTime    = fExpTime - ( float )( dRetVal / 1000 );
 
                     if ( pExpIFace != NULL ) {
@@ -244,8 +539,6 @@ void LeachController::ExposeCCD( float fExpTime, const bool& bAbort, CExposeList
             } catch ( ... ) {}
         }
 
-        dExposeCounter++;
-
         // ----------------------------
         // READOUT PIXEL COUNT
         // ----------------------------
@@ -253,7 +546,7 @@ void LeachController::ExposeCCD( float fExpTime, const bool& bAbort, CExposeList
 
         // Save the last pixel count for use by the timeout counter.
         dLastPixelCount = dPixelCount;
-        dPixelCount = pArcDev->GetPixelCount();
+        dPixelCount = this->TimedPixelCount();
 
         if ( pArcDev->ContainsError( dPixelCount ) ) {
             pArcDev->StopExposure();
@@ -266,25 +559,257 @@ void LeachController::ExposeCCD( float fExpTime, const bool& bAbort, CExposeList
             pExpIFace->ReadCallback( dPixelCount );
         }
 
-        ChkAbortExposure;
+        /*Hand the rows that are complete to the streaming consumers*/
+        if ( bInReadout ) {
+            this->DeliverCompletedRows( dPixelCount );
+            this->Telemetry.Record( std::chrono::duration<double>(std::chrono::system_clock::now() - this->ClockTimers.Readoutstart).count(),
+                                    dPixelCount + dSegmentPixelOffset );
+            this->Publisher.ReadoutProgress( dPixelCount + dSegmentPixelOffset );
+            if ( this->OutParams.QuickLook ) this->PublishQuickLook();
+        }
 
-        // If the controller's in READOUT, then increment the timeout
-        // counter. Checking for readout prevents timeouts when clearing
-        // large and/or slow arrays.
-        if ( bInReadout && dPixelCount == dLastPixelCount ) {
-            dTimeoutCounter++;
-        } else {
-            dTimeoutCounter = 0;
+        /*A readout that is saturating is not worth finishing*/
+        if ( this->OutParams.QuickLook && this->OutParams.AbortSaturatedFraction > 0
+             && this->QuickLookStats.Rows() >= this->OutParams.AbortAfterRows
+             && this->QuickLookStats.SaturatedFraction() > this->OutParams.AbortSaturatedFraction ) {
+            this->StopReadout( dPixelCount, "Too many saturated pixels in the first " + std::to_string(this->QuickLookStats.Rows())
+                                            + " rows, the exposure was stopped." );
         }
 
         ChkAbortExposure;
 
-        if ( dTimeoutCounter >= pArcDev->READ_TIMEOUT ) {
+        // If the controller's in READOUT, check how long the pixel count
+        // has not moved. Checking for readout prevents timeouts when
+        // clearing large and/or slow arrays.
+        tNow = std::chrono::steady_clock::now();
+        if ( bInReadout && dPixelCount != dLastPixelCount ) tLastProgress = tNow;
+
+        ChkAbortExposure;
+
+        if ( bInReadout && std::chrono::duration<double>(tNow - tLastProgress).count() > dStallTimeout ) {
             pArcDev->StopExposure();
             throw std::runtime_error( "Read timeout!" );
         }
 
-        Arc_Sleep( 50 );
+        if ( dPixelCount >= this->TotalPixelsToRead ) break;
+
+        // Predict how long until the next thing happens: the end of the
+        // exposure, or the end of the readout at the pixel rate so far.
+        double dRemaining;
+        if ( !bInReadout ) {
+            dRemaining = fExpTime - std::chrono::duration<double>(tNow - tExpStart).count();
+            /*Past the end of the exposure the controller may still be busy for a while*/
+            if ( dRemaining < this->AcqParams.PollInterval / 10000.0 ) dRemaining = this->AcqParams.PollInterval / 10000.0;
+        } else {
+            double dElapsed = std::chrono::duration<double>(tNow - tReadStart).count();
+            /*The rate of the first row is dominated by the readout start, the model is better there*/
+            if ( dPixelCount >= this->CCDParams.dCols * this->CCDParams.nSkipperR && dElapsed > 0 )
+                dRemaining = ( this->TotalPixelsToRead - dPixelCount ) * dElapsed / dPixelCount;
+            else if ( Prediction.FrameTime > 0 )
+                dRemaining = Prediction.Remaining( dPixelCount, this->TotalPixelsToRead );
+            else
+                dRemaining = this->AcqParams.PollInterval / 1000.0 * 2.0;
+        }
+
+        std::this_thread::sleep_for( NextPollDelay(dRemaining, this->AcqParams.MinPollInterval, this->AcqParams.PollInterval) );
+    }
+
+    /*The last rows may have arrived right before the loop exited*/
+    this->DeliverCompletedRows( dPixelCount );
+
+    int dAllRows = this->SegmentTotalRows > 0 ? this->SegmentTotalRows : this->CCDParams.dRows;
+    if (this->SegmentRowOffset + this->CCDParams.dRows >= dAllRows) {
+        for (CRowIFace *pListener : this->RowListeners)
+            pListener->ReadoutFinished();
+    }
+}
+
+
+/* *********************************************************************
+ * Stop the exposure or readout in progress and leave ExposeCCD. The
+ * pixel count at that point is kept, so that the rows already read can
+ * be saved (SalvageReadout).
+ * *********************************************************************
+ */
+
+void LeachController::StopReadout(int dPixelCount, const std::string &Reason)
+{
+
+    /*The elapsed time poll swallows its exceptions, so this can come twice for one abort*/
+    if (this->AbortedPixelCount < 0) {
+        pArcDev->StopExposure();
+        this->AbortedPixelCount = dPixelCount;
+        this->AbortReason = Reason;
+    }
+    throw std::runtime_error( this->AbortReason );
+
+}
+
+
+/*After a stopped readout: the number of complete rows in the common buffer if [output] SavePartial
+ *keeps them, -1 otherwise. The rest of the buffer is cleared, and the rows that were not handed to
+ *the row consumers yet are, before their readout is finished.*/
+int LeachController::SalvageReadout(void )
+{
+
+    if (this->AbortedPixelCount < 0 || !this->OutParams.SavePartial) return -1;
+
+    int dRowWidth = this->CCDParams.dCols * this->CCDParams.nSkipperR;
+    int dRowsRead = this->AbortedPixelCount / dRowWidth;
+    if (dRowsRead > this->CCDParams.dRows) dRowsRead = this->CCDParams.dRows;
+
+    unsigned short *pBuf = (unsigned short *) pArcDev->CommonBufferVA();
+    std::memset(pBuf + (size_t) dRowsRead * dRowWidth, 0, (size_t) (this->CCDParams.dRows - dRowsRead) * dRowWidth * sizeof(unsigned short));
+
+    this->DeliverCompletedRows(dRowsRead * dRowWidth);
+    for (CRowIFace *pListener : this->RowListeners)
+        pListener->ReadoutFinished();
+
+    return dRowsRead;
+}
+
+
+/* *********************************************************************
+ * Set the quick look up for the readout that is about to start, and
+ * register it as a row listener while the quick look is turned on.
+ * *********************************************************************
+ */
+
+void LeachController::SetupQuickLook(void )
+{
+
+    this->RemoveRowListener(&this->QuickLookStats);
+    if (!this->OutParams.QuickLook) return;
+
+    this->QuickLookStats.Configure(this->CCDParams.dCols, this->CCDParams.nSkipperR, this->CCDParams.AmplifierDirection,
+                                   this->OutParams.QuickLookBin, (unsigned int) this->OutParams.SaturationLevel);
+    this->AddRowListener(&this->QuickLookStats);
+
+}
+
+
+/*The same for the cluster finder*/
+void LeachController::SetupClusterFinder(void )
+{
+
+    this->RemoveRowListener(&this->EventFinder);
+    if (!this->OutParams.FindClusters) return;
+
+    int nDiscard = this->ProcParams.ReduceNDCM ? this->ProcParams.NDCMDiscard : 0;
+    this->EventFinder.Configure(this->CCDParams.dCols, this->CCDParams.nSkipperR, nDiscard, this->CCDParams.AmplifierDirection,
+                                this->OutParams.ClusterSeedSigma, this->OutParams.ClusterPixelSigma, this->OutParams.ClusterMaxPixels);
+    this->AddRowListener(&this->EventFinder);
+
+}
+
+
+void LeachController::PublishQuickLook(void )
+{
+
+    SharedAmpStats Amps[2];
+    int nAmps = this->QuickLookStats.Amplifiers();
+    for (int a = 0; a < nAmps; a++) {
+        QuickLookAmpStats S = this->QuickLookStats.Stats(a);
+        Amps[a].nSamples = S.nSamples;
+        Amps[a].Mean = S.Mean;
+        Amps[a].RMS = S.RMS;
+        Amps[a].Saturated = S.Saturated;
+    }
+    this->Publisher.QuickLookProgress(Amps, nAmps);
+
+}
+
+
+/* *********************************************************************
+ * Register a consumer that is fed completed rows of the common buffer
+ * during readout. See CRowIFace.hpp. The listener is not owned by the
+ * controller and must outlive every exposure it is registered for.
+ * *********************************************************************
+ */
+
+void LeachController::AddRowListener(CRowIFace *pListener)
+{
+    if (pListener != NULL) this->RowListeners.push_back(pListener);
+}
+
+void LeachController::RemoveRowListener(CRowIFace *pListener)
+{
+    for (auto it = this->RowListeners.begin(); it != this->RowListeners.end(); ++it) {
+        if (*it == pListener) {
+            this->RowListeners.erase(it);
+            return;
+        }
     }
 }
 
+
+/* *********************************************************************
+ * Work out how many full rows are in the common buffer for the current
+ * pixel count, and pass the new ones on to the row listeners. In a
+ * segmented readout, the row numbers are those of the full image.
+ * *********************************************************************
+ */
+
+void LeachController::DeliverCompletedRows(int dPixelCount)
+{
+
+    if (this->RowListeners.empty()) return;
+
+    int dRowWidth = this->CCDParams.dCols * this->CCDParams.nSkipperR;
+    int dRowsComplete = dPixelCount / dRowWidth;
+    if (dRowsComplete > this->CCDParams.dRows) dRowsComplete = this->CCDParams.dRows;
+    if (dRowsComplete <= this->RowsDelivered) return;
+
+    const unsigned short *pBuf = (const unsigned short *) pArcDev->CommonBufferVA();
+    const unsigned short *pFirstRow = pBuf + (size_t) this->RowsDelivered * dRowWidth;
+    int nNewRows = dRowsComplete - this->RowsDelivered;
+
+    for (CRowIFace *pListener : this->RowListeners)
+        pListener->RowsCallback(pFirstRow, this->SegmentRowOffset + this->RowsDelivered, nNewRows, dRowWidth);
+
+    this->RowsDelivered = dRowsComplete;
+}
+
+
+
+/* *********************************************************************
+ * Set the worker pool and the acquisition thread up as the [acquisition]
+ * section says. The pool is shared by all the controllers of the
+ * process; it and the thread are only made again if their settings
+ * changed.
+ * *********************************************************************
+ */
+
+void LeachController::SetupScheduling(void )
+{
+
+    WorkerPool::ConfigureShared(this->AcqParams.WorkerThreads, ParseCPUList(this->AcqParams.WorkerCPUs));
+    ConfigureLog(this->OutParams.LogFormat, this->OutParams.LogFile, this->OutParams.LogQueue, this->OutParams.ProgressInterval);
+
+    std::vector<int> AcqCPUs = ParseCPUList(this->AcqParams.AcquisitionCPUs);
+    if (!this->AcqParams.AcquisitionThread) this->AcquisitionWorker.reset();
+    else if (!this->AcquisitionWorker || !this->AcquisitionWorker->SameSettings(AcqCPUs, this->AcqParams.AcquisitionPriority))
+        this->AcquisitionWorker.reset(new DedicatedThread(AcqCPUs, this->AcqParams.AcquisitionPriority));
+
+}
+
+
+/*The polling of the controller, on the acquisition thread if there is one*/
+void LeachController::RunAcquisition(const std::function<void(void )> &Poll)
+{
+
+    if (this->AcquisitionWorker) this->AcquisitionWorker->Run(Poll);
+    else Poll();
+
+}
+
+
+/*Threads started from the acquisition thread inherit its CPUs and its priority*/
+void LeachController::LeaveAcquisitionScheduling(void )
+{
+
+    if (!this->AcquisitionWorker) return;
+    if (this->AcqParams.AcquisitionPriority > 0) SetCurrentThreadPriority(0);
+    PinCurrentThread(ParseCPUList(this->AcqParams.WorkerCPUs));
+
+}
@@ -0,0 +1,156 @@
+/* *********************************************************************
+ * This file contains the measurements of the link between the host and
+ * the controller. The round trip of single commands is timed with TDL,
+ * and the pixel throughput of the fiber / PCIe link is measured with
+ * the synthetic image mode of the controller, so the video chain and
+ * the CCD play no part in it.
+ * *********************************************************************
+ */
+
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <thread>
+
+#include "CArcDevice.h"
+#include "CArcPCIe.h"
+#include "ArcDefs.h"
+
+#include "LeachController.hpp"
+#include "CCDControlDataTypes.hpp"
+
+
+typedef std::chrono::steady_clock LinkClock;
+
+
+/* *********************************************************************
+ * Send nCommands test data link commands and store the round trip of
+ * each in LatenciesMicros. Returns the number of commands that did not
+ * echo their argument.
+ * *********************************************************************
+ */
+int LeachController::MeasureCommandLatency(int nCommands, std::vector<double> &LatenciesMicros)
+{
+
+    LatenciesMicros.clear();
+    LatenciesMicros.reserve(nCommands);
+    int nFailed = 0;
+
+    for (int i = 0; i < nCommands; i++) {
+        int dValue = 0x100000 + i;
+        auto t0 = LinkClock::now();
+        int dReply = pArcDev->Command( TIM_ID, TDL, dValue );
+        LatenciesMicros.push_back(std::chrono::duration<double, std::micro>(LinkClock::now() - t0).count());
+        if (dReply != dValue) nFailed++;
+    }
+
+    return nFailed;
+
+}
+
+
+/* *********************************************************************
+ * Read out one zero second synthetic image of dRows x dCols with nSkips
+ * samples per pixel, polling the pixel count as fast as possible.
+ * Returns 0 on success and -1 if the readout failed or stalled.
+ * *********************************************************************
+ */
+int LeachController::MeasureSyntheticReadout(int dRows, int dCols, int nSkips, LinkBenchResult &Result)
+{
+
+    Result = LinkBenchResult();
+    Result.dRows = dRows;
+    Result.dCols = dCols;
+    Result.nSkipperR = nSkips;
+
+    int TotalCol = dCols * nSkips;
+    size_t ImageMemorySize = (size_t) dRows * TotalCol * sizeof(unsigned short);
+    int dTotalPixels = dRows * TotalCol;
+
+    if (this->CCDParams.super_sequencer && this->CCDParams.CCDType == "SK") pArcDev->Command( TIM_ID, SSR, nSkips );
+    pArcDev->SetImageSize( dRows, dCols );
+    pArcDev->Command( TIM_ID, STC, TotalCol );
+    this->MapCommonBuffer( ImageMemorySize );
+    this->PreparedReadout.bValid = false;
+
+    if ( (size_t) pArcDev->CommonBufferSize() < ImageMemorySize ) {
+        std::cout << "Common buffer size: " << pArcDev->CommonBufferSize() << "  | Image memory requirement: " << ImageMemorySize << "\n";
+        return -1;
+    }
+
+    /*Leave the controller with the image size and NDCM of the config*/
+    auto RestoreController = [this]( ) {
+        pArcDev->SetSyntheticImageMode( false );
+        pArcDev->SetImageSize( this->CCDParams.dRows, this->CCDParams.dCols );
+        if (this->CCDParams.super_sequencer && this->CCDParams.CCDType == "SK") pArcDev->Command( TIM_ID, SSR, this->CCDParams.nSkipperR );
+    };
+
+    pArcDev->SetSyntheticImageMode( true );
+    pArcDev->SetOpenShutter( false );
+
+    if ( pArcDev->Command( TIM_ID, SET, 0 ) != DON || pArcDev->Command( TIM_ID, SEX ) != DON ) {
+        std::cout << "Could not start the synthetic exposure.\n";
+        RestoreController();
+        return -1;
+    }
+
+    int dPixelCount = 0, dLastPixelCount = 0;
+    LinkClock::time_point tFirst, tLast = LinkClock::now(), tLastChange = LinkClock::now();
+    bool bStarted = false;
+    double PollMicros = 0;
+
+    while ( dPixelCount < dTotalPixels ) {
+
+        auto t0 = LinkClock::now();
+        dPixelCount = pArcDev->GetPixelCount();
+        auto t1 = LinkClock::now();
+
+        PollMicros += std::chrono::duration<double, std::micro>(t1 - t0).count();
+        Result.nPolls++;
+
+        if ( pArcDev->ContainsError( dPixelCount ) ) {
+            std::cout << "Failed to read the pixel count.\n";
+            pArcDev->StopExposure();
+            RestoreController();
+            return -1;
+        }
+
+        if ( dPixelCount != dLastPixelCount ) {
+            if ( !bStarted ) {
+                bStarted = true;
+                tFirst = t1;
+            } else {
+                double dt = std::chrono::duration<double>(t1 - tLast).count();
+                if ( dt > 0 ) {
+                    double Rate = (dPixelCount - dLastPixelCount) / dt;
+                    if ( Rate > Result.PeakPixelRate ) Result.PeakPixelRate = Rate;
+                }
+            }
+            tLast = t1;
+            tLastChange = t1;
+            dLastPixelCount = dPixelCount;
+        }
+
+        /*Same time out as the exposure routine, in wall time*/
+        if ( std::chrono::duration<double>(t1 - tLastChange).count() > this->AcqParams.StallTimeout ) {
+            std::cout << "Synthetic readout stalled at " << dPixelCount << " of " << dTotalPixels << " pixels.\n";
+            pArcDev->StopExposure();
+            RestoreController();
+            return -1;
+        }
+
+    }
+
+    Result.ReadoutSeconds = std::chrono::duration<double>(tLast - tFirst).count();
+    if ( Result.ReadoutSeconds > 0 ) Result.PixelRate = dTotalPixels / Result.ReadoutSeconds;
+    Result.MeanPollMicros = PollMicros / Result.nPolls;
+
+    /*The synthetic image is a ramp that wraps at 16 bits*/
+    const unsigned short *pBuf = (const unsigned short *) pArcDev->CommonBufferVA();
+    for (int i = 1; i < dTotalPixels; i++)
+        if ( (unsigned short) (pBuf[i] - pBuf[i-1]) != 1 ) Result.RampErrors++;
+
+    RestoreController();
+    return 0;
+
+}
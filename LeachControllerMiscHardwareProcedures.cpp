@@ -12,6 +12,8 @@
 #include <fstream>
 #include <chrono>
 #include <thread>
+#include <functional>
+#include <exception>
 
 #include "CArcDevice.h"
 #include "CArcPCIe.h"
@@ -23,6 +25,7 @@
 
 #include "LeachController.hpp"
 #include "CCDControlDataTypes.hpp"
+#include "UtilityFunctions.hpp"
 
 
 /*
@@ -34,15 +37,14 @@
 void LeachController::ApplyAllPositiveVPixelArray()
 {
 
-    this->SetDACValueClock(0, 9.0, 9.0); //Channel 0: Min 9V Max 9V
-    this->SetDACValueClock(1, 9.0, 9.0); //Channel 1: Min 9V Max 9V
-    this->SetDACValueClock(2, 9.0, 9.0); //Channel 2: Min 9V Max 9V
-
-    if (this->CCDParams.SecondStageVersion=="UW2"){
-        this->SetDACValueClock(3, 9.0, 9.0); //Channel 0: Min 9V Max 9V
-        this->SetDACValueClock(4, 9.0, 9.0); //Channel 1: Min 9V Max 9V
-        this->SetDACValueClock(5, 9.0, 9.0); //Channel 2: Min 9V Max 9V
-    }
+    /*The V-clock lines of the board (channels 0-5), all at Min 9V Max 9V*/
+    std::vector<ClockDAC> Clocks, VClocks;
+    std::vector<DACWrite> Writes;
+    this->ClockChannelMap(this->CCDParams, this->ClockParams, Clocks);
+    for (const ClockDAC &c : Clocks)
+        if (c.chan < 6) VClocks.push_back({c.chan, 9.0, 9.0, c.name});
+    this->ClockDACWrites(VClocks, Writes);
+    this->IssueDACWrites(Writes, "erase V-clock voltages");
 
 }
 
@@ -54,62 +56,142 @@ void LeachController::ApplyAllPositiveVPixelArray()
 void LeachController::RestoreVClockVoltages(void )
 {
 
-    this->SetDACValueClock(0, this->ClockParams.one_vclock_lo, this->ClockParams.one_vclock_hi); //Channel 0: V1
-    this->SetDACValueClock(1, this->ClockParams.one_vclock_lo, this->ClockParams.one_vclock_hi); //Channel 1: V2
-    this->SetDACValueClock(2, this->ClockParams.one_vclock_lo, this->ClockParams.one_vclock_hi); //Channel 2: V3
+    /*The V-clock lines of the board (channels 0-5) at their configured voltages*/
+    std::vector<ClockDAC> Clocks, VClocks;
+    std::vector<DACWrite> Writes;
+    this->ClockChannelMap(this->CCDParams, this->ClockParams, Clocks);
+    for (const ClockDAC &c : Clocks)
+        if (c.chan < 6) VClocks.push_back(c);
+    this->ClockDACWrites(VClocks, Writes);
+    this->IssueDACWrites(Writes, "V-clock voltages");
+
+}
+
+
+
+/*
+ * The parsed image of a firmware file, from the firmware cache in do_not_touch/
+ * (shared by all the boards) once it has been parsed the first time.
+ */
+int LeachController::LoadFirmware(const std::string &sTimFile, FirmwareImage &Image)
+{
+    return LoadFirmwareImage(sTimFile, this->HashCache.Digest(sTimFile), DeviceStateFile(0, "FirmwareCache"), Image);
+}
+
+
+/*
+ * Cheap check of what the controller runs: one TDL, then a sample of the program
+ * memory words of the image read back with RDM. Any error means no.
+ */
+bool LeachController::ControllerRunsFirmware(const FirmwareImage &Image)
+{
+
+    std::vector<FirmwareWord> Sample = Image.VerificationWords(this->StartupParams.VerifyWords);
+    if (Sample.empty()) return false;
 
-    if (this->CCDParams.SecondStageVersion=="UW2"){
-        this->SetDACValueClock(3, this->ClockParams.two_vclock_lo, this->ClockParams.two_vclock_hi); //Channel 3: 2V1
-        this->SetDACValueClock(4, this->ClockParams.two_vclock_lo, this->ClockParams.two_vclock_hi); //Channel 4: 2V2
-        this->SetDACValueClock(5, this->ClockParams.two_vclock_lo, this->ClockParams.two_vclock_hi); //Channel 5: 2V3
+    try {
+        if ( this->TimedCommand( TIM_ID, TDL, 0x123456 ) != 0x123456 ) return false;
+        for (const FirmwareWord &W : Sample)
+            if ( this->TimedCommand( TIM_ID, RDM, W.MemAddr ) != W.Value ) return false;
+    } catch (const std::exception &) {
+        return false;
     }
+    return true;
 
 }
 
 
+/*
+ * The firmware file is what was last uploaded to this controller (LastHashes.txt),
+ * and the controller still runs it.
+ */
+bool LeachController::WarmStartPossible(const std::string &sTimFile)
+{
+
+    if (!this->StartupParams.WarmStart) return false;
+
+    std::ifstream fHashes(this->StateFile("LastHashes.txt"), std::fstream::in);
+    std::string OldSettingsHash, OldFirmwareHash;
+    std::getline(fHashes, OldSettingsHash);
+    std::getline(fHashes, OldFirmwareHash);
+
+    FirmwareImage Image;
+    if (this->LoadFirmware(sTimFile, Image) != 0 || Image.Digest != OldFirmwareHash) return false;
+    return this->ControllerRunsFirmware(Image);
+
+}
+
 
 /*
  * Procedure to startup the leach controller and set image size.
- * Prepare for IDLE clocking.
+ * Prepare for IDLE clocking. If the controller is still running the firmware it was
+ * last set up with (e.g. after the program crashed), the reset and the upload are skipped.
  */
 void LeachController::StartupController(void )
 {
 
+    bool bWarm = this->WarmStartPossible(this->CCDParams.sTimFile);
+
     //RESET
-    pArcDev->ResetController();
+    if (bWarm) std::cout<<"The controller still runs "<<this->CCDParams.sTimFile<<". Skipping the reset and the upload.\n";
+    else pArcDev->ResetController();
+    this->InvalidateAppliedSettings();
+    this->PreparedReadout.ExpTimeMs = -1;
     //Test Data Link
-    for (int i=0; i<123; i++) {
-        if ( pArcDev->Command( TIM_ID, TDL, 0x123456 ) != 0x123456 ) {
+    for (int i=0; i<this->StartupParams.LinkTests; i++) {
+        if ( this->TimedCommand( TIM_ID, TDL, 0x123456 ) != 0x123456 ) {
             std::cout<<"TIM TDL failed.\n";
             throw 10;
         }
     }
 
     //Load controller file
-    pArcDev->LoadControllerFile(this->CCDParams.sTimFile.c_str());
-    pArcDev->Command( TIM_ID, PON ); //Power ON
+    if (!bWarm) pArcDev->LoadControllerFile(this->CCDParams.sTimFile.c_str(), this->StartupParams.ValidateFirmware);
+    this->TimedCommand( TIM_ID, PON ); //Power ON
     pArcDev->SetImageSize(this->CCDParams.dRows,this->CCDParams.dCols); //Set image size for idle
 
 }
 
 
+static std::chrono::steady_clock::time_point SecondsAfter(std::chrono::steady_clock::time_point t, double dSeconds)
+{
+    return t + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(dSeconds));
+}
+
 /*
  * Charge erase procedure sequence. Please refer to the berkeley manual
  * for an explanation of how this works.
+ * The dwell times are in the [startup] section. The controller is left alone
+ * during them, so DuringDwell (if given) runs in a thread meanwhile. It must
+ * not talk to the controller, and the clock voltages are only restored after
+ * it is done.
  */
-void LeachController::PerformEraseProcedure(void)
+void LeachController::PerformEraseProcedure(std::function<void(void )> DuringDwell)
 {
 
     std::cout<<"Setting pixel array to (9V,9V)\n";
     this->ApplyAllPositiveVPixelArray();
 
-    std::cout<<"Switching Vsub / relay OFF (pin 11) and wait 5 seconds.\n";
+    printf("Switching Vsub / relay OFF (pin 11) and wait %.1f seconds.\n", this->StartupParams.EraseVsubOffTime);
     this->CCDBiasToggle(0);
-    std::this_thread::sleep_for(std::chrono::seconds(5));
+    auto tVsubOff = std::chrono::steady_clock::now();
+
+    std::thread DwellWork;
+    if (DuringDwell) DwellWork = std::thread([&DuringDwell]() {
+        try {
+            DuringDwell();
+        } catch (const std::exception &e) {
+            std::cout<<"Work during the erase failed: "<<e.what()<<"\n";
+        }
+    });
+
+    std::this_thread::sleep_until(SecondsAfter(tVsubOff, this->StartupParams.EraseVsubOffTime));
 
-    std::cout<<"Switch Vsub / relay ON (pin 11). After 5 seconds, the clock voltages will be restored.\n";
+    printf("Switch Vsub / relay ON (pin 11). After %.1f seconds, the clock voltages will be restored.\n", this->StartupParams.EraseSettleTime);
     this->CCDBiasToggle(1);
-    std::this_thread::sleep_for(std::chrono::seconds(5));
+    std::this_thread::sleep_until(SecondsAfter(std::chrono::steady_clock::now(), this->StartupParams.EraseSettleTime));
+
+    if (DwellWork.joinable()) DwellWork.join();
     this->RestoreVClockVoltages();
     std::cout<<"Clock voltages restored. Erase procedure is now complete.\n";
 
@@ -123,7 +205,7 @@ int LeachController::SetSSR(void )
 {
 
     int dReply = 0;
-    dReply = pArcDev->Command( TIM_ID, SSR, this->CCDParams.nSkipperR);
+    dReply = this->TimedCommand( TIM_ID, SSR, this->CCDParams.nSkipperR);
     if ( dReply == 0x00444F4E ) {
         return 0;
     } else {
@@ -137,7 +219,12 @@ int LeachController::SetSSR(void )
 
 void LeachController::ApplyNewSequencer(std::string seqFile)
 {
-    pArcDev->LoadControllerFile(seqFile.c_str());
+    if (this->WarmStartPossible(seqFile))
+        std::cout<<"The controller already runs "<<seqFile<<". It is not uploaded again.\n";
+    else
+        pArcDev->LoadControllerFile(seqFile.c_str(), this->StartupParams.ValidateFirmware);
+    this->InvalidateAppliedSettings();
+    this->PreparedReadout.ExpTimeMs = -1;
 }
 
 int LeachController::SetCCDType(void )
@@ -154,7 +241,7 @@ int LeachController::SetCCDType(void )
     }
     int dReply = 0;
 
-    dReply = pArcDev->Command( TIM_ID,SAT,_iCCDType);
+    dReply = this->TimedCommand( TIM_ID,SAT,_iCCDType);
     if ( dReply == 0x00444F4E ) {
         std::cout<<"CCD Type has been set in the sequencer.\n";
         return 0;
@@ -183,7 +270,7 @@ int LeachController::SetVDR(void )
         _snd_VDRxn = 0;
     }
 
-    dReply = pArcDev->Command( TIM_ID, VDR, _snd_VDRxn);
+    dReply = this->TimedCommand( TIM_ID, VDR, _snd_VDRxn);
     if ( dReply == DON ) {
         return 0;
     } else {
@@ -202,11 +289,11 @@ int LeachController::SetHDR(void )
     int HDR_response;
 
     if (this->CCDParams.HClkDirection == "UL") {
-        HDR_response = pArcDev->Command(TIM_ID, HDR, DRXN_LU);
+        HDR_response = this->TimedCommand( TIM_ID, HDR, DRXN_LU);
     } else if (this->CCDParams.HClkDirection == "U") {
-        HDR_response = pArcDev->Command(TIM_ID, HDR, DRXN_U);
+        HDR_response = this->TimedCommand( TIM_ID, HDR, DRXN_U);
     } else if (this->CCDParams.HClkDirection == "L") {
-        HDR_response = pArcDev->Command(TIM_ID, HDR, DRXN_L);
+        HDR_response = this->TimedCommand( TIM_ID, HDR, DRXN_L);
 
     } else {
         std::cout << "The Serial Register / H-clock direction selected does not exist. Stop and verify!\n";
@@ -226,13 +313,13 @@ int LeachController::SelectAmplifierAndHClocks(void )
 
     int SOS_response;
     if (this->CCDParams.AmplifierDirection == "UL") {
-        SOS_response = pArcDev->Command(TIM_ID, SOS, DRXN_LU);
+        SOS_response = this->TimedCommand( TIM_ID, SOS, DRXN_LU);
 
     } else if (this->CCDParams.AmplifierDirection == "U") {
-        SOS_response = pArcDev->Command(TIM_ID, SOS, DRXN_U);
+        SOS_response = this->TimedCommand( TIM_ID, SOS, DRXN_U);
 
     } else if (this->CCDParams.AmplifierDirection == "L") {
-        SOS_response = pArcDev->Command(TIM_ID, SOS, DRXN_L);
+        SOS_response = this->TimedCommand( TIM_ID, SOS, DRXN_L);
 
     } else {
         std::cout << "The amplifier selected does not exist. Stop and verify!\n";
@@ -253,7 +340,7 @@ int LeachController::SelectAmplifierAndHClocks(void )
 int LeachController::ApplyPBIN(int NPBIN){
 
     int dReply = 0;
-    dReply = pArcDev->Command( TIM_ID, NPB, NPBIN);
+    dReply = this->TimedCommand( TIM_ID, NPB, NPBIN);
     if ( dReply == DON ) {
         return 0;
     } else {
@@ -266,7 +353,7 @@ int LeachController::ApplyPBIN(int NPBIN){
 int LeachController::ApplySBIN(int NSBIN){
 
     int dReply = 0;
-    dReply = pArcDev->Command( TIM_ID, NSB, NSBIN);
+    dReply = this->TimedCommand( TIM_ID, NSB, NSBIN);
     if ( dReply == DON ) {
         return 0;
     } else {
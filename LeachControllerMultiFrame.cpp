@@ -0,0 +1,159 @@
+/* *********************************************************************
+ * This file contains the multi-frame acquisition routines. A series of
+ * exposures is taken with a single controller instance. Every frame is
+ * copied out of the common buffer and handed to the background writer,
+ * so the next frame is exposing while the last one is being written.
+ * *********************************************************************
+ */
+
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <memory>
+
+#include "LeachController.hpp"
+#include "AsyncFrameWriter.hpp"
+#include "UtilityFunctions.hpp"
+
+
+/* *********************************************************************
+ * Size the frame buffer pool for the image the next readout produces.
+ * The pool keeps enough buffers for every frame that can be queued on,
+ * or in the hands of, the writer at once, plus the one being filled.
+ * *********************************************************************
+ */
+
+void LeachController::SetupFramePool(void )
+{
+
+    int nSamples = this->CCDParams.CCDType == "SK" ? this->CCDParams.nSkipperR : 1;
+    size_t nPixels = (size_t) this->CCDParams.dRows * this->CCDParams.dCols * nSamples;
+
+    int nBuffers = this->AcqParams.FramePoolBuffers;
+    if (nBuffers <= 0) nBuffers = this->OutParams.WriterQueueDepth + this->OutParams.WriterThreads + 2;
+
+    if (this->FrameBuffers.Configure(nPixels, nBuffers, this->AcqParams.FramePoolHugePages, this->AcqParams.FramePoolPrefault) != 0)
+        std::cout << "Could not set up " << nBuffers << " frame buffers of " << nPixels << " pixels. They will be mapped as needed.\n";
+
+}
+
+
+/* *********************************************************************
+ * Take nFrames exposures of ExposureTime seconds each. Frame k is written
+ * to FrameFileName(OutFileName, k). If a frame writer is given, the frames
+ * are queued on it and may still be in flight when this returns.
+ * Returns the number of frames that were exposed successfully and, with
+ * the own writer, also written. The caller that gives a writer has to
+ * look at its FramesFailed once it is done.
+ * *********************************************************************
+ */
+
+int LeachController::ExposeMultipleFrames(int ExposureTime, int nFrames, std::string OutFileName, AsyncFrameWriter* pFrameWriter)
+{
+
+    std::unique_ptr<AsyncFrameWriter> OwnFrameWriter;
+    if (pFrameWriter == NULL) {
+        OwnFrameWriter.reset(new AsyncFrameWriter(this->OutParams.WriterQueueDepth, this->OutParams.WriterThreads,
+                                                  ParseCPUList(this->AcqParams.WorkerCPUs)));
+        pFrameWriter = OwnFrameWriter.get();
+    }
+    int nFramesExposed = 0;
+
+    /*What the whole series will take, the readout of every frame refines the model*/
+    ReadoutPrediction Prediction = this->PredictReadout();
+    printf("Expected time for %d frames: %.1f s (%d s exposure + %.2f s readout per frame)\n",
+           nFrames, nFrames * (ExposureTime + Prediction.FrameTime), ExposureTime, Prediction.FrameTime);
+    auto tStart = std::chrono::steady_clock::now();
+
+    /*Frame k stays in the common buffer until it is copied out while frame k+1 integrates. The
+     *controller is only set up again for frame k+1 if something changed.*/
+    this->bAbortExposure = false;
+    this->bFrameSeries = true;
+    this->PreparedReadout.bValid = false;
+    this->PreparedReadout.ExpTimeMs = -1;
+    std::unique_ptr<FrameRecord> PendingFrame;
+    const unsigned short *pPendingData = NULL;
+    bool bPendingCopied = false;
+    double dCopyTime = 0;
+
+    /*Only the copy runs during the next exposure. The frame is handed to the writer from here,
+     *as Submit blocks while the writer queue is full.*/
+    auto CopyPendingFrame = [&]() {
+        auto t0 = std::chrono::steady_clock::now();
+        this->CopyFramePixels(*PendingFrame, pPendingData);
+        dCopyTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        bPendingCopied = true;
+    };
+    auto SubmitPendingFrame = [&]() {
+        if (!bPendingCopied) CopyPendingFrame();
+        pFrameWriter->Submit(std::move(PendingFrame));
+        PendingFrame.reset();
+    };
+
+    for (int k = 0; k < nFrames; k++) {
+
+        std::cout << "\n---- Frame " << k+1 << " / " << nFrames << " ----\n";
+
+        /*Reset clock timers for this frame*/
+        this->ClockTimers.isReadout = false;
+        this->ClockTimers.isExp = false;
+        this->ClockTimers.rClockCounter = 0;
+
+        this->bDuringExposureLate = false;
+        if (PendingFrame && !bPendingCopied) this->DuringNextExposure = CopyPendingFrame;
+        int dResult = this->PrepareAndExposeCCD(ExposureTime, NULL);
+        this->DuringNextExposure = nullptr;
+
+        /*The previous frame is copied here if the exposure did not get to start*/
+        if (PendingFrame) {
+            if (this->bDuringExposureLate) {
+                printf("The readout of frame %d started while frame %d was still being copied. Its pixels may be corrupted.\n", k+1, k);
+                PendingFrame->bCopyOverlapped = true;
+            }
+            SubmitPendingFrame();
+        }
+
+        if (dResult != 0) {
+            std::cout << "Frame " << k+1 << " failed. Stopping the multi-frame acquisition.\n";
+            break;
+        }
+
+        pPendingData = this->ImageData();
+        PendingFrame = this->RecordLastExposure(FrameFileName(OutFileName, k));
+        bPendingCopied = false;
+        nFramesExposed++;
+
+        /*The copy is only left for the next exposure once it was timed, and if it took well under
+         *the exposure time. Otherwise it is done before the next exposure starts.*/
+        if (k + 1 == nFrames || PendingFrame->Pixels.Valid() || dCopyTime <= 0 || dCopyTime > 0.5 * ExposureTime)
+            CopyPendingFrame();
+
+        /*A stopped frame ends the series, the abort may also have come while the frame was copied*/
+        if (this->PartialRows >= 0 || this->bAbortExposure) {
+            if (PendingFrame) SubmitPendingFrame();
+            if (k + 1 < nFrames) std::cout << "The exposure was stopped. Stopping the multi-frame acquisition.\n";
+            break;
+        }
+
+        if (k + 1 < nFrames) {
+            double dElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+            double dLeft = (nFrames - k - 1) * (ExposureTime + this->PredictReadout().FrameTime);
+            printf("%.1f s elapsed, about %.1f s to go\n", dElapsed, dLeft);
+        }
+
+    }
+    if (PendingFrame) SubmitPendingFrame();
+
+    this->bFrameSeries = false;
+    this->PreparedReadout.bValid = false;
+
+    if (OwnFrameWriter) {
+        std::cout << "\nWaiting for the remaining frames to be written.\n";
+        OwnFrameWriter->WaitUntilDone();
+        int nFailed = OwnFrameWriter->FramesFailed();
+        if (nFailed > 0) std::cout << nFailed << " of " << nFramesExposed << " frames could not be written.\n";
+        nFramesExposed -= nFailed;
+    }
+
+    return nFramesExposed;
+}
@@ -0,0 +1,137 @@
+/* *********************************************************************
+ * This file contains the settings presets. A preset is a config file
+ * that is parsed once into the settings structures and kept in memory,
+ * together with its text and digest. Switching to a preset puts its
+ * settings in place without reading or parsing anything, uploads the
+ * sequencer only if it is not the one on the controller, and sends the
+ * rest through the differential apply, so going back and forth between
+ * two presets costs only the commands that differ between them.
+ * *********************************************************************
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "LeachController.hpp"
+#include "CCDControlDataTypes.hpp"
+#include "INIReader.h"
+
+
+/*Parse INIFile as preset Name. A preset of the same name is replaced. The settings of the controller
+ *are not touched. Returns 0, or -1 if the file cannot be read or its sequencer does not exist.*/
+int LeachController::LoadPreset(const std::string &Name, const std::string &INIFile)
+{
+
+    std::ifstream f(INIFile, std::fstream::binary);
+    INIReader Check(INIFile.c_str());
+    if (!f.is_open() || Check.ParseError() < 0) {
+        printf("Could not read the preset %s from %s.\n", Name.c_str(), INIFile.c_str());
+        return -1;
+    }
+    if (Check.ParseError() > 0) {
+        printf("The preset %s has an error on line %d of %s.\n", Name.c_str(), Check.ParseError(), INIFile.c_str());
+        return -1;
+    }
+
+    SettingsPreset P;
+    std::stringstream INIText;
+    INIText << f.rdbuf();
+    P.INIText = INIText.str();
+
+    /*The parsers fill in the settings of the controller, which are put back afterwards*/
+    ParsedSettings Live;
+    this->CaptureSettings(Live);
+    std::string LiveINIFileLoc = this->INIFileLoc;
+
+    this->INIFileLoc = INIFile;
+    this->ParseCCDSettings(this->CCDParams, this->ClockParams, this->BiasParams);
+    this->ParseProcessingSettings(this->ProcParams);
+    this->ParseAcquisitionSettings(this->AcqParams);
+    this->ParseOutputSettings(this->OutParams);
+    this->ParseRegionSettings(this->RoiParams);
+    this->ParseStartupSettings(this->StartupParams);
+    this->ComputeReadoutGeometry();
+    this->CaptureSettings(P.Settings);
+
+    this->INIFileLoc = LiveINIFileLoc;
+    this->RestoreSettings(Live);
+
+    struct stat buffer;
+    const CCDVariables &CCD = P.Settings.CCDParams;
+    if (stat(CCD.sTimFile.c_str(), &buffer) != 0) {
+        printf("The sequencer %s of the preset %s does not exist.\n", CCD.sTimFile.c_str(), Name.c_str());
+        return -1;
+    }
+
+    P.Settings.INIFileLoc = INIFile;
+    P.Settings.bValid = StatFile(INIFile, P.Settings.Stamp) == 0;
+    P.SettingsDigest = this->HashCache.Digest(INIFile);
+    this->Presets[Name] = P;
+
+    printf("Preset %s loaded from %s: %s, %d x %d, NDCM %d, %s.\n", Name.c_str(), INIFile.c_str(), CCD.CCDType.c_str(),
+           CCD.dCols, CCD.dRows, CCD.nSkipperR, CCD.sTimFile.c_str());
+    return 0;
+
+}
+
+
+/*Put the settings of preset Name on the controller. nSent is what ApplyChangedSettings returned, bSequencer
+ *tells if the sequencer had to be uploaded. Returns -1 if there is no such preset.*/
+int LeachController::SwitchPreset(const std::string &Name, int &nSent, bool &bSequencer)
+{
+
+    auto it = this->Presets.find(Name);
+    if (it == this->Presets.end()) {
+        printf("There is no preset %s.\n", Name.c_str());
+        return -1;
+    }
+    const SettingsPreset &P = it->second;
+
+    /*The sequencer on the controller is the one the last apply recorded*/
+    std::ifstream f3(this->StateFile("LastHashes.txt"), std::fstream::in);
+    std::string OldSettingsHash, OldFirmwareHash;
+    std::getline(f3, OldSettingsHash);
+    std::getline(f3, OldFirmwareHash);
+    f3.close();
+
+    /*The preset becomes the parsed config file, so nothing is parsed again while the file stays the same*/
+    this->INIFileLoc = P.Settings.INIFileLoc;
+    this->RestoreSettings(P.Settings);
+    this->LastParsed = P.Settings;
+    this->SetupParsedSettings();
+
+    std::string SequencerDigest = this->HashCache.Digest(this->CCDParams.sTimFile);
+    bSequencer = SequencerDigest != OldFirmwareHash;
+    if (bSequencer) {
+        std::cout << "Applying the sequencer of the preset.\n";
+        this->ApplyNewSequencer(this->CCDParams.sTimFile);
+    }
+
+    nSent = this->ApplyChangedSettings();
+
+    /*The config file may have changed since the preset was loaded; what was applied is the preset*/
+    this->WriteAppliedStateFiles(P.INIText, P.SettingsDigest, SequencerDigest);
+    this->CurrentPreset = Name;
+    return 0;
+
+}
+
+
+bool LeachController::DropPreset(const std::string &Name)
+{
+    if (this->CurrentPreset == Name) this->CurrentPreset.clear();
+    return this->Presets.erase(Name) > 0;
+}
+
+
+std::vector<std::string> LeachController::PresetNames(void ) const
+{
+    std::vector<std::string> Names;
+    for (const auto &p : this->Presets) Names.push_back(p.first);
+    return Names;
+}
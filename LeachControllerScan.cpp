@@ -0,0 +1,209 @@
+/* *********************************************************************
+ * This file contains the parameter scan engine. A scan is a grid over
+ * one or more voltages or timings. At every point the settings are
+ * changed in memory, the differences are applied to the controller and
+ * a series of frames is taken. The frames of all points go through one
+ * background writer, and every FITS file is tagged with its scan point.
+ * *********************************************************************
+ */
+
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+
+#include "LeachController.hpp"
+#include "AsyncFrameWriter.hpp"
+#include "UtilityFunctions.hpp"
+
+
+
+/*Find the setting a scan parameter refers to. The names are the keys of the config file.
+ *Exactly one of pDouble or pInt is set on success.*/
+bool LeachController::ScanParameterRef(const std::string &Parameter, double* &pDouble, int* &pInt)
+{
+
+    pDouble = NULL;
+    pInt = NULL;
+
+    struct { const char *Name; double *p; } DoubleParams[] = {
+        /*[clocks]*/
+        {"one_vclock_hi", &this->ClockParams.one_vclock_hi}, {"one_vclock_lo", &this->ClockParams.one_vclock_lo},
+        {"two_vclock_hi", &this->ClockParams.two_vclock_hi}, {"two_vclock_lo", &this->ClockParams.two_vclock_lo},
+        {"tg_hi", &this->ClockParams.tg_hi}, {"tg_lo", &this->ClockParams.tg_lo},
+        {"u_hclock_hi", &this->ClockParams.u_hclock_hi}, {"u_hclock_lo", &this->ClockParams.u_hclock_lo},
+        {"l_hclock_hi", &this->ClockParams.l_hclock_hi}, {"l_hclock_lo", &this->ClockParams.l_hclock_lo},
+        {"dg_hi", &this->ClockParams.dg_hi}, {"dg_lo", &this->ClockParams.dg_lo},
+        {"rg_hi", &this->ClockParams.rg_hi}, {"rg_lo", &this->ClockParams.rg_lo},
+        {"sw_hi", &this->ClockParams.sw_hi}, {"sw_lo", &this->ClockParams.sw_lo},
+        {"og_hi", &this->ClockParams.og_hi}, {"og_lo", &this->ClockParams.og_lo},
+        /*[bias]*/
+        {"vdd", &this->BiasParams.vdd}, {"vrefsk", &this->BiasParams.vrefsk}, {"vref", &this->BiasParams.vref},
+        {"drain", &this->BiasParams.drain}, {"opg", &this->BiasParams.opg}, {"battrelay", &this->BiasParams.battrelay},
+        /*[timing], with the names of the CCDVariables as well*/
+        {"IntegralTime", &this->CCDParams.IntegralTime},
+        {"PedestalIntgWait", &this->CCDParams.PedestalIntgWait}, {"SignalIntgWait", &this->CCDParams.SignalIntgWait},
+        {"DGWidth", &this->CCDParams.DGWidth}, {"OGWidth", &this->CCDParams.OGWidth},
+        {"SkippingRGWidth", &this->CCDParams.SKRSTWidth}, {"SKRSTWidth", &this->CCDParams.SKRSTWidth},
+        {"SWPulseWidth", &this->CCDParams.SWWidth}, {"SWWidth", &this->CCDParams.SWWidth},
+    };
+
+    struct { const char *Name; int *p; } IntParams[] = {
+        {"video_offsets_U", &this->BiasParams.video_offsets_U}, {"video_offsets_L", &this->BiasParams.video_offsets_L},
+        {"Gain", &this->CCDParams.Gain}, {"NDCM", &this->CCDParams.nSkipperR},
+        {"ParallelBin", &this->CCDParams.ParallelBin}, {"SerialBin", &this->CCDParams.SerialBin},
+    };
+
+    for (auto &d : DoubleParams) if (Parameter == d.Name) { pDouble = d.p; return true; }
+    for (auto &i : IntParams) if (Parameter == i.Name) { pInt = i.p; return true; }
+    return false;
+
+}
+
+
+/*
+ * Parse a scan axis given as <parameter>=<start>:<stop>:<step> or
+ * <parameter>=<v1>,<v2>,... Returns 0 on success and -1 otherwise.
+ */
+int LeachController::ParseScanAxis(std::string AxisSpec, ScanAxis &Axis)
+{
+
+    Axis.Values.clear();
+
+    std::string::size_type eq = AxisSpec.find('=');
+    if (eq == std::string::npos || eq == 0) {
+        std::cout << "Scan axis " << AxisSpec << " should look like <parameter>=<start>:<stop>:<step>.\n";
+        return -1;
+    }
+
+    Axis.Parameter = AxisSpec.substr(0, eq);
+    std::string Range = AxisSpec.substr(eq+1);
+
+    double *pDouble; int *pInt;
+    if (!this->ScanParameterRef(Axis.Parameter, pDouble, pInt)) {
+        std::cout << Axis.Parameter << " can not be scanned.\n";
+        return -1;
+    }
+
+    if (Range.find(':') != std::string::npos) {
+        double Start, Stop, Step;
+        char c1, c2;
+        std::istringstream ss(Range);
+        if (!(ss >> Start >> c1 >> Stop >> c2 >> Step) || Step == 0 || (Stop - Start) / Step < 0) {
+            std::cout << "The range of " << Axis.Parameter << " is not valid: " << Range << "\n";
+            return -1;
+        }
+        /*Include the stop value even with a little floating point error*/
+        int nSteps = (int) std::floor((Stop - Start) / Step + 1e-6);
+        for (int k = 0; k <= nSteps; k++) Axis.Values.push_back(Start + k * Step);
+    } else {
+        std::istringstream ss(Range);
+        std::string Value;
+        while (std::getline(ss, Value, ',')) {
+            char *pEnd;
+            double v = std::strtod(Value.c_str(), &pEnd);
+            if (pEnd == Value.c_str()) {
+                std::cout << "The value " << Value << " of " << Axis.Parameter << " is not a number.\n";
+                return -1;
+            }
+            Axis.Values.push_back(v);
+        }
+    }
+
+    if (Axis.Values.empty()) {
+        std::cout << "The scan of " << Axis.Parameter << " has no points.\n";
+        return -1;
+    }
+    return 0;
+
+}
+
+
+/* *********************************************************************
+ * Run a parameter scan. The frames of point p are written to
+ * FrameFileName(FrameFileName(OutFileName, p), k). After the scan the
+ * settings of the config file are applied again. While it runs, the
+ * state files say that the settings on the controller are not known,
+ * so a scan that is killed leaves nothing that a later program trusts.
+ * Returns the number of scan points that were completed.
+ * *********************************************************************
+ */
+int LeachController::RunParameterScan(const ScanSpec &Scan)
+{
+
+    int nPoints = 1;
+    for (auto &Axis : Scan.Axes) {
+        double *pDouble; int *pInt;
+        if (!this->ScanParameterRef(Axis.Parameter, pDouble, pInt) || Axis.Values.empty()) {
+            std::cout << "The scan of " << Axis.Parameter << " is not valid.\n";
+            return 0;
+        }
+        nPoints *= (int) Axis.Values.size();
+    }
+
+    AsyncFrameWriter FrameWriter(this->OutParams.WriterQueueDepth, this->OutParams.WriterThreads, ParseCPUList(this->AcqParams.WorkerCPUs));
+    std::vector<size_t> Index(Scan.Axes.size(), 0);
+    int nPointsDone = 0;
+
+    this->MarkAppliedStateStale();
+
+    for (int p = 0; p < nPoints; p++) {
+
+        /*Position on the grid, the last axis changes fastest*/
+        int rem = p;
+        for (int a = (int) Scan.Axes.size() - 1; a >= 0; a--) {
+            Index[a] = rem % Scan.Axes[a].Values.size();
+            rem /= Scan.Axes[a].Values.size();
+        }
+
+        this->ScanPoint = p;
+        this->ScanCoords.clear();
+        std::cout << "\n==== Scan point " << p+1 << " / " << nPoints << ":";
+
+        for (size_t a = 0; a < Scan.Axes.size(); a++) {
+            double Value = Scan.Axes[a].Values[Index[a]];
+            double *pDouble; int *pInt;
+            this->ScanParameterRef(Scan.Axes[a].Parameter, pDouble, pInt);
+            if (pDouble) *pDouble = Value;
+            else *pInt = (int) std::lround(Value);
+
+            this->ScanCoords.push_back({Scan.Axes[a].Parameter, pDouble ? Value : (double) *pInt});
+            std::cout << " " << Scan.Axes[a].Parameter << "=" << this->ScanCoords.back().Value;
+        }
+        std::cout << " ====\n";
+
+        if (this->CCDParams.CCDType=="DES") this->CCDParams.nSkipperR=1;
+        this->CCDParams.fExpTime = Scan.ExposureTime;
+
+        /*Only the scanned settings are sent*/
+        this->ApplyChangedSettings();
+
+        int nDone = this->ExposeMultipleFrames(Scan.ExposureTime, Scan.FramesPerPoint,
+                                               FrameFileName(Scan.OutFileName, p), &FrameWriter);
+        if (nDone != Scan.FramesPerPoint || this->PartialRows >= 0) {
+            std::cout << "Scan point " << p+1 << " did not complete. Stopping the scan.\n";
+            break;
+        }
+        nPointsDone++;
+
+    }
+
+    this->ScanPoint = -1;
+    this->ScanCoords.clear();
+
+    std::cout << "\nWaiting for the remaining frames to be written.\n";
+    FrameWriter.WaitUntilDone();
+    if (FrameWriter.FramesFailed() > 0)
+        std::cout << "Warning: " << FrameWriter.FramesFailed() << " frames of the scan could not be written.\n";
+
+    /*Put the controller back to the settings of the config file*/
+    std::cout << "Restoring the settings of " << this->INIFileLoc << "\n";
+    this->ParseAllSettings();
+    this->ApplyChangedSettings();
+    this->CopyOldAndStoreFileHashes();
+    this->IdleClockToggle();
+
+    return nPointsDone;
+
+}
@@ -0,0 +1,181 @@
+/* *********************************************************************
+ * This file contains the segmented readout. Images that are larger than
+ * the kernel common buffer are read out as a series of row bands that
+ * each fit in the buffer. Every band is drained into a host side image
+ * buffer before the next band is clocked out.
+ *
+ * The first band is exposed for the full exposure time. The bands after
+ * it are 0 second exposures that read out the rows the previous band
+ * left in the array, so the sequencer must not flush the array when an
+ * exposure starts. VDD is only switched off for the first band.
+ *
+ * If the readout is stopped and the rows read are kept, the band that
+ * was being read is drained up to its last complete row and the rows
+ * after it are left at 0.
+ * *********************************************************************
+ */
+
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <cstring>
+
+#include "LeachController.hpp"
+#include "UtilityFunctions.hpp"
+
+
+int LeachController::PrepareAndExposeCCDSegmented(int ExposureTime)
+{
+
+    int dFullRows = this->CCDParams.dRows;
+
+    try {
+
+        this->bImageInterlaced = false;
+        this->bImageInHostBuffer = false;
+        this->PreparedReadout.bValid = false;
+
+        if (this->CCDParams.CCDType == "SK") this->SetSSR();
+        else this->CCDParams.nSkipperR = 1;
+        this->SetupQuickLook();
+        this->SetupClusterFinder();
+
+        /*Needed for callbacks during exposure*/
+        CExposeListener cExposeListener(*this);
+
+        int TotalCol = this->CCDParams.dCols * this->CCDParams.nSkipperR;
+        size_t RowMemorySize = (size_t) TotalCol * sizeof(unsigned short);
+
+        /*Work out how many rows fit in one band*/
+        this->MapCommonBuffer(0);
+        int dBandRows = this->AcqParams.SegmentRows;
+        int dMaxBandRows = (int) (pArcDev->CommonBufferSize() / RowMemorySize);
+        if (dBandRows <= 0 || dBandRows > dMaxBandRows) dBandRows = dMaxBandRows;
+        if (dBandRows < 1) {
+            std::cout<<"Common buffer size: "<<pArcDev->CommonBufferSize()<<"  | Row memory requirement: "<<RowMemorySize<<"\n";
+            throw std::runtime_error("Not even one row fits in the common buffer!");
+        }
+        int nBands = (dFullRows + dBandRows - 1) / dBandRows;
+
+        /*The whole image is assembled on the host, in a pool buffer unless it is to be backed by a file*/
+        this->SegmentedFrame.Release();
+        if (this->AcqParams.SegmentBackingFile.empty()) {
+            this->SetupFramePool();
+            this->SegmentedFrame = this->FrameBuffers.Acquire();
+            if (!this->SegmentedFrame.Valid() || this->SegmentedFrame.Pixels() < (size_t) TotalCol * dFullRows)
+                throw std::runtime_error("Failed to get a frame buffer for the image!");
+        }
+        else if (this->SegmentedImage.Allocate((size_t) TotalCol * dFullRows, this->AcqParams.SegmentBackingFile) != 0)
+            throw std::runtime_error("Failed to allocate the host image buffer!");
+        unsigned short *pHostImage = this->SegmentedFrame.Valid() ? this->SegmentedFrame.Data() : this->SegmentedImage.Data();
+        this->bImageInHostBuffer = true;
+        this->SegmentTotalRows = dFullRows;
+
+        printf("Rows %d, Cols %d | NDCMS: %d , Total number of columns: %d | Segmented readout: %d bands of %d rows\n",
+               dFullRows, this->CCDParams.dCols, this->CCDParams.nSkipperR, TotalCol, nBands, dBandRows);
+
+        /*The band overheads are not in the model, so segmented readouts do not correct it*/
+        ReadoutPrediction Prediction = this->PredictReadout();
+        printf("Expected readout time: %.2f s without the band overheads\n", Prediction.FrameTime);
+
+        std::cout<<"Turning VDD OFF before exposure.\n";
+        this->ToggleVDD(0);
+
+        for (int b = 0; b < nBands && this->PartialRows < 0; b++) {
+
+            int dFirstRow = b * dBandRows;
+            int dRowsThisBand = dFullRows - dFirstRow < dBandRows ? dFullRows - dFirstRow : dBandRows;
+            size_t BandMemorySize = RowMemorySize * dRowsThisBand;
+
+            /*The controller and the rest of the expose routine only see the band*/
+            this->CCDParams.dRows = dRowsThisBand;
+            this->SegmentRowOffset = dFirstRow;
+
+            pArcDev->SetImageSize( dRowsThisBand, this->CCDParams.dCols );
+            this->TimedCommand( TIM_ID, STC, TotalCol);
+            this->MapCommonBuffer(BandMemorySize);
+
+            if ( (size_t) pArcDev->CommonBufferSize() < BandMemorySize ) {
+                std::cout<<"Common buffer size: "<<pArcDev->CommonBufferSize()<<"  | Band memory requirement: "<<BandMemorySize<<"\n";
+                throw std::runtime_error("Failed to map image buffer!");
+            }
+
+            std::cout << "\nReading out band " << b+1 << " / " << nBands << " (rows " << dFirstRow << " - "
+                      << dFirstRow + dRowsThisBand - 1 << ")\n";
+            if (b == 0 && this->pStartBarrier != NULL) this->pStartBarrier->Wait();
+            try {
+                this->RunAcquisition([&]() { this->ExposeCCD(b == 0 ? ExposureTime : 0, this->bAbortExposure, &cExposeListener); });
+            } catch (std::runtime_error &) {
+                int dBandRowsRead = this->SalvageReadout();
+                if (dBandRowsRead < 0 || dFirstRow + dBandRowsRead < 1) throw;
+                this->PartialRows = dFirstRow + dBandRowsRead;
+                if (!this->_expose_isVDDOn) this->ToggleVDD(1);
+                dRowsThisBand = dBandRowsRead;
+                BandMemorySize = RowMemorySize * dRowsThisBand;
+                std::memset(pHostImage + (size_t) this->PartialRows * TotalCol, 0, RowMemorySize * (dFullRows - this->PartialRows));
+            }
+            this->ReadoutProgress.done();
+
+            /*Drain the band before the next one overwrites the common buffer*/
+            unsigned short *pBand = (unsigned short *) pArcDev->CommonBufferVA();
+            std::memcpy(pHostImage + (size_t) dFirstRow * TotalCol, pBand, BandMemorySize);
+            if (!this->SegmentedFrame.Valid())
+                this->SegmentedImage.Retire((size_t) dFirstRow * TotalCol, (size_t) dRowsThisBand * TotalCol);
+        }
+
+        this->ClockTimers.ReadoutEnd = std::chrono::system_clock::now();
+        if (this->PartialRows >= 0)
+            printf("\n%s The first %d of %d rows are kept.\n", this->AbortReason.c_str(), this->PartialRows, dFullRows);
+        else
+            std::cout << "\nExposure complete.\n";
+
+        this->CCDParams.dRows = dFullRows;
+        this->SegmentRowOffset = 0;
+        this->SegmentTotalRows = 0;
+
+        /*If two amplifiers were used, we need to de-interlace*/
+        this->DeinterlaceImage(pHostImage);
+
+        /*Calculate and store the clock durations*/
+        auto ExpDuration = std::chrono::duration<double, std::milli> (this->ClockTimers.Readoutstart - this->ClockTimers.ExpStart);
+        auto RdoutDuration = std::chrono::duration<double, std::milli> (this->ClockTimers.ReadoutEnd - this->ClockTimers.Readoutstart);
+        this->ClockTimers.MeasuredExp = ExpDuration.count();
+        this->ClockTimers.MeasuredReadout = RdoutDuration.count();
+        this->ClockTimers.PredictedReadout = Prediction.FrameTime * 1000.0;
+
+    /* In case we run into a runtime error */
+    } catch (std::runtime_error &e) {
+        std::cout << "failed!" << std::endl;
+        std::cerr << std::endl << e.what() << std::endl;
+
+        this->CCDParams.dRows = dFullRows;
+        this->SegmentRowOffset = 0;
+        this->SegmentTotalRows = 0;
+        if (pArcDev->IsReadout()) {
+            pArcDev->StopExposure();
+        }
+
+        /*Stopped before the end of the integration, the amplifiers are still off*/
+        if (!this->_expose_isVDDOn) this->ToggleVDD(1);
+
+        return -1;
+
+    /* Or any other kind of error */
+    } catch (...) {
+        std::cerr << std::endl << "Error: unknown exception occurred!!!" << std::endl;
+
+        this->CCDParams.dRows = dFullRows;
+        this->SegmentRowOffset = 0;
+        this->SegmentTotalRows = 0;
+        if (pArcDev->IsReadout()) {
+            pArcDev->StopExposure();
+        }
+
+        /*Stopped before the end of the integration, the amplifiers are still off*/
+        if (!this->_expose_isVDDOn) this->ToggleVDD(1);
+
+        return -1;
+    }
+
+    return 0;
+}
@@ -23,6 +23,7 @@
 
 #include "LeachController.hpp"
 #include "CCDControlDataTypes.hpp"
+#include "ReadoutModel.hpp"
 
 
 /*!
@@ -37,8 +38,6 @@
 
 int LeachController::CalculateTiming(double time_in_us) {
 
-    //First, convert number to ns. The ($var+0.5)/1 converts float to an int
-
     if (time_in_us>163){
         std::cout<<"The range for integration time is 40ns to 163 usec.\n"<<
                  "The value entered is out of bounds, so restricting the time to 163 usec.\n";
@@ -46,37 +45,7 @@ int LeachController::CalculateTiming(double time_in_us) {
         time_in_us = 163;
     }
 
-    double fiTime_ns = time_in_us*1000;
-    int iTime_ns = (int) fiTime_ns;
-
-    int timing_bigmult, bigreminder, littlereminder,timing_littlemult;
-    int timing_dsp;
-
-    if (iTime_ns > 4000) {
-        timing_bigmult = ( iTime_ns/320 ) | 0x80;
-        timing_dsp = timing_bigmult;
-    } else {
-        //if between 640ns and 40ns, 640 is a closer match, then use that
-        bigreminder=iTime_ns % 320 > 160 ? 320-iTime_ns % 320 : iTime_ns % 320;
-        littlereminder= iTime_ns % 40 > 20 ? 40-iTime_ns % 40 : iTime_ns % 40 ;
-
-        if (bigreminder <= littlereminder ) {
-
-            timing_bigmult= (iTime_ns/320) | 0x80 ;
-            timing_dsp = timing_bigmult;
-
-        } else {
-
-            timing_littlemult= iTime_ns/40 ;
-            timing_dsp = timing_littlemult;
-
-        }
-
-    }
-
-    timing_dsp = timing_dsp<<16;
-
-    return timing_dsp;
+    return WaveformTimingCode(time_in_us);
 
 }
 
@@ -109,7 +78,7 @@ int LeachController::ApplyNewIntegralTimeAndGain(double integralTime, int gain)
 
     /*Set integral time*/
     int dReply = 0;
-    dReply = pArcDev->Command( TIM_ID, CIT, timing_dsp);
+    dReply = this->TimedCommand( TIM_ID, CIT, timing_dsp);
     if ( dReply == 0x00444F4E ) {
         return 0;
     } else {
@@ -136,7 +105,7 @@ int LeachController::ApplyGainAndSpeed( int gain, int speed) {
      * #SPEED = 0 for slow, 1 for fast */
 
     int dReply = 0;
-    dReply = pArcDev->Command( TIM_ID, SGN, gain, speed);
+    dReply = this->TimedCommand( TIM_ID, SGN, gain, speed);
     if ( dReply == 0x00444F4E ) {
         return 0;
     } else {
@@ -160,7 +129,7 @@ int LeachController::ApplyNewPedestalIntegralWait(double pedestalWaitTime){
     int timing_dsp = this->CalculateTiming(pedestalWaitTime);
 
     int dReply = 0;
-    dReply = pArcDev->Command( TIM_ID, CPR, timing_dsp);
+    dReply = this->TimedCommand( TIM_ID, CPR, timing_dsp);
     if ( dReply == DON ) {
         return 0;
     } else {
@@ -183,7 +152,7 @@ int LeachController::ApplyNewSignalIntegralWait(double signalWaitTime){
     int timing_dsp = this->CalculateTiming(signalWaitTime);
 
     int dReply = 0;
-    dReply = pArcDev->Command( TIM_ID, CPO, timing_dsp);
+    dReply = this->TimedCommand( TIM_ID, CPO, timing_dsp);
     if ( dReply == DON ) {
         return 0;
     } else {
@@ -204,7 +173,7 @@ int LeachController::ApplyDGWidth(double newDGWidth) {
     int timing_dsp = this->CalculateTiming(newDGWidth);
 
     int dReply = 0;
-    dReply = pArcDev->Command( TIM_ID, DGW, timing_dsp);
+    dReply = this->TimedCommand( TIM_ID, DGW, timing_dsp);
     if ( dReply == DON ) {
         return 0;
     } else {
@@ -224,7 +193,7 @@ int LeachController::ApplyOGWidth(double newOGWidth) {
     int timing_dsp = this->CalculateTiming(newOGWidth);
 
     int dReply = 0;
-    dReply = pArcDev->Command( TIM_ID, OGW, timing_dsp);
+    dReply = this->TimedCommand( TIM_ID, OGW, timing_dsp);
     if ( dReply == DON ) {
         return 0;
     } else {
@@ -244,7 +213,7 @@ int LeachController::ApplySkippingRGWidth(double newRGWidth) {
     int timing_dsp = this->CalculateTiming(newRGWidth);
 
     int dReply = 0;
-    dReply = pArcDev->Command( TIM_ID, RSW, timing_dsp);
+    dReply = this->TimedCommand( TIM_ID, RSW, timing_dsp);
     if ( dReply == DON ) {
         return 0;
     } else {
@@ -265,7 +234,7 @@ int LeachController::ApplySummingWellWidth(double newSWWidth) {
     int timing_dsp = this->CalculateTiming(newSWWidth);
 
     int dReply = 0;
-    dReply = pArcDev->Command( TIM_ID, SWW, timing_dsp);
+    dReply = this->TimedCommand( TIM_ID, SWW, timing_dsp);
     if ( dReply == DON ) {
         return 0;
     } else {
@@ -274,3 +243,21 @@ int LeachController::ApplySummingWellWidth(double newSWWidth) {
     }
 
 }
+
+
+/*!
+ * PredictReadout works out how long reading out the image will take,
+ * with the current geometry, binning, NDCM and waveform widths. The
+ * correction of the model is the one of the sequencer file in use.
+ *
+ * @return Expected times of a sample, a pixel, a row and the frame
+ */
+
+ReadoutPrediction LeachController::PredictReadout(void ) {
+
+    this->ReadoutModel.SetStateFile(this->StateFile("ReadoutModel.txt"));
+    this->ReadoutModel.SetKey(this->HashCache.Digest(this->CCDParams.sTimFile));
+
+    return this->ReadoutModel.Predict(this->CCDParams);
+
+}
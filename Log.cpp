@@ -0,0 +1,371 @@
+/* *********************************************************************
+ * This file contains the asynchronous log. See Log.hpp.
+ * *********************************************************************
+ */
+
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <string>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+#include "Log.hpp"
+
+#define LOG_TEXT_BYTES 240
+#define LOG_EVENT_BYTES 24
+
+/*How often the writer looks at the queue when it is empty*/
+#define LOG_SINK_PERIOD_MS 5
+
+
+struct LogRecord{
+    double Time;
+    int Level;
+    bool bProgress;
+    double Value;
+    double Total;
+    char Event[LOG_EVENT_BYTES];
+    char Text[LOG_TEXT_BYTES];
+};
+
+
+/* *********************************************************************
+ * Bounded multi producer queue after D. Vyukov. Every cell has a
+ * sequence number that says whose turn it is: a producer claims a slot
+ * with one compare-and-swap on the write position, and the single
+ * consumer (the writer thread) follows behind. Nothing here blocks.
+ * *********************************************************************
+ */
+
+class LogQueue
+{
+private:
+    struct Cell{
+        std::atomic<size_t> Seq;
+        LogRecord Rec;
+    };
+    std::unique_ptr<Cell[]> Cells;
+    size_t Mask;
+    std::atomic<size_t> WritePos;
+    std::atomic<size_t> ReadPos;
+
+public:
+    explicit LogQueue(size_t nRecords) : WritePos(0), ReadPos(0)
+    {
+        size_t n = 2;
+        while (n < nRecords) n <<= 1;
+        this->Cells.reset(new Cell[n]);
+        this->Mask = n - 1;
+        for (size_t i = 0; i < n; i++) this->Cells[i].Seq.store(i, std::memory_order_relaxed);
+    }
+
+    bool Push(const LogRecord &Rec)
+    {
+        size_t Pos = this->WritePos.load(std::memory_order_relaxed);
+        Cell *c;
+        while (true) {
+            c = &this->Cells[Pos & this->Mask];
+            size_t Seq = c->Seq.load(std::memory_order_acquire);
+            intptr_t Diff = (intptr_t) Seq - (intptr_t) Pos;
+            if (Diff == 0) {
+                if (this->WritePos.compare_exchange_weak(Pos, Pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (Diff < 0) return false;
+            else Pos = this->WritePos.load(std::memory_order_relaxed);
+        }
+        c->Rec = Rec;
+        c->Seq.store(Pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(LogRecord &Rec)
+    {
+        size_t Pos = this->ReadPos.load(std::memory_order_relaxed);
+        Cell *c = &this->Cells[Pos & this->Mask];
+        if (c->Seq.load(std::memory_order_acquire) != Pos + 1) return false;
+        Rec = c->Rec;
+        c->Seq.store(Pos + this->Mask + 1, std::memory_order_release);
+        this->ReadPos.store(Pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t Written(void ) const { return this->WritePos.load(std::memory_order_acquire); }
+    size_t Read(void ) const { return this->ReadPos.load(std::memory_order_acquire); }
+};
+
+
+class AsyncLog
+{
+private:
+    /*Producers may be inside Push while the log is reconfigured, so a queue is never freed: a new
+     *size makes a new queue, and the old ones are only drained. They only change with the writer
+     *stopped, the writer reads them all.*/
+    std::atomic<LogQueue*> Queue;
+    std::vector<std::unique_ptr<LogQueue>> Queues;
+    size_t QueueRecords = 0;
+    FILE *pOut = stdout;
+    bool bJSON = false;
+    bool bInProgressLine = false;
+    uint64_t nReported = 0;
+
+    std::thread Sink;
+    std::mutex mtx;
+    std::condition_variable Changed;
+    bool bStop = false;
+
+    void SinkLoop(void );
+    void Write(const LogRecord& );
+    void StopSink(void );
+
+public:
+    std::atomic<uint64_t> nDropped;
+    std::atomic<int64_t> ProgressIntervalNs;
+
+    AsyncLog() : Queue(nullptr), nDropped(0), ProgressIntervalNs(200000000) { this->Start(4096); }
+    ~AsyncLog() { this->StopSink(); if (this->pOut != stdout) fclose(this->pOut); }
+
+    void Start(size_t nRecords);
+    void Configure(const std::string &Format, const std::string &File, int nRecords);
+    void Push(const LogRecord &Rec) { if (!this->Queue.load(std::memory_order_acquire)->Push(Rec)) this->nDropped++; }
+    void Flush(double TimeoutSec);
+};
+
+
+static AsyncLog& TheLog(void )
+{
+    static AsyncLog Log;
+    return Log;
+}
+
+
+void AsyncLog::Start(size_t nRecords)
+{
+    if (nRecords != this->QueueRecords) {
+        this->Queues.emplace_back(new LogQueue(nRecords));
+        this->Queue.store(this->Queues.back().get(), std::memory_order_release);
+        this->QueueRecords = nRecords;
+    }
+    this->bStop = false;
+    this->Sink = std::thread(&AsyncLog::SinkLoop, this);
+}
+
+
+void AsyncLog::StopSink(void )
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->bStop = true;
+    }
+    this->Changed.notify_all();
+    if (this->Sink.joinable()) this->Sink.join();
+}
+
+
+void AsyncLog::Configure(const std::string &Format, const std::string &File, int nRecords)
+{
+
+    static std::mutex ConfigMutex;
+    std::lock_guard<std::mutex> ConfigLock(ConfigMutex);
+
+    /*Reconfiguring is rare (a config file is read), so the writer is simply stopped and started again*/
+    static std::string LastFormat = "text", LastFile;
+    static int LastRecords = 4096;
+    if (Format == LastFormat && File == LastFile && nRecords == LastRecords) return;
+
+    this->Flush(2.0);
+    this->StopSink();
+    if (this->pOut != stdout) fclose(this->pOut);
+    this->pOut = stdout;
+    if (!File.empty()) {
+        this->pOut = fopen(File.c_str(), "a");
+        if (this->pOut == NULL) {
+            printf("Could not open the log file %s. Logging to the terminal.\n", File.c_str());
+            this->pOut = stdout;
+        }
+    }
+    this->bJSON = Format == "json";
+    this->bInProgressLine = false;
+    this->Start(nRecords > 0 ? (size_t) nRecords : 4096);
+
+    LastFormat = Format;
+    LastFile = File;
+    LastRecords = nRecords;
+
+}
+
+
+static void WriteJSONString(FILE *pOut, const char *s)
+{
+    fputc('"', pOut);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\') { fputc('\\', pOut); fputc(c, pOut); }
+        else if (c == '\n') fputs("\\n", pOut);
+        else if (c == '\r' || c == '\t') fputc(' ', pOut);
+        else if (c < 0x20) fprintf(pOut, "\\u%04x", c);
+        else fputc(c, pOut);
+    }
+    fputc('"', pOut);
+}
+
+
+void AsyncLog::Write(const LogRecord &R)
+{
+
+    static const char *LevelNames[] = { "debug", "info", "warning", "error" };
+
+    if (this->bJSON) {
+        fprintf(this->pOut, "{\"time\":%.3f,\"level\":\"%s\",\"event\":", R.Time, LevelNames[R.Level & 3]);
+        WriteJSONString(this->pOut, R.Event);
+        if (R.bProgress) fprintf(this->pOut, ",\"value\":%.6g,\"total\":%.6g", R.Value, R.Total);
+        fputs(",\"msg\":", this->pOut);
+        /*The text of the terminal may carry its own line breaks*/
+        const char *pText = R.Text;
+        while (*pText == '\n' || *pText == '\r') pText++;
+        std::string sText(pText);
+        while (!sText.empty() && (sText.back() == '\n' || sText.back() == '\r')) sText.pop_back();
+        WriteJSONString(this->pOut, sText.c_str());
+        fputs("}\n", this->pOut);
+        return;
+    }
+
+    /*Progress lines overwrite each other, anything else starts on a line of its own*/
+    if (R.bProgress) {
+        fprintf(this->pOut, "\r%s", R.Text);
+        this->bInProgressLine = true;
+        return;
+    }
+    if (this->bInProgressLine && R.Text[0] != '\n') fputc('\n', this->pOut);
+    this->bInProgressLine = false;
+    fputs(R.Text, this->pOut);
+    size_t n = strlen(R.Text);
+    if (n == 0 || R.Text[n-1] != '\n') fputc('\n', this->pOut);
+
+}
+
+
+void AsyncLog::SinkLoop(void )
+{
+
+    LogRecord R;
+    while (true) {
+
+        /*The older queues first, they can only hold messages pushed while the log was reconfigured*/
+        bool bAny = false;
+        bool bEmpty = true;
+        for (auto &q : this->Queues) {
+            while (q->Pop(R)) {
+                this->Write(R);
+                bAny = true;
+            }
+            bEmpty = bEmpty && q->Read() == q->Written();
+        }
+
+        uint64_t nDroppedNow = this->nDropped.load();
+        if (nDroppedNow != this->nReported) {
+            unsigned long long nLost = (unsigned long long) (nDroppedNow - this->nReported);
+            if (this->bJSON) {
+                double Now = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+                fprintf(this->pOut, "{\"time\":%.3f,\"level\":\"warning\",\"event\":\"log\",\"dropped\":%llu,"
+                                    "\"msg\":\"%llu log messages were dropped\"}\n", Now, nLost, nLost);
+            } else {
+                fprintf(this->pOut, "\n%llu log messages were dropped because the output could not keep up\n", nLost);
+            }
+            this->nReported = nDroppedNow;
+            bAny = true;
+        }
+        if (bAny) {
+            fflush(this->pOut);
+            this->Changed.notify_all();
+        }
+
+        std::unique_lock<std::mutex> lock(this->mtx);
+        if (this->bStop && bEmpty) return;
+        this->Changed.wait_for(lock, std::chrono::milliseconds(LOG_SINK_PERIOD_MS));
+    }
+
+}
+
+
+void AsyncLog::Flush(double TimeoutSec)
+{
+
+    LogQueue *q = this->Queue.load(std::memory_order_acquire);
+    size_t Target = q->Written();
+    auto tEnd = std::chrono::steady_clock::now() + std::chrono::microseconds((long) (TimeoutSec * 1e6));
+    std::unique_lock<std::mutex> lock(this->mtx);
+    while (q->Read() < Target && std::chrono::steady_clock::now() < tEnd)
+        this->Changed.wait_for(lock, std::chrono::milliseconds(LOG_SINK_PERIOD_MS));
+
+}
+
+
+static void FillRecord(LogRecord &R, int Level, bool bProgress, const char *Event, const char *Format, va_list Args)
+{
+    R.Time = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    R.Level = Level;
+    R.bProgress = bProgress;
+    R.Value = 0;
+    R.Total = 0;
+    strncpy(R.Event, Event ? Event : "", LOG_EVENT_BYTES - 1);
+    R.Event[LOG_EVENT_BYTES - 1] = 0;
+    vsnprintf(R.Text, LOG_TEXT_BYTES, Format, Args);
+}
+
+
+bool LogRate::Ready(void )
+{
+    int64_t Now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t Next = this->NextNs.load(std::memory_order_relaxed);
+    if (Now < Next) return false;
+    return this->NextNs.compare_exchange_strong(Next, Now + TheLog().ProgressIntervalNs.load(std::memory_order_relaxed));
+}
+
+
+void ConfigureLog(const std::string &Format, const std::string &File, int QueueRecords, double ProgressInterval)
+{
+    TheLog().ProgressIntervalNs = (int64_t) (ProgressInterval > 0 ? ProgressInterval * 1e9 : 0);
+    TheLog().Configure(Format, File, QueueRecords);
+}
+
+
+void LogMessage(LogLevel Level, const char *Event, const char *Format, ...)
+{
+    LogRecord R;
+    va_list Args;
+    va_start(Args, Format);
+    FillRecord(R, Level, false, Event, Format, Args);
+    va_end(Args);
+    TheLog().Push(R);
+}
+
+
+void LogProgress(LogRate &Rate, bool bForce, const char *Event, double Value, double Total, const char *Format, ...)
+{
+    if (!bForce && !Rate.Ready()) return;
+    LogRecord R;
+    va_list Args;
+    va_start(Args, Format);
+    FillRecord(R, LOG_INFO, true, Event, Format, Args);
+    va_end(Args);
+    R.Value = Value;
+    R.Total = Total;
+    TheLog().Push(R);
+}
+
+
+void LogFlush(double TimeoutSec)
+{
+    TheLog().Flush(TimeoutSec);
+}
+
+
+uint64_t LogDropped(void )
+{
+    return TheLog().nDropped.load();
+}
@@ -0,0 +1,58 @@
+/* *********************************************************************
+ * Asynchronous logging for the paths that run while the controller is
+ * being polled. A message is formatted into a fixed size record and put
+ * on a bounded lock free queue; a background thread writes the records
+ * out. The caller never waits for the terminal or the pipe: if the
+ * queue is full, the message is dropped and counted instead.
+ *
+ * Progress messages (time remaining, the readout bar) are rate limited
+ * with a LogRate, so a 1 ms poll does not format a line every time. In
+ * text mode they overwrite each other on one line like before.
+ *
+ * With LogFormat = json in [output] every record is written as one JSON
+ * object per line instead, for the server and the monitors:
+ *   {"time":1718000000.123,"level":"info","event":"readout","value":1200,"total":4800,"msg":"..."}
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_LOG_HPP
+#define CCDDRONE_LOG_HPP
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+enum LogLevel { LOG_DEBUG = 0, LOG_INFO = 1, LOG_WARN = 2, LOG_ERROR = 3 };
+
+
+/*Lets a progress message through at most once per ProgressInterval of the log*/
+class LogRate
+{
+private:
+    std::atomic<int64_t> NextNs;
+public:
+    LogRate() : NextNs(0) {};
+    bool Ready(void );
+    void Reset(void ) { NextNs = 0; }
+};
+
+
+/*text or json, the file to write to (empty = stdout), the records the queue holds and the
+ *shortest time between two progress messages of one LogRate (s)*/
+void ConfigureLog(const std::string &Format, const std::string &File, int QueueRecords, double ProgressInterval);
+
+void LogMessage(LogLevel Level, const char *Event, const char *Format, ...) __attribute__((format(printf, 3, 4)));
+
+/*A progress update; Value out of Total go to the JSON record. Skipped unless Rate is ready or bForce is set.*/
+void LogProgress(LogRate &Rate, bool bForce, const char *Event, double Value, double Total, const char *Format, ...)
+                 __attribute__((format(printf, 6, 7)));
+
+/*Wait until everything logged so far is written, or TimeoutSec passed. For the places where the log
+ *has to be in order with what is printed directly; never call it while polling.*/
+void LogFlush(double TimeoutSec = 2.0);
+
+/*Messages that did not fit in the queue*/
+uint64_t LogDropped(void );
+
+
+#endif //CCDDRONE_LOG_HPP
@@ -0,0 +1,118 @@
+/* *********************************************************************
+ * This file contains the native de-interlacing routines. See
+ * NativeDeinterlace.hpp for a description.
+ * *********************************************************************
+ */
+
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <cstddef>
+
+#include "NativeDeinterlace.hpp"
+#include "SkipperReduction.hpp"
+#include "UtilityFunctions.hpp"
+
+
+
+void DeinterlaceSerialRow(const unsigned short *pSrc, unsigned short *pDst, int dWidth)
+{
+
+    int dHalf = dWidth / 2;
+    for (int j = 0; j < dHalf; j++) {
+        pDst[j] = pSrc[2*j];
+        pDst[dWidth-1-j] = pSrc[2*j+1];
+    }
+
+}
+
+
+void DeinterlaceSerial(unsigned short *pData, int dRows, int dWidth, int nThreads)
+{
+
+    ParallelForRows(dRows, nThreads, [=](int dFirstRow, int dEndRow) {
+        /*One row of scratch per thread, so that the row can be rewritten in place*/
+        std::vector<unsigned short> RowScratch(dWidth);
+        for (int r = dFirstRow; r < dEndRow; r++) {
+            unsigned short *pRow = pData + (size_t) r * dWidth;
+            std::memcpy(RowScratch.data(), pRow, dWidth * sizeof(unsigned short));
+            DeinterlaceSerialRow(RowScratch.data(), pRow, dWidth);
+        }
+    });
+
+}
+
+
+/*Mean and RMS of the samples of one pixel, in the same way as ReduceSkipperRows.*/
+static inline void ReducePixel(const unsigned short *pSamples, int nKept, float &mean, float &rms)
+{
+    uint64_t sum, sumSq;
+    SumSkipperSamples(pSamples, nKept, sum, sumSq);
+
+    uint64_t n = (uint64_t) nKept;
+    mean = (float) ((double) sum / (double) n);
+    rms = (float) (std::sqrt((double) (n*sumSq - sum*sum)) / (double) n);
+}
+
+
+void DeinterlaceAndReduceRow(const unsigned short *pSrc, unsigned short *pDstRaw, int dCols, int nSamples, int nDiscard,
+                             float *pMeanRow, float *pRMSRow, unsigned short *pPixScratch)
+{
+
+    int nKept = nSamples - nDiscard;
+    int dHalf = dCols / 2;
+    unsigned short *pU = pPixScratch;
+    unsigned short *pL = pPixScratch + nSamples;
+
+    /*The samples of U pixel p and L pixel p are interlaced in raw[2*p*nSamples, 2*(p+1)*nSamples),
+     *so every pixel pair only touches a few kB that stay in cache.*/
+    for (int p = 0; p < dHalf; p++) {
+
+        const unsigned short *pRaw = pSrc + (size_t) 2 * p * nSamples;
+        for (int s = 0; s < nSamples; s++) {
+            pU[s] = pRaw[2*s];
+            pL[s] = pRaw[2*s+1];
+        }
+
+        ReducePixel(pU + nDiscard, nKept, pMeanRow[p], pRMSRow[p]);
+        ReducePixel(pL + nDiscard, nKept, pMeanRow[dCols-1-p], pRMSRow[dCols-1-p]);
+
+        if (pDstRaw != NULL) {
+            std::memcpy(pDstRaw + (size_t) p * nSamples, pU, nSamples * sizeof(unsigned short));
+            unsigned short *pLDst = pDstRaw + (size_t) (dCols - p) * nSamples - 1;
+            for (int s = 0; s < nSamples; s++) pLDst[-s] = pL[s];
+        }
+    }
+
+}
+
+
+void DeinterlaceAndReduce(unsigned short *pData, int dRows, int dCols, int nSamples, int nDiscard, bool bPackRaw,
+                          float *pMean, float *pRMS, int nThreads)
+{
+
+    if (nSamples - nDiscard < 1) return;
+    size_t dWidth = (size_t) dCols * nSamples;
+
+    ParallelForRows(dRows, nThreads, [=](int dFirstRow, int dEndRow) {
+        std::vector<unsigned short> PixScratch(2 * nSamples);
+        std::vector<unsigned short> RowScratch(bPackRaw ? dWidth : 0);
+
+        for (int r = dFirstRow; r < dEndRow; r++) {
+            unsigned short *pRow = pData + (size_t) r * dWidth;
+            const unsigned short *pSrc = pRow;
+            unsigned short *pDst = NULL;
+
+            /*Packing the de-interlaced samples back into the same row needs a copy of the input*/
+            if (bPackRaw) {
+                std::memcpy(RowScratch.data(), pRow, dWidth * sizeof(unsigned short));
+                pSrc = RowScratch.data();
+                pDst = pRow;
+            }
+
+            DeinterlaceAndReduceRow(pSrc, pDst, dCols, nSamples, nDiscard,
+                                    pMean + (size_t) r * dCols, pRMS + (size_t) r * dCols, PixScratch.data());
+        }
+    });
+
+}
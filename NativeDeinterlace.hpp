@@ -0,0 +1,37 @@
+/* *********************************************************************
+ * Native replacement for CArcDeinterlace::RunAlg( ..., DEINTERLACE_SERIAL).
+ * Reading out with both amplifiers (UL) interlaces the two halves of
+ * every row: U, L, U, L ... After de-interlacing, the U half is on the
+ * left, and the L half is on the right, mirrored. This is exactly what
+ * the ArcAPI serial algorithm produces.
+ *
+ * The rows are split across threads, and the de-interlace can be fused
+ * with the NDCM reduction so the buffer is only traversed once.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_NATIVEDEINTERLACE_HPP
+#define CCDDRONE_NATIVEDEINTERLACE_HPP
+
+
+/*De-interlace a single row of dWidth values. pSrc and pDst must not overlap.*/
+void DeinterlaceSerialRow(const unsigned short *pSrc, unsigned short *pDst, int dWidth);
+
+/*In place, multithreaded serial de-interlace of dRows rows of dWidth values*/
+void DeinterlaceSerial(unsigned short *pData, int dRows, int dWidth, int nThreads = 0);
+
+/*
+ * De-interlace and NDCM reduce one raw row of dCols pixels x nSamples in a single pass.
+ * The mean and RMS come out in the de-interlaced column order. If pDstRaw is not NULL, the
+ * de-interlaced samples are also packed into it (it must not overlap pSrc).
+ * pPixScratch needs room for 2*nSamples values.
+ */
+void DeinterlaceAndReduceRow(const unsigned short *pSrc, unsigned short *pDstRaw, int dCols, int nSamples, int nDiscard,
+                             float *pMeanRow, float *pRMSRow, unsigned short *pPixScratch);
+
+/*In place, multithreaded version of the above for a whole image. If bPackRaw is false, pData is left untouched.*/
+void DeinterlaceAndReduce(unsigned short *pData, int dRows, int dCols, int nSamples, int nDiscard, bool bPackRaw,
+                          float *pMean, float *pRMS, int nThreads = 0);
+
+
+#endif //CCDDRONE_NATIVEDEINTERLACE_HPP
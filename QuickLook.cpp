@@ -0,0 +1,205 @@
+/* *********************************************************************
+ * This file contains the quick look statistics and preview. See
+ * QuickLook.hpp for a description.
+ * *********************************************************************
+ */
+
+#include <cmath>
+#include <cstdio>
+
+#include "fitsio.h"
+#include "QuickLook.hpp"
+#include "FitsOps.hpp"
+
+
+void QuickLook::Configure(int dCols, int nSamples, const std::string &AmplifierDirection, int PreviewBin, unsigned int SaturationLevel)
+{
+    this->dCols = dCols > 0 ? dCols : 1;
+    this->nSamples = nSamples > 0 ? nSamples : 1;
+    this->nAmps = AmplifierDirection == "UL" ? 2 : 1;
+    this->PreviewBin = PreviewBin > 0 ? PreviewBin : 1;
+    this->SaturationLevel = SaturationLevel;
+}
+
+
+void QuickLook::ReadoutStarted(int dRows, int dRowWidth)
+{
+
+    /*The samples of a UL row alternate U, L. The L half ends up mirrored on the right.*/
+    this->ColumnAmp.resize(dRowWidth);
+    this->ColumnPreview.resize(dRowWidth);
+    for (int i = 0; i < dRowWidth; i++) {
+        int dPixel;
+        if (this->nAmps == 2) {
+            int dInAmp = (i / 2) / this->nSamples;
+            this->ColumnAmp[i] = i % 2;
+            dPixel = i % 2 == 0 ? dInAmp : this->dCols - 1 - dInAmp;
+        } else {
+            this->ColumnAmp[i] = 0;
+            dPixel = i / this->nSamples;
+        }
+        if (dPixel >= this->dCols) dPixel = this->dCols - 1;
+        if (dPixel < 0) dPixel = 0;
+        this->ColumnPreview[i] = dPixel / this->PreviewBin;
+    }
+
+    for (auto &A : this->Amps) {
+        A.nSamples = 0;
+        A.Sum = 0;
+        A.SumSq = 0;
+        A.Saturated = 0;
+        A.Histogram.assign(QUICKLOOK_HIST_BINS, 0);
+    }
+
+    this->PreviewRows = (dRows + this->PreviewBin - 1) / this->PreviewBin;
+    this->PreviewCols = (this->dCols + this->PreviewBin - 1) / this->PreviewBin;
+    this->PreviewSum.assign((size_t) this->PreviewRows * this->PreviewCols, 0);
+    this->PreviewN.assign((size_t) this->PreviewRows * this->PreviewCols, 0);
+    this->RowsSeen = 0;
+
+}
+
+
+void QuickLook::RowsCallback(const unsigned short *pRows, int dFirstRow, int nRows, int dRowWidth)
+{
+
+    if ((int) this->ColumnAmp.size() != dRowWidth) return;
+
+    for (int r = 0; r < nRows; r++) {
+
+        const unsigned short *pRow = pRows + (size_t) r * dRowWidth;
+        int dPreviewRow = (dFirstRow + r) / this->PreviewBin;
+        if (dPreviewRow >= this->PreviewRows) break;
+        double *pPrevSum = this->PreviewSum.data() + (size_t) dPreviewRow * this->PreviewCols;
+        uint32_t *pPrevN = this->PreviewN.data() + (size_t) dPreviewRow * this->PreviewCols;
+
+        /*Sums of a row fit in 64 bits, they are only added to the doubles once per row*/
+        uint64_t Sum[2] = { 0, 0 }, SumSq[2] = { 0, 0 };
+        int64_t Saturated[2] = { 0, 0 };
+
+        for (int i = 0; i < dRowWidth; i++) {
+            unsigned int v = pRow[i];
+            int a = this->ColumnAmp[i];
+            Sum[a] += v;
+            SumSq[a] += (uint64_t) v * v;
+            Saturated[a] += v >= this->SaturationLevel;
+            this->Amps[a].Histogram[v / QUICKLOOK_BIN_ADU]++;
+            pPrevSum[this->ColumnPreview[i]] += v;
+            pPrevN[this->ColumnPreview[i]]++;
+        }
+
+        for (int a = 0; a < this->nAmps; a++) {
+            this->Amps[a].nSamples += this->nAmps == 2 ? dRowWidth / 2 : dRowWidth;
+            this->Amps[a].Sum += (double) Sum[a];
+            this->Amps[a].SumSq += (double) SumSq[a];
+            this->Amps[a].Saturated += Saturated[a];
+        }
+    }
+
+    this->RowsSeen += nRows;
+
+}
+
+
+QuickLookAmpStats QuickLook::Stats(int Amp) const
+{
+
+    QuickLookAmpStats S;
+    const Accumulator &A = this->Amps[Amp];
+    S.nSamples = A.nSamples;
+    S.Saturated = A.Saturated;
+    if (A.nSamples > 0) {
+        S.Mean = A.Sum / A.nSamples;
+        double Var = A.SumSq / A.nSamples - S.Mean * S.Mean;
+        S.RMS = Var > 0 ? std::sqrt(Var) : 0;
+    }
+    return S;
+
+}
+
+
+double QuickLook::SaturatedFraction(void ) const
+{
+    int64_t n = 0, nSat = 0;
+    for (int a = 0; a < this->nAmps; a++) {
+        n += this->Amps[a].nSamples;
+        nSat += this->Amps[a].Saturated;
+    }
+    return n > 0 ? (double) nSat / n : 0;
+}
+
+
+void QuickLook::Preview(std::vector<float> &Pixels, int &Rows, int &Cols) const
+{
+    Rows = this->PreviewRows;
+    Cols = this->PreviewCols;
+    Pixels.resize(this->PreviewSum.size());
+    for (size_t i = 0; i < Pixels.size(); i++)
+        Pixels[i] = this->PreviewN[i] > 0 ? (float) (this->PreviewSum[i] / this->PreviewN[i]) : 0.0f;
+}
+
+
+std::string QuickLookFileName(const std::string &ImageFileName)
+{
+    std::string Base = ImageFileName;
+    size_t dExt = Base.rfind(".fits");
+    if (dExt != std::string::npos && dExt + 5 == Base.size()) Base.erase(dExt);
+    return Base + "_quicklook.fits";
+}
+
+
+int WriteQuickLookFits(const QuickLook &Look, const std::string &FileName)
+{
+
+    std::vector<float> Pixels;
+    int dRows, dCols;
+    Look.Preview(Pixels, dRows, dCols);
+    if (Pixels.empty()) return 0;
+
+    fitsfile *fptr;
+    int status = 0;
+    long imageSizeXY[2] = { dCols, dRows };
+
+    /*The leading ! overwrites a quick look left over from an earlier run*/
+    std::unique_lock<std::mutex> FitsLock = FitsWriteLock();
+    fits_create_file(&fptr, ("!" + FileName).c_str(), &status);
+    fits_create_img(fptr, FLOAT_IMG, 2, &imageSizeXY[0], &status);
+    fits_write_key(fptr, TSTRING, "EXTNAME", (char*) "PREVIEW", "Quick look of the readout", &status);
+
+    int dBin = Look.Bin();
+    int dRowsSeen = Look.Rows();
+    fits_write_key(fptr, TINT, "PVBIN", &dBin, "Pixels averaged per preview pixel, each axis", &status);
+    fits_write_key(fptr, TINT, "PVROWS", &dRowsSeen, "Rows read when the preview was taken", &status);
+
+    const char *AmpNames[2] = { Look.Amplifiers() == 2 ? "U" : "", "L" };
+    for (int a = 0; a < Look.Amplifiers(); a++) {
+        QuickLookAmpStats S = Look.Stats(a);
+        std::string sAmp = AmpNames[a];
+        long long nSat = (long long) S.Saturated;
+        fits_write_key(fptr, TDOUBLE, ("MEAN" + sAmp).c_str(), &S.Mean, "Mean of the raw samples (ADU)", &status);
+        fits_write_key(fptr, TDOUBLE, ("RMS" + sAmp).c_str(), &S.RMS, "RMS of the raw samples (ADU)", &status);
+        fits_write_key(fptr, TLONGLONG, ("NSAT" + sAmp).c_str(), &nSat, "Saturated raw samples", &status);
+    }
+
+    fits_write_img(fptr, TFLOAT, 1, (LONGLONG) Pixels.size(), Pixels.data(), &status);
+
+    /*Histogram of the raw samples, one column per amplifier*/
+    std::vector<int> BinStart(QUICKLOOK_HIST_BINS);
+    for (int b = 0; b < QUICKLOOK_HIST_BINS; b++) BinStart[b] = b * QUICKLOOK_BIN_ADU;
+    char *ttype[] = { (char*) "ADU", (char*) "COUNT_U", (char*) "COUNT_L" };
+    char *tform[] = { (char*) "1J", (char*) "1V", (char*) "1V" };
+    char *tunit[] = { (char*) "ADU", (char*) "", (char*) "" };
+    if (Look.Amplifiers() == 1) ttype[1] = (char*) "COUNT";
+    fits_create_tbl(fptr, BINARY_TBL, QUICKLOOK_HIST_BINS, 1 + Look.Amplifiers(), ttype, tform, tunit, "HISTOGRAM", &status);
+    fits_write_col(fptr, TINT, 1, 1, 1, QUICKLOOK_HIST_BINS, BinStart.data(), &status);
+    for (int a = 0; a < Look.Amplifiers(); a++) {
+        std::vector<uint32_t> Counts = Look.Histogram(a);
+        Counts.resize(QUICKLOOK_HIST_BINS, 0);
+        fits_write_col(fptr, TUINT, 2 + a, 1, 1, QUICKLOOK_HIST_BINS, Counts.data(), &status);
+    }
+
+    fits_close_file(fptr, &status);
+    fits_report_error(stderr, status);
+    return status;
+
+}
@@ -0,0 +1,96 @@
+/* *********************************************************************
+ * Quick look of an image while it is read out. As the rows arrive from
+ * the controller, the statistics of the raw samples of each amplifier
+ * (mean, RMS, histogram, saturated samples) are kept up to date, and a
+ * preview image is built by averaging blocks of PreviewBin x PreviewBin
+ * pixels over all their samples. The preview is de-interlaced, i.e. the
+ * L half of a UL readout is mirrored like in the final image.
+ *
+ * The rows are taken as they sit in the common buffer (see CRowIFace.hpp)
+ * and the work per sample is small, so this keeps up with the readout on
+ * the polling thread.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_QUICKLOOK_HPP
+#define CCDDRONE_QUICKLOOK_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "CRowIFace.hpp"
+
+
+/*Histogram bins of the raw samples, each QUICKLOOK_BIN_ADU wide*/
+#define QUICKLOOK_HIST_BINS 256
+#define QUICKLOOK_BIN_ADU 256
+
+
+struct QuickLookAmpStats{
+    int64_t nSamples = 0;
+    double Mean = 0;
+    double RMS = 0;
+    int64_t Saturated = 0;
+};
+
+
+class QuickLook : public CRowIFace
+{
+
+private:
+    int dCols = 0;
+    int nSamples = 1;
+    int nAmps = 1;
+    int PreviewBin = 16;
+    unsigned int SaturationLevel = 65535;
+
+    /*Per raw column of a row: the amplifier and the preview column it goes to*/
+    std::vector<int> ColumnAmp;
+    std::vector<int> ColumnPreview;
+
+    struct Accumulator{
+        int64_t nSamples = 0;
+        double Sum = 0;
+        double SumSq = 0;
+        int64_t Saturated = 0;
+        std::vector<uint32_t> Histogram;
+    } Amps[2];
+
+    int PreviewRows = 0;
+    int PreviewCols = 0;
+    std::vector<double> PreviewSum;
+    std::vector<uint32_t> PreviewN;
+    int RowsSeen = 0;
+
+public:
+    /*The geometry of the next readout. AmplifierDirection is that of the [ccd] section.*/
+    void Configure(int dCols, int nSamples, const std::string &AmplifierDirection, int PreviewBin, unsigned int SaturationLevel);
+
+    void ReadoutStarted(int dRows, int dRowWidth) override;
+    void RowsCallback(const unsigned short *pRows, int dFirstRow, int nRows, int dRowWidth) override;
+
+    int Amplifiers(void ) const { return nAmps; }
+    int Rows(void ) const { return RowsSeen; }
+    int Bin(void ) const { return PreviewBin; }
+    QuickLookAmpStats Stats(int Amp) const;
+    const std::vector<uint32_t>& Histogram(int Amp) const { return Amps[Amp].Histogram; }
+
+    /*Fraction of the samples so far that are saturated, over all amplifiers*/
+    double SaturatedFraction(void ) const;
+
+    /*The preview so far, PreviewRows x PreviewCols. Blocks that have not been read yet are 0.*/
+    void Preview(std::vector<float> &Pixels, int &Rows, int &Cols) const;
+
+};
+
+
+/*Write the preview and the statistics as a small FITS file: the PREVIEW image, with the statistics
+ *of each amplifier as keys, and the HISTOGRAM table. Returns the cfitsio status.*/
+int WriteQuickLookFits(const QuickLook &, const std::string &FileName);
+
+/*The quick look file that goes with an image file: image.fits -> image_quicklook.fits*/
+std::string QuickLookFileName(const std::string &ImageFileName);
+
+
+#endif //CCDDRONE_QUICKLOOK_HPP
@@ -0,0 +1,164 @@
+/* *********************************************************************
+ * This file contains the raw frame files. See RawFrame.hpp.
+ * *********************************************************************
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "RawFrame.hpp"
+
+/*Size of one write. Large writes keep the disk busy without a copy through the page cache.*/
+#define RAW_FRAME_CHUNK_BYTES (64UL*1024*1024)
+
+
+std::string RawFrameFileName(const std::string &FitsFileName)
+{
+    std::string Base = FitsFileName;
+    size_t nExt = Base.rfind(".fits");
+    if (nExt != std::string::npos && nExt + 5 == Base.size()) Base.resize(nExt);
+    return Base + ".raw";
+}
+
+
+static int WriteAll(int fd, const char *pSrc, size_t nBytes, off_t Offset)
+{
+    while (nBytes > 0) {
+        size_t nChunk = nBytes < RAW_FRAME_CHUNK_BYTES ? nBytes : RAW_FRAME_CHUNK_BYTES;
+        ssize_t nDone = pwrite(fd, pSrc, nChunk, Offset);
+        if (nDone < 0 && errno == EINTR) continue;
+        if (nDone <= 0) return -1;
+        pSrc += nDone;
+        Offset += nDone;
+        nBytes -= (size_t) nDone;
+    }
+    return 0;
+}
+
+
+int WriteRawFrame(const std::string &File, RawFrameHeader &Header, const std::vector<char> &Metadata,
+                  const unsigned short *pData, bool bDirectIO)
+{
+
+    memcpy(Header.Magic, RAW_FRAME_MAGIC, sizeof(Header.Magic));
+    Header.Version = RAW_FRAME_VERSION;
+    Header.ByteOrder = RAW_FRAME_BYTE_ORDER;
+    Header.MetadataBytes = Metadata.size();
+    Header.PixelBytes = (uint64_t) Header.Width * Header.Height * sizeof(unsigned short);
+    size_t nHead = sizeof(RawFrameHeader) + Metadata.size();
+    Header.HeaderBytes = (nHead + RAW_FRAME_ALIGN - 1) / RAW_FRAME_ALIGN * RAW_FRAME_ALIGN;
+
+    int fd = open(File.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cout << "Could not create " << File << ": " << strerror(errno) << "\n";
+        return -1;
+    }
+
+    /*The header block is built in an aligned buffer too, so the whole file can go through O_DIRECT*/
+    char *pHead = NULL;
+    if (posix_memalign((void**) &pHead, RAW_FRAME_ALIGN, Header.HeaderBytes) != 0) {
+        close(fd);
+        std::cout << "Could not allocate the header of " << File << "\n";
+        return -1;
+    }
+    memset(pHead, 0, Header.HeaderBytes);
+    memcpy(pHead, &Header, sizeof(RawFrameHeader));
+    if (!Metadata.empty()) memcpy(pHead + sizeof(RawFrameHeader), Metadata.data(), Metadata.size());
+
+    /*Direct writes need an aligned buffer, offset and length. The tail that is not a whole block
+     *goes through the page cache.*/
+    size_t nPixelBytes = (size_t) Header.PixelBytes;
+    size_t nDirect = 0;
+    int fdDirect = -1;
+#ifdef O_DIRECT
+    if (bDirectIO && ((uintptr_t) pData % RAW_FRAME_ALIGN) == 0) {
+        fdDirect = open(File.c_str(), O_WRONLY | O_DIRECT);
+        if (fdDirect >= 0) nDirect = nPixelBytes / RAW_FRAME_ALIGN * RAW_FRAME_ALIGN;
+    }
+#endif
+    int fdBulk = fdDirect >= 0 ? fdDirect : fd;
+
+    int Status = WriteAll(fdBulk, pHead, Header.HeaderBytes, 0);
+    if (Status == 0 && nDirect > 0)
+        Status = WriteAll(fdBulk, (const char*) pData, nDirect, (off_t) Header.HeaderBytes);
+    if (Status == 0 && nPixelBytes > nDirect)
+        Status = WriteAll(fd, (const char*) pData + nDirect, nPixelBytes - nDirect, (off_t) (Header.HeaderBytes + nDirect));
+
+    /*Some file systems refuse O_DIRECT only at the first write*/
+    if (Status != 0 && fdDirect >= 0 && errno == EINVAL) {
+        close(fdDirect);
+        fdDirect = -1;
+        Status = WriteAll(fd, pHead, Header.HeaderBytes, 0);
+        if (Status == 0) Status = WriteAll(fd, (const char*) pData, nPixelBytes, (off_t) Header.HeaderBytes);
+    }
+    if (Status != 0) std::cout << "Could not write " << File << ": " << strerror(errno) << "\n";
+
+    free(pHead);
+    if (fdDirect >= 0) close(fdDirect);
+    close(fd);
+
+    return Status;
+}
+
+
+int RawFrameFile::Open(const std::string &File)
+{
+
+    this->Close();
+
+    int fd = open(File.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cout << "Could not open " << File << ": " << strerror(errno) << "\n";
+        return -1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    size_t nBytes = (size_t) st.st_size;
+    if (nBytes < sizeof(RawFrameHeader)) {
+        close(fd);
+        std::cout << File << " is too short to be a raw frame file\n";
+        return -1;
+    }
+
+    void *pFile = mmap(NULL, nBytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pFile == MAP_FAILED) {
+        std::cout << "Could not map " << File << "\n";
+        return -1;
+    }
+    this->pMap = pFile;
+    this->nMappedBytes = nBytes;
+
+    const RawFrameHeader &H = this->Header();
+    std::string sError;
+    if (memcmp(H.Magic, RAW_FRAME_MAGIC, sizeof(RAW_FRAME_MAGIC)) != 0) sError = " is not a raw frame file";
+    else if (H.ByteOrder != RAW_FRAME_BYTE_ORDER) sError = " was written on a host of the other byte order";
+    else if (H.Version != RAW_FRAME_VERSION) sError = " has version " + std::to_string(H.Version) + " of the raw format";
+    else if (sizeof(RawFrameHeader) + H.MetadataBytes > H.HeaderBytes || H.HeaderBytes + H.PixelBytes > nBytes)
+        sError = " is truncated";
+    else if (H.PixelBytes != (uint64_t) H.Width * H.Height * sizeof(unsigned short)) sError = " has an inconsistent header";
+
+    if (!sError.empty()) {
+        std::cout << File << sError << "\n";
+        this->Close();
+        return -1;
+    }
+
+    madvise(this->pMap, this->nMappedBytes, MADV_SEQUENTIAL);
+    return 0;
+}
+
+
+void RawFrameFile::Close(void )
+{
+    if (this->pMap != NULL) munmap(this->pMap, this->nMappedBytes);
+    this->pMap = NULL;
+    this->nMappedBytes = 0;
+}
@@ -0,0 +1,91 @@
+/* *********************************************************************
+ * Raw frame files, the fast spill output of Format = raw in [output].
+ * The samples are dumped as they are in the frame buffer (native byte
+ * order, readout order, not reduced) after a fixed header, so writing
+ * a frame costs no more than the disk bandwidth. CCDDConvert turns a
+ * raw file into a standard FITS file offline.
+ *
+ * Layout of a file:
+ *   RawFrameHeader        fixed size, see below
+ *   metadata              small FITS file (no image) with the keys of the
+ *                         frame in the primary HDU and the READOUT table
+ *   padding               up to HeaderBytes, a multiple of 4096
+ *   samples               Width x Height unsigned shorts
+ * The samples start on a 4096 byte boundary so that they can be written
+ * with O_DIRECT and mapped straight from the file.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_RAWFRAME_HPP
+#define CCDDRONE_RAWFRAME_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#define RAW_FRAME_MAGIC "CCDDRAW"
+#define RAW_FRAME_VERSION 1
+#define RAW_FRAME_BYTE_ORDER 0x01020304u
+#define RAW_FRAME_ALIGN 4096
+
+
+struct RawFrameHeader{
+
+    char Magic[8];              //RAW_FRAME_MAGIC
+    uint32_t Version;
+    uint32_t ByteOrder;         //RAW_FRAME_BYTE_ORDER as the writing host stores it
+    uint64_t HeaderBytes;       //Offset of the samples
+    uint64_t MetadataBytes;     //Size of the FITS metadata after this header
+    uint64_t PixelBytes;
+
+    /*Image as it would be written to the FITS file, dCols*NDCM x dRows*/
+    int32_t Width;
+    int32_t Height;
+    int32_t dCols;
+    int32_t dRows;
+    int32_t nSkipperR;
+    int32_t Interlaced;         //1 if the U and L samples of a UL readout are still interlaced
+    char AmplifierDirection[8];
+    char Reserved[56];
+
+};
+
+static_assert(sizeof(RawFrameHeader) == 128, "The raw frame header must keep its size");
+
+
+/*<name>.fits -> <name>.raw*/
+std::string RawFrameFileName(const std::string &FitsFileName);
+
+/*Write a raw frame file. pData should be page aligned for the direct writes, otherwise the
+ *samples go through the page cache. Returns 0 on success and -1 on an error.*/
+int WriteRawFrame(const std::string &File, RawFrameHeader &Header, const std::vector<char> &Metadata,
+                  const unsigned short *pData, bool bDirectIO);
+
+
+/*Read only mapping of a raw frame file*/
+class RawFrameFile
+{
+
+private:
+    void *pMap = NULL;
+    size_t nMappedBytes = 0;
+
+public:
+    RawFrameFile() {};
+    ~RawFrameFile() { Close(); }
+    RawFrameFile(const RawFrameFile& ) = delete;
+    RawFrameFile& operator=(const RawFrameFile& ) = delete;
+
+    /*Map a file and check its header. Returns 0 on success and -1 on an error.*/
+    int Open(const std::string &File);
+    void Close(void );
+
+    const RawFrameHeader& Header(void ) const { return *(const RawFrameHeader*) pMap; }
+    const char* Metadata(void ) const { return (const char*) pMap + sizeof(RawFrameHeader); }
+    const unsigned short* Pixels(void ) const { return (const unsigned short*) ((const char*) pMap + Header().HeaderBytes); }
+
+};
+
+
+#endif //CCDDRONE_RAWFRAME_HPP
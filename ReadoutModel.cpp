@@ -0,0 +1,200 @@
+/* *********************************************************************
+ * This file contains the readout time model. See ReadoutModel.hpp for
+ * a description.
+ * *********************************************************************
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "ReadoutModel.hpp"
+#include "CCDControlDataTypes.hpp"
+
+/*Weight of a new measurement once the correction has settled*/
+#define READOUT_MODEL_MIN_WEIGHT 0.1
+
+
+int WaveformTimingCode(double time_in_us)
+{
+
+    if (time_in_us > 163) time_in_us = 163;
+
+    double fiTime_ns = time_in_us*1000;
+    int iTime_ns = (int) fiTime_ns;
+
+    int timing_bigmult, bigreminder, littlereminder,timing_littlemult;
+    int timing_dsp;
+
+    if (iTime_ns > 4000) {
+        timing_bigmult = ( iTime_ns/320 ) | 0x80;
+        timing_dsp = timing_bigmult;
+    } else {
+        //if between 640ns and 40ns, 640 is a closer match, then use that
+        bigreminder=iTime_ns % 320 > 160 ? 320-iTime_ns % 320 : iTime_ns % 320;
+        littlereminder= iTime_ns % 40 > 20 ? 40-iTime_ns % 40 : iTime_ns % 40 ;
+
+        if (bigreminder <= littlereminder ) {
+
+            timing_bigmult= (iTime_ns/320) | 0x80 ;
+            timing_dsp = timing_bigmult;
+
+        } else {
+
+            timing_littlemult= iTime_ns/40 ;
+            timing_dsp = timing_littlemult;
+
+        }
+
+    }
+
+    timing_dsp = timing_dsp<<16;
+
+    return timing_dsp;
+}
+
+
+double WaveformTimingMicros(int timing_dsp)
+{
+    int dCode = (timing_dsp >> 16) & 0xFF;
+    return (dCode & 0x80 ? 0.32 : 0.04) * (dCode & 0x7F);
+}
+
+
+static double Quantized(double time_in_us)
+{
+    return WaveformTimingMicros(WaveformTimingCode(time_in_us));
+}
+
+
+double ReadoutPrediction::Remaining(long nPixels, long nTotal) const
+{
+    if (nTotal <= 0 || nPixels >= nTotal) return 0;
+    if (nPixels < 0) nPixels = 0;
+    return this->FrameTime * (double) (nTotal - nPixels) / (double) nTotal;
+}
+
+
+ReadoutTimeModel::ReadoutTimeModel(void ) : Correction(1.0), nCalibrations(0)
+{
+}
+
+
+void ReadoutTimeModel::SetStateFile(const std::string &File)
+{
+    if (File == this->StateFile) return;
+    this->StateFile = File;
+    this->Load();
+}
+
+
+void ReadoutTimeModel::SetKey(const std::string &NewKey)
+{
+    if (NewKey == this->Key) return;
+    this->Key = NewKey;
+    this->Load();
+}
+
+
+void ReadoutTimeModel::Load(void )
+{
+
+    this->Correction = 1.0;
+    this->nCalibrations = 0;
+    if (this->StateFile.empty() || this->Key.empty()) return;
+
+    std::ifstream f(this->StateFile);
+    std::string Line;
+    while (std::getline(f, Line)) {
+        std::istringstream ss(Line);
+        std::string FileKey;
+        double dCorrection;
+        long n;
+        if (!(ss >> FileKey >> dCorrection >> n)) continue;
+        if (FileKey != this->Key || dCorrection <= 0) continue;
+        this->Correction = dCorrection;
+        this->nCalibrations = n;
+    }
+
+}
+
+
+void ReadoutTimeModel::Save(void ) const
+{
+
+    if (this->StateFile.empty() || this->Key.empty()) return;
+
+    /*Keep the corrections of the other sequencers*/
+    std::vector<std::string> Lines;
+    std::ifstream fIn(this->StateFile);
+    std::string Line;
+    while (std::getline(fIn, Line)) {
+        std::istringstream ss(Line);
+        std::string FileKey;
+        if (!(ss >> FileKey) || FileKey == this->Key) continue;
+        Lines.push_back(Line);
+    }
+    fIn.close();
+
+    std::ofstream fOut(this->StateFile, std::fstream::trunc | std::fstream::out);
+    if (!fOut.is_open()) return;
+    for (const std::string &l : Lines) fOut << l << "\n";
+    fOut << this->Key << " " << this->Correction << " " << this->nCalibrations << "\n";
+
+}
+
+
+ReadoutPrediction ReadoutTimeModel::Predict(const CCDVariables &CCD) const
+{
+
+    ReadoutPrediction P;
+
+    bool bSkipper = CCD.CCDType == "SK";
+    P.nSamples = bSkipper && CCD.nSkipperR > 0 ? CCD.nSkipperR : 1;
+    P.nAmps = CCD.AmplifierDirection == "UL" ? 2 : 1;
+
+    /*One charge measurement: pedestal, charge transfer and signal*/
+    double dSample = Quantized(CCD.PedestalIntgWait) + Quantized(CCD.IntegralTime)
+                     + Quantized(CCD.SignalIntgWait) + Quantized(CCD.IntegralTime) + CCD.SampleOverhead;
+    if (bSkipper) dSample += Quantized(CCD.SWWidth) + Quantized(CCD.SKRSTWidth);
+
+    /*The samples of a pixel, its dump and the serial shifts*/
+    double dPixel = P.nSamples * dSample + Quantized(CCD.DGWidth) + (CCD.SerialBin > 0 ? CCD.SerialBin : 1) * CCD.PixelOverhead;
+    if (bSkipper) dPixel += Quantized(CCD.OGWidth);
+
+    /*Both amplifiers of a UL readout are sampled at the same time*/
+    double dPixelsPerAmp = (double) CCD.dCols / P.nAmps;
+    double dRow = dPixelsPerAmp * dPixel + (CCD.ParallelBin > 0 ? CCD.ParallelBin : 1) * CCD.RowOverhead;
+
+    P.SampleTime = dSample * 1e-6;
+    P.PixelTime = dPixel * 1e-6;
+    P.RowTime = dRow * 1e-6;
+    P.NominalTime = P.RowTime * CCD.dRows;
+    P.Correction = this->Correction;
+    P.FrameTime = P.NominalTime * P.Correction;
+
+    return P;
+}
+
+
+double ReadoutTimeModel::Calibrate(const ReadoutPrediction &P, double MeasuredTime)
+{
+
+    if (P.NominalTime <= 0 || MeasuredTime <= 0) return 0;
+
+    double dRatio = MeasuredTime / P.NominalTime;
+    double dError = (P.FrameTime - MeasuredTime) / MeasuredTime;
+
+    /*A stalled or aborted readout says nothing about the sequencer*/
+    if (this->nCalibrations > 0 && (dRatio > 5 * this->Correction || dRatio < this->Correction / 5)) return dError;
+
+    /*Average over the first readouts, then follow slow drifts*/
+    this->nCalibrations++;
+    double dWeight = 1.0 / this->nCalibrations;
+    if (dWeight < READOUT_MODEL_MIN_WEIGHT) dWeight = READOUT_MODEL_MIN_WEIGHT;
+    this->Correction += (dRatio - this->Correction) * dWeight;
+
+    this->Save();
+    return dError;
+}
@@ -0,0 +1,86 @@
+/* *********************************************************************
+ * Model of the readout time of an image. The time of one skipper
+ * sample is worked out from the waveform widths of the [timing]
+ * section, quantized the same way the sequencer gets them, and is
+ * scaled up to a pixel, a row and the whole frame with the binning and
+ * the geometry of the readout.
+ *
+ * Parts of the sequence are not in the settings (ADC conversion, the
+ * clock edges, fast skips), so the model corrects itself with the
+ * measured readout times. The correction is kept per sequencer file in
+ * ReadoutModel.txt in the state directory.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_READOUTMODEL_HPP
+#define CCDDRONE_READOUTMODEL_HPP
+
+#include <string>
+
+struct CCDVariables;
+
+
+/*8 bit DSP timing code of a waveform width (40 ns or 320 ns units), in the upper byte as the
+ *sequencer expects it. Widths are limited to 163 us.*/
+int WaveformTimingCode(double time_in_us);
+
+/*Width in us that a timing code really gives*/
+double WaveformTimingMicros(int timing_dsp);
+
+
+struct ReadoutPrediction{
+
+    int nSamples = 1;
+    int nAmps = 1;
+
+    /*Times in seconds, without the correction*/
+    double SampleTime = 0;
+    double PixelTime = 0;
+    double RowTime = 0;
+    double NominalTime = 0;
+
+    /*Expected readout time of the frame, with the correction*/
+    double Correction = 1.0;
+    double FrameTime = 0;
+
+    /*Expected time of one row and of the rest of a readout with nPixels of nTotal pixels read*/
+    double CorrectedRowTime(void ) const { return RowTime * Correction; }
+    double Remaining(long nPixels, long nTotal) const;
+
+};
+
+
+class ReadoutTimeModel
+{
+
+private:
+    std::string StateFile;
+    std::string Key;
+    double Correction;
+    long nCalibrations;
+
+    void Load(void );
+    void Save(void ) const;
+
+public:
+    ReadoutTimeModel(void );
+
+    /*Where the corrections are kept, an empty name keeps them in memory only*/
+    void SetStateFile(const std::string &);
+
+    /*Correction to use, usually the digest of the sequencer file. Changing the key loads its correction.*/
+    void SetKey(const std::string &);
+
+    ReadoutPrediction Predict(const CCDVariables &) const;
+
+    /*Fold the measured readout time (s) of a predicted readout into the correction.
+     *Returns the relative error of the prediction.*/
+    double Calibrate(const ReadoutPrediction &, double MeasuredTime);
+
+    double CorrectionFactor(void ) const { return this->Correction; }
+    long Calibrations(void ) const { return this->nCalibrations; }
+
+};
+
+
+#endif //CCDDRONE_READOUTMODEL_HPP
@@ -0,0 +1,83 @@
+/* *********************************************************************
+ * This file contains the readout telemetry ring and the statistics that
+ * are derived from it. See ReadoutTelemetry.hpp.
+ * *********************************************************************
+ */
+
+#include "ReadoutTelemetry.hpp"
+
+
+void ReadoutTelemetry::Reset(size_t Capacity)
+{
+
+    if (this->Ring.size() != Capacity) {
+        this->Ring.assign(Capacity, TelemetrySample());
+        this->Ring.shrink_to_fit();
+    }
+    this->nNext = 0;
+    this->nRecorded = 0;
+
+}
+
+
+void ReadoutTelemetry::CopySamples(std::vector<TelemetrySample> &Samples) const
+{
+
+    Samples.clear();
+    if (this->Ring.empty()) return;
+
+    size_t n = this->nRecorded < (long) this->Ring.size() ? (size_t) this->nRecorded : this->Ring.size();
+    size_t First = this->nRecorded < (long) this->Ring.size() ? 0 : this->nNext;
+    Samples.reserve(n);
+    for (size_t i = 0; i < n; i++) Samples.push_back(this->Ring[(First + i) % this->Ring.size()]);
+
+}
+
+
+/*The rates are taken between samples at least RateWindow seconds apart, so that the pixel count
+ *granularity of the controller (it updates in blocks) does not show up as rate spikes*/
+TelemetrySummary ReadoutTelemetry::Summarize(const std::vector<TelemetrySample> &Samples, long nDropped,
+                                             double RateWindow, double StallEventMs)
+{
+
+    TelemetrySummary S;
+    S.nSamples = (long) Samples.size();
+    S.nDropped = nDropped;
+    if (Samples.size() < 2) return S;
+
+    const TelemetrySample &First = Samples.front();
+    const TelemetrySample &Last = Samples.back();
+    if (Last.Time > First.Time) S.MeanRate = (Last.PixelCount - First.PixelCount) / (Last.Time - First.Time);
+
+    bool bHaveRate = false;
+    size_t w = 0;
+    size_t StallStart = 0;
+    for (size_t i = 1; i < Samples.size(); i++) {
+
+        /*Rates over the window ending at sample i*/
+        while (w + 1 < i && Samples[i].Time - Samples[w+1].Time >= RateWindow) w++;
+        double dt = Samples[i].Time - Samples[w].Time;
+        if (dt >= RateWindow && dt > 0) {
+            double Rate = (Samples[i].PixelCount - Samples[w].PixelCount) / dt;
+            if (!bHaveRate || Rate < S.MinRate) S.MinRate = Rate;
+            if (!bHaveRate || Rate > S.MaxRate) S.MaxRate = Rate;
+            bHaveRate = true;
+        }
+
+        /*The count stood still from sample StallStart up to at least sample i-1*/
+        bool bMoved = Samples[i].PixelCount != Samples[StallStart].PixelCount;
+        if (bMoved || i + 1 == Samples.size()) {
+            size_t StallEnd = bMoved ? i - 1 : i;
+            double StallMs = (Samples[StallEnd].Time - Samples[StallStart].Time) * 1000.0;
+            if (StallMs > StallEventMs) {
+                S.nStalls++;
+                S.StallTime += StallMs;
+                if (StallMs > S.LongestStall) S.LongestStall = StallMs;
+            }
+            StallStart = i;
+        }
+    }
+
+    return S;
+
+}
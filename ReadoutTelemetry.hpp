@@ -0,0 +1,72 @@
+/* *********************************************************************
+ * Time series of the pixel count during a readout. ExposeCCD records a
+ * sample at every poll into a ring that is allocated before the
+ * exposure, so nothing is allocated in the poll loop. If the ring fills
+ * up, the oldest samples are overwritten and counted as dropped.
+ * The series is written to the FITS file as the READOUT binary table,
+ * together with the pixel rate statistics and the stalls seen in it.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_READOUTTELEMETRY_HPP
+#define CCDDRONE_READOUTTELEMETRY_HPP
+
+#include <vector>
+#include <cstddef>
+
+
+struct TelemetrySample{
+    double Time = 0;        //Seconds since the start of the readout
+    int PixelCount = 0;
+};
+
+
+/*What can be derived from the series*/
+struct TelemetrySummary{
+    long nSamples = 0;
+    long nDropped = 0;
+    double MeanRate = 0;        //Pixels/s over the whole readout
+    double MinRate = 0;         //Lowest and highest rate between two samples that are at least
+    double MaxRate = 0;         //RateWindow apart
+    int nStalls = 0;            //Times the pixel count did not move for longer than StallEventMs
+    double LongestStall = 0;    //ms
+    double StallTime = 0;       //ms in stalls in total
+};
+
+
+class ReadoutTelemetry
+{
+
+private:
+
+    std::vector<TelemetrySample> Ring;
+    size_t nNext = 0;
+    long nRecorded = 0;
+
+public:
+
+    ReadoutTelemetry() {};
+
+    /*Allocate the ring. 0 turns the telemetry off.*/
+    void Reset(size_t Capacity);
+    bool Enabled(void ) const { return !Ring.empty(); }
+
+    void Record(double Time, int PixelCount) {
+        if (Ring.empty()) return;
+        Ring[nNext].Time = Time;
+        Ring[nNext].PixelCount = PixelCount;
+        nNext = (nNext + 1 == Ring.size()) ? 0 : nNext + 1;
+        nRecorded++;
+    }
+
+    /*The samples that are in the ring, oldest first*/
+    void CopySamples(std::vector<TelemetrySample> &Samples) const;
+    long Dropped(void ) const { return nRecorded > (long) Ring.size() ? nRecorded - (long) Ring.size() : 0; }
+
+    static TelemetrySummary Summarize(const std::vector<TelemetrySample> &Samples, long nDropped,
+                                      double RateWindow, double StallEventMs);
+
+};
+
+
+#endif //CCDDRONE_READOUTTELEMETRY_HPP
@@ -0,0 +1,327 @@
+/* *********************************************************************
+ * This file contains the worker pool and the dedicated acquisition
+ * thread. See Scheduler.hpp.
+ * *********************************************************************
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "Scheduler.hpp"
+
+/*Index of the worker the calling thread is, -1 if it is not one*/
+static thread_local int tlsWorkerIndex = -1;
+static thread_local WorkerPool *tlsWorkerPool = NULL;
+
+static std::mutex SharedPoolMutex;
+static std::shared_ptr<WorkerPool> SharedPool;
+
+
+std::vector<int> ParseCPUList(const std::string &List)
+{
+
+    std::vector<int> CPUs;
+    size_t p = 0;
+    while (p < List.size()) {
+        size_t q = List.find(',', p);
+        if (q == std::string::npos) q = List.size();
+        std::string Item = List.substr(p, q - p);
+        p = q + 1;
+
+        int dFirst, dLast;
+        if (sscanf(Item.c_str(), "%d-%d", &dFirst, &dLast) == 2) ;
+        else if (sscanf(Item.c_str(), "%d", &dFirst) == 1) dLast = dFirst;
+        else continue;
+        for (int c = dFirst; c <= dLast && c >= 0; c++) CPUs.push_back(c);
+    }
+    return CPUs;
+
+}
+
+
+int PinCurrentThread(const std::vector<int> &CPUs)
+{
+
+    cpu_set_t Set;
+    CPU_ZERO(&Set);
+    if (CPUs.empty()) {
+        int nCPUs = (int) std::thread::hardware_concurrency();
+        for (int c = 0; c < nCPUs && c < CPU_SETSIZE; c++) CPU_SET(c, &Set);
+    }
+    for (int c : CPUs) if (c < CPU_SETSIZE) CPU_SET(c, &Set);
+
+    int dErr = pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set);
+    if (dErr != 0) std::cout << "Warning: could not pin a thread to its CPUs: " << strerror(dErr) << "\n";
+    return dErr == 0 ? 0 : -1;
+
+}
+
+
+int SetCurrentThreadPriority(int Priority)
+{
+
+    struct sched_param Param;
+    memset(&Param, 0, sizeof(Param));
+    Param.sched_priority = Priority > 0 ? Priority : 0;
+
+    int dErr = pthread_setschedparam(pthread_self(), Priority > 0 ? SCHED_FIFO : SCHED_OTHER, &Param);
+    if (dErr != 0) std::cout << "Warning: could not set the priority of a thread to " << Priority << ": " << strerror(dErr)
+                             << (dErr == EPERM ? " (needs CAP_SYS_NICE or an rtprio limit)" : "") << "\n";
+    return dErr == 0 ? 0 : -1;
+
+}
+
+
+WorkerPool::WorkerPool(int nThreads, const std::vector<int> &CPUList) : nQueued(0), NextQueue(0)
+{
+
+    this->CPUs = CPUList;
+    if (nThreads < 1) nThreads = 1;
+
+    for (int i = 0; i < nThreads; i++) this->Queues.emplace_back(new TaskQueue);
+    for (int i = 0; i < nThreads; i++) this->Workers.push_back(std::thread(&WorkerPool::WorkerLoop, this, i));
+
+}
+
+
+WorkerPool::~WorkerPool()
+{
+
+    {
+        std::lock_guard<std::mutex> lock(this->WakeMutex);
+        this->bStop = true;
+    }
+    this->Wake.notify_all();
+    for (std::thread &t : this->Workers)
+        if (t.joinable()) t.join();
+
+}
+
+
+void WorkerPool::Submit(std::function<void(void )> Task)
+{
+
+    int dQueue = tlsWorkerPool == this ? tlsWorkerIndex : (int) (this->NextQueue++ % this->Queues.size());
+    {
+        std::lock_guard<std::mutex> lock(this->Queues[dQueue]->mtx);
+        this->Queues[dQueue]->Tasks.push_back(std::move(Task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->WakeMutex);
+        this->nQueued++;
+    }
+    this->Wake.notify_one();
+
+}
+
+
+/*Own queue from the back, the others from the front. Self is -1 for a thread that is not a worker.*/
+bool WorkerPool::RunOneTask(int Self)
+{
+
+    std::function<void(void )> Task;
+    int nQueues = (int) this->Queues.size();
+
+    if (Self >= 0) {
+        std::lock_guard<std::mutex> lock(this->Queues[Self]->mtx);
+        if (!this->Queues[Self]->Tasks.empty()) {
+            Task = std::move(this->Queues[Self]->Tasks.back());
+            this->Queues[Self]->Tasks.pop_back();
+        }
+    }
+    for (int i = 1; !Task && i <= nQueues; i++) {
+        int q = ((Self >= 0 ? Self : 0) + i) % nQueues;
+        std::lock_guard<std::mutex> lock(this->Queues[q]->mtx);
+        if (!this->Queues[q]->Tasks.empty()) {
+            Task = std::move(this->Queues[q]->Tasks.front());
+            this->Queues[q]->Tasks.pop_front();
+        }
+    }
+    if (!Task) return false;
+
+    this->nQueued--;
+    try {
+        Task();
+    } catch (std::exception &e) {
+        std::cerr << "A pipeline task failed: " << e.what() << "\n";
+    } catch (...) {
+        std::cerr << "A pipeline task failed.\n";
+    }
+    return true;
+
+}
+
+
+void WorkerPool::WorkerLoop(int Index)
+{
+
+    tlsWorkerIndex = Index;
+    tlsWorkerPool = this;
+    if (!this->CPUs.empty()) PinCurrentThread(this->CPUs);
+
+    while (true) {
+        if (this->RunOneTask(Index)) continue;
+
+        std::unique_lock<std::mutex> lock(this->WakeMutex);
+        this->Wake.wait(lock, [this]{ return this->bStop || this->nQueued > 0; });
+        if (this->bStop && this->nQueued == 0) return;
+    }
+
+}
+
+
+void WorkerPool::ParallelFor(int nRows, int nBlocks, const std::function<void(int, int)> &Func)
+{
+
+    if (nBlocks <= 0) nBlocks = this->Size();
+    if (nBlocks > nRows) nBlocks = nRows;
+    if (nBlocks <= 1) {
+        if (nRows > 0) Func(0, nRows);
+        return;
+    }
+
+    struct Group{
+        std::mutex mtx;
+        std::condition_variable Done;
+        int nLeft;
+        std::exception_ptr Error;
+    };
+    std::shared_ptr<Group> G = std::make_shared<Group>();
+
+    int dBlock = (nRows + nBlocks - 1) / nBlocks;
+    G->nLeft = (nRows + dBlock - 1) / dBlock;
+    for (int dFirst = 0; dFirst < nRows; dFirst += dBlock) {
+        int dEnd = dFirst + dBlock < nRows ? dFirst + dBlock : nRows;
+        this->Submit([G, &Func, dFirst, dEnd]() {
+            /*Counted as done even if Func throws, or the caller would wait forever. The first
+             *exception is thrown again by the caller.*/
+            struct Finish {
+                Group &g;
+                ~Finish() { std::lock_guard<std::mutex> lock(g.mtx); if (--g.nLeft == 0) g.Done.notify_all(); }
+            } Finished{ *G };
+            try {
+                Func(dFirst, dEnd);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(G->mtx);
+                if (!G->Error) G->Error = std::current_exception();
+            }
+        });
+    }
+
+    /*Help with the queued tasks; once none is left to take, the rest are running elsewhere*/
+    int Self = tlsWorkerPool == this ? tlsWorkerIndex : -1;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(G->mtx);
+            if (G->nLeft == 0) break;
+        }
+        if (!this->RunOneTask(Self)) break;
+    }
+    std::unique_lock<std::mutex> lock(G->mtx);
+    G->Done.wait(lock, [&G]{ return G->nLeft == 0; });
+
+    /*A block that failed leaves its rows undone*/
+    if (G->Error) std::rethrow_exception(G->Error);
+
+}
+
+
+std::shared_ptr<WorkerPool> WorkerPool::Shared(void )
+{
+    std::lock_guard<std::mutex> lock(SharedPoolMutex);
+    return SharedPool;
+}
+
+
+void WorkerPool::ConfigureShared(int nThreads, const std::vector<int> &CPUs)
+{
+
+    std::lock_guard<std::mutex> lock(SharedPoolMutex);
+    if (nThreads <= 0) {
+        SharedPool.reset();
+        return;
+    }
+    if (SharedPool && SharedPool->Size() == nThreads && SharedPool->CPUList() == CPUs) return;
+
+    /*Users of the old pool keep it until they are done with it*/
+    SharedPool = std::make_shared<WorkerPool>(nThreads, CPUs);
+
+}
+
+
+DedicatedThread::DedicatedThread(const std::vector<int> &CPUList, int dPriority)
+{
+
+    this->CPUs = CPUList;
+    this->Priority = dPriority;
+    this->Worker = std::thread(&DedicatedThread::Loop, this);
+
+}
+
+
+DedicatedThread::~DedicatedThread()
+{
+
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->bStop = true;
+    }
+    this->Changed.notify_all();
+    if (this->Worker.joinable()) this->Worker.join();
+
+}
+
+
+void DedicatedThread::Loop(void )
+{
+
+    if (!this->CPUs.empty()) PinCurrentThread(this->CPUs);
+    if (this->Priority > 0) SetCurrentThreadPriority(this->Priority);
+
+    std::unique_lock<std::mutex> lock(this->mtx);
+    while (true) {
+        this->Changed.wait(lock, [this]{ return this->bStop || this->nFinished < this->nSubmitted; });
+        if (this->bStop) return;
+
+        std::function<void(void )> ThisJob = std::move(this->Job);
+        lock.unlock();
+        std::exception_ptr Error;
+        try {
+            ThisJob();
+        } catch (...) {
+            Error = std::current_exception();
+        }
+        lock.lock();
+
+        this->JobError = Error;
+        this->nFinished++;
+        this->Changed.notify_all();
+    }
+
+}
+
+
+void DedicatedThread::Run(std::function<void(void )> NewJob)
+{
+
+    /*One job at a time, the ticket tells this caller when its own is done*/
+    std::unique_lock<std::mutex> lock(this->mtx);
+    this->Changed.wait(lock, [this]{ return this->nFinished == this->nSubmitted; });
+    this->Job = std::move(NewJob);
+    this->JobError = nullptr;
+    unsigned long Ticket = ++this->nSubmitted;
+    this->Changed.notify_all();
+
+    this->Changed.wait(lock, [this, Ticket]{ return this->nFinished >= Ticket; });
+    std::exception_ptr Error = this->JobError;
+    this->JobError = nullptr;
+    lock.unlock();
+
+    if (Error) std::rethrow_exception(Error);
+
+}
@@ -0,0 +1,123 @@
+/* *********************************************************************
+ * Scheduling of the acquisition pipeline. Two parts:
+ *
+ * WorkerPool is a bounded pool of threads with one task queue each.
+ * A worker takes its own tasks from the back of its queue and steals
+ * from the front of the others when it runs out. ParallelForRows runs
+ * its row blocks on the shared pool once WorkerThreads is set in the
+ * [acquisition] section, so the de-interlace, the NDCM reduction and
+ * the packing of all the frame writers together never use more than
+ * that many threads, on the CPUs of WorkerCPUs.
+ *
+ * DedicatedThread is a single long lived thread that runs what it is
+ * given while the caller waits. The controller polls from one of these
+ * (AcquisitionThread = true), pinned to AcquisitionCPUs and with a real
+ * time priority if asked, so that the polls keep their timing however
+ * busy the rest of the host is.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_SCHEDULER_HPP
+#define CCDDRONE_SCHEDULER_HPP
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+
+/*"2-5,7" -> {2,3,4,5,7}. An empty list means any CPU.*/
+std::vector<int> ParseCPUList(const std::string& );
+
+/*Restrict the calling thread to the CPUs, all of them if the list is empty. Returns 0 on success.*/
+int PinCurrentThread(const std::vector<int>& );
+
+/*SCHED_FIFO with the given priority (1-99), or normal scheduling for 0. Returns 0 on success.*/
+int SetCurrentThreadPriority(int );
+
+
+class WorkerPool
+{
+
+private:
+    struct TaskQueue{
+        std::mutex mtx;
+        std::deque< std::function<void(void )> > Tasks;
+    };
+    std::vector< std::unique_ptr<TaskQueue> > Queues;
+    std::vector<std::thread> Workers;
+    std::vector<int> CPUs;
+
+    std::mutex WakeMutex;
+    std::condition_variable Wake;
+    std::atomic<int> nQueued;
+    std::atomic<unsigned> NextQueue;
+    bool bStop = false;
+
+    void WorkerLoop(int );
+    bool RunOneTask(int );
+
+public:
+    WorkerPool(int nThreads, const std::vector<int> &CPUs);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool& ) = delete;
+    WorkerPool& operator=(const WorkerPool& ) = delete;
+
+    int Size(void ) const { return (int) Workers.size(); }
+    const std::vector<int>& CPUList(void ) const { return CPUs; }
+
+    /*Queue a task. From a worker it goes on the queue of that worker.*/
+    void Submit(std::function<void(void )> );
+
+    /*Run Func(firstRow, endRow) over nBlocks blocks of [0, nRows) and wait for all of them. The
+     *caller works on the tasks while it waits, so this can be called from a task too. If a block
+     *throws, the first exception is thrown again here once all the blocks are done.*/
+    void ParallelFor(int nRows, int nBlocks, const std::function<void(int, int)> &Func);
+
+    /*The pool ParallelForRows uses, NULL if there is none. Configure replaces it if the settings
+     *changed, nThreads <= 0 removes it.*/
+    static std::shared_ptr<WorkerPool> Shared(void );
+    static void ConfigureShared(int nThreads, const std::vector<int> &CPUs);
+
+};
+
+
+class DedicatedThread
+{
+
+private:
+    std::thread Worker;
+    std::mutex mtx;
+    std::condition_variable Changed;
+    std::function<void(void )> Job;
+    std::exception_ptr JobError;
+    unsigned long nSubmitted = 0;
+    unsigned long nFinished = 0;
+    bool bStop = false;
+
+    std::vector<int> CPUs;
+    int Priority;
+
+    void Loop(void );
+
+public:
+    DedicatedThread(const std::vector<int> &CPUs, int Priority);
+    ~DedicatedThread();
+    DedicatedThread(const DedicatedThread& ) = delete;
+    DedicatedThread& operator=(const DedicatedThread& ) = delete;
+
+    /*Run Job on the thread and wait for it. An exception of the job is thrown again here.*/
+    void Run(std::function<void(void )> Job);
+
+    bool SameSettings(const std::vector<int> &OtherCPUs, int OtherPriority) const { return CPUs == OtherCPUs && Priority == OtherPriority; }
+
+};
+
+
+#endif //CCDDRONE_SCHEDULER_HPP
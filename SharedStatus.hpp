@@ -0,0 +1,140 @@
+/* *********************************************************************
+ * Layout of the shared memory segment in which CCDDrone publishes the
+ * state of the exposure and the last frame, for slow control and quick
+ * look programs. The segment is written by the acquisition thread only.
+ * Every part of it is guarded by a sequence counter (a seqlock): the
+ * writer makes the counter odd, writes, and makes it even again. A
+ * reader takes the counter, reads, and checks that the counter has not
+ * changed; if it has, it reads again. Readers never block the writer.
+ *
+ * The frame is published in two slots that are used in turn. A monitor
+ * can work on a slot in place (zero copy), and afterwards check with
+ * SlotStillValid() that it was not overwritten in the mean time.
+ *
+ * This header has no dependencies, so that monitors can include it on
+ * its own. See StatusPublisher.hpp for the writer side.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_SHAREDSTATUS_HPP
+#define CCDDRONE_SHAREDSTATUS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#define CCDD_SHM_MAGIC 0x43434444   //'CCDD'
+#define CCDD_SHM_VERSION 2
+
+
+enum SharedExposureState : int32_t {
+    SHM_IDLE = 0,
+    SHM_EXPOSING = 1,
+    SHM_READOUT = 2,
+    SHM_FAILED = 3
+};
+
+
+/*Quick look statistics of the raw samples of one amplifier so far, see QuickLook.hpp*/
+struct SharedAmpStats{
+    int64_t nSamples;
+    double Mean;                //ADU
+    double RMS;                 //ADU
+    int64_t Saturated;
+};
+
+
+/*The state of the exposure. Copied out as a whole by the readers.*/
+struct SharedStatus{
+    int32_t State;
+    int32_t DeviceIndex;
+    double ExposureTime;        //s
+    double RemainingTime;       //s, from the last RET
+    int64_t PixelCount;
+    int64_t TotalPixels;
+    int64_t FramesCompleted;
+    double UpdateTime;          //Unix time of the last update (s)
+    int32_t nAmps;              //Amplifiers with quick look statistics, 0 if the quick look is off
+    SharedAmpStats Amps[2];     //U, L (or the one amplifier used)
+};
+
+
+/*Description of a published frame*/
+struct SharedFrameInfo{
+    int64_t FrameNumber;        //Counts up from 1, 0 = no frame in this slot yet
+    int32_t Rows;
+    int32_t Cols;               //Columns of the raw image, i.e. pixels x NDCM
+    int32_t NDCM;
+    int32_t Interlaced;         //1 if the two amplifier halves are still interlaced
+    double Timestamp;           //Unix time at the end of the readout (s)
+    uint64_t Bytes;
+    uint64_t Offset;            //Of the pixel data from the start of the segment
+};
+
+
+struct SharedFrameSlot{
+    std::atomic<uint64_t> Seq;
+    SharedFrameInfo Info;
+};
+
+
+struct SharedStatusHeader{
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t SlotCapacity;      //Bytes of pixel data per slot
+
+    std::atomic<uint64_t> StatusSeq;
+    SharedStatus Status;
+
+    /*Which slot has the newest frame*/
+    std::atomic<int32_t> LatestSlot;
+    SharedFrameSlot Slots[2];
+};
+
+
+/*Bytes of the whole segment for a given slot size. The pixel data of slot i is at
+ *SharedSlotOffset(Capacity, i).*/
+inline uint64_t SharedSlotOffset(uint64_t SlotCapacity, int Slot)
+{
+    uint64_t HeaderBytes = (sizeof(SharedStatusHeader) + 4095) & ~(uint64_t) 4095;
+    return HeaderBytes + (uint64_t) Slot * ((SlotCapacity + 4095) & ~(uint64_t) 4095);
+}
+
+inline uint64_t SharedSegmentSize(uint64_t SlotCapacity)
+{
+    return SharedSlotOffset(SlotCapacity, 2);
+}
+
+
+/*Reader side: copy the status out. Returns false if the writer was busy, then try again.*/
+inline bool ReadSharedStatus(const SharedStatusHeader *pHeader, SharedStatus &Status)
+{
+    uint64_t s1 = pHeader->StatusSeq.load(std::memory_order_acquire);
+    if (s1 & 1) return false;
+    std::memcpy(&Status, (const void*) &pHeader->Status, sizeof(SharedStatus));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return pHeader->StatusSeq.load(std::memory_order_relaxed) == s1;
+}
+
+/*Reader side: the description of the newest frame, and the sequence number of its slot to
+ *check against later. Returns false if the slot is being written.*/
+inline bool ReadLatestFrame(const SharedStatusHeader *pHeader, SharedFrameInfo &Info, int &Slot, uint64_t &Seq)
+{
+    Slot = pHeader->LatestSlot.load(std::memory_order_acquire);
+    if (Slot < 0 || Slot > 1) return false;
+    Seq = pHeader->Slots[Slot].Seq.load(std::memory_order_acquire);
+    if (Seq & 1) return false;
+    std::memcpy(&Info, (const void*) &pHeader->Slots[Slot].Info, sizeof(SharedFrameInfo));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return pHeader->Slots[Slot].Seq.load(std::memory_order_relaxed) == Seq && Info.FrameNumber > 0;
+}
+
+/*Reader side: true if the pixels of the slot are still the frame that was read with Seq*/
+inline bool SlotStillValid(const SharedStatusHeader *pHeader, int Slot, uint64_t Seq)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return pHeader->Slots[Slot].Seq.load(std::memory_order_relaxed) == Seq;
+}
+
+
+#endif //CCDDRONE_SHAREDSTATUS_HPP
@@ -0,0 +1,276 @@
+/* *********************************************************************
+ * This file contains the simulated ARC device. See SimulatedArcDevice.hpp.
+ * *********************************************************************
+ */
+
+#include <iostream>
+#include <cmath>
+#include <thread>
+#include <stdexcept>
+
+#include <sys/mman.h>
+
+#include "SimulatedArcDevice.hpp"
+#include "ArcDefs.h"
+
+
+/*Shape of the simulated skipper data, in ADU*/
+#define SIM_PEDESTAL 10000
+#define SIM_ADU_PER_E 10
+#define SIM_READ_NOISE 15
+#define SIM_NOISE_TABLE 65536
+
+/*Super-sequencer commands that change the layout of the image, see LeachController.hpp*/
+#define SIM_STC 0x00535443
+#define SIM_DRXN_LU 0x5F4C55
+
+
+
+SimulatedArcDevice::SimulatedArcDevice(double PixelRate, size_t MaxCommonBufferBytes, int CommandLatencyUs)
+{
+
+    this->PixelRate = PixelRate;
+    this->MaxCommonBufferBytes = MaxCommonBufferBytes;
+    this->CommandLatencyUs = CommandLatencyUs;
+
+    this->bOpen = false;
+    this->bSyntheticMode = false;
+    this->dRows = 0;
+    this->dCols = 0;
+    this->dExpTimeMs = 0;
+
+    this->bExposing = false;
+    this->dTotalCols = 0;
+    this->dPixelsToRead = 0;
+    this->dPixelsFilled = 0;
+    this->bInterlaced = false;
+    this->dCharge[0] = this->dCharge[1] = 0;
+    this->RandState = 0x12345678;
+
+    this->m_tImgBuffer.pUserAddr = NULL;
+    this->m_tImgBuffer.ulPhysicalAddr = 0;
+    this->m_tImgBuffer.dSize = 0;
+
+    /*Gaussian read noise, drawn once so that filling the buffer stays cheap*/
+    this->NoiseTable.resize(SIM_NOISE_TABLE);
+    for (int i = 0; i < SIM_NOISE_TABLE; i += 2) {
+        double u1 = (this->NextRandom() + 1.0) / 4294967297.0;
+        double u2 = (this->NextRandom() + 1.0) / 4294967297.0;
+        double r = SIM_READ_NOISE * std::sqrt(-2.0 * std::log(u1));
+        this->NoiseTable[i] = (unsigned short) std::lround(SIM_PEDESTAL + r * std::cos(2 * M_PI * u2));
+        this->NoiseTable[i+1] = (unsigned short) std::lround(SIM_PEDESTAL + r * std::sin(2 * M_PI * u2));
+    }
+
+}
+
+SimulatedArcDevice::~SimulatedArcDevice()
+{
+    this->UnMapCommonBuffer();
+}
+
+
+uint32_t SimulatedArcDevice::NextRandom(void )
+{
+    /*xorshift32*/
+    uint32_t x = this->RandState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    this->RandState = x;
+    return x;
+}
+
+
+void SimulatedArcDevice::Open(int dDeviceNumber)
+{
+    this->Open(dDeviceNumber, (size_t) 0);
+}
+
+void SimulatedArcDevice::Open(int , size_t dBytes)
+{
+    this->bOpen = true;
+    this->MapCommonBuffer(dBytes);
+}
+
+void SimulatedArcDevice::Open(int dDeviceNumber, int dRows, int dCols)
+{
+    this->Open(dDeviceNumber, (size_t) dRows * dCols * sizeof(unsigned short));
+}
+
+void SimulatedArcDevice::Close(void )
+{
+    this->UnMapCommonBuffer();
+    this->bOpen = false;
+}
+
+
+/*The buffer is an anonymous mapping, so only the pages that are written use memory*/
+void SimulatedArcDevice::MapCommonBuffer(size_t dBytes)
+{
+
+    if (dBytes == 0 || dBytes > this->MaxCommonBufferBytes) dBytes = this->MaxCommonBufferBytes;
+    if (this->m_tImgBuffer.pUserAddr != NULL && this->m_tImgBuffer.dSize == dBytes) return;
+
+    this->UnMapCommonBuffer();
+    void *pMap = mmap(NULL, dBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pMap == MAP_FAILED) throw std::runtime_error("Failed to map the simulated common buffer!");
+
+    this->m_tImgBuffer.pUserAddr = pMap;
+    this->m_tImgBuffer.dSize = dBytes;
+
+}
+
+void SimulatedArcDevice::UnMapCommonBuffer(void )
+{
+
+    if (this->m_tImgBuffer.pUserAddr != NULL) munmap(this->m_tImgBuffer.pUserAddr, this->m_tImgBuffer.dSize);
+    this->m_tImgBuffer.pUserAddr = NULL;
+    this->m_tImgBuffer.dSize = 0;
+
+}
+
+/*Like the kernel buffer, the mapping can not grow past its maximum size*/
+void SimulatedArcDevice::ReMapCommonBuffer(size_t dBytes)
+{
+    this->MapCommonBuffer(dBytes);
+}
+
+
+int SimulatedArcDevice::Command(int , int dCommand, int dArg1, int , int , int )
+{
+
+    if (this->CommandLatencyUs > 0) std::this_thread::sleep_for(std::chrono::microseconds(this->CommandLatencyUs));
+    if (!this->bOpen) return TOUT;
+
+    switch (dCommand) {
+
+        case TDL:
+            return dArg1;
+
+        case SET:
+            this->dExpTimeMs = dArg1;
+            return DON;
+
+        case SEX:
+            this->bExposing = true;
+            this->ExpStart = Clock::now();
+            this->dPixelsToRead = this->dRows * (this->dTotalCols > 0 ? this->dTotalCols : this->dCols);
+            this->dPixelsFilled = 0;
+            return DON;
+
+        case RET: {
+            if (!this->bExposing) return 0;
+            int dElapsed = (int) std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - this->ExpStart).count();
+            return dElapsed >= this->dExpTimeMs ? ROUT : dElapsed;
+        }
+
+        case SIM_STC:
+            this->dTotalCols = dArg1;
+            return DON;
+
+        case SOS:
+            this->bInterlaced = (dArg1 == SIM_DRXN_LU);
+            return DON;
+
+        case ABR:
+        case STP:
+            this->bExposing = false;
+            return DON;
+
+        default:
+            return DON;
+    }
+
+}
+
+
+void SimulatedArcDevice::ResetController(void )
+{
+    this->bExposing = false;
+    this->bSyntheticMode = false;
+}
+
+
+void SimulatedArcDevice::LoadControllerFile(const std::string sFilename, bool , const bool& )
+{
+    std::cout << "Simulated device: not loading " << sFilename << "\n";
+}
+
+
+void SimulatedArcDevice::SetImageSize(int dRows, int dCols)
+{
+    this->dRows = dRows;
+    this->dCols = dCols;
+    this->dTotalCols = 0;
+}
+
+
+void SimulatedArcDevice::StopExposure(void )
+{
+    this->bExposing = false;
+}
+
+
+bool SimulatedArcDevice::IsReadout(void )
+{
+
+    if (!this->bExposing) return false;
+    int dElapsed = (int) std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - this->ExpStart).count();
+    return dElapsed >= this->dExpTimeMs;
+
+}
+
+
+int SimulatedArcDevice::GetPixelCount(void )
+{
+
+    if (!this->bExposing) return this->dPixelsFilled;
+
+    double dElapsed = std::chrono::duration<double>(Clock::now() - this->ExpStart).count() - this->dExpTimeMs / 1000.0;
+    if (dElapsed <= 0) return 0;
+
+    double dPixels = dElapsed * this->PixelRate;
+    int dCount = dPixels >= this->dPixelsToRead ? this->dPixelsToRead : (int) dPixels;
+
+    this->FillPixels(dCount);
+    if (dCount >= this->dPixelsToRead) this->bExposing = false;
+
+    return dCount;
+
+}
+
+
+/*Write the pixels that the simulated readout has reached since the last call*/
+void SimulatedArcDevice::FillPixels(int dUpTo)
+{
+
+    size_t nBufPixels = this->m_tImgBuffer.dSize / sizeof(unsigned short);
+    if ((size_t) dUpTo > nBufPixels) dUpTo = (int) nBufPixels;
+
+    unsigned short *pBuf = (unsigned short *) this->m_tImgBuffer.pUserAddr;
+    int N = (this->dTotalCols > 0 && this->dCols > 0) ? this->dTotalCols / this->dCols : 1;
+    if (N < 1) N = 1;
+
+    for (int i = this->dPixelsFilled; i < dUpTo; i++) {
+
+        if (this->bSyntheticMode) {
+            pBuf[i] = (unsigned short) (i & 0xFFFF);
+            continue;
+        }
+
+        /*All the samples of a pixel see the same charge. With two amplifiers the
+         *samples of U and L alternate, so the pixel index is taken from every other word.*/
+        int dAmp = this->bInterlaced ? (i & 1) : 0;
+        int dWord = this->bInterlaced ? (i >> 1) : i;
+        if (dWord % N == 0) {
+            /*About one pixel in 256 has some charge*/
+            uint32_t r = this->NextRandom();
+            this->dCharge[dAmp] = ((r & 0xFF) == 0) ? (int) ((r >> 8) % 20) : 0;
+        }
+
+        pBuf[i] = (unsigned short) (this->NoiseTable[this->NextRandom() & (SIM_NOISE_TABLE - 1)] + this->dCharge[dAmp] * SIM_ADU_PER_E);
+    }
+
+    this->dPixelsFilled = dUpTo;
+
+}
@@ -0,0 +1,112 @@
+/* *********************************************************************
+ * A simulated ARC device that needs no hardware. It answers the
+ * controller commands used by CCDDrone with DON, runs the exposure
+ * timer on the host clock and fills the common buffer at a fixed pixel
+ * rate during readout, so IsReadout and GetPixelCount behave like a
+ * real readout. The pixels look like skipper data: a pedestal, a
+ * charge per pixel that is the same for all its samples, and read
+ * noise per sample. In synthetic image mode the pixels are a ramp, as
+ * the real controller does.
+ * This is meant for profiling and testing the host side of CCDDrone.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_SIMULATEDARCDEVICE_HPP
+#define CCDDRONE_SIMULATEDARCDEVICE_HPP
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include "CArcDevice.h"
+#include "ArcDefs.h"
+
+
+class SimulatedArcDevice : public arc::device::CArcDevice
+{
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    double PixelRate;
+    size_t MaxCommonBufferBytes;
+    int CommandLatencyUs;
+
+    bool bOpen;
+    bool bSyntheticMode;
+    int dRows, dCols;
+    int dExpTimeMs;
+
+    /*Readout state*/
+    bool bExposing;
+    Clock::time_point ExpStart;
+    int dTotalCols;
+    int dPixelsToRead;
+    int dPixelsFilled;
+    bool bInterlaced;
+    int dCharge[2];
+    uint32_t RandState;
+    std::vector<unsigned short> NoiseTable;
+
+    void FillPixels(int dUpTo);
+    uint32_t NextRandom(void );
+
+protected:
+    bool GetCommonBufferProperties(void ) { return true; }
+    int  GetContinuousImageSize(int dImageSize) { return dImageSize; }
+    int  SmallCamDLoad(int , std::vector<int>& ) { return DON; }
+    void LoadGen23ControllerFile(const std::string , bool , const bool& = false) {}
+    void SetByteSwapping(void ) {}
+
+public:
+    /*PixelRate in pixels per second over all amplifiers, CommandLatencyUs is added to every Command*/
+    SimulatedArcDevice(double PixelRate = 2.0e6, size_t MaxCommonBufferBytes = (size_t) 512 << 20, int CommandLatencyUs = 0);
+    ~SimulatedArcDevice();
+
+    void SetPixelRate(double PixelRate) { this->PixelRate = PixelRate; }
+    void SetCommandLatency(int CommandLatencyUs) { this->CommandLatencyUs = CommandLatencyUs; }
+
+    const std::string ToString(void ) { return "Simulated ARC device"; }
+
+    bool IsOpen(void ) { return this->bOpen; }
+    void Open(int dDeviceNumber = 0);
+    void Open(int dDeviceNumber, size_t dBytes);
+    void Open(int dDeviceNumber, int dRows, int dCols);
+    void Close(void );
+    void Reset(void ) {}
+
+    void MapCommonBuffer(size_t dBytes = 0);
+    void UnMapCommonBuffer(void );
+    void ReMapCommonBuffer(size_t dBytes = 0);
+
+    int  GetId(void ) { return 0; }
+    int  GetStatus(void ) { return 0; }
+    void ClearStatus(void ) {}
+    void Set2xFOTransmitter(bool ) {}
+    void LoadDeviceFile(const std::string ) {}
+
+    int  Command(int dBoardId, int dCommand, int dArg1 = NOPARAM, int dArg2 = NOPARAM, int dArg3 = NOPARAM, int dArg4 = NOPARAM);
+    int  GetControllerId(void ) { return 0; }
+    void ResetController(void );
+    bool IsControllerConnected(void ) { return this->bOpen; }
+
+    void LoadControllerFile(const std::string sFilename, bool bValidate = true, const bool& bAbort = false);
+    void SetImageSize(int dRows, int dCols);
+    int  GetImageRows(void ) { return this->dRows; }
+    int  GetImageCols(void ) { return this->dCols; }
+
+    bool IsSyntheticImageMode(void ) { return this->bSyntheticMode; }
+    void SetSyntheticImageMode(bool bMode) { this->bSyntheticMode = bMode; }
+    void SetOpenShutter(bool ) {}
+
+    void StopExposure(void );
+    bool IsReadout(void );
+    int  GetPixelCount(void );
+    int  GetCRPixelCount(void ) { return this->GetPixelCount(); }
+    int  GetFrameCount(void ) { return 0; }
+
+};
+
+
+#endif //CCDDRONE_SIMULATEDARCDEVICE_HPP
@@ -0,0 +1,187 @@
+/* *********************************************************************
+ * This file contains the skipper NDCM reduction kernels. See
+ * SkipperReduction.hpp for a description.
+ * *********************************************************************
+ */
+
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "SkipperReduction.hpp"
+#include "NativeDeinterlace.hpp"
+#include "UtilityFunctions.hpp"
+
+
+
+void SumSkipperSamples(const unsigned short *pSamples, int n, uint64_t &sum, uint64_t &sumSq)
+{
+
+    uint64_t _sum = 0, _sumSq = 0;
+    int i = 0;
+
+#ifdef __AVX2__
+    /*8 samples at a time: widen to 32 bit for the sum, 64 bit products for the squares.
+     *A 32 bit lane can hold 65537 samples of 0xFFFF, so flush the sum regularly.*/
+    if (n >= 8) {
+        __m256i vSumSq = _mm256_setzero_si256();
+        const __m256i vMaskLo = _mm256_set1_epi64x(0xFFFFFFFF);
+
+        while (i + 8 <= n) {
+            __m256i vSum = _mm256_setzero_si256();
+            int iBlockEnd = i + 8*8192;
+            if (iBlockEnd > n) iBlockEnd = n;
+
+            for ( ; i + 8 <= iBlockEnd; i += 8) {
+                __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(pSamples + i)));
+                vSum = _mm256_add_epi32(vSum, v);
+                vSumSq = _mm256_add_epi64(vSumSq, _mm256_mul_epu32(v, v));
+                __m256i vOdd = _mm256_srli_epi64(v, 32);
+                vSumSq = _mm256_add_epi64(vSumSq, _mm256_mul_epu32(vOdd, vOdd));
+            }
+
+            /*Widen the 32 bit sums to 64 bit before adding them up*/
+            __m256i vSum64 = _mm256_add_epi64(_mm256_and_si256(vSum, vMaskLo), _mm256_srli_epi64(vSum, 32));
+            uint64_t _lanes[4];
+            _mm256_storeu_si256((__m256i *)_lanes, vSum64);
+            _sum += _lanes[0] + _lanes[1] + _lanes[2] + _lanes[3];
+        }
+
+        uint64_t _lanes[4];
+        _mm256_storeu_si256((__m256i *)_lanes, vSumSq);
+        _sumSq += _lanes[0] + _lanes[1] + _lanes[2] + _lanes[3];
+    }
+#endif
+
+    for ( ; i < n; i++) {
+        uint64_t v = pSamples[i];
+        _sum += v;
+        _sumSq += v*v;
+    }
+
+    sum = _sum;
+    sumSq = _sumSq;
+}
+
+
+void ReduceSkipperRows(const unsigned short *pSrc, int nRows, int dCols, int nSamples, int nDiscard,
+                       int dReversedFromCol, float *pMean, float *pRMS)
+{
+
+    int nKept = nSamples - nDiscard;
+    if (nKept < 1) return;
+
+    for (int r = 0; r < nRows; r++) {
+
+        const unsigned short *pRow = pSrc + (size_t) r * dCols * nSamples;
+        float *pMeanRow = pMean + (size_t) r * dCols;
+        float *pRMSRow = pRMS + (size_t) r * dCols;
+
+        for (int c = 0; c < dCols; c++) {
+
+            /*Normal pixels drop the leading samples, mirrored pixels drop the trailing ones*/
+            const unsigned short *pPix = pRow + (size_t) c * nSamples;
+            if (c < dReversedFromCol) pPix += nDiscard;
+
+            uint64_t sum, sumSq;
+            SumSkipperSamples(pPix, nKept, sum, sumSq);
+
+            /*n*sumSq - sum^2 is exact in 64 bits for any NDCM the sequencer can do*/
+            uint64_t n = (uint64_t) nKept;
+            uint64_t varNum = n*sumSq - sum*sum;
+
+            pMeanRow[c] = (float) ((double) sum / (double) n);
+            pRMSRow[c] = (float) (std::sqrt((double) varNum) / (double) n);
+        }
+    }
+
+}
+
+
+void GatherSamplePlanes(const unsigned short *pSrc, int nRows, int dCols, int nSamples, int dReversedFromCol,
+                        int dFirstSample, int nPlanes, unsigned short *pDst, int nThreads)
+{
+
+    size_t dPlaneSize = (size_t) nRows * dCols;
+
+    ParallelForRows(nRows, nThreads, [=](int dFirstRow, int dEndRow) {
+        for (int r = dFirstRow; r < dEndRow; r++) {
+
+            const unsigned short *pRow = pSrc + (size_t) r * dCols * nSamples;
+            unsigned short *pDstRow = pDst + (size_t) r * dCols;
+
+            /*Each pixel's samples are read as one short run and scattered to nPlanes output rows,
+             *which stay in cache while the row is done*/
+            for (int c = 0; c < dCols; c++) {
+                const unsigned short *pPix = pRow + (size_t) c * nSamples;
+                if (c < dReversedFromCol) {
+                    for (int p = 0; p < nPlanes; p++)
+                        pDstRow[p * dPlaneSize + c] = pPix[dFirstSample + p];
+                } else {
+                    for (int p = 0; p < nPlanes; p++)
+                        pDstRow[p * dPlaneSize + c] = pPix[nSamples - 1 - dFirstSample - p];
+                }
+            }
+        }
+    });
+
+}
+
+
+bool ReduceFrameNDCM(FrameRecord &Frame, unsigned short *pData)
+{
+
+    if (pData == NULL) return false;
+
+    int nSamples = Frame.CCDParams.nSkipperR;
+    int nThreads = Frame.ProcParams.ProcessingThreads;
+    bool bReduce = Frame.ProcParams.ReduceNDCM;
+
+    if (bReduce && Frame.ProcParams.NDCMDiscard >= nSamples) {
+        std::cout << "Cannot discard " << Frame.ProcParams.NDCMDiscard << " of " << nSamples
+                  << " charge measurements. The image will not be reduced.\n";
+        bReduce = false;
+    }
+
+    if (!bReduce) {
+        if (Frame.bInterlaced) {
+            DeinterlaceSerial(pData, Frame.CCDParams.dRows, Frame.CCDParams.dCols * nSamples, nThreads);
+            Frame.bInterlaced = false;
+        }
+        return false;
+    }
+
+    size_t nPixels = (size_t) Frame.CCDParams.dCols * Frame.CCDParams.dRows;
+    Frame.MeanPixels.resize(nPixels);
+    Frame.RMSPixels.resize(nPixels);
+
+    /*Interlaced UL data is de-interlaced and reduced in one pass. The raw samples are only
+     *rewritten if they are going to be saved, otherwise pData stays interlaced.*/
+    if (Frame.bInterlaced) {
+        DeinterlaceAndReduce(pData, Frame.CCDParams.dRows, Frame.CCDParams.dCols, nSamples, Frame.ProcParams.NDCMDiscard,
+                             Frame.ProcParams.KeepRawNDCM, Frame.MeanPixels.data(), Frame.RMSPixels.data(), nThreads);
+        if (Frame.ProcParams.KeepRawNDCM) Frame.bInterlaced = false;
+        return true;
+    }
+
+    /*Once the two amplifiers are de-interlaced, the L half is mirrored*/
+    int dReversedFromCol = Frame.CCDParams.dCols;
+    if (Frame.CCDParams.AmplifierDirection == "UL") dReversedFromCol = Frame.CCDParams.dCols / 2;
+
+    int dCols = Frame.CCDParams.dCols;
+    int nDiscard = Frame.ProcParams.NDCMDiscard;
+    float *pMean = Frame.MeanPixels.data();
+    float *pRMS = Frame.RMSPixels.data();
+
+    ParallelForRows(Frame.CCDParams.dRows, nThreads, [=](int dFirstRow, int dEndRow) {
+        size_t dOffset = (size_t) dFirstRow * dCols;
+        ReduceSkipperRows(pData + dOffset * nSamples, dEndRow - dFirstRow, dCols, nSamples, nDiscard,
+                          dReversedFromCol, pMean + dOffset, pRMS + dOffset);
+    });
+
+    return true;
+}
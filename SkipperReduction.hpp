@@ -0,0 +1,44 @@
+/* *********************************************************************
+ * Skipper NDCM reduction. Collapses the nSkipperR charge measurements
+ * of every pixel into a mean and an RMS value, optionally throwing
+ * away the first few measurements of each pixel.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_SKIPPERREDUCTION_HPP
+#define CCDDRONE_SKIPPERREDUCTION_HPP
+
+#include <cstdint>
+
+#include "CCDControlDataTypes.hpp"
+
+
+/*Sum and sum of squares of n consecutive samples. Vectorized where the CPU allows it.*/
+void SumSkipperSamples(const unsigned short *pSamples, int n, uint64_t &sum, uint64_t &sumSq);
+
+/*
+ * Reduce nRows rows of skipper data. Every row holds dCols pixels with nSamples consecutive
+ * samples each. Pixels at column dReversedFromCol and beyond store their samples in reverse
+ * order (the serial de-interlace mirrors the L half), so their discarded samples are taken
+ * from the end of the group instead. pMean and pRMS must hold nRows*dCols values.
+ */
+void ReduceSkipperRows(const unsigned short *pSrc, int nRows, int dCols, int nSamples, int nDiscard,
+                       int dReversedFromCol, float *pMean, float *pRMS);
+
+/*
+ * Gather charge measurements dFirstSample .. dFirstSample+nPlanes-1 of every pixel into nPlanes
+ * sample planes of nRows x dCols each, plane after plane in pDst. The source is laid out as for
+ * ReduceSkipperRows; mirrored pixels are read back to front so that plane s always holds the
+ * s-th measurement. The rows are split over nThreads.
+ */
+void GatherSamplePlanes(const unsigned short *pSrc, int nRows, int dCols, int nSamples, int dReversedFromCol,
+                        int dFirstSample, int nPlanes, unsigned short *pDst, int nThreads);
+
+/*Fill the MeanPixels and RMSPixels of a frame from its raw samples, if its ProcParams ask for it.
+ *If the raw samples are still interlaced, they are de-interlaced in place along the way, unless
+ *they are reduced and not kept. Frame.bInterlaced tells what pData holds afterwards.
+ *Returns true if the frame was reduced.*/
+bool ReduceFrameNDCM(FrameRecord &, unsigned short * );
+
+
+#endif //CCDDRONE_SKIPPERREDUCTION_HPP
@@ -0,0 +1,205 @@
+/* *********************************************************************
+ * This file contains the zero suppressed image storage. See
+ * SparseImage.hpp for a description.
+ * *********************************************************************
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "SparseImage.hpp"
+#include "UtilityFunctions.hpp"
+
+/*Median absolute deviation of a gaussian to its sigma*/
+#define MAD_TO_SIGMA 1.4826
+
+
+static float Median(std::vector<float> &v)
+{
+    if (v.empty()) return 0;
+    auto Mid = v.begin() + v.size() / 2;
+    std::nth_element(v.begin(), Mid, v.end());
+    return *Mid;
+}
+
+
+void SparsifyImage(const float *pMean, const float *pRMS, int dRows, int dCols, int nAmps, double Sigma,
+                   SparseImage &Out, int nThreads)
+{
+
+    Out.dCols = dCols;
+    Out.dRows = dRows;
+    Out.nAmps = nAmps == 2 ? 2 : 1;
+    Out.Sigma = Sigma;
+    Out.bRMS = pRMS != NULL;
+    Out.Pedestal.assign((size_t) dRows * Out.nAmps, 0);
+    Out.Noise.assign((size_t) dRows * Out.nAmps, 0);
+    Out.RMSLevel.assign((size_t) dRows * Out.nAmps, 0);
+    Out.RowStart.assign((size_t) dRows + 1, 0);
+
+    int dHalf = Out.nAmps == 2 ? dCols / 2 : dCols;
+    std::vector<float> Threshold((size_t) dRows * Out.nAmps, 0);
+
+    /*The levels of every row and how many of its pixels stay; then the pixels go in their place*/
+    ParallelForRows(dRows, nThreads, [&](int dFirst, int dEnd) {
+        std::vector<float> Scratch;
+        for (int r = dFirst; r < dEnd; r++) {
+            const float *pRow = pMean + (size_t) r * dCols;
+            int64_t nKept = 0;
+            for (int a = 0; a < Out.nAmps; a++) {
+                int dBegin = a == 0 ? 0 : dHalf;
+                int dStop = a == 0 ? dHalf : dCols;
+                size_t i = (size_t) r * Out.nAmps + a;
+
+                Scratch.assign(pRow + dBegin, pRow + dStop);
+                float Pedestal = Median(Scratch);
+                for (float &v : Scratch) v = std::fabs(v - Pedestal);
+                Out.Pedestal[i] = Pedestal;
+                Out.Noise[i] = (float) (MAD_TO_SIGMA * Median(Scratch));
+                Threshold[i] = (float) (Pedestal + Sigma * Out.Noise[i]);
+                if (pRMS != NULL) {
+                    Scratch.assign(pRMS + (size_t) r * dCols + dBegin, pRMS + (size_t) r * dCols + dStop);
+                    Out.RMSLevel[i] = Median(Scratch);
+                }
+
+                for (int x = dBegin; x < dStop; x++) nKept += pRow[x] > Threshold[i];
+            }
+            Out.RowStart[r + 1] = nKept;
+        }
+    });
+
+    for (int r = 0; r < dRows; r++) Out.RowStart[r + 1] += Out.RowStart[r];
+    Out.Cols.resize(Out.RowStart[dRows]);
+    Out.Mean.resize(Out.RowStart[dRows]);
+    Out.RMS.resize(pRMS != NULL ? Out.RowStart[dRows] : 0);
+
+    ParallelForRows(dRows, nThreads, [&](int dFirst, int dEnd) {
+        for (int r = dFirst; r < dEnd; r++) {
+            const float *pRow = pMean + (size_t) r * dCols;
+            int64_t k = Out.RowStart[r];
+            for (int x = 0; x < dCols; x++) {
+                if (pRow[x] <= Threshold[(size_t) r * Out.nAmps + (x < dHalf ? 0 : 1)]) continue;
+                Out.Cols[k] = x;
+                Out.Mean[k] = pRow[x];
+                if (pRMS != NULL) Out.RMS[k] = pRMS[(size_t) r * dCols + x];
+                k++;
+            }
+        }
+    });
+
+}
+
+
+void DenseImage(const SparseImage &In, std::vector<float> &Mean, std::vector<float> &RMS)
+{
+
+    Mean.assign((size_t) In.dCols * In.dRows, 0);
+    RMS.assign(In.bRMS ? Mean.size() : 0, 0);
+    int dHalf = In.nAmps == 2 ? In.dCols / 2 : In.dCols;
+
+    for (int r = 0; r < In.dRows; r++) {
+        float *pMean = Mean.data() + (size_t) r * In.dCols;
+        float *pRMS = In.bRMS ? RMS.data() + (size_t) r * In.dCols : NULL;
+        for (int a = 0; a < In.nAmps; a++) {
+            size_t i = (size_t) r * In.nAmps + a;
+            int dBegin = a == 0 ? 0 : dHalf;
+            int dStop = a == 0 ? dHalf : In.dCols;
+            std::fill(pMean + dBegin, pMean + dStop, In.Pedestal[i]);
+            if (pRMS != NULL) std::fill(pRMS + dBegin, pRMS + dStop, In.RMSLevel[i]);
+        }
+        for (int64_t k = In.RowStart[r]; k < In.RowStart[r + 1]; k++) {
+            pMean[In.Cols[k]] = In.Mean[k];
+            if (pRMS != NULL) pRMS[In.Cols[k]] = In.RMS[k];
+        }
+    }
+
+}
+
+
+void WriteSparseTable(fitsfile *fptr, const SparseImage &Image, const char *ExtName, int &status)
+{
+
+    /*The levels of the two amplifiers are vectors of two in one column each*/
+    const char *LevelForm = Image.nAmps == 2 ? "2E" : "1E";
+    char *ttype[] = { (char*) "COLS", (char*) "MEAN", (char*) "PEDESTAL", (char*) "NOISE", (char*) "RMSLEVEL", (char*) "RMS" };
+    char *tform[] = { (char*) "1PJ", (char*) "1PE", (char*) LevelForm, (char*) LevelForm, (char*) LevelForm, (char*) "1PE" };
+    char *tunit[] = { (char*) "pixel", (char*) "ADU", (char*) "ADU", (char*) "ADU", (char*) "ADU", (char*) "ADU" };
+    int nColumns = Image.bRMS ? 6 : 4;
+    fits_create_tbl(fptr, BINARY_TBL, Image.dRows, nColumns, ttype, tform, tunit, ExtName, &status);
+
+    for (int r = 0; r < Image.dRows && status == 0; r++) {
+        int64_t k = Image.RowStart[r];
+        long n = (long) (Image.RowStart[r + 1] - k);
+        size_t i = (size_t) r * Image.nAmps;
+        if (n > 0) {
+            fits_write_col(fptr, TINT, 1, r + 1, 1, n, (void*) (Image.Cols.data() + k), &status);
+            fits_write_col(fptr, TFLOAT, 2, r + 1, 1, n, (void*) (Image.Mean.data() + k), &status);
+            if (Image.bRMS) fits_write_col(fptr, TFLOAT, 6, r + 1, 1, n, (void*) (Image.RMS.data() + k), &status);
+        }
+        fits_write_col(fptr, TFLOAT, 3, r + 1, 1, Image.nAmps, (void*) (Image.Pedestal.data() + i), &status);
+        fits_write_col(fptr, TFLOAT, 4, r + 1, 1, Image.nAmps, (void*) (Image.Noise.data() + i), &status);
+        if (Image.bRMS) fits_write_col(fptr, TFLOAT, 5, r + 1, 1, Image.nAmps, (void*) (Image.RMSLevel.data() + i), &status);
+    }
+
+    long long nKept = (long long) Image.Kept();
+    fits_write_key(fptr, TINT, "SPCOLS", (void*) &Image.dCols, "Columns of the dense image", &status);
+    fits_write_key(fptr, TINT, "SPAMPS", (void*) &Image.nAmps, "Amplifiers (halves of the row) with own levels", &status);
+    fits_write_key(fptr, TDOUBLE, "SPSIGMA", (void*) &Image.Sigma, "Pixels kept above pedestal + SPSIGMA * noise", &status);
+    fits_write_key(fptr, TLONGLONG, "SPNKEPT", &nKept, "Pixels kept", &status);
+
+}
+
+
+void ReadSparseTable(fitsfile *fptr, SparseImage &Image, int &status)
+{
+
+    long nRows = 0;
+    int nColumns = 0;
+    fits_read_key(fptr, TINT, "SPCOLS", &Image.dCols, NULL, &status);
+    fits_read_key(fptr, TINT, "SPAMPS", &Image.nAmps, NULL, &status);
+    fits_read_key(fptr, TDOUBLE, "SPSIGMA", &Image.Sigma, NULL, &status);
+    fits_get_num_rows(fptr, &nRows, &status);
+    fits_get_num_cols(fptr, &nColumns, &status);
+    if (status != 0) return;
+    if (Image.nAmps != 2) Image.nAmps = 1;
+
+    Image.dRows = (int) nRows;
+    Image.bRMS = nColumns >= 6;
+    Image.RowStart.assign((size_t) nRows + 1, 0);
+    Image.Pedestal.assign((size_t) nRows * Image.nAmps, 0);
+    Image.Noise.assign((size_t) nRows * Image.nAmps, 0);
+    Image.RMSLevel.assign((size_t) nRows * Image.nAmps, 0);
+
+    for (long r = 0; r < nRows && status == 0; r++) {
+        LONGLONG n = 0, HeapOffset;
+        fits_read_descriptll(fptr, 1, r + 1, &n, &HeapOffset, &status);
+        Image.RowStart[r + 1] = Image.RowStart[r] + n;
+    }
+    if (status != 0) return;
+
+    int64_t nKept = Image.RowStart[nRows];
+    Image.Cols.resize(nKept);
+    Image.Mean.resize(nKept);
+    Image.RMS.resize(Image.bRMS ? nKept : 0);
+
+    int anynul;
+    for (long r = 0; r < nRows && status == 0; r++) {
+        int64_t k = Image.RowStart[r];
+        long n = (long) (Image.RowStart[r + 1] - k);
+        size_t i = (size_t) r * Image.nAmps;
+        if (n > 0) {
+            fits_read_col(fptr, TINT, 1, r + 1, 1, n, NULL, Image.Cols.data() + k, &anynul, &status);
+            fits_read_col(fptr, TFLOAT, 2, r + 1, 1, n, NULL, Image.Mean.data() + k, &anynul, &status);
+            if (Image.bRMS) fits_read_col(fptr, TFLOAT, 6, r + 1, 1, n, NULL, Image.RMS.data() + k, &anynul, &status);
+        }
+        fits_read_col(fptr, TFLOAT, 3, r + 1, 1, Image.nAmps, NULL, Image.Pedestal.data() + i, &anynul, &status);
+        fits_read_col(fptr, TFLOAT, 4, r + 1, 1, Image.nAmps, NULL, Image.Noise.data() + i, &anynul, &status);
+        if (Image.bRMS) fits_read_col(fptr, TFLOAT, 5, r + 1, 1, Image.nAmps, NULL, Image.RMSLevel.data() + i, &anynul, &status);
+    }
+
+    /*Columns out of range would write past the dense image*/
+    for (int &c : Image.Cols)
+        if (c < 0 || c >= Image.dCols) c = 0;
+
+}
@@ -0,0 +1,63 @@
+/* *********************************************************************
+ * Zero suppressed storage of the reduced (MEAN and RMS) images. Every
+ * row of each amplifier gets a pedestal (median) and a noise (from the
+ * median absolute deviation), and only the pixels more than Sigma times
+ * the noise above the pedestal are kept, in compressed sparse row form:
+ * the kept pixels of row r are Cols / Mean / RMS [RowStart[r],
+ * RowStart[r+1]).
+ *
+ * In the FITS file this is the MEAN_SPARSE binary table, one row per
+ * image row with the kept columns and values as variable length arrays
+ * and the pedestal, the noise and the median RMS of the row. A dense
+ * image is made again with DenseImage, the pixels that were dropped get
+ * the pedestal (and the median RMS) of their row. CCDDConvert does that
+ * for a whole file.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_SPARSEIMAGE_HPP
+#define CCDDRONE_SPARSEIMAGE_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "fitsio.h"
+
+
+struct SparseImage{
+
+    int dCols = 0;
+    int dRows = 0;
+    int nAmps = 1;              //A UL image has U on the left half and L on the right half
+    double Sigma = 0;
+    bool bRMS = false;
+
+    std::vector<int64_t> RowStart;  //dRows + 1
+    std::vector<int> Cols;
+    std::vector<float> Mean;
+    std::vector<float> RMS;         //Empty unless bRMS
+
+    /*Per row and amplifier, dRows x nAmps*/
+    std::vector<float> Pedestal;
+    std::vector<float> Noise;
+    std::vector<float> RMSLevel;
+
+    size_t Kept(void ) const { return Cols.size(); }
+
+};
+
+
+/*Keep the pixels of a dCols x dRows MEAN image (pRMS may be NULL) that are more than Sigma times
+ *the noise above the pedestal of their row. The rows are split over nThreads.*/
+void SparsifyImage(const float *pMean, const float *pRMS, int dRows, int dCols, int nAmps, double Sigma,
+                   SparseImage &Out, int nThreads);
+
+/*The dense dCols x dRows images again. RMS is left empty if the sparse image has none.*/
+void DenseImage(const SparseImage &In, std::vector<float> &Mean, std::vector<float> &RMS);
+
+/*Write the image as a binary table HDU named ExtName, read it back from the current HDU*/
+void WriteSparseTable(fitsfile *fptr, const SparseImage &Image, const char *ExtName, int &status);
+void ReadSparseTable(fitsfile *fptr, SparseImage &Image, int &status);
+
+
+#endif //CCDDRONE_SPARSEIMAGE_HPP
@@ -0,0 +1,204 @@
+/* *********************************************************************
+ * This file contains the writer side of the shared memory status
+ * segment. See StatusPublisher.hpp and SharedStatus.hpp.
+ * *********************************************************************
+ */
+
+#include <iostream>
+#include <chrono>
+#include <new>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "StatusPublisher.hpp"
+
+
+static double UnixTimeNow(void )
+{
+    return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+StatusPublisher::StatusPublisher()
+{
+    std::memset(&this->Current, 0, sizeof(SharedStatus));
+}
+
+
+StatusPublisher::~StatusPublisher()
+{
+    this->Close();
+}
+
+
+int StatusPublisher::Open(const std::string &Name, size_t SlotBytes, int DeviceIndex)
+{
+
+    this->Close();
+
+    std::string ShmName = (Name.empty() || Name[0] != '/') ? "/" + Name : Name;
+    size_t Bytes = (size_t) SharedSegmentSize(SlotBytes);
+
+    int fd = shm_open(ShmName.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        std::cout << "Could not create the shared memory segment " << ShmName << ": " << strerror(errno) << "\n";
+        return -1;
+    }
+    if (ftruncate(fd, (off_t) Bytes) != 0) {
+        std::cout << "Could not size the shared memory segment " << ShmName << ": " << strerror(errno) << "\n";
+        close(fd);
+        shm_unlink(ShmName.c_str());
+        return -1;
+    }
+
+    void *pMap = mmap(NULL, Bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pMap == MAP_FAILED) {
+        std::cout << "Could not map the shared memory segment " << ShmName << ": " << strerror(errno) << "\n";
+        shm_unlink(ShmName.c_str());
+        return -1;
+    }
+
+    /*Invalidate the magic first, so that a monitor attached to an older segment of the same name lets go*/
+    this->pHeader = (SharedStatusHeader*) pMap;
+    this->pHeader->Magic = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+
+    new (&this->pHeader->StatusSeq) std::atomic<uint64_t>(0);
+    new (&this->pHeader->LatestSlot) std::atomic<int32_t>(-1);
+    for (int i = 0; i < 2; i++) {
+        new (&this->pHeader->Slots[i].Seq) std::atomic<uint64_t>(0);
+        std::memset(&this->pHeader->Slots[i].Info, 0, sizeof(SharedFrameInfo));
+    }
+    this->pHeader->SlotCapacity = SlotBytes;
+    this->pHeader->Version = CCDD_SHM_VERSION;
+
+    this->Name = ShmName;
+    this->SegmentBytes = Bytes;
+    this->nFramesPublished = 0;
+    std::memset(&this->Current, 0, sizeof(SharedStatus));
+    this->Current.DeviceIndex = DeviceIndex;
+    this->Current.State = SHM_IDLE;
+    this->Publish();
+
+    std::atomic_thread_fence(std::memory_order_release);
+    this->pHeader->Magic = CCDD_SHM_MAGIC;
+
+    return 0;
+
+}
+
+
+void StatusPublisher::Close(void )
+{
+
+    if (this->pHeader == NULL) return;
+
+    this->pHeader->Magic = 0;
+    munmap((void*) this->pHeader, this->SegmentBytes);
+    shm_unlink(this->Name.c_str());
+    this->pHeader = NULL;
+    this->SegmentBytes = 0;
+
+}
+
+
+void StatusPublisher::Publish(void )
+{
+
+    if (this->pHeader == NULL) return;
+
+    this->Current.UpdateTime = UnixTimeNow();
+
+    uint64_t s = this->pHeader->StatusSeq.load(std::memory_order_relaxed);
+    this->pHeader->StatusSeq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy((void*) &this->pHeader->Status, &this->Current, sizeof(SharedStatus));
+    this->pHeader->StatusSeq.store(s + 2, std::memory_order_release);
+
+}
+
+
+void StatusPublisher::ExposureStarted(double ExposureTime, int64_t TotalPixels)
+{
+    this->Current.State = SHM_EXPOSING;
+    this->Current.ExposureTime = ExposureTime;
+    this->Current.RemainingTime = ExposureTime;
+    this->Current.PixelCount = 0;
+    this->Current.TotalPixels = TotalPixels;
+    this->Current.nAmps = 0;
+    this->Publish();
+}
+
+
+void StatusPublisher::ExposureProgress(double RemainingTime)
+{
+    this->Current.RemainingTime = RemainingTime;
+    this->Publish();
+}
+
+
+void StatusPublisher::ReadoutProgress(int64_t PixelCount)
+{
+    this->Current.State = SHM_READOUT;
+    this->Current.RemainingTime = 0;
+    this->Current.PixelCount = PixelCount;
+    this->Publish();
+}
+
+
+void StatusPublisher::QuickLookProgress(const SharedAmpStats *pAmps, int nAmps)
+{
+    if (nAmps > 2) nAmps = 2;
+    this->Current.nAmps = nAmps;
+    for (int a = 0; a < nAmps; a++) this->Current.Amps[a] = pAmps[a];
+    this->Publish();
+}
+
+
+void StatusPublisher::ExposureFinished(bool bSuccess)
+{
+    this->Current.State = bSuccess ? SHM_IDLE : SHM_FAILED;
+    if (bSuccess) this->Current.FramesCompleted++;
+    this->Publish();
+}
+
+
+int StatusPublisher::PublishFrame(const unsigned short *pData, int Rows, int Cols, int NDCM, bool bInterlaced)
+{
+
+    if (this->pHeader == NULL || pData == NULL) return -1;
+
+    uint64_t Bytes = (uint64_t) Rows * Cols * sizeof(unsigned short);
+    if (Bytes > this->pHeader->SlotCapacity) return -1;
+
+    int Latest = this->pHeader->LatestSlot.load(std::memory_order_relaxed);
+    int Slot = (Latest == 0) ? 1 : 0;
+    SharedFrameSlot &S = this->pHeader->Slots[Slot];
+    uint64_t Offset = SharedSlotOffset(this->pHeader->SlotCapacity, Slot);
+
+    uint64_t s = S.Seq.load(std::memory_order_relaxed);
+    S.Seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    std::memcpy((char*) this->pHeader + Offset, pData, (size_t) Bytes);
+    S.Info.FrameNumber = ++this->nFramesPublished;
+    S.Info.Rows = Rows;
+    S.Info.Cols = Cols;
+    S.Info.NDCM = NDCM;
+    S.Info.Interlaced = bInterlaced ? 1 : 0;
+    S.Info.Timestamp = UnixTimeNow();
+    S.Info.Bytes = Bytes;
+    S.Info.Offset = Offset;
+
+    S.Seq.store(s + 2, std::memory_order_release);
+    this->pHeader->LatestSlot.store(Slot, std::memory_order_release);
+
+    return 0;
+
+}
@@ -0,0 +1,59 @@
+/* *********************************************************************
+ * Writer side of the shared memory status segment (SharedStatus.hpp).
+ * The segment is a POSIX shared memory object, /dev/shm/<name>. It is
+ * created when the publisher is opened and removed when it is closed.
+ * All the calls are made from the acquisition thread and never wait
+ * for the readers.
+ * *********************************************************************
+ */
+
+#ifndef CCDDRONE_STATUSPUBLISHER_HPP
+#define CCDDRONE_STATUSPUBLISHER_HPP
+
+#include <string>
+#include <cstddef>
+
+#include "SharedStatus.hpp"
+
+
+class StatusPublisher
+{
+
+private:
+
+    std::string Name;
+    SharedStatusHeader *pHeader = NULL;
+    size_t SegmentBytes = 0;
+    int64_t nFramesPublished = 0;
+
+    /*Copy of the status, written out as a whole under the seqlock*/
+    SharedStatus Current;
+    void Publish(void );
+
+public:
+
+    StatusPublisher();
+    ~StatusPublisher();
+    StatusPublisher(const StatusPublisher& ) = delete;
+    StatusPublisher& operator=(const StatusPublisher& ) = delete;
+
+    /*Create the segment with room for frames of up to SlotBytes. Returns 0 on success and -1 otherwise.*/
+    int Open(const std::string &Name, size_t SlotBytes, int DeviceIndex = 0);
+    void Close(void );
+    bool IsOpen(void ) const { return pHeader != NULL; }
+    const std::string& SegmentName(void ) const { return Name; }
+
+    void ExposureStarted(double ExposureTime, int64_t TotalPixels);
+    void ExposureProgress(double RemainingTime);
+    void ReadoutProgress(int64_t PixelCount);
+    void QuickLookProgress(const SharedAmpStats *pAmps, int nAmps);
+    void ExposureFinished(bool bSuccess);
+
+    /*Copy a frame into the slot that is not the newest one and make it the newest.
+     *Frames that do not fit in a slot are not published.*/
+    int PublishFrame(const unsigned short *pData, int Rows, int Cols, int NDCM, bool bInterlaced);
+
+};
+
+
+#endif //CCDDRONE_STATUSPUBLISHER_HPP
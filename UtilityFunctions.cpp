@@ -2,3 +2,62 @@
 // Created by Pitam Mitra on 2019-07-29.
 //
 
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+
+#include "UtilityFunctions.hpp"
+
+
+/*Name of frame k in a multi-frame run. Image.fits becomes Image_0000.fits, Image_0001.fits ...*/
+std::string FrameFileName(const std::string &OutFileName, int FrameNumber)
+{
+
+    char _FrameSuffix[16];
+    snprintf(_FrameSuffix, sizeof(_FrameSuffix), "_%04d", FrameNumber);
+
+    std::string::size_type _extPos = OutFileName.rfind(".fits");
+    if (_extPos == std::string::npos)
+        return OutFileName + _FrameSuffix + ".fits";
+
+    return OutFileName.substr(0, _extPos) + _FrameSuffix + OutFileName.substr(_extPos);
+}
+
+
+/*Image.fits becomes Image_dev1.fits for the controller on PCIe board 1*/
+std::string DeviceFileName(const std::string &OutFileName, int DeviceIndex)
+{
+
+    std::string _DevSuffix = "_dev" + std::to_string(DeviceIndex);
+
+    std::string::size_type _extPos = OutFileName.rfind(".fits");
+    if (_extPos == std::string::npos)
+        return OutFileName + _DevSuffix + ".fits";
+
+    return OutFileName.substr(0, _extPos) + _DevSuffix + OutFileName.substr(_extPos);
+}
+
+/*Board 0 keeps its state files directly in do_not_touch/, as with a single controller.
+ *Every other board gets do_not_touch/devN/, which is created if it does not exist yet.*/
+std::string DeviceStateFile(int DeviceIndex, const std::string &File)
+{
+
+    if (DeviceIndex <= 0) return "do_not_touch/" + File;
+
+    std::string _DevDir = "do_not_touch/dev" + std::to_string(DeviceIndex);
+    mkdir(_DevDir.c_str(), 0755);
+    return _DevDir + "/" + File;
+}
+
+/*The programs that drive a single controller pick the board from the environment, so that
+ *their arguments stay the same: CCDD_DEVICE=1 ./CCDDExpose 10 Image.fits*/
+int SelectedDevice(void )
+{
+
+    const char *_Dev = std::getenv("CCDD_DEVICE");
+    if (_Dev == NULL || *_Dev == '\0') return 0;
+
+    int DeviceIndex = atoi(_Dev);
+    return DeviceIndex > 0 ? DeviceIndex : 0;
+}
@@ -10,6 +10,140 @@
 #include <iostream>
 #include <iomanip>
 #include <cmath>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include "Scheduler.hpp"
+#include "Log.hpp"
+
+
+/*Output file name of a single frame in a multi-frame run*/
+std::string FrameFileName(const std::string &, int );
+
+/*Output file name of the image of one controller when several are exposed together*/
+std::string DeviceFileName(const std::string &, int );
+
+/*Location of a state file in do_not_touch/ for the PCIe board DeviceIndex*/
+std::string DeviceStateFile(int , const std::string &);
+
+/*PCIe board the single controller programs talk to: $CCDD_DEVICE, or 0 if it is not set*/
+int SelectedDevice(void );
+
+
+/*Lets a group of threads start something at the same time. A thread that drops out
+ *calls Leave(), so that the others do not wait for it any more.*/
+class StartBarrier {
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    int nParties;
+    int nWaiting = 0;
+    unsigned long Generation = 0;
+
+    void ReleaseIfComplete() {
+        if (nParties > 0 && nWaiting >= nParties) {
+            nWaiting = 0;
+            Generation++;
+            cv.notify_all();
+        }
+    }
+
+public:
+    explicit StartBarrier(int nParties) : nParties(nParties) {};
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mtx);
+        unsigned long MyGeneration = Generation;
+        nWaiting++;
+        ReleaseIfComplete();
+        cv.wait(lock, [&]{ return Generation != MyGeneration; });
+    }
+
+    void Leave() {
+        std::lock_guard<std::mutex> lock(mtx);
+        nParties--;
+        ReleaseIfComplete();
+    }
+};
+
+
+/*Split the rows [0, nRows) into contiguous blocks and run Func(firstRow, endRow) on every
+ *block in its own thread. nThreads <= 0 uses one thread per core. With a shared WorkerPool
+ *(WorkerThreads in [acquisition]) the blocks run on the pool instead, and nThreads <= 0 is
+ *one block per worker. The first exception of a block is thrown again once all are done.*/
+template <typename F>
+void ParallelForRows(int nRows, int nThreads, F Func)
+{
+    std::shared_ptr<WorkerPool> Pool = WorkerPool::Shared();
+    if (Pool) {
+        Pool->ParallelFor(nRows, nThreads, Func);
+        return;
+    }
+
+    if (nThreads <= 0) nThreads = (int) std::thread::hardware_concurrency();
+    if (nThreads <= 0) nThreads = 1;
+    if (nThreads > nRows) nThreads = nRows;
+    if (nThreads <= 1) {
+        if (nRows > 0) Func(0, nRows);
+        return;
+    }
+
+    std::vector<std::thread> Workers;
+    std::mutex ErrorMutex;
+    std::exception_ptr Error;
+    int dBlock = (nRows + nThreads - 1) / nThreads;
+    for (int dFirst = 0; dFirst < nRows; dFirst += dBlock) {
+        int dEnd = dFirst + dBlock < nRows ? dFirst + dBlock : nRows;
+        Workers.push_back(std::thread([&Func, &ErrorMutex, &Error, dFirst, dEnd]() {
+            try {
+                Func(dFirst, dEnd);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(ErrorMutex);
+                if (!Error) Error = std::current_exception();
+            }
+        }));
+    }
+    for (std::thread &t : Workers) t.join();
+    if (Error) std::rethrow_exception(Error);
+}
+
+/*Wall clock duration of the named phases of a procedure, for a breakdown at the end*/
+class PhaseTimer {
+private:
+    std::vector< std::pair<std::string, double> > Phases;
+    std::string Current;
+    std::chrono::steady_clock::time_point tStart;
+    bool bRunning = false;
+
+public:
+    void Start(const std::string &Name) {
+        Stop();
+        Current = Name;
+        tStart = std::chrono::steady_clock::now();
+        bRunning = true;
+    }
+
+    void Stop() {
+        if (!bRunning) return;
+        Phases.push_back(std::make_pair(Current, std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count()));
+        bRunning = false;
+    }
+
+    void PrintSummary() {
+        Stop();
+        double dTotal = 0;
+        for (const auto &p : Phases) dTotal += p.second;
+        std::cout << "\nTime per phase:\n";
+        for (const auto &p : Phases)
+            std::cout << "  " << std::left << std::setw(32) << p.first << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(9) << p.second << " s  " << std::setw(5) << std::setprecision(1)
+                      << (dTotal > 0 ? 100.0 * p.second / dTotal : 0.0) << " %\n";
+        std::cout << "  " << std::left << std::setw(32) << "Total" << std::right << std::setprecision(2) << std::setw(9) << dTotal << " s\n";
+    }
+};
 
 class ProgressBar {
 private:
@@ -19,6 +153,8 @@ private:
     const char incomplete_char = ' ';
     std::chrono::system_clock::time_point start_time;
     int total_items;
+    /*display() is called for every pixel callback, the bar is only drawn at the rate of the log*/
+    mutable LogRate Rate;
 
 public:
     ProgressBar (){};
@@ -26,12 +162,15 @@ public:
     void SetEssentials(int total_items, std::chrono::system_clock::time_point sttime) {
         this->total_items=total_items;
         this->start_time=sttime;
+        this->Rate.Reset();
     }
 
     void updProgress(int new_items) { items = new_items; }
 
-    void display() const
+    void display(bool bForce = false) const
     {
+        if (!bForce && !this->Rate.Ready()) return;
+
         float progress = (float) items / (float) total_items;
         int pos = (int) (bar_width * progress);
 
@@ -41,25 +180,27 @@ public:
         float _estimatedTimeRemain = fractionRemain * (float)_elpasedMilli/(1000.0*progress);
 
 
-        std::cout << "[";
-
-        for (int i = 0; i < bar_width; ++i) {
-            if (i < pos) std::cout << complete_char;
-            else if (i == pos) std::cout << ">";
-            else std::cout << incomplete_char;
+        char Bar[64];
+        unsigned int i;
+        for (i = 0; i < bar_width; ++i) {
+            if ((int) i < pos) Bar[i] = complete_char;
+            else if ((int) i == pos) Bar[i] = '>';
+            else Bar[i] = incomplete_char;
         }
-        std::cout << "] ";
-        std::cout << std::fixed;
-        std::cout << std::setprecision(0);
-        std::cout << progress * 100.0 << "% ";
-        if (!std::isnan(_estimatedTimeRemain) ) std::cout<< " | Est. time remaining: " << _estimatedTimeRemain << " sec";
-        std::cout<< "\r";
-        std::cout.flush();
+        Bar[i] = 0;
+
+        if (!std::isnan(_estimatedTimeRemain))
+            LogProgress(this->Rate, true, "readout", items, total_items, "[%s] %.0f%%  | Est. time remaining: %.0f sec",
+                        Bar, progress * 100.0, _estimatedTimeRemain);
+        else
+            LogProgress(this->Rate, true, "readout", items, total_items, "[%s] %.0f%% ", Bar, progress * 100.0);
     }
 
+    /*The last state of the bar, and everything logged before what is printed next*/
     void done() const
     {
-        display();
+        display(true);
+        LogFlush();
         std::cout << std::endl;
     }
 };